@@ -0,0 +1,1229 @@
+/* bench/bench.c
+ *
+ * Throughput benchmark for the force phase and the integrators.
+ * Every run uses a fixed seed so results compare across commits and machines.
+ */
+#include <float.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+
+#include "../src/io/trajectory.h"
+#include "../src/physics/boundary.h"
+#include "../src/physics/collision.h"
+#include "../src/physics/external.h"
+#include "../src/physics/gravity.h"
+#include "../src/physics/gravity_kernel.h"
+#include "../src/physics/integration.h"
+#include "../src/physics/morton.h"
+#include "../src/physics/octree.h"
+#include "../src/utils/config.h"
+#include "../src/utils/profiler.h"
+#include "../src/utils/rng.h"
+#include "../src/utils/timer.h"
+
+#define BENCH_SEED 12345
+#define BENCH_MAX_RESULTS 256
+
+// Minimum measured time per data point; repetitions are added until it is reached
+#define BENCH_MIN_SECONDS 0.2
+
+// Frames streamed per trajectory data point
+#define BENCH_TRAJECTORY_FRAMES 32
+
+// Collision benchmark: the default 200-wide box holds 1024 particles; larger runs grow it
+// so the number density, and with it the work per particle, stays fixed
+#define BENCH_COLLISION_DENSITY_N 1024
+
+// Energy-error benchmark: planets on circular orbits around a heavy central body,
+// integrated for a fixed simulated time at a range of step sizes
+#define BENCH_ENERGY_N 128
+#define BENCH_ENERGY_TIME 40.0
+#define BENCH_ENERGY_CENTRAL_MASS 1.0e12f
+#define BENCH_ENERGY_PLANET_MASS 1.0e3f
+#define BENCH_ENERGY_SAMPLES 16
+
+// Block timestep benchmark: satellites on orbits of radius 0.3 to 8 around four heavy
+// cores (periods of about 0.4 to 60), so the required step varies by over 100x
+#define BENCH_BLOCK_N 2048
+#define BENCH_BLOCK_CLUSTERS 4
+#define BENCH_BLOCK_CORE_MASS 1.0e11f
+#define BENCH_BLOCK_TIME 2.0
+#define BENCH_BLOCK_DT 0.25f
+#define BENCH_BLOCK_LEVELS 8
+
+// Adaptive timestep benchmark: two planets on e = 0.9 orbits (periods of about 17 and 32)
+// whose pericentre passages need steps tens of times smaller than their apocentres
+#define BENCH_ADAPTIVE_TIME 100.0
+#define BENCH_ADAPTIVE_ECCENTRICITY 0.9f
+#define BENCH_ADAPTIVE_SAMPLE_EVERY 16
+
+// Allocation benchmark: heap allocations per step once the solvers have sized their
+// buffers. Counting starts after the first Morton reorder and covers another full interval.
+#define BENCH_ALLOC_N 4096
+
+// Test-particle benchmark: massive particles among n, the rest massless tracers
+#define BENCH_TRACER_MASSIVE 64
+
+// Accuracy benchmark: force error of the approximate methods against the apply_gravity
+// pair sum, with the time per evaluation, on the sweep's initial conditions
+#define BENCH_ACCURACY_N 16384
+
+// External potential benchmark: interpolation cost and error against the exact profiles
+#define BENCH_EXTERNAL_N 65536
+
+// Periodic-box benchmark: targets checked against the exact Ewald sum, and the largest
+// particle count that check runs at
+#define BENCH_PERIODIC_CHECKED 32
+#define BENCH_PERIODIC_CHECK_N 1024
+
+typedef struct {
+    const char *phase;       // "force" or "integrate"
+    const char *method;      // Force method or integrator name
+    int n;                   // Particle count
+    int threads;
+    int reps;                // Steps timed
+    double seconds_per_step;
+    double interactions;     // Interactions per step (force phase only)
+    double bytes;            // Estimated particle-array bytes moved per step
+    double time_step;        // Step size (energy benchmark only; the mean step for adaptive)
+    double energy_error;     // Largest relative energy error over the run (energy benchmark only)
+    double force_error;      // Median relative acceleration error (accuracy benchmark only)
+    double cache_misses;     // Per particle per step, 0 without counters (reorder benchmark only)
+    double allocations;      // Heap allocations per step once warmed up (allocation benchmark only)
+} BenchResult;
+
+typedef struct {
+    int max_n;               // Largest particle count in the sweep
+    int max_direct_n;        // Largest count for the SIMD direct sum
+    int max_pairs_n;         // Largest count for the scalar pair reference
+    int threads;
+    const char *json_path;
+    const char *csv_path;
+    const char *trajectory_path; // Scratch file for the trajectory benchmark, NULL: skip it
+} BenchOptions;
+
+// Allocation probe. The bench links with --wrap for the libc allocators (see the Makefile),
+// so every heap allocation made by the simulation code passes through these wrappers.
+// Allocations made inside libc or the OpenMP runtime themselves are not seen.
+static atomic_llong heap_allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+void *__real_aligned_alloc(size_t alignment, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t count, size_t size);
+void *__wrap_realloc(void *pointer, size_t size);
+void *__wrap_aligned_alloc(size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    atomic_fetch_add_explicit(&heap_allocations, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&heap_allocations, 1, memory_order_relaxed);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size) {
+    atomic_fetch_add_explicit(&heap_allocations, 1, memory_order_relaxed);
+    return __real_realloc(pointer, size);
+}
+
+void *__wrap_aligned_alloc(size_t alignment, size_t size) {
+    atomic_fetch_add_explicit(&heap_allocations, 1, memory_order_relaxed);
+    return __real_aligned_alloc(alignment, size);
+}
+
+static BenchResult results[BENCH_MAX_RESULTS];
+static int result_count = 0;
+
+static void record(BenchResult result) {
+    if (result_count < BENCH_MAX_RESULTS) {
+        results[result_count++] = result;
+    }
+
+    printf("%-9s %-10s n=%-8d %10.3f ms/step %12.2f steps/s",
+           result.phase, result.method, result.n,
+           result.seconds_per_step * 1e3, 1.0 / result.seconds_per_step);
+    if (result.interactions > 0) {
+        printf(" %8.3f ns/interaction", result.seconds_per_step * 1e9 / result.interactions);
+    }
+    printf(" %8.2f GB/s\n", result.bytes / result.seconds_per_step * 1e-9);
+}
+
+// Fresh particle system with the benchmark's fixed initial conditions
+static int make_system(ParticleSystem *ps, SimConfig *config, int n) {
+    config_init(config);
+    config->max_particles = n;
+    config->random_seed = BENCH_SEED;
+    config->enable_collision = 0; // Timed separately by bench_collision
+
+    if (!particle_system_init(ps, n)) {
+        fprintf(stderr, "Failed to allocate %d particles\n", n);
+        return 0;
+    }
+    create_initial_particles(config, ps);
+    return 1;
+}
+
+// Time the force phase of update_particle_system for one method
+static void bench_force(const char *name, int force_method, int kernel, int n, const BenchOptions *options) {
+    SimConfig config;
+    ParticleSystem ps;
+    if (!make_system(&ps, &config, n)) return;
+
+    config.force_method = force_method;
+    config.force_kernel = kernel;
+    config.num_threads = options->threads;
+
+    PhysicsState state;
+    physics_state_init(&state, &config);
+
+    // Warm-up step (allocates solver workspace, faults pages in)
+    compute_forces(&ps, &state, &config);
+
+    int reps = 0;
+    double interactions = 0.0;
+    double start = timer_now();
+    double elapsed;
+    do {
+        compute_forces(&ps, &state, &config);
+        interactions += (double)state.interactions;
+        reps++;
+        elapsed = timer_now() - start;
+    } while (elapsed < BENCH_MIN_SECONDS);
+
+    // Positions and masses are read, accelerations cleared and written
+    BenchResult result = {
+        "force", name, n, state.threads, reps, elapsed / reps,
+        interactions / reps, (double)n * sizeof(float) * (4 + 3 + 3), 0.0, 0.0, 0.0, 0.0, 0.0
+    };
+    record(result);
+
+    physics_state_cleanup(&state);
+    particle_system_free(&ps);
+}
+
+// Time the direct force phase with all but BENCH_TRACER_MASSIVE of the n particles made
+// massless tracers, for comparison with the all-massive "direct" rows
+static void bench_tracers(int n, const BenchOptions *options) {
+    SimConfig config;
+    ParticleSystem ps;
+    config_init(&config);
+    config.max_particles = BENCH_TRACER_MASSIVE;
+    config.tracer_count = n - BENCH_TRACER_MASSIVE;
+    config.random_seed = BENCH_SEED;
+    config.enable_collision = 0;
+    config.num_threads = options->threads;
+    if (!particle_system_init(&ps, n)) {
+        fprintf(stderr, "Failed to allocate %d particles\n", n);
+        return;
+    }
+    create_initial_particles(&config, &ps);
+
+    PhysicsState state;
+    physics_state_init(&state, &config);
+    compute_forces(&ps, &state, &config);
+
+    int reps = 0;
+    double interactions = 0.0;
+    double start = timer_now();
+    double elapsed;
+    do {
+        compute_forces(&ps, &state, &config);
+        interactions += (double)state.interactions;
+        reps++;
+        elapsed = timer_now() - start;
+    } while (elapsed < BENCH_MIN_SECONDS);
+
+    // Tracer positions are read and accelerations written; the massive set stays in cache
+    BenchResult result = {
+        "force", "tracers", n, state.threads, reps, elapsed / reps,
+        interactions / reps, (double)n * sizeof(float) * (3 + 3 + 3), 0.0, 0.0, 0.0, 0.0, 0.0
+    };
+    record(result);
+
+    physics_state_cleanup(&state);
+    particle_system_free(&ps);
+}
+
+// Time full steps of one integrator with direct-sum forces
+static void bench_integrator(int method, int n, const BenchOptions *options) {
+    SimConfig config;
+    ParticleSystem ps;
+    if (!make_system(&ps, &config, n)) return;
+    
+    config.integration_method = method;
+    config.num_threads = options->threads;
+    PhysicsState state;
+    physics_state_init(&state, &config);
+    
+    update_particle_system(&ps, &state, &config);
+    
+    int reps = 0;
+    double interactions = 0.0;
+    double evaluations = 0.0;
+    double start = timer_now();
+    double elapsed;
+    do {
+        update_particle_system(&ps, &state, &config);
+        interactions += (double)state.step_interactions;
+        evaluations += state.step_force_evaluations;
+        reps++;
+        elapsed = timer_now() - start;
+    } while (elapsed < BENCH_MIN_SECONDS);
+    
+    // Each force evaluation streams the force arrays, each kick/drift stage the state
+    BenchResult result = {
+        "integrate", integrator_name(method), n, state.threads, reps, elapsed / reps,
+        interactions / reps, evaluations / reps * n * sizeof(float) * (10 + 15), 0.0, 0.0, 0.0, 0.0, 0.0
+    };
+    record(result);
+    
+    physics_state_cleanup(&state);
+    particle_system_free(&ps);
+}
+
+// Bound test problem for the energy benchmark: a central body and planets on circular
+// orbits between radius 4 and 16 in a thin disc (orbital periods of about 6 to 50)
+static int make_orbits(ParticleSystem *ps, SimConfig *config) {
+    config_init(config);
+    config->max_particles = BENCH_ENERGY_N;
+    config->random_seed = BENCH_SEED;
+    config->enable_collision = 0;
+    if (!particle_system_init(ps, BENCH_ENERGY_N)) return 0;
+    
+    Rng rng;
+    rng_seed(&rng, BENCH_SEED);
+    float gm = G * BENCH_ENERGY_CENTRAL_MASS;
+    
+    Particle p;
+    particle_init(&p, (Vec3){0.0f, 0.0f, 0.0f}, (Vec3){0.0f, 0.0f, 0.0f},
+                  BENCH_ENERGY_CENTRAL_MASS, 1.0f, (Vec3){1.0f, 1.0f, 0.0f});
+    particle_system_set(ps, 0, &p);
+    for (int i = 1; i < BENCH_ENERGY_N; i++) {
+        float r = rng_range(&rng, 4.0f, 16.0f);
+        float phi = rng_range(&rng, 0.0f, 6.2831853f);
+        float speed = sqrtf(gm / r);
+        Vec3 pos = { r * cosf(phi), r * sinf(phi), rng_range(&rng, -0.1f, 0.1f) };
+        Vec3 vel = { -speed * sinf(phi), speed * cosf(phi), 0.0f };
+        particle_init(&p, pos, vel, BENCH_ENERGY_PLANET_MASS, 0.1f, (Vec3){1.0f, 1.0f, 1.0f});
+        particle_system_set(ps, i, &p);
+    }
+    return 1;
+}
+
+// Energy error against wall time for one integrator and step size
+static void bench_energy(int method, double dt, const BenchOptions *options) {
+    SimConfig config;
+    ParticleSystem ps;
+    if (!make_orbits(&ps, &config)) return;
+    
+    config.integration_method = method;
+    config.time_step = (float)dt;
+    config.num_threads = options->threads;
+    PhysicsState state;
+    physics_state_init(&state, &config);
+    
+    int steps = (int)(BENCH_ENERGY_TIME / dt + 0.5);
+    int sample_every = steps / BENCH_ENERGY_SAMPLES > 0 ? steps / BENCH_ENERGY_SAMPLES : 1;
+    double e0 = gravity_total_energy(&ps);
+    double max_error = 0.0;
+    double interactions = 0.0;
+    double seconds = 0.0;
+    
+    // Only the steps are timed; energy samples are taken between them
+    for (int step = 1; step <= steps; step++) {
+        double start = timer_now();
+        update_particle_system(&ps, &state, &config);
+        seconds += timer_now() - start;
+        interactions += (double)state.step_interactions;
+        
+        if (step % sample_every == 0 || step == steps) {
+            double error = fabs((gravity_total_energy(&ps) - e0) / e0);
+            if (!(error <= max_error)) max_error = error; // Also catches NaN
+        }
+    }
+    
+    BenchResult result = {
+        "energy", integrator_name(method), BENCH_ENERGY_N, state.threads, steps, seconds / steps,
+        interactions / steps, 0.0, dt, max_error, 0.0, 0.0, 0.0
+    };
+    record(result);
+    printf("          dt=%-8g %9.3f ms total  max |dE/E| %.3e\n", dt, seconds * 1e3, max_error);
+    
+    physics_state_cleanup(&state);
+    particle_system_free(&ps);
+}
+
+// Clustered test problem for the block timestep benchmark
+static int make_clusters(ParticleSystem *ps, SimConfig *config) {
+    config_init(config);
+    config->max_particles = BENCH_BLOCK_N;
+    config->random_seed = BENCH_SEED;
+    config->enable_collision = 0;
+    if (!particle_system_init(ps, BENCH_BLOCK_N)) return 0;
+    
+    Rng rng;
+    rng_seed(&rng, BENCH_SEED);
+    float gm = G * BENCH_BLOCK_CORE_MASS;
+    const Vec3 cores[BENCH_BLOCK_CLUSTERS] = {
+        {40.0f, 0.0f, 0.0f}, {-40.0f, 0.0f, 0.0f}, {0.0f, 40.0f, 0.0f}, {0.0f, -40.0f, 0.0f}
+    };
+    
+    Particle p;
+    for (int c = 0; c < BENCH_BLOCK_CLUSTERS; c++) {
+        particle_init(&p, cores[c], vec3_zero(), BENCH_BLOCK_CORE_MASS, 1.0f, (Vec3){1.0f, 1.0f, 0.0f});
+        particle_system_set(ps, c, &p);
+    }
+    for (int i = BENCH_BLOCK_CLUSTERS; i < BENCH_BLOCK_N; i++) {
+        // Log-uniform radius in a random orbital plane around a random core
+        Vec3 core = cores[i % BENCH_BLOCK_CLUSTERS];
+        float r = 0.3f * powf(8.0f / 0.3f, rng_float(&rng));
+        Vec3 dir = vec3_normalize((Vec3){rng_range(&rng, -1.0f, 1.0f), rng_range(&rng, -1.0f, 1.0f),
+                                         rng_range(&rng, -1.0f, 1.0f)});
+        Vec3 other = {rng_range(&rng, -1.0f, 1.0f), rng_range(&rng, -1.0f, 1.0f), rng_range(&rng, -1.0f, 1.0f)};
+        Vec3 tangent = vec3_normalize(vec3_cross(dir, other));
+        particle_init(&p, vec3_add(core, vec3_mul(dir, r)), vec3_mul(tangent, sqrtf(gm / r)),
+                      BENCH_ENERGY_PLANET_MASS, 0.1f, (Vec3){1.0f, 1.0f, 1.0f});
+        particle_system_set(ps, i, &p);
+    }
+    return 1;
+}
+
+// Block timesteps against a global leapfrog at the block scheme's smallest step
+static void bench_block(const char *name, int force_method, int block, const BenchOptions *options) {
+    SimConfig config;
+    ParticleSystem ps;
+    if (!make_clusters(&ps, &config)) return;
+    
+    config.force_method = force_method;
+    config.num_threads = options->threads;
+    config.integration_method = 1;
+    config.block_timesteps = block;
+    config.block_levels = BENCH_BLOCK_LEVELS;
+    config.time_step = block ? BENCH_BLOCK_DT : BENCH_BLOCK_DT / (1 << (BENCH_BLOCK_LEVELS - 1));
+    PhysicsState state;
+    physics_state_init(&state, &config);
+    
+    int steps = (int)(BENCH_BLOCK_TIME / config.time_step + 0.5);
+    double e0 = gravity_total_energy(&ps);
+    double interactions = 0.0;
+    double particle_forces = 0.0;
+    double start = timer_now();
+    for (int step = 0; step < steps; step++) {
+        update_particle_system(&ps, &state, &config);
+        interactions += (double)state.step_interactions;
+        particle_forces += (double)state.step_particle_forces;
+    }
+    double seconds = timer_now() - start;
+    double error = fabs((gravity_total_energy(&ps) - e0) / e0);
+    
+    BenchResult result = {
+        "block", name, BENCH_BLOCK_N, state.threads, steps, seconds / steps,
+        interactions / steps, 0.0, config.time_step, error, 0.0, 0.0, 0.0
+    };
+    record(result);
+    printf("          %.4g particle force evaluations (%.1f per particle), %.3f s total, |dE/E| %.3e\n",
+           particle_forces, particle_forces / BENCH_BLOCK_N, seconds, error);
+    
+    physics_state_cleanup(&state);
+    particle_system_free(&ps);
+}
+
+// Eccentric test problem for the adaptive timestep benchmark: the planets start at
+// apocentre, out of phase, so their close approaches to the central body fall apart
+static int make_eccentric(ParticleSystem *ps, SimConfig *config) {
+    config_init(config);
+    config->max_particles = 3;
+    config->random_seed = BENCH_SEED;
+    config->enable_collision = 0;
+    if (!particle_system_init(ps, 3)) return 0;
+    
+    const float axes[2] = {8.0f, 12.0f};
+    const float phases[2] = {0.0f, 2.5f};
+    float gm = G * BENCH_ENERGY_CENTRAL_MASS;
+    float e = BENCH_ADAPTIVE_ECCENTRICITY;
+    
+    Particle p;
+    particle_init(&p, vec3_zero(), vec3_zero(), BENCH_ENERGY_CENTRAL_MASS, 1.0f, (Vec3){1.0f, 1.0f, 0.0f});
+    particle_system_set(ps, 0, &p);
+    for (int i = 0; i < 2; i++) {
+        float r = axes[i] * (1.0f + e);
+        float speed = sqrtf(gm * (1.0f - e) / r);
+        Vec3 pos = { r * cosf(phases[i]), r * sinf(phases[i]), 0.0f };
+        Vec3 vel = { -speed * sinf(phases[i]), speed * cosf(phases[i]), 0.0f };
+        particle_init(&p, pos, vel, BENCH_ENERGY_PLANET_MASS, 0.1f, (Vec3){1.0f, 1.0f, 1.0f});
+        particle_system_set(ps, i + 1, &p);
+    }
+    return 1;
+}
+
+// Leapfrog with the adaptive global step, or with a fixed step when fixed_dt > 0, over a
+// fixed simulated time. Returns the mean step size.
+static double bench_adaptive(const char *name, int symmetric, int jerk, double fixed_dt,
+                             const BenchOptions *options) {
+    SimConfig config;
+    ParticleSystem ps;
+    if (!make_eccentric(&ps, &config)) return 0.0;
+    
+    config.num_threads = options->threads;
+    config.integration_method = 1;
+    config.adaptive_timestep = fixed_dt <= 0.0;
+    config.adaptive_symmetric = symmetric;
+    config.adaptive_jerk = jerk;
+    config.adaptive_max_step = 1.0f;
+    if (fixed_dt > 0.0) config.time_step = (float)fixed_dt;
+    PhysicsState state;
+    physics_state_init(&state, &config);
+    
+    double e0 = gravity_total_energy(&ps);
+    double max_error = 0.0;
+    double time = 0.0;
+    double seconds = 0.0;
+    long evaluations = 0;
+    int steps = 0;
+    while (time < BENCH_ADAPTIVE_TIME) {
+        double start = timer_now();
+        update_particle_system(&ps, &state, &config);
+        seconds += timer_now() - start;
+        time += state.step_dt;
+        evaluations += state.step_force_evaluations;
+        
+        if (++steps % BENCH_ADAPTIVE_SAMPLE_EVERY == 0) {
+            double error = fabs((gravity_total_energy(&ps) - e0) / e0);
+            if (!(error <= max_error)) max_error = error;
+        }
+    }
+    double mean_dt = time / steps;
+    
+    BenchResult result = {
+        "adaptive", name, 3, state.threads, steps, seconds / steps,
+        0.0, 0.0, mean_dt, max_error, 0.0, 0.0, 0.0
+    };
+    record(result);
+    printf("          %d steps, %ld force evaluations, mean dt %.4g, max |dE/E| %.3e\n",
+           steps, evaluations, mean_dt, max_error);
+    
+    physics_state_cleanup(&state);
+    particle_system_free(&ps);
+    return mean_dt;
+}
+
+// Producer-side cost of trajectory output, plus the size and error of the encoding
+static void bench_trajectory(int n, const BenchOptions *options) {
+    SimConfig config;
+    ParticleSystem ps;
+    if (!make_system(&ps, &config, n)) return;
+    
+    TrajectoryWriter writer;
+    if (!trajectory_open(&writer, options->trajectory_path, n, config.trajectory_precision,
+                         config.trajectory_velocity_precision, config.trajectory_keyframe_interval, -1)) {
+        particle_system_free(&ps);
+        return;
+    }
+    
+    // Frames are trajectory_interval force-free steps apart, as in a run with default settings
+    double push_seconds = 0.0;
+    double start = timer_now();
+    for (int frame = 0; frame < BENCH_TRAJECTORY_FRAMES; frame++) {
+        float drift = config.trajectory_interval * config.time_step;
+        for (int i = 0; i < n; i++) {
+            ps.x[i] += ps.vx[i] * drift;
+            ps.y[i] += ps.vy[i] * drift;
+            ps.z[i] += ps.vz[i] * drift;
+        }
+        double push_start = timer_now();
+        trajectory_push(&writer, &ps, frame, frame * config.time_step);
+        push_seconds += timer_now() - push_start;
+    }
+    trajectory_close(&writer);
+    double writer_seconds = timer_now() - start;
+    
+    // Decode the stream and compare the last frame with the exact positions
+    TrajectoryReader reader;
+    float max_error = 0.0f;
+    if (trajectory_reader_open(&reader, options->trajectory_path)) {
+        while (trajectory_reader_next(&reader)) { }
+        const float *exact[3] = { ps.x, ps.y, ps.z };
+        for (int c = 0; c < 3 && reader.count == n; c++) {
+            for (int i = 0; i < n; i++) {
+                float error = fabsf(reader.values[c][i] - exact[c][i]);
+                if (error > max_error) max_error = error;
+            }
+        }
+        trajectory_reader_close(&reader);
+    }
+    remove(options->trajectory_path);
+    
+    // Positions and velocities are copied into the writer's buffer
+    BenchResult result = {
+        "trajectory", "push", n, 1, BENCH_TRAJECTORY_FRAMES, push_seconds / BENCH_TRAJECTORY_FRAMES,
+        0.0, (double)n * sizeof(float) * writer.components, 0.0, 0.0, 0.0, 0.0, 0.0
+    };
+    record(result);
+    printf("          %.3f bytes/coordinate, %.3f ms/frame end to end, %.3f ms/frame waiting, "
+           "max position error %.2g (precision %g)\n",
+           (double)writer.bytes_written / ((double)writer.frames_written * n * writer.components),
+           writer_seconds / BENCH_TRAJECTORY_FRAMES * 1e3, writer.wait_seconds / BENCH_TRAJECTORY_FRAMES * 1e3,
+           max_error, config.trajectory_precision);
+    
+    particle_system_free(&ps);
+}
+
+// Time collision_step on its own; interactions are the candidate pairs it tested
+static void bench_collision(int n, const BenchOptions *options) {
+    SimConfig config;
+    config_init(&config);
+    config.max_particles = n;
+    config.random_seed = BENCH_SEED;
+    float scale = cbrtf((float)n / BENCH_COLLISION_DENSITY_N);
+    config.space_min = vec3_mul(config.space_min, scale);
+    config.space_max = vec3_mul(config.space_max, scale);
+    
+    ParticleSystem ps;
+    if (!particle_system_init(&ps, n)) {
+        fprintf(stderr, "Failed to allocate %d particles\n", n);
+        return;
+    }
+    create_initial_particles(&config, &ps);
+    
+    config.num_threads = options->threads;
+    PhysicsState state;
+    physics_state_init(&state, &config);
+    
+    // The first call sizes the grid and separates the initial overlaps
+    collision_step(&state.collisions, &ps, &config);
+    
+    int reps = 0;
+    double tested = 0.0;
+    double collisions = 0.0;
+    double start = timer_now();
+    double elapsed;
+    do {
+        collision_step(&state.collisions, &ps, &config);
+        tested += (double)state.collisions.tested;
+        collisions += state.collisions.collisions;
+        reps++;
+        elapsed = timer_now() - start;
+    } while (elapsed < BENCH_MIN_SECONDS);
+    
+    // Positions and radii are read twice (hash, then pair tests)
+    BenchResult result = {
+        "collide", "hash", n, state.threads, reps, elapsed / reps,
+        tested / reps, (double)n * sizeof(float) * 8, 0.0, 0.0, 0.0, 0.0, 0.0
+    };
+    record(result);
+    printf("          %.2f ns/particle, %.2f candidate pairs/particle, %.1f collisions/step\n",
+           elapsed / reps * 1e9 / n, tested / reps / n, collisions / reps);
+    
+    physics_state_cleanup(&state);
+    particle_system_free(&ps);
+}
+
+// Force phase in creation order against Morton order. Cache misses come from the
+// profiler's hardware counters, which only see the calling thread (exact with --threads 1).
+static void bench_reorder(const char *name, int force_method, int reorder, int n, const BenchOptions *options) {
+    SimConfig config;
+    ParticleSystem ps;
+    if (!make_system(&ps, &config, n)) return;
+
+    config.force_method = force_method;
+    config.num_threads = options->threads;
+    PhysicsState state;
+    physics_state_init(&state, &config);
+    if (reorder && !morton_reorder(&state.morton, &ps)) {
+        physics_state_cleanup(&state);
+        particle_system_free(&ps);
+        return;
+    }
+    compute_forces(&ps, &state, &config);
+
+    int reps = 0;
+    double interactions = 0.0;
+    double misses = 0.0;
+    double elapsed = 0.0;
+    do {
+        ProfileScope scope = profiler_begin(PROFILE_FORCES);
+        compute_forces(&ps, &state, &config);
+        profiler_end(&scope);
+
+        ProfileSample sample;
+        if (profiler_last_sample(PROFILE_FORCES, &sample)) {
+            elapsed += sample.duration;
+            misses += (double)sample.counters[PROFILE_COUNTER_CACHE_MISSES];
+        }
+        interactions += (double)state.interactions;
+        reps++;
+    } while (elapsed < BENCH_MIN_SECONDS);
+
+    BenchResult result = {
+        "reorder", name, n, state.threads, reps, elapsed / reps,
+        interactions / reps, (double)n * sizeof(float) * (4 + 3 + 3), 0.0, 0.0, 0.0, misses / reps / n, 0.0
+    };
+    record(result);
+    if (misses > 0.0) printf("          %.2f cache misses/particle\n", misses / reps / n);
+
+    physics_state_cleanup(&state);
+    particle_system_free(&ps);
+}
+
+// Time octree construction on its own, then the Barnes-Hut walks over the finished tree.
+// With refit set, every timed update refits the warm-up tree instead of rebuilding it.
+static void bench_tree(const char *name, int parallel, int refit, int n, const BenchOptions *options) {
+    SimConfig config;
+    ParticleSystem ps;
+    if (!make_system(&ps, &config, n)) return;
+
+    config.force_method = 1;
+    config.tree_build = parallel;
+    config.num_threads = options->threads;
+    PhysicsState state;
+    physics_state_init(&state, &config);
+    Octree *tree = &state.tree;
+    tree->refit_interval = refit ? INT_MAX : 0;
+    tree->refit_growth = FLT_MAX;
+
+    // Warm-up build (allocates the node pool and sort buffers)
+    if (!octree_update(tree, &ps)) {
+        physics_state_cleanup(&state);
+        particle_system_free(&ps);
+        return;
+    }
+
+    int reps = 0;
+    double start = timer_now();
+    double elapsed;
+    do {
+        octree_update(tree, &ps);
+        reps++;
+        elapsed = timer_now() - start;
+    } while (elapsed < BENCH_MIN_SECONDS);
+
+    // Positions and masses are read; the walk below is timed against the same tree
+    BenchResult result = {
+        "tree", name, n, state.threads, reps, elapsed / reps,
+        0.0, (double)n * sizeof(float) * 4, 0.0, 0.0, 0.0, 0.0, 0.0
+    };
+    record(result);
+
+    if (parallel && !refit) {
+        int walks = 0;
+        double interactions = 0.0;
+        start = timer_now();
+        do {
+            long long count = 0;
+            #pragma omp parallel for schedule(dynamic, 64) reduction(+:count)
+            for (int i = 0; i < n; i++) {
+                count += apply_barnes_hut_gravity(&ps, i, tree);
+            }
+            interactions += (double)count;
+            walks++;
+            elapsed = timer_now() - start;
+        } while (elapsed < BENCH_MIN_SECONDS);
+
+        BenchResult walk = {
+            "tree", "bh_walk", n, state.threads, walks, elapsed / walks,
+            interactions / walks, (double)n * sizeof(float) * (4 + 3), 0.0, 0.0, 0.0, 0.0, 0.0
+        };
+        record(walk);
+    }
+
+    physics_state_cleanup(&state);
+    particle_system_free(&ps);
+}
+
+// Count heap allocations over full steps after a warm-up; a force method (or collision
+// mode) that keeps its transient data in arenas and grow-only buffers should make none
+static void bench_allocations(const char *name, int force_method, int refit, int p3m, int collisions,
+                              const BenchOptions *options) {
+    SimConfig config;
+    ParticleSystem ps;
+    if (!make_system(&ps, &config, BENCH_ALLOC_N)) return;
+
+    config.force_method = force_method;
+    config.tree_refit_interval = refit;
+    config.pm_p3m = p3m;
+    config.enable_collision = collisions;
+    config.num_threads = options->threads;
+    int interval = config.reorder_interval > 0 ? config.reorder_interval : 1;
+    PhysicsState state;
+    physics_state_init(&state, &config);
+
+    for (int step = 0; step <= interval; step++) {
+        update_particle_system(&ps, &state, &config);
+    }
+
+    long long before = atomic_load(&heap_allocations);
+    double start = timer_now();
+    for (int step = 0; step < interval; step++) {
+        update_particle_system(&ps, &state, &config);
+    }
+    double elapsed = timer_now() - start;
+    long long allocations = atomic_load(&heap_allocations) - before;
+
+    BenchResult result = {
+        "alloc", name, BENCH_ALLOC_N, state.threads, interval, elapsed / interval,
+        0.0, 0.0, config.time_step, 0.0, 0.0, 0.0, (double)allocations / interval
+    };
+    record(result);
+    printf("          %lld heap allocations in %d steps\n", allocations, interval);
+
+    physics_state_cleanup(&state);
+    particle_system_free(&ps);
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Time one force configuration and compare its accelerations with reference (3 per particle)
+static void bench_accuracy(const char *name, const SimConfig *base, const float *reference,
+                           const BenchOptions *options) {
+    SimConfig config = *base;
+    ParticleSystem ps;
+    SimConfig initial;
+    if (!make_system(&ps, &initial, BENCH_ACCURACY_N)) return;
+    config.num_threads = options->threads;
+
+    PhysicsState state;
+    physics_state_init(&state, &config);
+    compute_forces(&ps, &state, &config);
+
+    int reps = 0;
+    double interactions = 0.0;
+    double start = timer_now();
+    double elapsed;
+    do {
+        compute_forces(&ps, &state, &config);
+        interactions += (double)state.interactions;
+        reps++;
+        elapsed = timer_now() - start;
+    } while (elapsed < BENCH_MIN_SECONDS);
+
+    int n = BENCH_ACCURACY_N;
+    double *error = malloc((size_t)n * sizeof(double));
+    if (!error) {
+        fprintf(stderr, "Failed to allocate the accuracy buffer\n");
+        physics_state_cleanup(&state);
+        particle_system_free(&ps);
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        double rx = reference[3 * i], ry = reference[3 * i + 1], rz = reference[3 * i + 2];
+        double dx = ps.ax[i] - rx, dy = ps.ay[i] - ry, dz = ps.az[i] - rz;
+        error[i] = sqrt(dx * dx + dy * dy + dz * dz) / sqrt(rx * rx + ry * ry + rz * rz);
+    }
+    qsort(error, n, sizeof(double), compare_double);
+
+    BenchResult result = {
+        "accuracy", name, n, state.threads, reps, elapsed / reps,
+        interactions / reps, (double)n * sizeof(float) * (4 + 3 + 3), 0.0, 0.0, error[n / 2], 0.0, 0.0
+    };
+    record(result);
+    printf("          median error %.3e, 99%% %.3e, max %.3e\n",
+           error[n / 2], error[n * 99 / 100], error[n - 1]);
+
+    free(error);
+    physics_state_cleanup(&state);
+    particle_system_free(&ps);
+}
+
+// Accuracy against time: Barnes-Hut and fast multipole over their accuracy parameters,
+// measured against the scalar apply_gravity pair sum
+static void bench_accuracy_sweep(const BenchOptions *options) {
+    SimConfig config;
+    ParticleSystem ps;
+    if (!make_system(&ps, &config, BENCH_ACCURACY_N)) return;
+
+    config.force_method = 0;
+    config.force_kernel = GRAVITY_KERNEL_SCALAR;
+    config.num_threads = options->threads;
+    PhysicsState state;
+    physics_state_init(&state, &config);
+    compute_forces(&ps, &state, &config);
+
+    float *reference = malloc((size_t)BENCH_ACCURACY_N * 3 * sizeof(float));
+    if (reference) {
+        for (int i = 0; i < BENCH_ACCURACY_N; i++) {
+            reference[3 * i] = ps.ax[i];
+            reference[3 * i + 1] = ps.ay[i];
+            reference[3 * i + 2] = ps.az[i];
+        }
+    }
+    physics_state_cleanup(&state);
+    particle_system_free(&ps);
+    if (!reference) {
+        fprintf(stderr, "Failed to allocate the reference accelerations\n");
+        return;
+    }
+
+    SimConfig base;
+    config_init(&base);
+    base.max_particles = BENCH_ACCURACY_N;
+    base.enable_collision = 0;
+
+    SimConfig run = base;
+    run.force_method = 0;
+    bench_accuracy("direct", &run, reference, options);
+
+    // Names are kept by the results table, so they are literals
+    static const float bh_thetas[] = { 0.3f, 0.5f, 0.7f };
+    static const char *bh_names[] = { "bh_t0.3", "bh_t0.5", "bh_t0.7" };
+    for (int k = 0; k < 3; k++) {
+        run = base;
+        run.force_method = 1;
+        run.barnes_hut_theta = bh_thetas[k];
+        bench_accuracy(bh_names[k], &run, reference, options);
+    }
+
+    static const char *order_names[] = { "fmm_p2", "fmm_p3", "fmm_p4", "fmm_p5", "fmm_p6" };
+    for (int order = 2; order <= 6; order++) {
+        run = base;
+        run.force_method = 3;
+        run.fmm_order = order;
+        bench_accuracy(order_names[order - 2], &run, reference, options);
+    }
+
+    static const float fmm_thetas[] = { 0.3f, 0.7f };
+    static const char *theta_names[] = { "fmm_t0.3", "fmm_t0.7" };
+    for (int k = 0; k < 2; k++) {
+        run = base;
+        run.force_method = 3;
+        run.fmm_theta = fmm_thetas[k];
+        bench_accuracy(theta_names[k], &run, reference, options);
+    }
+
+    free(reference);
+}
+
+// Time one pass of the external field over the sweep's initial conditions: the exact
+// profiles evaluated per particle (geometry -1) or a tabulated grid, with the grid's
+// median error against the exact values
+static void bench_external(const char *name, int geometry, const BenchOptions *options) {
+    SimConfig config;
+    ParticleSystem ps;
+    if (!make_system(&ps, &config, BENCH_EXTERNAL_N)) return;
+    config.external_potential = geometry >= 0 ? EXTERNAL_PROFILES : EXTERNAL_NONE;
+    config.external_geometry = geometry;
+    config.external_bulge_mass = 1.0e11f;
+    config.external_disk_mass = 5.0e11f;
+    config.external_halo_mass = 2.0e12f;
+    config.num_threads = options->threads;
+
+    // The physics state tabulates the field
+    PhysicsState state;
+    double setup = timer_now();
+    physics_state_init(&state, &config);
+    setup = timer_now() - setup;
+    const ExternalField *field = &state.external;
+    if (geometry >= 0 && !field->nodes) {
+        physics_state_cleanup(&state);
+        particle_system_free(&ps);
+        return;
+    }
+
+    // In Morton order, as a run with reorder_interval set keeps it
+    if (!morton_reorder(&state.morton, &ps)) {
+        physics_state_cleanup(&state);
+        particle_system_free(&ps);
+        return;
+    }
+
+    const int n = BENCH_EXTERNAL_N;
+
+    int reps = 0;
+    double start = timer_now();
+    double elapsed;
+    do {
+        particle_system_reset_forces(&ps);
+        if (geometry >= 0) {
+            external_field_apply(field, &ps, NULL, n);
+        } else {
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < n; i++) {
+                double position[3] = {ps.x[i], ps.y[i], ps.z[i]}, acc[3];
+                external_profile_acceleration(&config, position, acc);
+                ps.ax[i] = (float)acc[0];
+                ps.ay[i] = (float)acc[1];
+                ps.az[i] = (float)acc[2];
+            }
+        }
+        reps++;
+        elapsed = timer_now() - start;
+    } while (elapsed < BENCH_MIN_SECONDS);
+
+    double *error = malloc((size_t)n * sizeof(double));
+    if (!error) {
+        fprintf(stderr, "Failed to allocate the accuracy buffer\n");
+        physics_state_cleanup(&state);
+        particle_system_free(&ps);
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        double position[3] = {ps.x[i], ps.y[i], ps.z[i]}, exact[3];
+        external_profile_acceleration(&config, position, exact);
+        double dx = ps.ax[i] - exact[0], dy = ps.ay[i] - exact[1], dz = ps.az[i] - exact[2];
+        double magnitude = sqrt(exact[0] * exact[0] + exact[1] * exact[1] + exact[2] * exact[2]);
+        error[i] = magnitude > 0.0 ? sqrt(dx * dx + dy * dy + dz * dz) / magnitude : 0.0; // Zero at the center
+    }
+    qsort(error, n, sizeof(double), compare_double);
+
+    // Positions read, accelerations written, plus the grid nodes touched
+    BenchResult result = {
+        "external", name, n, state.threads, reps, elapsed / reps,
+        0.0, (double)n * sizeof(float) * (3 + 3), 0.0, 0.0, error[n / 2], 0.0, 0.0
+    };
+    record(result);
+    if (geometry >= 0) {
+        printf("          %dx%dx%d nodes built in %.3f ms, median error %.3e, max %.3e\n",
+               field->nx, field->ny, field->nz, setup * 1e3, error[n / 2], error[n - 1]);
+    }
+
+    free(error);
+    physics_state_cleanup(&state);
+    particle_system_free(&ps);
+}
+
+// Time the periodic direct sum on the default box, with the nearest image only or with the
+// Ewald table. At small n the table forces of a few targets are checked against the
+// exact Ewald sum.
+static void bench_periodic(const char *name, int ewald, int n, const BenchOptions *options) {
+    SimConfig config;
+    ParticleSystem ps;
+    if (!make_system(&ps, &config, n)) return;
+    config.enable_bounded_space = BOUNDARY_PERIODIC;
+    config.periodic_ewald = ewald;
+    config.num_threads = options->threads;
+
+    PhysicsState state;
+    physics_state_init(&state, &config);
+    const BoundaryBox *box = &state.boundary;
+    if (box->mode != BOUNDARY_PERIODIC) {
+        physics_state_cleanup(&state);
+        particle_system_free(&ps);
+        return;
+    }
+    // The central body starts at the origin, inside the default box
+    boundary_apply(box, &ps);
+    compute_forces(&ps, &state, &config);
+
+    int reps = 0;
+    double interactions = 0.0;
+    double start = timer_now();
+    double elapsed;
+    do {
+        compute_forces(&ps, &state, &config);
+        interactions += (double)state.interactions;
+        reps++;
+        elapsed = timer_now() - start;
+    } while (elapsed < BENCH_MIN_SECONDS);
+
+    // Median error over the checked targets, each summed exactly over every source
+    double error[BENCH_PERIODIC_CHECKED];
+    int checked = 0;
+    if (ewald && n <= BENCH_PERIODIC_CHECK_N) {
+        for (int t = 0; t < BENCH_PERIODIC_CHECKED; t++) {
+            int i = (int)((long long)t * n / BENCH_PERIODIC_CHECKED);
+            double exact[3] = {0.0, 0.0, 0.0};
+            for (int j = 0; j < n; j++) {
+                if (j == i) continue;
+                double d[3] = {ps.x[i] - ps.x[j], ps.y[i] - ps.y[j], ps.z[i] - ps.z[j]};
+                const double size[3] = {box->size.x, box->size.y, box->size.z};
+                for (int c = 0; c < 3; c++) {
+                    if (d[c] > 0.5 * size[c]) d[c] -= size[c];
+                    if (d[c] < -0.5 * size[c]) d[c] += size[c];
+                }
+                double r2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2] + GRAVITY_SOFTENING;
+                double inv_r3 = 1.0 / (r2 * sqrt(r2));
+                double correction[3];
+                boundary_ewald_exact(box, d, correction);
+                for (int c = 0; c < 3; c++) {
+                    exact[c] += (double)G * ps.mass[j] * (correction[c] - d[c] * inv_r3);
+                }
+            }
+            double dx = ps.ax[i] - exact[0], dy = ps.ay[i] - exact[1], dz = ps.az[i] - exact[2];
+            double magnitude = sqrt(exact[0] * exact[0] + exact[1] * exact[1] + exact[2] * exact[2]);
+            error[checked++] = sqrt(dx * dx + dy * dy + dz * dz) / magnitude;
+        }
+        qsort(error, checked, sizeof(double), compare_double);
+    }
+
+    // Positions and masses are read, accelerations written; the table comes from cache
+    BenchResult result = {
+        "force", name, n, state.threads, reps, elapsed / reps,
+        interactions / reps, (double)n * sizeof(float) * (4 + 3 + 3), 0.0, 0.0,
+        checked ? error[checked / 2] : 0.0, 0.0, 0.0
+    };
+    record(result);
+    if (checked) {
+        printf("          against the exact Ewald sum: median error %.3e, max %.3e\n",
+               error[checked / 2], error[checked - 1]);
+    }
+
+    physics_state_cleanup(&state);
+    particle_system_free(&ps);
+}
+
+static void write_json(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return;
+    }
+
+    fprintf(file, "{\n  \"seed\": %d,\n  \"kernel\": \"%s\",\n  \"results\": [\n",
+            BENCH_SEED, gravity_kernel_name(gravity_kernel_current()));
+    for (int i = 0; i < result_count; i++) {
+        BenchResult *r = &results[i];
+        fprintf(file, "    {\"phase\": \"%s\", \"method\": \"%s\", \"n\": %d, \"threads\": %d, "
+                      "\"reps\": %d, \"seconds_per_step\": %.9g, \"steps_per_sec\": %.6g, "
+                      "\"ns_per_interaction\": %.6g, \"bytes_per_step\": %.6g, \"gb_per_sec\": %.6g, "
+                      "\"time_step\": %.6g, \"energy_error\": %.6g, \"force_error\": %.6g, \"cache_misses\": %.6g, "
+                      "\"allocations\": %.6g}%s\n",
+                r->phase, r->method, r->n, r->threads, r->reps, r->seconds_per_step,
+                1.0 / r->seconds_per_step,
+                r->interactions > 0 ? r->seconds_per_step * 1e9 / r->interactions : 0.0,
+                r->bytes, r->bytes / r->seconds_per_step * 1e-9,
+                r->time_step, r->energy_error, r->force_error, r->cache_misses, r->allocations,
+                i + 1 < result_count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    printf("Wrote %s\n", path);
+}
+
+static void write_csv(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return;
+    }
+
+    fprintf(file, "phase,method,n,threads,reps,seconds_per_step,steps_per_sec,ns_per_interaction,"
+                  "bytes_per_step,gb_per_sec,time_step,energy_error,force_error,cache_misses,allocations\n");
+    for (int i = 0; i < result_count; i++) {
+        BenchResult *r = &results[i];
+        fprintf(file, "%s,%s,%d,%d,%d,%.9g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g\n",
+                r->phase, r->method, r->n, r->threads, r->reps, r->seconds_per_step,
+                1.0 / r->seconds_per_step,
+                r->interactions > 0 ? r->seconds_per_step * 1e9 / r->interactions : 0.0,
+                r->bytes, r->bytes / r->seconds_per_step * 1e-9,
+                r->time_step, r->energy_error, r->force_error, r->cache_misses, r->allocations);
+    }
+    fclose(file);
+    printf("Wrote %s\n", path);
+}
+
+static void print_usage(const char *program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  --max-n N         Largest particle count (default 1048576)\n");
+    printf("  --max-direct-n N  Largest count for the SIMD direct sum (default 65536)\n");
+    printf("  --max-pairs-n N   Largest count for the scalar pair loop (default 16384)\n");
+    printf("  --threads N       Worker threads, 0: one per core (default 0)\n");
+    printf("  --json FILE       Write results as JSON\n");
+    printf("  --csv FILE        Write results as CSV\n");
+    printf("  --trajectory FILE Scratch file for the trajectory output benchmark\n");
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options = {1 << 20, 1 << 16, 1 << 14, 0, NULL, NULL, NULL};
+
+    for (int i = 1; i < argc; i++) {
+        int has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--max-n") == 0 && has_value) options.max_n = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--max-direct-n") == 0 && has_value) options.max_direct_n = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--max-pairs-n") == 0 && has_value) options.max_pairs_n = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && has_value) options.threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--json") == 0 && has_value) options.json_path = argv[++i];
+        else if (strcmp(argv[i], "--csv") == 0 && has_value) options.csv_path = argv[++i];
+        else if (strcmp(argv[i], "--trajectory") == 0 && has_value) options.trajectory_path = argv[++i];
+        else {
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    // Hardware counters for the reorder benchmark; unavailable counters read as zero
+    profiler_init(1);
+
+    // Particle counts: 256, 1024, ... up to max_n
+    for (int n = 256; n <= options.max_n; n *= 4) {
+        if (n <= options.max_pairs_n) bench_force("pairs", 0, GRAVITY_KERNEL_SCALAR, n, &options);
+        if (n <= options.max_direct_n) bench_force("direct", 0, GRAVITY_KERNEL_AUTO, n, &options);
+        bench_tracers(n, &options);
+        if (n <= options.max_pairs_n) {
+            bench_periodic("periodic_nearest", 0, n, &options);
+            bench_periodic("periodic_ewald", 1, n, &options);
+        }
+        bench_force("barnes_hut", 1, GRAVITY_KERNEL_AUTO, n, &options);
+        bench_force("pm", 2, GRAVITY_KERNEL_AUTO, n, &options);
+        bench_force("fmm", 3, GRAVITY_KERNEL_AUTO, n, &options);
+
+        // Full steps with direct forces, so capped like the direct sum
+        for (int method = 0; method <= 4 && n <= options.max_direct_n; method++) {
+            bench_integrator(method, n, &options);
+        }
+        
+        bench_collision(n, &options);
+        
+        // Tree walk and mesh deposit in creation order and after a Morton sort
+        bench_reorder("bh_created", 1, 0, n, &options);
+        bench_reorder("bh_morton", 1, 1, n, &options);
+        bench_reorder("pm_created", 2, 0, n, &options);
+        bench_reorder("pm_morton", 2, 1, n, &options);
+        if (options.trajectory_path) bench_trajectory(n, &options);
+
+        // Octree construction timed apart from the force walk
+        bench_tree("tree_serial", 0, 0, n, &options);
+        bench_tree("tree_parallel", 1, 0, n, &options);
+        bench_tree("tree_refit", 1, 1, n, &options);
+    }
+
+    bench_accuracy_sweep(&options);
+
+    // Background potential: exact profiles per particle against the two grid geometries
+    bench_external("profiles", -1, &options);
+    bench_external("grid_rz", EXTERNAL_AXISYMMETRIC, &options);
+    bench_external("grid_3d", EXTERNAL_CARTESIAN, &options);
+
+    // Steady-state heap allocations per force method, and with the collision pass
+    bench_allocations("direct", 0, 0, 0, 0, &options);
+    bench_allocations("barnes_hut", 1, 0, 0, 0, &options);
+    bench_allocations("bh_refit", 1, 8, 0, 0, &options);
+    bench_allocations("p3m", 2, 0, 1, 0, &options);
+    bench_allocations("fmm", 3, 0, 0, 0, &options);
+    bench_allocations("collisions", 1, 0, 0, 1, &options);
+
+    // Force evaluations saved by block timesteps on a clustered system, for both force paths
+    bench_block("global_direct", 0, 0, &options);
+    bench_block("block_direct", 0, 1, &options);
+    bench_block("global_tree", 1, 0, &options);
+    bench_block("block_tree", 1, 1, &options);
+    
+    // Eccentric orbits: the adaptive step against a fixed one of the same mean size
+    double mean_dt = bench_adaptive("explicit", 0, 0, 0.0, &options);
+    bench_adaptive("symmetric", 1, 0, 0.0, &options);
+    bench_adaptive("sym_jerk", 1, 1, 0.0, &options);
+    if (mean_dt > 0.0) bench_adaptive("fixed", 0, 0, mean_dt, &options);
+    
+    // Energy error against wall time: halve the step until the float round-off floor
+    // (Wisdom-Holman only integrates the weak mutual pulls, so it starts at far larger steps)
+    for (int method = 0; method <= 4; method++) {
+        for (double dt = method == 4 ? 3.2 : 0.4; dt > 0.01; dt *= 0.5) {
+            bench_energy(method, dt, &options);
+        }
+    }
+    
+    if (options.json_path) write_json(options.json_path);
+    if (options.csv_path) write_csv(options.csv_path);
+
+    return 0;
+}
@@ -3,8 +3,8 @@ out vec4 FragColor;
 
 in vec3 FragPos;
 in vec3 Normal;
+in vec3 Color;
 
-uniform vec3 objectColor;
 // We'll add some simple lighting parameters
 uniform vec3 lightPos = vec3(100.0, 100.0, 100.0); // Default light position
 uniform vec3 lightColor = vec3(1.0, 1.0, 1.0);     // White light
@@ -29,7 +29,7 @@ void main() {
     vec3 specular = specularStrength * spec * lightColor;
         
     // Calculate final color
-    vec3 result = (ambient + diffuse + specular) * objectColor;
+    vec3 result = (ambient + diffuse + specular) * Color;
     FragColor = vec4(result, 1.0);
     
     // Add a rim lighting effect for a more sci-fi look
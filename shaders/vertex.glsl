@@ -1,18 +1,21 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec4 aInstance; // Per instance: xyz = position, w = radius
+layout (location = 3) in vec3 aColor;    // Per instance: RGB color
 
 out vec3 FragPos;
 out vec3 Normal;
+out vec3 Color;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
 void main() {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    // Calculate the normal in world space
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    FragPos = aInstance.xyz + aPos * aInstance.w;
+    // The model transform is a uniform scale plus translation, so the unit-sphere normal stays valid
+    Normal = aNormal;
+    Color = aColor;
     
     gl_Position = projection * view * vec4(FragPos, 1.0);
-}
\ No newline at end of file
+}
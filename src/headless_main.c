@@ -0,0 +1,16 @@
+/* src/headless_main.c */
+#include "sim/simulation.h"
+#include "utils/config.h"
+
+// Entry point of gravity_sim_headless, which carries no GLFW/OpenGL dependency
+int main(int argc, char *argv[]) {
+    SimConfig config;
+    config_init(&config);
+    config.headless = 1;
+    
+    if (!config_parse_args(&config, argc, argv)) {
+        return -1;
+    }
+    
+    return simulation_run_headless(&config) ? 0 : -1;
+}
@@ -0,0 +1,306 @@
+#define _POSIX_C_SOURCE 200809L
+#include "snapshot.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t align_up(uint64_t value) {
+    return (value + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+// The float array behind a particle section (every particle section except color)
+static float **float_array(ParticleSystem *ps, int id) {
+    switch (id) {
+        case SNAPSHOT_SECTION_X:      return &ps->x;
+        case SNAPSHOT_SECTION_Y:      return &ps->y;
+        case SNAPSHOT_SECTION_Z:      return &ps->z;
+        case SNAPSHOT_SECTION_VX:     return &ps->vx;
+        case SNAPSHOT_SECTION_VY:     return &ps->vy;
+        case SNAPSHOT_SECTION_VZ:     return &ps->vz;
+        case SNAPSHOT_SECTION_AX:     return &ps->ax;
+        case SNAPSHOT_SECTION_AY:     return &ps->ay;
+        case SNAPSHOT_SECTION_AZ:     return &ps->az;
+        case SNAPSHOT_SECTION_MASS:   return &ps->mass;
+        case SNAPSHOT_SECTION_RADIUS: return &ps->radius;
+        default:                      return NULL;
+    }
+}
+
+// Start of the data written for a particle section
+static const void *section_data(const ParticleSystem *ps, int id) {
+    if (id == SNAPSHOT_SECTION_COLOR) return ps->color;
+    if (id == SNAPSHOT_SECTION_ID) return ps->id;
+    return *float_array((ParticleSystem *)ps, id);
+}
+
+// Point a particle section's array at data
+static void set_section_array(ParticleSystem *ps, int id, void *array) {
+    if (id == SNAPSHOT_SECTION_COLOR) ps->color = array;
+    else if (id == SNAPSHOT_SECTION_ID) ps->id = array;
+    else *float_array(ps, id) = array;
+}
+
+// IDs are 32-bit like the floats, so every section byte-swaps as 4-byte words
+static size_t section_element_bytes(int id) {
+    return id == SNAPSHOT_SECTION_COLOR ? sizeof(Vec3) : sizeof(float);
+}
+
+// Write size zero bytes
+static int write_zeros(FILE *file, uint64_t size) {
+    static const char zeros[SNAPSHOT_ALIGNMENT];
+    while (size > 0) {
+        size_t chunk = size < sizeof(zeros) ? (size_t)size : sizeof(zeros);
+        if (fwrite(zeros, 1, chunk, file) != chunk) return 0;
+        size -= chunk;
+    }
+    return 1;
+}
+
+int snapshot_write(const char *path, const ParticleSystem *ps, const SimConfig *config, const SnapshotState *state) {
+    // The config section is the text config_load_from_file reads, so it survives struct changes
+    char *config_text = NULL;
+    size_t config_size = 0;
+    FILE *text = open_memstream(&config_text, &config_size);
+    if (!text) {
+        fprintf(stderr, "Snapshot: out of memory\n");
+        return 0;
+    }
+    config_write(config, text);
+    fclose(text);
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.endian_tag = SNAPSHOT_ENDIAN_TAG;
+    header.version = SNAPSHOT_VERSION;
+    header.header_size = sizeof(SnapshotHeader);
+    header.section_count = SNAPSHOT_SECTION_COUNT;
+    header.particle_count = (uint64_t)ps->count;
+    header.capacity = (uint64_t)ps->capacity;
+    header.step = (uint64_t)state->step;
+    header.time = state->time;
+    memcpy(header.rng_state, state->rng.s, sizeof(header.rng_state));
+
+    uint64_t offset = align_up(sizeof(SnapshotHeader));
+    for (int s = 0; s < SNAPSHOT_SECTION_COUNT; s++) {
+        SnapshotSection *section = &header.sections[s];
+        section->id = (uint32_t)s;
+        section->offset = offset;
+        if (s == SNAPSHOT_SECTION_CONFIG) {
+            section->element_size = 1;
+            section->size = config_size;
+        } else {
+            section->element_size = sizeof(float);
+            section->size = (uint64_t)ps->capacity * section_element_bytes(s);
+        }
+        offset = align_up(offset + section->size);
+    }
+
+    // Write to a temporary file and rename it over the old snapshot once complete
+    char temp_path[4096];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *file = fopen(temp_path, "wb");
+    if (!file) {
+        fprintf(stderr, "Snapshot: could not open %s\n", temp_path);
+        free(config_text);
+        return 0;
+    }
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    uint64_t position = sizeof(header);
+    for (int s = 0; s < SNAPSHOT_SECTION_COUNT && ok; s++) {
+        const SnapshotSection *section = &header.sections[s];
+        const void *data = s == SNAPSHOT_SECTION_CONFIG ? config_text : section_data(ps, s);
+        ok = write_zeros(file, section->offset - position) &&
+             fwrite(data, 1, (size_t)section->size, file) == section->size;
+        position = section->offset + section->size;
+    }
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    free(config_text);
+
+    if (!ok || rename(temp_path, path) != 0) {
+        fprintf(stderr, "Snapshot: failed to write %s\n", path);
+        remove(temp_path);
+        return 0;
+    }
+    return 1;
+}
+
+static uint32_t swap32(uint32_t v) {
+    return (v >> 24) | ((v >> 8) & 0xff00u) | ((v << 8) & 0xff0000u) | (v << 24);
+}
+
+static uint64_t swap64(uint64_t v) {
+    return ((uint64_t)swap32((uint32_t)v) << 32) | swap32((uint32_t)(v >> 32));
+}
+
+static void swap_header(SnapshotHeader *header) {
+    header->endian_tag = swap32(header->endian_tag);
+    header->version = swap32(header->version);
+    header->header_size = swap32(header->header_size);
+    header->section_count = swap32(header->section_count);
+    header->particle_count = swap64(header->particle_count);
+    header->capacity = swap64(header->capacity);
+    header->step = swap64(header->step);
+
+    uint64_t time_bits;
+    memcpy(&time_bits, &header->time, sizeof(time_bits));
+    time_bits = swap64(time_bits);
+    memcpy(&header->time, &time_bits, sizeof(time_bits));
+
+    for (int i = 0; i < 4; i++) header->rng_state[i] = swap32(header->rng_state[i]);
+    for (int s = 0; s < SNAPSHOT_SECTION_COUNT; s++) {
+        SnapshotSection *section = &header->sections[s];
+        section->id = swap32(section->id);
+        section->element_size = swap32(section->element_size);
+        section->offset = swap64(section->offset);
+        section->size = swap64(section->size);
+    }
+}
+
+// Map a whole file privately (writable, copy-on-write)
+static void *map_file(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Snapshot: could not open %s\n", path);
+        return NULL;
+    }
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        *size = (size_t)st.st_size;
+        data = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Snapshot: could not map %s\n", path);
+        return NULL;
+    }
+    return data;
+}
+
+// Copy the header out of a mapped file, convert it to native byte order and validate
+// every section against the file size. *swapped is set for foreign-endian files.
+static int read_header(const char *path, const unsigned char *data, size_t size,
+                       SnapshotHeader *header, int *swapped) {
+    if (size < sizeof(SnapshotHeader) || memcmp(data, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "Snapshot: %s is not a snapshot file\n", path);
+        return 0;
+    }
+    memcpy(header, data, sizeof(SnapshotHeader));
+
+    *swapped = header->endian_tag == swap32(SNAPSHOT_ENDIAN_TAG);
+    if (*swapped) {
+        swap_header(header);
+    }
+    if (header->endian_tag != SNAPSHOT_ENDIAN_TAG) {
+        fprintf(stderr, "Snapshot: %s has an unknown byte order\n", path);
+        return 0;
+    }
+    if (header->version != SNAPSHOT_VERSION || header->header_size != sizeof(SnapshotHeader) ||
+        header->section_count != SNAPSHOT_SECTION_COUNT) {
+        fprintf(stderr, "Snapshot: %s has unsupported version %u\n", path, header->version);
+        return 0;
+    }
+    if (header->capacity > INT_MAX || header->capacity % PARTICLE_PADDING != 0 ||
+        header->particle_count > header->capacity) {
+        fprintf(stderr, "Snapshot: %s has an invalid particle count\n", path);
+        return 0;
+    }
+
+    for (int s = 0; s < SNAPSHOT_SECTION_COUNT; s++) {
+        const SnapshotSection *section = &header->sections[s];
+        int valid = section->id == (uint32_t)s &&
+                    section->offset % SNAPSHOT_ALIGNMENT == 0 &&
+                    section->offset <= size && section->size <= size - section->offset;
+        if (s != SNAPSHOT_SECTION_CONFIG) {
+            valid = valid && section->size == header->capacity * section_element_bytes(s);
+        }
+        if (!valid) {
+            fprintf(stderr, "Snapshot: %s is truncated or corrupt (section %d)\n", path, s);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int snapshot_read_config(const char *path, SimConfig *config) {
+    size_t size;
+    unsigned char *data = map_file(path, &size);
+    if (!data) return 0;
+
+    SnapshotHeader header;
+    int swapped;
+    int ok = read_header(path, data, size, &header, &swapped);
+    if (ok) {
+        // Whether to open a window is up to the front end, not the run being resumed
+        int headless = config->headless;
+        const SnapshotSection *section = &header.sections[SNAPSHOT_SECTION_CONFIG];
+        config_load_from_string(config, (const char *)data + section->offset, (size_t)section->size, path);
+        config->headless = headless;
+    }
+
+    munmap(data, size);
+    return ok;
+}
+
+int snapshot_map(const char *path, ParticleSystem *ps, SnapshotState *state) {
+    size_t size;
+    unsigned char *data = map_file(path, &size);
+    if (!data) return 0;
+
+    SnapshotHeader header;
+    int swapped;
+    if (!read_header(path, data, size, &header, &swapped)) {
+        munmap(data, size);
+        return 0;
+    }
+
+    state->step = (long)header.step;
+    state->time = header.time;
+    memcpy(state->rng.s, header.rng_state, sizeof(state->rng.s));
+
+    if (!swapped) {
+        // Zero copy: the arrays live in the mapping and pages fault in as they are touched
+        ps->count = (int)header.particle_count;
+        ps->capacity = (int)header.capacity;
+        for (int s = SNAPSHOT_SECTION_X; s < SNAPSHOT_SECTION_COUNT; s++) {
+            set_section_array(ps, s, data + header.sections[s].offset);
+        }
+        ps->mapping = data;
+        ps->mapping_size = size;
+        // Tracers are the massless tail of the arrays, so the split is not stored
+        ps->massive_count = particle_system_find_massive_count(ps);
+        return 1;
+    }
+
+    // Foreign byte order: copy into heap arrays, swapping every float
+    if (!particle_system_init(ps, (int)header.particle_count)) {
+        fprintf(stderr, "Snapshot: failed to allocate %llu particles\n",
+                (unsigned long long)header.particle_count);
+        munmap(data, size);
+        return 0;
+    }
+    for (int s = SNAPSHOT_SECTION_X; s < SNAPSHOT_SECTION_COUNT; s++) {
+        const unsigned char *source = data + header.sections[s].offset;
+        unsigned char *target = (unsigned char *)section_data(ps, s);
+        size_t words = (size_t)ps->count * (section_element_bytes(s) / sizeof(uint32_t));
+        for (size_t k = 0; k < words; k++) {
+            uint32_t word;
+            memcpy(&word, source + k * sizeof(word), sizeof(word));
+            word = swap32(word);
+            memcpy(target + k * sizeof(word), &word, sizeof(word));
+        }
+    }
+    ps->massive_count = particle_system_find_massive_count(ps);
+    munmap(data, size);
+    return 1;
+}
@@ -0,0 +1,556 @@
+#define _POSIX_C_SOURCE 200809L
+#include "trajectory.h"
+#include "../utils/timer.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Largest quantised magnitude; keeps deltas of two values inside int64_t
+#define TRAJECTORY_QUANT_LIMIT 4.0e18
+
+// Longest varint of a 64-bit value
+#define TRAJECTORY_VARINT_MAX 10
+
+// Size of the frame header that precedes the component payloads
+#define TRAJECTORY_FRAME_HEADER 21
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static void put_u64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) v |= (uint32_t)p[i] << (8 * i);
+    return v;
+}
+
+static uint64_t get_u64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+static int64_t quantise(float value, double inv_precision) {
+    double scaled = (double)value * inv_precision;
+    if (scaled != scaled) return 0; // NaN
+    if (scaled > TRAJECTORY_QUANT_LIMIT) scaled = TRAJECTORY_QUANT_LIMIT;
+    if (scaled < -TRAJECTORY_QUANT_LIMIT) scaled = -TRAJECTORY_QUANT_LIMIT;
+    return llrint(scaled);
+}
+
+// Map signed deltas to unsigned so small negative values stay short
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static unsigned char *put_varint(unsigned char *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+// Quantise and delta-encode one component; returns the encoded length
+static size_t encode_component(const float *values, int64_t *previous, int count, float precision,
+                               unsigned char *out) {
+    double inv_precision = 1.0 / precision;
+    unsigned char *p = out;
+    for (int i = 0; i < count; i++) {
+        int64_t q = quantise(values[i], inv_precision);
+        p = put_varint(p, zigzag(q - previous[i]));
+        previous[i] = q;
+    }
+    return (size_t)(p - out);
+}
+
+// Ascending IDs as gaps to the previous one less one; returns the encoded length
+static size_t encode_ids(const int *ids, int count, unsigned char *out) {
+    unsigned char *p = out;
+    int previous = -1;
+    for (int i = 0; i < count; i++) {
+        p = put_varint(p, (uint64_t)(ids[i] - previous - 1));
+        previous = ids[i];
+    }
+    return (size_t)(p - out);
+}
+
+// Grow the encoder state to hold count particles
+static int reserve_encoder(TrajectoryWriter *writer, int count) {
+    if (count <= writer->encoder_capacity) return 1;
+    for (int c = 0; c < writer->components; c++) {
+        int64_t *previous = realloc(writer->previous[c], (size_t)count * sizeof(int64_t));
+        if (!previous) return 0;
+        writer->previous[c] = previous;
+    }
+    unsigned char *encoded = realloc(writer->encoded, (size_t)count * TRAJECTORY_VARINT_MAX);
+    if (!encoded) return 0;
+    writer->encoded = encoded;
+    writer->encoder_capacity = count;
+    return 1;
+}
+
+static int write_frame(TrajectoryWriter *writer, const TrajectoryFrame *frame) {
+    if (!reserve_encoder(writer, frame->count)) {
+        fprintf(stderr, "Trajectory: out of memory\n");
+        return 0;
+    }
+
+    // A changed particle count has nothing to take deltas against, and the reader needs
+    // to learn which IDs are left
+    int list_ids = frame->count != writer->previous_count || writer->frames_written == 0;
+    int keyframe = writer->frames_written % writer->keyframe_interval == 0 || list_ids;
+    if (keyframe) {
+        for (int c = 0; c < writer->components; c++) {
+            memset(writer->previous[c], 0, (size_t)frame->count * sizeof(int64_t));
+        }
+    }
+    writer->previous_count = frame->count;
+
+    unsigned char header[TRAJECTORY_FRAME_HEADER];
+    uint64_t time_bits;
+    memcpy(&time_bits, &frame->time, sizeof(time_bits));
+    header[0] = list_ids ? TRAJECTORY_KEYFRAME_IDS : keyframe ? TRAJECTORY_KEYFRAME : TRAJECTORY_DELTA;
+    put_u64(header + 1, (uint64_t)frame->step);
+    put_u64(header + 9, time_bits);
+    put_u32(header + 17, (uint32_t)frame->count);
+    if (fwrite(header, sizeof(header), 1, writer->file) != 1) return 0;
+    writer->bytes_written += sizeof(header);
+
+    if (list_ids) {
+        size_t length = encode_ids(frame->ids, frame->count, writer->encoded);
+        unsigned char prefix[4];
+        put_u32(prefix, (uint32_t)length);
+        if (fwrite(prefix, sizeof(prefix), 1, writer->file) != 1 ||
+            fwrite(writer->encoded, 1, length, writer->file) != length) {
+            return 0;
+        }
+        writer->bytes_written += sizeof(prefix) + length;
+    }
+
+    for (int c = 0; c < writer->components; c++) {
+        size_t length = encode_component(frame->values[c], writer->previous[c], frame->count,
+                                         writer->precision[c], writer->encoded);
+        unsigned char prefix[4];
+        put_u32(prefix, (uint32_t)length);
+        if (fwrite(prefix, sizeof(prefix), 1, writer->file) != 1 ||
+            fwrite(writer->encoded, 1, length, writer->file) != length) {
+            return 0;
+        }
+        writer->bytes_written += sizeof(prefix) + length;
+    }
+
+    writer->frames_written++;
+    return 1;
+}
+
+static void *trajectory_thread_main(void *arg) {
+    TrajectoryWriter *writer = (TrajectoryWriter*)arg;
+    int slot = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&writer->lock);
+        while (!writer->filled[slot] && !writer->stop) {
+            pthread_cond_wait(&writer->cond, &writer->lock);
+        }
+        int has_frame = writer->filled[slot];
+        pthread_mutex_unlock(&writer->lock);
+        if (!has_frame) break; // Stopped and drained
+
+        if (!writer->failed && !write_frame(writer, &writer->frames[slot])) {
+            fprintf(stderr, "Trajectory: write failed, dropping further frames\n");
+            writer->failed = 1;
+        }
+
+        pthread_mutex_lock(&writer->lock);
+        writer->filled[slot] = 0;
+        pthread_cond_broadcast(&writer->cond);
+        pthread_mutex_unlock(&writer->lock);
+        slot ^= 1;
+    }
+    return NULL;
+}
+
+// Make sure a frame buffer holds count particles
+static int reserve_frame(TrajectoryFrame *frame, int components, int count) {
+    if (count <= frame->capacity) return 1;
+    for (int c = 0; c < components; c++) {
+        float *values = realloc(frame->values[c], (size_t)count * sizeof(float));
+        if (!values) return 0;
+        frame->values[c] = values;
+    }
+    int *ids = realloc(frame->ids, (size_t)count * sizeof(int));
+    if (!ids) return 0;
+    frame->ids = ids;
+    frame->capacity = count;
+    return 1;
+}
+
+static void free_buffers(TrajectoryWriter *writer) {
+    for (int c = 0; c < TRAJECTORY_MAX_COMPONENTS; c++) {
+        free(writer->frames[0].values[c]);
+        free(writer->frames[1].values[c]);
+        free(writer->previous[c]);
+    }
+    free(writer->frames[0].ids);
+    free(writer->frames[1].ids);
+    free(writer->encoded);
+    free(writer->by_id);
+}
+
+// Keep the frames of an existing trajectory that precede resume_step, dropping later ones
+// and any frame cut short, and leave the file positioned to append. The file must have
+// been written with the same header. Returns 0 (with a message) otherwise.
+static int resume_file(TrajectoryWriter *writer, const char *path, const unsigned char *header,
+                       long resume_step) {
+    FILE *file = writer->file;
+    unsigned char existing[24];
+    if (fread(existing, sizeof(existing), 1, file) != 1 || memcmp(existing, header, sizeof(existing)) != 0) {
+        fprintf(stderr, "Trajectory: %s was not written with the current trajectory settings; "
+                "refusing to overwrite it on restart\n", path);
+        return 0;
+    }
+    off_t size = fseeko(file, 0, SEEK_END) == 0 ? ftello(file) : -1;
+    off_t keep = sizeof(existing);
+
+    for (;;) {
+        unsigned char frame[TRAJECTORY_FRAME_HEADER];
+        if (fseeko(file, keep, SEEK_SET) != 0 || fread(frame, sizeof(frame), 1, file) != 1) break;
+        if ((int64_t)get_u64(frame + 1) >= resume_step) break;
+
+        off_t end = keep + (off_t)sizeof(frame);
+        int blocks = writer->components + (frame[0] == TRAJECTORY_KEYFRAME_IDS);
+        int complete = 1;
+        for (int c = 0; c < blocks && complete; c++) {
+            unsigned char prefix[4];
+            complete = fread(prefix, sizeof(prefix), 1, file) == 1;
+            end += (off_t)sizeof(prefix) + get_u32(prefix);
+            complete = complete && end <= size && fseeko(file, end, SEEK_SET) == 0;
+        }
+        if (!complete) break;
+        keep = end;
+    }
+
+    if (size < 0 || fflush(file) != 0 || ftruncate(fileno(file), keep) != 0 || fseeko(file, keep, SEEK_SET) != 0) {
+        fprintf(stderr, "Trajectory: could not truncate %s for appending\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+int trajectory_open(TrajectoryWriter *writer, const char *path, int capacity, float position_precision,
+                    float velocity_precision, int keyframe_interval, long resume_step) {
+    memset(writer, 0, sizeof(*writer));
+    if (position_precision <= 0.0f) {
+        fprintf(stderr, "Trajectory: precision must be positive\n");
+        return 0;
+    }
+
+    writer->components = velocity_precision > 0.0f ? 6 : 3;
+    writer->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : 1;
+    for (int c = 0; c < writer->components; c++) {
+        writer->precision[c] = c < 3 ? position_precision : velocity_precision;
+    }
+
+    if (!reserve_frame(&writer->frames[0], writer->components, capacity) ||
+        !reserve_frame(&writer->frames[1], writer->components, capacity) ||
+        !reserve_encoder(writer, capacity)) {
+        fprintf(stderr, "Trajectory: out of memory\n");
+        free_buffers(writer);
+        return 0;
+    }
+
+    unsigned char header[24];
+    memcpy(header, TRAJECTORY_MAGIC, 8);
+    put_u32(header + 8, TRAJECTORY_VERSION);
+    put_u32(header + 12, (uint32_t)writer->components);
+    uint32_t bits;
+    memcpy(&bits, &position_precision, sizeof(bits));
+    put_u32(header + 16, bits);
+    memcpy(&bits, &velocity_precision, sizeof(bits));
+    put_u32(header + 20, bits);
+
+    if (resume_step >= 0) {
+        writer->file = fopen(path, "r+b"); // NULL: nothing to resume, start a new file
+        if (writer->file) setvbuf(writer->file, NULL, _IOFBF, 1 << 20);
+        if (writer->file && !resume_file(writer, path, header, resume_step)) {
+            fclose(writer->file);
+            writer->file = NULL;
+            free_buffers(writer);
+            return 0;
+        }
+    }
+    if (!writer->file) {
+        writer->file = fopen(path, "wb");
+        if (!writer->file) {
+            fprintf(stderr, "Trajectory: could not open %s\n", path);
+            free_buffers(writer);
+            return 0;
+        }
+        setvbuf(writer->file, NULL, _IOFBF, 1 << 20);
+        fwrite(header, sizeof(header), 1, writer->file);
+        writer->bytes_written = sizeof(header);
+    }
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    if (pthread_create(&writer->thread, NULL, trajectory_thread_main, writer) != 0) {
+        fprintf(stderr, "Trajectory: failed to start writer thread\n");
+        pthread_mutex_destroy(&writer->lock);
+        pthread_cond_destroy(&writer->cond);
+        fclose(writer->file);
+        writer->file = NULL;
+        free_buffers(writer);
+        return 0;
+    }
+    return 1;
+}
+
+// Slots of the particles in increasing ID order, or NULL when the slots already are in
+// that order (or on allocation failure, with *failed set)
+static const int *slots_by_id(TrajectoryWriter *writer, const ParticleSystem *ps, int *failed) {
+    *failed = 0;
+    int max_id = -1;
+    int sorted = 1;
+    for (int i = 0; i < ps->count; i++) {
+        if (ps->id[i] > max_id) max_id = ps->id[i];
+        else sorted = 0;
+    }
+    if (sorted) return NULL;
+
+    if (max_id + 1 > writer->by_id_capacity) {
+        int *by_id = realloc(writer->by_id, (size_t)(max_id + 1) * sizeof(int));
+        if (!by_id) {
+            *failed = 1;
+            return NULL;
+        }
+        writer->by_id = by_id;
+        writer->by_id_capacity = max_id + 1;
+    }
+    // IDs of merged particles are missing, so index by ID and then close the gaps
+    for (int k = 0; k <= max_id; k++) writer->by_id[k] = -1;
+    for (int i = 0; i < ps->count; i++) writer->by_id[ps->id[i]] = i;
+    int count = 0;
+    for (int k = 0; k <= max_id; k++) {
+        if (writer->by_id[k] >= 0) writer->by_id[count++] = writer->by_id[k];
+    }
+    return writer->by_id;
+}
+
+void trajectory_push(TrajectoryWriter *writer, const ParticleSystem *ps, long step, double time) {
+    int slot = writer->next;
+
+    // Wait only if the writer has not yet taken the frame queued two pushes ago
+    pthread_mutex_lock(&writer->lock);
+    if (writer->filled[slot]) {
+        double start = timer_now();
+        while (writer->filled[slot]) {
+            pthread_cond_wait(&writer->cond, &writer->lock);
+        }
+        writer->wait_seconds += timer_now() - start;
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    // The writer never touches an unfilled buffer, so it is copied without the lock
+    TrajectoryFrame *frame = &writer->frames[slot];
+    if (!reserve_frame(frame, writer->components, ps->count)) {
+        fprintf(stderr, "Trajectory: out of memory, frame at step %ld dropped\n", step);
+        return;
+    }
+    int failed;
+    const int *slots = slots_by_id(writer, ps, &failed);
+    if (failed) {
+        fprintf(stderr, "Trajectory: out of memory, frame at step %ld dropped\n", step);
+        return;
+    }
+    for (int k = 0; k < ps->count; k++) frame->ids[k] = ps->id[slots ? slots[k] : k];
+    const float *sources[TRAJECTORY_MAX_COMPONENTS] = { ps->x, ps->y, ps->z, ps->vx, ps->vy, ps->vz };
+    for (int c = 0; c < writer->components; c++) {
+        if (slots) {
+            for (int k = 0; k < ps->count; k++) frame->values[c][k] = sources[c][slots[k]];
+        } else {
+            memcpy(frame->values[c], sources[c], (size_t)ps->count * sizeof(float));
+        }
+    }
+    frame->count = ps->count;
+    frame->step = step;
+    frame->time = time;
+
+    pthread_mutex_lock(&writer->lock);
+    writer->filled[slot] = 1;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+    writer->next = slot ^ 1;
+}
+
+int trajectory_close(TrajectoryWriter *writer) {
+    if (!writer->file) return 0;
+
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = 1;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    int ok = !writer->failed;
+    ok = fclose(writer->file) == 0 && ok;
+    writer->file = NULL;
+
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->cond);
+    free_buffers(writer);
+    return ok;
+}
+
+int trajectory_reader_open(TrajectoryReader *reader, const char *path) {
+    memset(reader, 0, sizeof(*reader));
+    reader->file = fopen(path, "rb");
+    if (!reader->file) {
+        fprintf(stderr, "Trajectory: could not open %s\n", path);
+        return 0;
+    }
+
+    unsigned char header[24];
+    if (fread(header, sizeof(header), 1, reader->file) != 1 ||
+        memcmp(header, TRAJECTORY_MAGIC, 8) != 0 || get_u32(header + 8) != TRAJECTORY_VERSION) {
+        fprintf(stderr, "Trajectory: %s is not a version %d trajectory file\n", path, TRAJECTORY_VERSION);
+        fclose(reader->file);
+        reader->file = NULL;
+        return 0;
+    }
+
+    reader->components = get_u32(header + 12) == 6 ? 6 : 3;
+    float position_precision, velocity_precision;
+    uint32_t bits = get_u32(header + 16);
+    memcpy(&position_precision, &bits, sizeof(bits));
+    bits = get_u32(header + 20);
+    memcpy(&velocity_precision, &bits, sizeof(bits));
+    for (int c = 0; c < reader->components; c++) {
+        reader->precision[c] = c < 3 ? position_precision : velocity_precision;
+    }
+    return 1;
+}
+
+static int reserve_reader(TrajectoryReader *reader, int count) {
+    if (count <= reader->capacity) return 1;
+    for (int c = 0; c < reader->components; c++) {
+        float *values = realloc(reader->values[c], (size_t)count * sizeof(float));
+        if (!values) return 0;
+        reader->values[c] = values;
+        int64_t *previous = realloc(reader->previous[c], (size_t)count * sizeof(int64_t));
+        if (!previous) return 0;
+        reader->previous[c] = previous;
+    }
+    int *ids = realloc(reader->ids, (size_t)count * sizeof(int));
+    if (!ids) return 0;
+    reader->ids = ids;
+    reader->capacity = count;
+    return 1;
+}
+
+// Decode one varint; NULL if it runs past end or overflows
+static const unsigned char *get_varint(const unsigned char *p, const unsigned char *end, uint64_t *value) {
+    uint64_t v = 0;
+    for (int shift = 0; shift <= 63; shift += 7) {
+        if (p == end) return NULL;
+        unsigned char byte = *p++;
+        v |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = v;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Read one length-prefixed block of the frame into reader->buffer
+static int read_block(TrajectoryReader *reader) {
+    unsigned char prefix[4];
+    if (fread(prefix, sizeof(prefix), 1, reader->file) != 1) return 0;
+    size_t length = get_u32(prefix);
+    if (length > reader->buffer_capacity) {
+        unsigned char *buffer = realloc(reader->buffer, length);
+        if (!buffer) return 0;
+        reader->buffer = buffer;
+        reader->buffer_capacity = length;
+    }
+    reader->block_length = length;
+    return fread(reader->buffer, 1, length, reader->file) == length;
+}
+
+int trajectory_reader_next(TrajectoryReader *reader) {
+    unsigned char header[TRAJECTORY_FRAME_HEADER];
+    if (!reader->file || fread(header, sizeof(header), 1, reader->file) != 1) {
+        return 0;
+    }
+
+    int list_ids = header[0] == TRAJECTORY_KEYFRAME_IDS;
+    int keyframe = header[0] == TRAJECTORY_KEYFRAME || list_ids;
+    int count = (int)get_u32(header + 17);
+    if (count < 0 || (!list_ids && count != reader->count) || !reserve_reader(reader, count)) {
+        fprintf(stderr, "Trajectory: corrupt frame\n");
+        return 0;
+    }
+    uint64_t time_bits = get_u64(header + 9);
+    reader->step = (long)get_u64(header + 1);
+    memcpy(&reader->time, &time_bits, sizeof(time_bits));
+    reader->count = count;
+
+    if (list_ids) {
+        if (!read_block(reader)) return 0;
+        const unsigned char *p = reader->buffer;
+        const unsigned char *end = p + reader->block_length;
+        int64_t id = -1;
+        for (int i = 0; i < count; i++) {
+            uint64_t gap;
+            if (!(p = get_varint(p, end, &gap)) || gap > INT32_MAX || id + 1 + (int64_t)gap > INT32_MAX) {
+                fprintf(stderr, "Trajectory: corrupt frame\n");
+                return 0;
+            }
+            id += 1 + (int64_t)gap;
+            reader->ids[i] = (int)id;
+        }
+    }
+
+    for (int c = 0; c < reader->components; c++) {
+        if (!read_block(reader)) return 0;
+        size_t length = reader->block_length;
+
+        int64_t *previous = reader->previous[c];
+        if (keyframe) memset(previous, 0, (size_t)count * sizeof(int64_t));
+
+        const unsigned char *p = reader->buffer;
+        const unsigned char *end = p + length;
+        for (int i = 0; i < count; i++) {
+            uint64_t delta;
+            if (!(p = get_varint(p, end, &delta))) {
+                fprintf(stderr, "Trajectory: corrupt frame\n");
+                return 0;
+            }
+            previous[i] += unzigzag(delta);
+            reader->values[c][i] = (float)((double)previous[i] * reader->precision[c]);
+        }
+    }
+    return 1;
+}
+
+void trajectory_reader_close(TrajectoryReader *reader) {
+    if (reader->file) fclose(reader->file);
+    for (int c = 0; c < TRAJECTORY_MAX_COMPONENTS; c++) {
+        free(reader->values[c]);
+        free(reader->previous[c]);
+    }
+    free(reader->ids);
+    free(reader->buffer);
+    memset(reader, 0, sizeof(*reader));
+}
@@ -0,0 +1,121 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "../physics/particle.h"
+
+// Trajectory stream layout (all integers little-endian):
+//
+//   header:  "GRAVTRAJ", u32 version, u32 components (3: positions, 6: with velocities),
+//            f32 position precision, f32 velocity precision
+//   frame:   u8 type (0: keyframe, 1: delta, 2: keyframe with IDs), u64 step, f64 time,
+//            u32 particle count, for type 2 a u32 byte length and the particle IDs, then
+//            per component (x, y, z[, vx, vy, vz]) a u32 byte length and the payload
+//
+// Every value is quantised to a multiple of its precision. Keyframes store the quantised
+// values, delta frames the difference to the previous frame, both as zigzag varints, so
+// slowly moving particles take about one byte per coordinate. Deltas are taken against the
+// quantised previous frame, so the error never accumulates beyond half the precision.
+// Particles are written in order of their ParticleSystem ID, whatever slots they occupy.
+// The first frame and every frame whose particle count changed (merges remove IDs) list
+// the IDs, ascending, as varints of the gap to the previous ID less one; the columns of
+// the frames that follow belong to those IDs.
+#define TRAJECTORY_MAGIC "GRAVTRAJ"
+#define TRAJECTORY_VERSION 2
+#define TRAJECTORY_MAX_COMPONENTS 6
+
+#define TRAJECTORY_KEYFRAME 0
+#define TRAJECTORY_DELTA 1
+#define TRAJECTORY_KEYFRAME_IDS 2
+
+// One raw frame handed from the simulation to the writer thread
+typedef struct {
+    float *values[TRAJECTORY_MAX_COMPONENTS];
+    int *ids;            // Particle ID of each column, ascending
+    int count;
+    int capacity;
+    long step;
+    double time;
+} TrajectoryFrame;
+
+// Asynchronous trajectory writer. The simulation copies each frame into one of two
+// buffers and returns; a background thread quantises, encodes and writes it. The
+// producer only waits if the writer is still busy with both buffers.
+typedef struct {
+    FILE *file;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    TrajectoryFrame frames[2];
+    int filled[2];       // Frame holds data the writer has not taken yet
+    int next;            // Buffer the producer fills next
+    int stop;
+
+    int components;
+    float precision[TRAJECTORY_MAX_COMPONENTS];
+    int keyframe_interval;
+
+    // Encoder state, owned by the writer thread
+    int64_t *previous[TRAJECTORY_MAX_COMPONENTS]; // Quantised values of the last frame
+    int previous_count;
+    int encoder_capacity;
+    unsigned char *encoded;
+    long frames_written;
+    uint64_t bytes_written;
+    int failed;
+
+    double wait_seconds; // Time the producer spent waiting for a free buffer
+
+    // Producer side: slots of the particles in ID order, for reordered systems
+    int *by_id;
+    int by_id_capacity;
+} TrajectoryWriter;
+
+// Create (or resume) the file and start the writer thread, with buffers sized for
+// capacity particles (they grow if the count does). velocity_precision 0 leaves velocities
+// out; a keyframe is written every keyframe_interval frames. With resume_step >= 0 (a
+// restarted run) an existing file written with the same settings keeps its frames from
+// before resume_step and the new ones are appended, starting with a keyframe; a file with
+// other settings is left alone and the open fails. resume_step -1 always creates a new
+// file. Returns 1 on success.
+int trajectory_open(TrajectoryWriter *writer, const char *path, int capacity, float position_precision,
+                    float velocity_precision, int keyframe_interval, long resume_step);
+
+// Queue the current state of ps as a frame
+void trajectory_push(TrajectoryWriter *writer, const ParticleSystem *ps, long step, double time);
+
+// Write the queued frames, stop the thread and close the file. Returns 1 if every frame was written.
+int trajectory_close(TrajectoryWriter *writer);
+
+// Sequential decoder for trajectory files
+typedef struct {
+    FILE *file;
+    int components;
+    float precision[TRAJECTORY_MAX_COMPONENTS];
+
+    // The last decoded frame
+    float *values[TRAJECTORY_MAX_COMPONENTS];
+    int *ids;            // Particle ID of each column, from the last frame that listed them
+    int count;
+    long step;
+    double time;
+
+    int64_t *previous[TRAJECTORY_MAX_COMPONENTS];
+    int capacity;
+    unsigned char *buffer;
+    size_t buffer_capacity;
+    size_t block_length;     // Bytes of the block in buffer
+} TrajectoryReader;
+
+// Open a trajectory file and read its header. Returns 1 on success.
+int trajectory_reader_open(TrajectoryReader *reader, const char *path);
+
+// Decode the next frame into reader->values. Returns 0 at the end of the file or on error.
+int trajectory_reader_next(TrajectoryReader *reader);
+
+void trajectory_reader_close(TrajectoryReader *reader);
+
+#endif /* TRAJECTORY_H */
@@ -1,66 +1,53 @@
 /* src/main.c */
 #include <stdio.h>
-#include <stdlib.h>
-#include <time.h>
 
-#include "physics/particle.h"
-#include "physics/gravity.h"
-#include "physics/integration.h"
 #include "render/renderer.h"
+#include "sim/simulation.h"
 #include "utils/config.h"
 
 int main(int argc, char *argv[]) {
-    // Seed random number generator
-    srand(time(NULL));
-    
     // Initialize configuration
     SimConfig config;
     config_init(&config);
     
     // Parse command line arguments and/or configuration file
-    if (argc > 1) {
-        if (config_load_from_file(&config, argv[1])) {
-            printf("Loaded configuration from file: %s\n", argv[1]);
-        } else {
-            printf("Failed to load configuration file, using defaults\n");
-        }
+    if (!config_parse_args(&config, argc, argv)) {
+        return -1;
     }
     
-    // Create particles
-    Particle *particles = (Particle*)malloc(config.max_particles * sizeof(Particle));
-    if (!particles) {
-        fprintf(stderr, "Failed to allocate memory for particles\n");
-        return -1;
+    // Headless runs never touch GLFW or OpenGL
+    if (config.headless) {
+        return simulation_run_headless(&config) ? 0 : -1;
     }
     
-    // Initialize particles
-    create_initial_particles(&config, particles);
-    printf("Created %d particles\n", config.max_particles);
+    // Create particles and physics state
+    Simulation sim;
+    if (!simulation_init(&sim, &config)) {
+        return -1;
+    }
     
     // Initialize renderer
     Renderer renderer;
     if (!renderer_init(&renderer, &config)) {
         fprintf(stderr, "Failed to initialize renderer\n");
-        free(particles);
+        simulation_cleanup(&sim);
         return -1;
     }
     
-    printf("Starting simulation with:\n");
-    printf("- %d particles\n", config.max_particles);
-    printf("- Time step: %f\n", config.time_step);
-    printf("- Integration method: %d\n", config.integration_method);
-    
-    if (config.enable_central_body) {
-        printf("- Central body enabled with mass %e\n", config.central_body_mass);
-    }
+    simulation_print_summary(&sim);
     
     // Main loop
-    renderer_main_loop(&renderer, particles, config.max_particles, &config);
+    renderer_main_loop(&renderer, &sim);
+    
+    // The physics thread has stopped, so the state is consistent
+    if (config.checkpoint_path && simulation_write_checkpoint(&sim)) {
+        printf("Wrote checkpoint %s at step %ld\n", config.checkpoint_path, sim.step);
+    }
     
     // Cleanup
     renderer_cleanup(&renderer);
-    free(particles);
+    simulation_cleanup(&sim);
     
     printf("Simulation completed\n");
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,403 @@
+#include "boundary.h"
+#include "gravity.h"
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Table nodes start on cache lines
+#define BOUNDARY_ALIGNMENT 64
+
+// Ewald sums are cut where erfc(alpha r) and exp(-k² / 4 alpha²) fall below ~1e-13
+#define EWALD_CUTOFF 5.5
+
+void boundary_init(BoundaryBox *box) {
+    memset(box, 0, sizeof(*box));
+}
+
+void boundary_free(BoundaryBox *box) {
+    free(box->table);
+    memset(box, 0, sizeof(*box));
+}
+
+void boundary_ewald_exact(const BoundaryBox *box, const double d[3], double correction[3]) {
+    const double L[3] = {box->size.x, box->size.y, box->size.z};
+    const double alpha = box->alpha;
+    const double volume = L[0] * L[1] * L[2];
+    const double r_cut = EWALD_CUTOFF / alpha;
+    const double k_cut = 2.0 * EWALD_CUTOFF * alpha;
+    const double two_over_sqrt_pi = 2.0 / sqrt(M_PI);
+
+    correction[0] = correction[1] = correction[2] = 0.0;
+
+    // Real space: screened images; the nearest one only keeps the part the screening removes
+    int nmax[3];
+    for (int c = 0; c < 3; c++) nmax[c] = (int)ceil((r_cut + 0.5 * L[c]) / L[c]);
+    for (int nz = -nmax[2]; nz <= nmax[2]; nz++) {
+        for (int ny = -nmax[1]; ny <= nmax[1]; ny++) {
+            for (int nx = -nmax[0]; nx <= nmax[0]; nx++) {
+                double r[3] = {d[0] - nx * L[0], d[1] - ny * L[1], d[2] - nz * L[2]};
+                double r2 = r[0] * r[0] + r[1] * r[1] + r[2] * r[2];
+                if (r2 > r_cut * r_cut) continue;
+                double dist = sqrt(r2);
+                double gauss = two_over_sqrt_pi * alpha * dist * exp(-alpha * alpha * r2);
+                double factor;
+                if (nx == 0 && ny == 0 && nz == 0) {
+                    // erf(ar) - gauss, with its series limit 4 a³ r³ / (3 sqrt(pi)) near 0
+                    if (alpha * dist < 1e-4) {
+                        factor = 2.0 * two_over_sqrt_pi / 3.0 * alpha * alpha * alpha;
+                    } else {
+                        factor = (erf(alpha * dist) - gauss) / (r2 * dist);
+                    }
+                } else {
+                    factor = -(erfc(alpha * dist) + gauss) / (r2 * dist);
+                }
+                for (int c = 0; c < 3; c++) correction[c] += factor * r[c];
+            }
+        }
+    }
+
+    // Fourier space, without the k = 0 term (the background)
+    int hmax[3];
+    for (int c = 0; c < 3; c++) hmax[c] = (int)floor(k_cut * L[c] / (2.0 * M_PI));
+    for (int hz = -hmax[2]; hz <= hmax[2]; hz++) {
+        for (int hy = -hmax[1]; hy <= hmax[1]; hy++) {
+            for (int hx = -hmax[0]; hx <= hmax[0]; hx++) {
+                if (hx == 0 && hy == 0 && hz == 0) continue;
+                double k[3] = {2.0 * M_PI * hx / L[0], 2.0 * M_PI * hy / L[1], 2.0 * M_PI * hz / L[2]};
+                double k2 = k[0] * k[0] + k[1] * k[1] + k[2] * k[2];
+                if (k2 > k_cut * k_cut) continue;
+                double factor = -4.0 * M_PI / volume / k2 * exp(-k2 / (4.0 * alpha * alpha)) *
+                                sin(k[0] * d[0] + k[1] * d[1] + k[2] * d[2]);
+                for (int c = 0; c < 3; c++) correction[c] += factor * k[c];
+            }
+        }
+    }
+}
+
+// Tabulate the correction over the positive octant. Each node holds the correction and
+// its derivatives per node spacing along x, y and z (central differences of exact values
+// one node further out on every side), so a lookup is a first-order expansion about the
+// nearest node: one 64-byte node instead of the eight corners of a trilinear cell.
+static int build_ewald_table(BoundaryBox *box, int n) {
+    if (n < 2) {
+        fprintf(stderr, "Boundaries: the Ewald table needs at least 2 nodes per axis\n");
+        return 0;
+    }
+    const int m = n + 2;
+    size_t bytes = (size_t)n * n * n * BOUNDARY_NODE_FLOATS * sizeof(float);
+    box->table = aligned_alloc(BOUNDARY_ALIGNMENT, bytes);
+    double *exact = malloc((size_t)m * m * m * 3 * sizeof(double));
+    if (!box->table || !exact) {
+        fprintf(stderr, "Boundaries: failed to allocate %zu bytes of Ewald table\n", bytes);
+        free(exact);
+        return 0;
+    }
+    box->table_size = n;
+    box->table_scale = (Vec3){(n - 1) / box->half.x, (n - 1) / box->half.y, (n - 1) / box->half.z};
+
+    float smallest = box->size.x;
+    if (box->size.y < smallest) smallest = box->size.y;
+    if (box->size.z < smallest) smallest = box->size.z;
+    box->alpha = 2.0 / smallest;
+
+    // Exact values on nodes -1 .. n along each axis
+    const double h[3] = {box->half.x / (n - 1), box->half.y / (n - 1), box->half.z / (n - 1)};
+    #pragma omp parallel for schedule(dynamic, 1) collapse(2)
+    for (int k = 0; k < m; k++) {
+        for (int j = 0; j < m; j++) {
+            for (int i = 0; i < m; i++) {
+                double d[3] = {h[0] * (i - 1), h[1] * (j - 1), h[2] * (k - 1)};
+                boundary_ewald_exact(box, d, exact + 3 * (((size_t)k * m + j) * m + i));
+            }
+        }
+    }
+
+    const size_t step[3] = {3, 3 * (size_t)m, 3 * (size_t)m * m};
+    #pragma omp parallel for schedule(static) collapse(2)
+    for (int k = 0; k < n; k++) {
+        for (int j = 0; j < n; j++) {
+            for (int i = 0; i < n; i++) {
+                const double *e = exact + 3 * (((size_t)(k + 1) * m + (j + 1)) * m + (i + 1));
+                float *node = box->table + BOUNDARY_NODE_FLOATS * (((size_t)k * n + j) * n + i);
+                for (int c = 0; c < 3; c++) {
+                    node[c] = (float)e[c];
+                    for (int axis = 0; axis < 3; axis++) {
+                        node[4 * (axis + 1) + c] = (float)(0.5 * (e[step[axis] + c] - e[c - (ptrdiff_t)step[axis]]));
+                    }
+                }
+                node[3] = node[7] = node[11] = node[15] = 0.0f;
+            }
+        }
+    }
+    free(exact);
+    return 1;
+}
+
+int boundary_setup(BoundaryBox *box, const SimConfig *config) {
+    boundary_free(box);
+    int mode = config->enable_bounded_space;
+    if (mode == BOUNDARY_OPEN) return 1;
+    if (mode != BOUNDARY_PERIODIC && mode != BOUNDARY_REFLECTIVE) {
+        fprintf(stderr, "Boundaries: unknown enable_bounded_space %d\n", mode);
+        return 0;
+    }
+
+    Vec3 size = vec3_sub(config->space_max, config->space_min);
+    if (!(size.x > 0.0f && size.y > 0.0f && size.z > 0.0f)) {
+        fprintf(stderr, "Boundaries: space_max must lie above space_min\n");
+        return 0;
+    }
+    box->mode = mode;
+    box->min = config->space_min;
+    box->size = size;
+    box->half = vec3_mul(size, 0.5f);
+
+    if (mode == BOUNDARY_PERIODIC && config->periodic_ewald &&
+        !build_ewald_table(box, config->periodic_ewald_table)) {
+        boundary_free(box);
+        return 0;
+    }
+    return 1;
+}
+
+// Move a coordinate into [lo, lo + size)
+static inline float wrap(float x, float lo, float size) {
+    if (x < lo || x >= lo + size) {
+        x -= size * floorf((x - lo) / size);
+        // Rounding can land a value just below lo exactly on the top face
+        if (x >= lo + size) x = lo;
+    }
+    return x;
+}
+
+// Mirror a coordinate that has crossed a wall and turn its velocity inwards
+static inline int reflect(float *x, float *v, float lo, float hi) {
+    if (*x < lo) {
+        *x = 2.0f * lo - *x;
+        if (*x > hi) *x = hi;
+        *v = fabsf(*v);
+        return 1;
+    }
+    if (*x > hi) {
+        *x = 2.0f * hi - *x;
+        if (*x < lo) *x = lo;
+        *v = -fabsf(*v);
+        return 1;
+    }
+    return 0;
+}
+
+int boundary_apply(const BoundaryBox *box, ParticleSystem *ps) {
+    const float x0 = box->min.x, y0 = box->min.y, z0 = box->min.z;
+    const float sx = box->size.x, sy = box->size.y, sz = box->size.z;
+    int reflected = 0;
+
+    if (box->mode == BOUNDARY_PERIODIC) {
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < ps->count; i++) {
+            ps->x[i] = wrap(ps->x[i], x0, sx);
+            ps->y[i] = wrap(ps->y[i], y0, sy);
+            ps->z[i] = wrap(ps->z[i], z0, sz);
+        }
+    } else if (box->mode == BOUNDARY_REFLECTIVE) {
+        #pragma omp parallel for schedule(static) reduction(+:reflected)
+        for (int i = 0; i < ps->count; i++) {
+            int hit = reflect(&ps->x[i], &ps->vx[i], x0, x0 + sx);
+            hit |= reflect(&ps->y[i], &ps->vy[i], y0, y0 + sy);
+            hit |= reflect(&ps->z[i], &ps->vz[i], z0, z0 + sz);
+            reflected += hit;
+        }
+    }
+    return reflected;
+}
+
+// Shift a separation onto its nearest image; positions are wrapped once per step, so a
+// single period is always enough
+static inline float nearest_image(float d, float size, float half) {
+    if (d > half) return d - size;
+    if (d < -half) return d + size;
+    return d;
+}
+
+#ifdef __SSE2__
+
+// Sources handled per pass: the first pass sums the nearest images and prepares the table
+// lookups into stack arrays of this many entries, the second applies the corrections
+#define BOUNDARY_BLOCK 256
+
+// Periodic acceleration (without G) on a target at (xi, yi, zi) from all massive particles,
+// with the rsqrt estimate plus one Newton-Raphson step of the SSE direct-sum kernel. Runs
+// to the padded count; the padding has zero mass, so its lookups add nothing.
+static void periodic_target(const BoundaryBox *box, const ParticleSystem *ps,
+                            float xi, float yi, float zi, float acc[3]) {
+    const float *x = ps->x, *y = ps->y, *z = ps->z, *m = ps->mass;
+    const int count = (ps->massive_count + PARTICLE_PADDING - 1) / PARTICLE_PADDING * PARTICLE_PADDING;
+    const int n = box->table_size;
+
+    const __m128 eps = _mm_set1_ps(GRAVITY_SOFTENING);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 three_halves = _mm_set1_ps(1.5f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 size_x = _mm_set1_ps(box->size.x), size_y = _mm_set1_ps(box->size.y), size_z = _mm_set1_ps(box->size.z);
+    const __m128 half_x = _mm_set1_ps(box->half.x), half_y = _mm_set1_ps(box->half.y), half_z = _mm_set1_ps(box->half.z);
+    const __m128 scale_x = _mm_set1_ps(box->table_scale.x);
+    const __m128 scale_y = _mm_set1_ps(box->table_scale.y);
+    const __m128 scale_z = _mm_set1_ps(box->table_scale.z);
+    const __m128 top = _mm_set1_ps((float)n - 0.5f);
+    const __m128 row = _mm_set1_ps((float)n);
+    const __m128 vxi = _mm_set1_ps(xi), vyi = _mm_set1_ps(yi), vzi = _mm_set1_ps(zi);
+
+    __m128 acc_x = _mm_setzero_ps(), acc_y = _mm_setzero_ps(), acc_z = _mm_setzero_ps();
+    __m128 correction = _mm_setzero_ps();
+
+    int node[BOUNDARY_BLOCK];
+    _Alignas(16) float offset[3][BOUNDARY_BLOCK];
+    _Alignas(16) float weight[BOUNDARY_BLOCK][4];
+
+    // d - size where d > half, d + size where d < -half
+#define NEAREST(d, size, half) \
+    _mm_sub_ps((d), _mm_or_ps(_mm_and_ps(_mm_cmpgt_ps((d), (half)), (size)), \
+                              _mm_and_ps(_mm_cmplt_ps((d), _mm_xor_ps((half), sign)), _mm_xor_ps((size), sign))))
+    // Nearest node index (clamped to the table, NaN included) and the offset from it
+#define TABLE_AXIS(d, scale, index, fraction) do { \
+        __m128 u_ = _mm_mul_ps(_mm_andnot_ps(sign, (d)), (scale)); \
+        (index) = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(u_, half), top))); \
+        (fraction) = _mm_sub_ps(u_, (index)); \
+    } while (0)
+
+    for (int j_begin = 0; j_begin < count; j_begin += BOUNDARY_BLOCK) {
+        int j_end = j_begin + BOUNDARY_BLOCK < count ? j_begin + BOUNDARY_BLOCK : count;
+
+        for (int j = j_begin; j < j_end; j += 4) {
+            __m128 dx = NEAREST(_mm_sub_ps(_mm_load_ps(x + j), vxi), size_x, half_x);
+            __m128 dy = NEAREST(_mm_sub_ps(_mm_load_ps(y + j), vyi), size_y, half_y);
+            __m128 dz = NEAREST(_mm_sub_ps(_mm_load_ps(z + j), vzi), size_z, half_z);
+            __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                   _mm_add_ps(_mm_mul_ps(dz, dz), eps));
+            __m128 inv = _mm_rsqrt_ps(r2);
+            inv = _mm_mul_ps(inv, _mm_sub_ps(three_halves, _mm_mul_ps(_mm_mul_ps(half, r2), _mm_mul_ps(inv, inv))));
+            __m128 mass = _mm_load_ps(m + j);
+            __m128 s = _mm_mul_ps(mass, _mm_mul_ps(inv, _mm_mul_ps(inv, inv)));
+            acc_x = _mm_add_ps(acc_x, _mm_mul_ps(dx, s));
+            acc_y = _mm_add_ps(acc_y, _mm_mul_ps(dy, s));
+            acc_z = _mm_add_ps(acc_z, _mm_mul_ps(dz, s));
+
+            if (!box->table) continue;
+            __m128 ix, iy, iz, fx, fy, fz;
+            TABLE_AXIS(dx, scale_x, ix, fx);
+            TABLE_AXIS(dy, scale_y, iy, fy);
+            TABLE_AXIS(dz, scale_z, iz, fz);
+            // Exact in float for tables of up to 2^24 nodes
+            __m128i index = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(iz, row), iy), row), ix));
+            _mm_storeu_si128((__m128i *)(node + j - j_begin), index);
+            _mm_store_ps(offset[0] + j - j_begin, fx);
+            _mm_store_ps(offset[1] + j - j_begin, fy);
+            _mm_store_ps(offset[2] + j - j_begin, fz);
+
+            // The table holds the correction at x_i - x_j = -d, i.e. -c(d), and c is odd along
+            // each axis: weight each component by -m_j with the sign of d on that axis
+            __m128 neg_mass = _mm_xor_ps(mass, sign);
+            __m128 wx = _mm_xor_ps(neg_mass, _mm_and_ps(dx, sign));
+            __m128 wy = _mm_xor_ps(neg_mass, _mm_and_ps(dy, sign));
+            __m128 wz = _mm_xor_ps(neg_mass, _mm_and_ps(dz, sign));
+            __m128 wpad = _mm_setzero_ps();
+            _MM_TRANSPOSE4_PS(wx, wy, wz, wpad);
+            _mm_store_ps(weight[j - j_begin], wx);
+            _mm_store_ps(weight[j - j_begin + 1], wy);
+            _mm_store_ps(weight[j - j_begin + 2], wz);
+            _mm_store_ps(weight[j - j_begin + 3], wpad);
+        }
+
+        // Further images: one 64-byte node per source, expanded about the nearest node
+        if (!box->table) continue;
+        for (int k = 0; k < j_end - j_begin; k++) {
+            const float *p = box->table + (size_t)BOUNDARY_NODE_FLOATS * node[k];
+            __m128 c = _mm_load_ps(p);
+            c = _mm_add_ps(c, _mm_mul_ps(_mm_load1_ps(offset[0] + k), _mm_load_ps(p + 4)));
+            c = _mm_add_ps(c, _mm_mul_ps(_mm_load1_ps(offset[1] + k), _mm_load_ps(p + 8)));
+            c = _mm_add_ps(c, _mm_mul_ps(_mm_load1_ps(offset[2] + k), _mm_load_ps(p + 12)));
+            correction = _mm_add_ps(correction, _mm_mul_ps(_mm_load_ps(weight[k]), c));
+        }
+    }
+#undef NEAREST
+#undef TABLE_AXIS
+
+    float lanes[3][4], corr[4];
+    _mm_storeu_ps(lanes[0], acc_x);
+    _mm_storeu_ps(lanes[1], acc_y);
+    _mm_storeu_ps(lanes[2], acc_z);
+    _mm_storeu_ps(corr, correction);
+    for (int c = 0; c < 3; c++) {
+        acc[c] = (lanes[c][0] + lanes[c][1]) + (lanes[c][2] + lanes[c][3]) + corr[c];
+    }
+}
+
+#else
+
+// Nearest node to a separation along one axis and the offset from it in node spacings
+static inline int table_node(float d, float scale, int top, float *offset) {
+    float u = fabsf(d) * scale;
+    int i = (int)(u + 0.5f);
+    if (i > top) i = top;
+    *offset = u - (float)i;
+    return i;
+}
+
+// Periodic acceleration (without G) on a target at (xi, yi, zi) from all massive particles
+static void periodic_target(const BoundaryBox *box, const ParticleSystem *ps,
+                            float xi, float yi, float zi, float acc[3]) {
+    const int n = box->table_size;
+    acc[0] = acc[1] = acc[2] = 0.0f;
+
+    for (int j = 0; j < ps->massive_count; j++) {
+        float d[3] = {
+            nearest_image(ps->x[j] - xi, box->size.x, box->half.x),
+            nearest_image(ps->y[j] - yi, box->size.y, box->half.y),
+            nearest_image(ps->z[j] - zi, box->size.z, box->half.z)
+        };
+        float dist_sq = d[0] * d[0] + d[1] * d[1] + d[2] * d[2] + GRAVITY_SOFTENING;
+        float inv_dist = 1.0f / sqrtf(dist_sq);
+        float s = ps->mass[j] * inv_dist * inv_dist * inv_dist;
+        for (int c = 0; c < 3; c++) acc[c] += s * d[c];
+
+        if (!box->table) continue;
+        float f[3];
+        int i = table_node(d[0], box->table_scale.x, n - 1, &f[0]);
+        int jj = table_node(d[1], box->table_scale.y, n - 1, &f[1]);
+        int k = table_node(d[2], box->table_scale.z, n - 1, &f[2]);
+        const float *p = box->table + BOUNDARY_NODE_FLOATS * (((size_t)k * n + jj) * n + i);
+        for (int c = 0; c < 3; c++) {
+            float value = p[c] + f[0] * p[4 + c] + f[1] * p[8 + c] + f[2] * p[12 + c];
+            // -c(d), odd along each axis
+            acc[c] -= ps->mass[j] * (d[c] < 0.0f ? -value : value);
+        }
+    }
+}
+
+#endif
+
+long long boundary_periodic_forces(const BoundaryBox *box, ParticleSystem *ps, const int *active, int count) {
+    // Each target only writes its own acceleration. The self term needs no test: a zero
+    // separation contributes neither a softened force nor a correction.
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int k = 0; k < count; k++) {
+        int i = active ? active[k] : k;
+        float acc[3];
+        periodic_target(box, ps, ps->x[i], ps->y[i], ps->z[i], acc);
+        ps->ax[i] += G * acc[0];
+        ps->ay[i] += G * acc[1];
+        ps->az[i] += G * acc[2];
+    }
+
+    return (long long)count * (ps->massive_count - 1);
+}
@@ -0,0 +1,66 @@
+#ifndef BOUNDARY_H
+#define BOUNDARY_H
+
+#include "particle.h"
+#include "../utils/config.h"
+
+// Box boundaries on space_min / space_max, selected by enable_bounded_space:
+//
+//   BOUNDARY_PERIODIC    Positions wrap around the box and every pair interacts through
+//                        its nearest image. With periodic_ewald the force also includes
+//                        all further images (Ewald summation against a uniform
+//                        neutralising background), read from a table of the correction
+//                        to the nearest-image force.
+//   BOUNDARY_REFLECTIVE  Particles bounce elastically off the walls; forces stay those of
+//                        open space.
+//
+// Periodic forces are always summed directly, whatever force_method says. Collision
+// detection does not look across the periodic faces.
+//
+// The correction is odd along each axis, so the table only covers the octant
+// [0, size / 2] with periodic_ewald_table nodes per axis; it is stored per unit G * m.
+// Every node holds the correction and its gradient, one cache line, and a lookup expands
+// about the nearest node.
+
+#define BOUNDARY_OPEN       0 // enable_bounded_space: no walls
+#define BOUNDARY_PERIODIC   1
+#define BOUNDARY_REFLECTIVE 2
+
+// Floats per Ewald table node: correction, then its derivative along x, y and z, each
+// zero padded to four
+#define BOUNDARY_NODE_FLOATS 16
+
+typedef struct {
+    int mode;           // BOUNDARY_*
+    Vec3 min;           // Box corner (space_min)
+    Vec3 size;          // space_max - space_min
+    Vec3 half;          // size / 2, the largest nearest-image separation per axis
+
+    int table_size;     // Ewald nodes per axis, 0: nearest image only
+    Vec3 table_scale;   // Nodes per unit separation along each axis
+    float *table;       // table_size^3 nodes of BOUNDARY_NODE_FLOATS, 64-byte aligned
+    double alpha;       // Ewald splitting parameter the table was summed with
+} BoundaryBox;
+
+void boundary_init(BoundaryBox *box);
+void boundary_free(BoundaryBox *box);
+
+// Set up the boundaries of config->enable_bounded_space, building the Ewald table for a
+// periodic box with periodic_ewald. Returns 0 (with a message) for an empty box or a
+// failed allocation; the box is then left open.
+int boundary_setup(BoundaryBox *box, const SimConfig *config);
+
+// Exact Ewald correction at separation d, by direct summation in double precision: the
+// acceleration (G = 1) from a unit mass at the origin, all its periodic images and the
+// neutralising background, minus the nearest-image term -d / |d|^3
+void boundary_ewald_exact(const BoundaryBox *box, const double d[3], double correction[3]);
+
+// Wrap positions back into a periodic box or reflect particles off the walls. Returns the
+// number of particles whose velocity was reflected (wrapping leaves forces unchanged).
+int boundary_apply(const BoundaryBox *box, ParticleSystem *ps);
+
+// Periodic direct summation over the massive particles for the listed targets (all of
+// them when active is NULL), added to their accelerations. Returns the interactions.
+long long boundary_periodic_forces(const BoundaryBox *box, ParticleSystem *ps, const int *active, int count);
+
+#endif /* BOUNDARY_H */
@@ -0,0 +1,345 @@
+#include "collision.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bucket value of particles that are not in the hash grid
+#define COLLISION_NOT_IN_GRID UINT32_MAX
+
+// Bucket value of particles absorbed by a merge this step
+#define COLLISION_MERGED (UINT32_MAX - 1)
+
+// Cell coordinates are clamped so particles that fly off never overflow an int
+#define COLLISION_COORD_LIMIT 1.0e9f
+
+#define COLLISION_INITIAL_PAIRS 1024
+
+void collision_grid_init(CollisionGrid *grid) {
+    memset(grid, 0, sizeof(*grid));
+}
+
+void collision_grid_free(CollisionGrid *grid) {
+    arena_free(&grid->arena);
+    memset(grid, 0, sizeof(*grid));
+}
+
+// Allocate this step's arrays, with a table of at least twice the particle count
+static int reserve_grid(CollisionGrid *grid, int count) {
+    int table_size = 64;
+    while (table_size < 2 * count) table_size *= 2;
+    if (grid->pair_capacity < COLLISION_INITIAL_PAIRS) grid->pair_capacity = COLLISION_INITIAL_PAIRS;
+
+    Arena *arena = &grid->arena;
+    arena_reset(arena);
+    grid->cell_start = arena_alloc(arena, ((size_t)table_size + 1) * sizeof(int));
+    grid->sorted = arena_alloc(arena, (size_t)count * sizeof(int));
+    grid->packed = arena_alloc(arena, (size_t)count * 4 * sizeof(float));
+    grid->bucket = arena_alloc(arena, (size_t)count * sizeof(uint32_t));
+    grid->large = arena_alloc(arena, (size_t)count * sizeof(int));
+    grid->pairs = arena_alloc(arena, 2 * (size_t)grid->pair_capacity * sizeof(int));
+    if (!grid->cell_start || !grid->sorted || !grid->packed || !grid->bucket || !grid->large || !grid->pairs) {
+        fprintf(stderr, "Failed to allocate the collision grid\n");
+        return 0;
+    }
+
+    grid->table_size = table_size;
+    return 1;
+}
+
+static int cell_coord(float v, float inv_cell) {
+    float c = floorf(v * inv_cell);
+    if (c > COLLISION_COORD_LIMIT) c = COLLISION_COORD_LIMIT;
+    if (c < -COLLISION_COORD_LIMIT) c = -COLLISION_COORD_LIMIT;
+    return (int)c;
+}
+
+static uint32_t hash_cell(int ix, int iy, int iz, uint32_t mask) {
+    return (((uint32_t)ix * 73856093u) ^ ((uint32_t)iy * 19349663u) ^ ((uint32_t)iz * 83492791u)) & mask;
+}
+
+// Hash every particle and counting-sort the grid particles into buckets
+static void build_grid(CollisionGrid *grid, const ParticleSystem *ps, float inv_cell, float max_radius) {
+    const uint32_t mask = (uint32_t)grid->table_size - 1;
+    const int count = ps->massive_count;
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < count; i++) {
+        if (ps->radius[i] > max_radius) {
+            grid->bucket[i] = COLLISION_NOT_IN_GRID;
+        } else {
+            grid->bucket[i] = hash_cell(cell_coord(ps->x[i], inv_cell), cell_coord(ps->y[i], inv_cell),
+                                        cell_coord(ps->z[i], inv_cell), mask);
+        }
+    }
+
+    // Count, exclusive prefix sum, scatter (which leaves each entry at the end of its
+    // bucket), then shift back so cell_start[b] .. cell_start[b + 1] spans bucket b
+    int *start = grid->cell_start;
+    memset(start, 0, ((size_t)grid->table_size + 1) * sizeof(int));
+    grid->large_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (grid->bucket[i] == COLLISION_NOT_IN_GRID) grid->large[grid->large_count++] = i;
+        else start[grid->bucket[i]]++;
+    }
+    int sum = 0;
+    for (int b = 0; b < grid->table_size; b++) {
+        int n = start[b];
+        start[b] = sum;
+        sum += n;
+    }
+    for (int i = 0; i < count; i++) {
+        if (grid->bucket[i] != COLLISION_NOT_IN_GRID) grid->sorted[start[grid->bucket[i]]++] = i;
+    }
+    for (int b = grid->table_size; b > 0; b--) start[b] = start[b - 1];
+    start[0] = 0;
+
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < count - grid->large_count; k++) {
+        int i = grid->sorted[k];
+        float *p = grid->packed + 4 * (size_t)k;
+        p[0] = ps->x[i];
+        p[1] = ps->y[i];
+        p[2] = ps->z[i];
+        p[3] = ps->radius[i];
+    }
+}
+
+static int overlaps(const ParticleSystem *ps, int i, int j) {
+    float dx = ps->x[j] - ps->x[i];
+    float dy = ps->y[j] - ps->y[i];
+    float dz = ps->z[j] - ps->z[i];
+    float reach = ps->radius[i] + ps->radius[j];
+    return dx * dx + dy * dy + dz * dz < reach * reach;
+}
+
+// Store a pair if there is room; the returned total tells the caller whether to grow and retry
+static void add_pair(CollisionGrid *grid, int *found, int i, int j) {
+    int slot;
+    #pragma omp atomic capture
+    slot = (*found)++;
+    if (slot < grid->pair_capacity) {
+        grid->pairs[2 * slot] = i < j ? i : j;
+        grid->pairs[2 * slot + 1] = i < j ? j : i;
+    }
+}
+
+// Collect every overlapping pair; returns the number found. A pair can be reported twice
+// when two of the 27 neighbour cells hash to the same bucket, which is rare enough that
+// the duplicates are dropped after sorting instead of checked for here.
+static int detect_pairs(CollisionGrid *grid, const ParticleSystem *ps, float inv_cell) {
+    const uint32_t mask = (uint32_t)grid->table_size - 1;
+    const int count = ps->massive_count;
+    const int grid_count = count - grid->large_count;
+    int found = 0;
+    long long tested = 0;
+
+    // Walking the particles in bucket order keeps neighbouring lookups in cache
+    #pragma omp parallel for schedule(dynamic, 256) reduction(+:tested)
+    for (int k = 0; k < grid_count; k++) {
+        int i = grid->sorted[k];
+        const float *pi = grid->packed + 4 * (size_t)k;
+        int ix = cell_coord(pi[0], inv_cell);
+        int iy = cell_coord(pi[1], inv_cell);
+        int iz = cell_coord(pi[2], inv_cell);
+
+        for (int dz = -1; dz <= 1; dz++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    uint32_t b = hash_cell(ix + dx, iy + dy, iz + dz, mask);
+                    for (int m = grid->cell_start[b]; m < grid->cell_start[b + 1]; m++) {
+                        // Branch-free test; only the rare hit branches
+                        int j = grid->sorted[m];
+                        const float *pj = grid->packed + 4 * (size_t)m;
+                        float sx = pj[0] - pi[0];
+                        float sy = pj[1] - pi[1];
+                        float sz = pj[2] - pi[2];
+                        float reach = pi[3] + pj[3];
+                        int hit = (j > i) & (sx * sx + sy * sy + sz * sz < reach * reach);
+                        tested += j > i;
+                        if (hit) add_pair(grid, &found, i, j);
+                    }
+                }
+            }
+        }
+    }
+
+    // Particles too big for the grid are tested against everything (pairs of them once)
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+:tested)
+    for (int l = 0; l < grid->large_count; l++) {
+        int i = grid->large[l];
+        for (int j = 0; j < count; j++) {
+            if (j == i || (grid->bucket[j] == COLLISION_NOT_IN_GRID && j < i)) continue;
+            tested++;
+            if (overlaps(ps, i, j)) add_pair(grid, &found, i, j);
+        }
+    }
+
+    grid->tested = tested;
+    return found;
+}
+
+static int compare_pairs(const void *a, const void *b) {
+    const int *pa = a, *pb = b;
+    if (pa[0] != pb[0]) return pa[0] < pb[0] ? -1 : 1;
+    return (pa[1] > pb[1]) - (pa[1] < pb[1]);
+}
+
+// Separate the pair along the contact normal and apply a restitution impulse if approaching
+static int bounce(ParticleSystem *ps, int i, int j, float restitution) {
+    float dx = ps->x[j] - ps->x[i];
+    float dy = ps->y[j] - ps->y[i];
+    float dz = ps->z[j] - ps->z[i];
+    float dist = sqrtf(dx * dx + dy * dy + dz * dz);
+    float overlap = ps->radius[i] + ps->radius[j] - dist;
+    if (overlap <= 0.0f) return 0; // Already pushed apart by an earlier contact
+
+    float nx = 1.0f, ny = 0.0f, nz = 0.0f;
+    if (dist > 0.0f) {
+        nx = dx / dist;
+        ny = dy / dist;
+        nz = dz / dist;
+    }
+
+    float inv_i = 1.0f / ps->mass[i];
+    float inv_j = 1.0f / ps->mass[j];
+    float inv_sum = inv_i + inv_j;
+
+    // Positional correction, shared in proportion to inverse mass
+    float push_i = overlap * inv_i / inv_sum;
+    float push_j = overlap * inv_j / inv_sum;
+    ps->x[i] -= nx * push_i;
+    ps->y[i] -= ny * push_i;
+    ps->z[i] -= nz * push_i;
+    ps->x[j] += nx * push_j;
+    ps->y[j] += ny * push_j;
+    ps->z[j] += nz * push_j;
+
+    float approach = (ps->vx[j] - ps->vx[i]) * nx + (ps->vy[j] - ps->vy[i]) * ny + (ps->vz[j] - ps->vz[i]) * nz;
+    if (approach < 0.0f) {
+        float impulse = -(1.0f + restitution) * approach / inv_sum;
+        ps->vx[i] -= nx * impulse * inv_i;
+        ps->vy[i] -= ny * impulse * inv_i;
+        ps->vz[i] -= nz * impulse * inv_i;
+        ps->vx[j] += nx * impulse * inv_j;
+        ps->vy[j] += ny * impulse * inv_j;
+        ps->vz[j] += nz * impulse * inv_j;
+    }
+    return 1;
+}
+
+// Absorb j into i, conserving mass, momentum and volume. The result keeps the lower ID,
+// so it does not depend on which slots the pair happened to occupy.
+static void merge(ParticleSystem *ps, int i, int j) {
+    float mi = ps->mass[i], mj = ps->mass[j];
+    float m = mi + mj;
+    float wi = mi / m, wj = mj / m;
+
+    ps->x[i] = wi * ps->x[i] + wj * ps->x[j];
+    ps->y[i] = wi * ps->y[i] + wj * ps->y[j];
+    ps->z[i] = wi * ps->z[i] + wj * ps->z[j];
+    ps->vx[i] = wi * ps->vx[i] + wj * ps->vx[j];
+    ps->vy[i] = wi * ps->vy[i] + wj * ps->vy[j];
+    ps->vz[i] = wi * ps->vz[i] + wj * ps->vz[j];
+    ps->ax[i] = wi * ps->ax[i] + wj * ps->ax[j];
+    ps->ay[i] = wi * ps->ay[i] + wj * ps->ay[j];
+    ps->az[i] = wi * ps->az[i] + wj * ps->az[j];
+    ps->color[i] = vec3_add(vec3_mul(ps->color[i], wi), vec3_mul(ps->color[j], wj));
+
+    float ri = ps->radius[i], rj = ps->radius[j];
+    ps->radius[i] = cbrtf(ri * ri * ri + rj * rj * rj);
+    ps->mass[i] = m;
+    if (ps->id[j] < ps->id[i]) ps->id[i] = ps->id[j];
+}
+
+// Remove merged particles, keeping the survivors in order, the tracers behind them and the
+// padding at zero mass
+static void compact(CollisionGrid *grid, ParticleSystem *ps) {
+    int kept = 0;
+    int massive_kept = 0;
+    for (int i = 0; i < ps->count; i++) {
+        if (i < ps->massive_count && grid->bucket[i] == COLLISION_MERGED) continue;
+        if (kept != i) {
+            ps->x[kept] = ps->x[i];
+            ps->y[kept] = ps->y[i];
+            ps->z[kept] = ps->z[i];
+            ps->vx[kept] = ps->vx[i];
+            ps->vy[kept] = ps->vy[i];
+            ps->vz[kept] = ps->vz[i];
+            ps->ax[kept] = ps->ax[i];
+            ps->ay[kept] = ps->ay[i];
+            ps->az[kept] = ps->az[i];
+            ps->mass[kept] = ps->mass[i];
+            ps->radius[kept] = ps->radius[i];
+            ps->color[kept] = ps->color[i];
+            ps->id[kept] = ps->id[i];
+        }
+        kept++;
+        if (i < ps->massive_count) massive_kept = kept;
+    }
+
+    for (int i = kept; i < ps->count; i++) {
+        Particle empty;
+        memset(&empty, 0, sizeof(empty));
+        particle_system_set(ps, i, &empty);
+    }
+    ps->count = kept;
+    ps->massive_count = massive_kept;
+}
+
+int collision_step(CollisionGrid *grid, ParticleSystem *ps, const SimConfig *config) {
+    grid->tested = 0;
+    grid->collisions = 0;
+    float max_radius = config->particle_max_radius;
+    if (ps->massive_count < 2 || max_radius <= 0.0f || !reserve_grid(grid, ps->massive_count)) return 0;
+
+    float inv_cell = 0.5f / max_radius;
+    build_grid(grid, ps, inv_cell, max_radius);
+
+    int found = detect_pairs(grid, ps, inv_cell);
+    if (found > grid->pair_capacity) {
+        int *pairs = arena_alloc(&grid->arena, 2 * (size_t)found * sizeof(int));
+        if (!pairs) {
+            fprintf(stderr, "Failed to grow the collision pair list\n");
+            return 0;
+        }
+        grid->pairs = pairs;
+        grid->pair_capacity = found;
+        found = detect_pairs(grid, ps, inv_cell);
+    }
+    if (found == 0) return 0;
+
+    // Pairs arrive in thread order; sorting makes the response independent of it
+    qsort(grid->pairs, (size_t)found, 2 * sizeof(int), compare_pairs);
+    int unique = 0;
+    for (int p = 0; p < found; p++) {
+        if (unique > 0 && grid->pairs[2 * p] == grid->pairs[2 * unique - 2] &&
+            grid->pairs[2 * p + 1] == grid->pairs[2 * unique - 1]) continue;
+        grid->pairs[2 * unique] = grid->pairs[2 * p];
+        grid->pairs[2 * unique + 1] = grid->pairs[2 * p + 1];
+        unique++;
+    }
+    found = unique;
+
+    int resolved = 0;
+    for (int p = 0; p < found; p++) {
+        int i = grid->pairs[2 * p];
+        int j = grid->pairs[2 * p + 1];
+        if (config->collision_mode == 1) {
+            if (grid->bucket[i] == COLLISION_MERGED || grid->bucket[j] == COLLISION_MERGED) continue;
+            if (!overlaps(ps, i, j)) continue; // i may have moved in an earlier merge
+            merge(ps, i, j);
+            grid->bucket[j] = COLLISION_MERGED;
+            resolved++;
+        } else {
+            resolved += bounce(ps, i, j, config->collision_damping);
+        }
+    }
+
+    if (config->collision_mode == 1 && resolved > 0) {
+        compact(grid, ps);
+    }
+
+    grid->collisions = resolved;
+    return resolved;
+}
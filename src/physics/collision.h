@@ -0,0 +1,41 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <stdint.h>
+#include "particle.h"
+#include "../utils/arena.h"
+#include "../utils/config.h"
+
+// Spatial hash for overlap detection. Cells are 2 * particle_max_radius wide, so two
+// overlapping particles of up to that radius always sit in neighbouring cells. The hash
+// table is rebuilt every step with a counting sort; particles that have outgrown the cell
+// (central body, merge products) are tested against everything instead. Massless tracers
+// pass through everything and are not hashed.
+typedef struct {
+    // Per-step arrays, carved out of arena at the start of every collision_step
+    Arena arena;
+    int *cell_start;      // table_size + 1 offsets into sorted, per hash bucket
+    int *sorted;          // Grid particle indices ordered by bucket
+    float *packed;        // x, y, z, radius of each sorted particle, so a bucket scan reads contiguous memory
+    uint32_t *bucket;     // Bucket of each particle (UINT32_MAX: not in the grid)
+    int *large;           // Particles too big for the grid
+    int large_count;
+    int table_size;       // Buckets (power of two)
+
+    int *pairs;           // Overlapping pairs (i, j) with i < j, two ints each
+    int pair_capacity;    // Pairs the list holds; kept across steps as a size hint
+
+    long long tested;     // Candidate pairs tested by the last step
+    int collisions;       // Collisions resolved by the last step
+} CollisionGrid;
+
+void collision_grid_init(CollisionGrid *grid);
+void collision_grid_free(CollisionGrid *grid);
+
+// Find overlapping pairs and resolve them with config->collision_mode: damped bounces
+// with restitution collision_damping, or merges that conserve mass and momentum (merged
+// particles are removed, so ps->count may shrink). Returns the number of collisions
+// resolved; positions or velocities only change when it is nonzero.
+int collision_step(CollisionGrid *grid, ParticleSystem *ps, const SimConfig *config);
+
+#endif /* COLLISION_H */
@@ -0,0 +1,64 @@
+#ifndef EXTERNAL_H
+#define EXTERNAL_H
+
+#include "particle.h"
+#include "../utils/config.h"
+
+// Static external potential (galaxy, halo) felt by every particle. The acceleration is
+// tabulated once on a regular grid of nodes reaching external_extent from external_center
+// along each axis, then interpolated linearly between the nodes for every force
+// evaluation, so the per-particle cost does not depend on how expensive the profiles
+// are. Two grid geometries:
+//
+//   EXTERNAL_CARTESIAN     n^3 nodes over the cube [-extent, extent]^3, trilinear
+//   EXTERNAL_AXISYMMETRIC  n nodes in cylindrical R over [0, extent] and 2n - 1 in z over
+//                          [-extent, extent], bilinear, with (a_R, a_z) turned back into
+//                          x and y components
+//
+// Beyond the grid the field continues as a point mass matching the mean radial pull on
+// the grid's boundary.
+//
+// The table comes from the analytic profiles in SimConfig (Hernquist bulge,
+// Miyamoto-Nagai disc, NFW halo, summed) or from a text file:
+//
+//   cartesian <n> <extent>         or    axisymmetric <n> <extent>
+//   <ax> <ay> <az>                       <aR> <az>
+//   ...  (n^3 lines, x fastest)          ...  (n * (2n - 1) lines, R fastest)
+//
+// with '#' comment lines allowed anywhere.
+
+#define EXTERNAL_NONE     0 // external_potential: no field
+#define EXTERNAL_PROFILES 1 // Tabulate the analytic profiles
+#define EXTERNAL_TABLE    2 // Load external_table_path
+
+#define EXTERNAL_CARTESIAN    0
+#define EXTERNAL_AXISYMMETRIC 1
+
+typedef struct {
+    int geometry;     // EXTERNAL_CARTESIAN or EXTERNAL_AXISYMMETRIC
+    int nx, ny, nz;   // Nodes per axis; the axisymmetric grid uses nx for R and nz for z (ny = 1)
+    Vec3 center;
+    float extent;
+    float spacing;    // Distance between neighbouring nodes
+    float edge_gm;    // G * M of the point mass used outside the grid
+    float *nodes;     // 4 floats per node (acceleration components, zero padded), 16-byte aligned
+} ExternalField;
+
+void external_field_init(ExternalField *field);
+void external_field_free(ExternalField *field);
+
+// Build the table selected by config->external_potential. Returns 0 (with a message) if
+// the table cannot be allocated or loaded; the field is then left empty.
+int external_field_build(ExternalField *field, const SimConfig *config);
+
+// Read a table in the format above, centred on center. Returns 0 on failure.
+int external_field_load(ExternalField *field, const char *path, Vec3 center);
+
+// Exact acceleration of the configured profiles at a position, in double precision
+void external_profile_acceleration(const SimConfig *config, const double position[3], double acc[3]);
+
+// Add the interpolated acceleration to the listed particles (all of them when active is
+// NULL). Does nothing for an empty field.
+void external_field_apply(const ExternalField *field, ParticleSystem *ps, const int *active, int count);
+
+#endif /* EXTERNAL_H */
@@ -0,0 +1,98 @@
+#include "fft.h"
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+int fft_plan_init(FFTPlan *plan, int n) {
+    plan->n = 0;
+    plan->twiddle = NULL;
+    plan->bitrev = NULL;
+    if (n < 2 || (n & (n - 1)) != 0) return 0;
+
+    plan->twiddle = malloc((size_t)n * sizeof(float));
+    plan->bitrev = malloc((size_t)n * sizeof(int));
+    if (!plan->twiddle || !plan->bitrev) {
+        fft_plan_free(plan);
+        return 0;
+    }
+
+    // Twiddles in double so long transforms do not accumulate rounding from a recurrence
+    for (int k = 0; k < n / 2; k++) {
+        double angle = -2.0 * M_PI * k / n;
+        plan->twiddle[2 * k] = (float)cos(angle);
+        plan->twiddle[2 * k + 1] = (float)sin(angle);
+    }
+
+    int bits = 0;
+    while ((1 << bits) < n) bits++;
+    for (int i = 0; i < n; i++) {
+        int r = 0;
+        for (int b = 0; b < bits; b++) {
+            if (i & (1 << b)) r |= 1 << (bits - 1 - b);
+        }
+        plan->bitrev[i] = r;
+    }
+
+    plan->n = n;
+    return 1;
+}
+
+void fft_plan_free(FFTPlan *plan) {
+    free(plan->twiddle);
+    free(plan->bitrev);
+    plan->twiddle = NULL;
+    plan->bitrev = NULL;
+    plan->n = 0;
+}
+
+static void swap_rows(float *data, int a, int b) {
+    float *ra = data + (size_t)a * FFT_LINES;
+    float *rb = data + (size_t)b * FFT_LINES;
+    for (int l = 0; l < FFT_LINES; l++) {
+        float t = ra[l];
+        ra[l] = rb[l];
+        rb[l] = t;
+    }
+}
+
+void fft_transform_lines(const FFTPlan *plan, float *re, float *im, int inverse) {
+    const int n = plan->n;
+
+    for (int i = 0; i < n; i++) {
+        int j = plan->bitrev[i];
+        if (j > i) {
+            swap_rows(re, i, j);
+            swap_rows(im, i, j);
+        }
+    }
+
+    // Iterative Cooley-Tukey butterflies; the inverse conjugates the twiddles
+    const float sign = inverse ? -1.0f : 1.0f;
+    for (int size = 2; size <= n; size *= 2) {
+        int half = size / 2;
+        int step = n / size;
+        for (int start = 0; start < n; start += size) {
+            for (int k = 0; k < half; k++) {
+                float wr = plan->twiddle[2 * k * step];
+                float wi = sign * plan->twiddle[2 * k * step + 1];
+                float *ar = re + (size_t)(start + k) * FFT_LINES;
+                float *ai = im + (size_t)(start + k) * FFT_LINES;
+                float *br = re + (size_t)(start + k + half) * FFT_LINES;
+                float *bi = im + (size_t)(start + k + half) * FFT_LINES;
+                #pragma omp simd
+                for (int l = 0; l < FFT_LINES; l++) {
+                    float tr = br[l] * wr - bi[l] * wi;
+                    float ti = br[l] * wi + bi[l] * wr;
+                    br[l] = ar[l] - tr;
+                    bi[l] = ai[l] - ti;
+                    ar[l] += tr;
+                    ai[l] += ti;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef FFT_H
+#define FFT_H
+
+// Lines transformed together by fft_transform_lines. Every butterfly is applied to all
+// of them at once, so the inner loop is a fixed-length vector loop.
+#define FFT_LINES 8
+
+// Radix-2 complex FFT. Twiddles and the bit-reversal permutation are computed once per
+// length, so a plan can be shared by many threads.
+typedef struct {
+    int n;            // Transform length (power of two)
+    float *twiddle;   // exp(-2 pi i k / n) for k < n / 2, interleaved (re, im)
+    int *bitrev;      // Bit-reversal permutation of 0 .. n - 1
+} FFTPlan;
+
+// Prepare a plan for length n. Returns 0 if n is not a power of two or allocation fails.
+int fft_plan_init(FFTPlan *plan, int n);
+
+void fft_plan_free(FFTPlan *plan);
+
+// In-place transform of FFT_LINES independent sequences of plan->n complex values, stored
+// as split real and imaginary arrays with element k of line l at [k * FFT_LINES + l].
+// The forward transform uses exp(-i...), the inverse exp(+i...); neither is normalised.
+void fft_transform_lines(const FFTPlan *plan, float *re, float *im, int inverse);
+
+#endif /* FFT_H */
@@ -0,0 +1,622 @@
+#include "fmm.h"
+#include "gravity.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FMM_P2P_SSE 1
+#endif
+
+// Tree levels whose children are handed out as tasks; deeper subtrees stay on one thread
+#define FMM_TASK_DEPTH 4
+
+// Near-list entries kept on the stack before a traversal step falls back to the heap
+#define FMM_NEAR_STACK 512
+
+// Direct pairs costing about as much as one M2L translation, per expansion term
+#define FMM_M2L_PAIRS 4
+
+// Multi-indices with a + b + c <= order
+static int term_count(int order) {
+    return (order + 1) * (order + 2) * (order + 3) / 6;
+}
+
+void fmm_init(FMMSolver *fmm) {
+    memset(fmm, 0, sizeof(*fmm));
+}
+
+void fmm_free(FMMSolver *fmm) {
+    free(fmm->sum_index);
+    free(fmm->cells);
+    free(fmm->multipole);
+    free(fmm->local);
+    free(fmm->order_index);
+    free(fmm->slot);
+    free(fmm->px);
+    free(fmm->py);
+    free(fmm->pz);
+    free(fmm->pm);
+    free(fmm->ax);
+    free(fmm->ay);
+    free(fmm->az);
+    arena_set_free(&fmm->lists);
+    memset(fmm, 0, sizeof(*fmm));
+}
+
+// Multi-index tables for an expansion order: graded ordering, factorials, n + k sums and
+// the recurrence for the derivatives of 1/r. Graded ordering makes the indices of total
+// order <= q the prefix of length term_count(q).
+static int build_tables(FMMSolver *fmm, int order) {
+    if (order == fmm->order && fmm->sum_index) return 1;
+
+    double factorial[FMM_MAX_ORDER + 1];
+    factorial[0] = 1.0;
+    for (int k = 1; k <= FMM_MAX_ORDER; k++) factorial[k] = factorial[k - 1] * k;
+
+    int t = 0;
+    for (int q = 0; q <= order; q++) {
+        for (int a = q; a >= 0; a--) {
+            for (int b = q - a; b >= 0; b--) {
+                int c = q - a - b;
+                fmm->power[t][0] = a;
+                fmm->power[t][1] = b;
+                fmm->power[t][2] = c;
+                fmm->lookup[a][b][c] = t;
+                fmm->inv_factorial[t] = 1.0 / (factorial[a] * factorial[b] * factorial[c]);
+                t++;
+            }
+        }
+    }
+    fmm->terms = t;
+
+    for (t = 1; t < fmm->terms; t++) {
+        const int *n = fmm->power[t];
+        fmm->recur_axis[t] = n[0] > 0 ? 0 : n[1] > 0 ? 1 : 2;
+        for (int j = 0; j < 3; j++) {
+            int m[3] = { n[0], n[1], n[2] };
+            m[j] -= 1;
+            fmm->recur_minus[t][j] = m[j] >= 0 ? fmm->lookup[m[0]][m[1]][m[2]] : -1;
+            m[j] -= 1;
+            fmm->recur_minus2[t][j] = m[j] >= 0 ? fmm->lookup[m[0]][m[1]][m[2]] : -1;
+        }
+    }
+
+    int *sum_index = realloc(fmm->sum_index, (size_t)fmm->terms * fmm->terms * sizeof(int));
+    if (!sum_index) {
+        fprintf(stderr, "FMM: failed to allocate expansion tables\n");
+        return 0;
+    }
+    fmm->sum_index = sum_index;
+    for (int n = 0; n < fmm->terms; n++) {
+        for (int k = 0; k < fmm->terms; k++) {
+            const int *pn = fmm->power[n], *pk = fmm->power[k];
+            int a = pn[0] + pk[0], b = pn[1] + pk[1], c = pn[2] + pk[2];
+            sum_index[n * fmm->terms + k] = a + b + c <= order ? fmm->lookup[a][b][c] : -1;
+        }
+    }
+
+    fmm->order = order;
+    return 1;
+}
+
+static int reserve_particles(FMMSolver *fmm, int count) {
+    if (count <= fmm->particle_capacity) return 1;
+
+    int ok = 1;
+    int **ints[] = { &fmm->order_index, &fmm->slot };
+    for (int k = 0; k < 2; k++) {
+        int *array = realloc(*ints[k], (size_t)count * sizeof(int));
+        if (array) *ints[k] = array;
+        else ok = 0;
+    }
+    float **floats[] = { &fmm->px, &fmm->py, &fmm->pz, &fmm->pm, &fmm->ax, &fmm->ay, &fmm->az };
+    for (int k = 0; k < 7; k++) {
+        float *array = realloc(*floats[k], (size_t)count * sizeof(float));
+        if (array) *floats[k] = array;
+        else ok = 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "FMM: failed to allocate particle buffers\n");
+        return 0;
+    }
+    fmm->particle_capacity = count;
+    return 1;
+}
+
+// Append n contiguous cells; returns the first index, or -1 if the pool could not grow
+static int new_cells(FMMSolver *fmm, int n) {
+    if (fmm->cell_count + n > fmm->cell_capacity) {
+        int capacity = fmm->cell_capacity ? fmm->cell_capacity : 1024;
+        while (capacity < fmm->cell_count + n) capacity *= 2;
+        FMMCell *cells = realloc(fmm->cells, (size_t)capacity * sizeof(FMMCell));
+        if (!cells) {
+            fprintf(stderr, "FMM: failed to allocate cells\n");
+            return -1;
+        }
+        fmm->cells = cells;
+        fmm->cell_capacity = capacity;
+    }
+    int first = fmm->cell_count;
+    fmm->cell_count += n;
+    return first;
+}
+
+// Append the particles below an octree node to the cell order
+static void gather(FMMSolver *fmm, const Octree *tree, int node, int *position) {
+    const OctreeNode *n = &tree->nodes[node];
+    if (n->particle >= 0) {
+        for (int p = n->particle; p >= 0; p = tree->next[p]) {
+            fmm->order_index[(*position)++] = p;
+        }
+        return;
+    }
+    for (int c = 0; c < 8; c++) {
+        if (n->children[c] >= 0) gather(fmm, tree, n->children[c], position);
+    }
+}
+
+// Fill cell from an octree node, stopping at nodes of at most leaf_size particles
+static int build_cell(FMMSolver *fmm, const Octree *tree, int node, int cell, int leaf_size, int *position) {
+    const OctreeNode *n = &tree->nodes[node];
+    fmm->cells[cell].center[0] = n->com.x;
+    fmm->cells[cell].center[1] = n->com.y;
+    fmm->cells[cell].center[2] = n->com.z;
+    fmm->cells[cell].begin = *position;
+    fmm->cells[cell].count = n->count;
+    fmm->cells[cell].first_child = -1;
+    fmm->cells[cell].child_count = 0;
+
+    if (n->particle >= 0 || n->count <= leaf_size) {
+        gather(fmm, tree, node, position);
+        return 1;
+    }
+
+    int children = 0;
+    for (int c = 0; c < 8; c++) {
+        if (n->children[c] >= 0 && tree->nodes[n->children[c]].count > 0) children++;
+    }
+    // The pool may move, so the cell is written through its index afterwards
+    int first = new_cells(fmm, children);
+    if (first < 0) return 0;
+    fmm->cells[cell].first_child = first;
+    fmm->cells[cell].child_count = children;
+
+    int k = 0;
+    for (int c = 0; c < 8; c++) {
+        int child = n->children[c];
+        if (child < 0 || tree->nodes[child].count == 0) continue;
+        if (!build_cell(fmm, tree, child, first + k++, leaf_size, position)) return 0;
+    }
+    return 1;
+}
+
+static double *multipole_of(FMMSolver *fmm, int cell) {
+    return fmm->multipole + (size_t)cell * fmm->terms;
+}
+
+static double *local_of(FMMSolver *fmm, int cell) {
+    return fmm->local + (size_t)cell * fmm->terms;
+}
+
+// Powers 0 .. order of the three components of d
+static void powers(const double d[3], int order, double p[3][FMM_MAX_ORDER + 1]) {
+    for (int axis = 0; axis < 3; axis++) {
+        p[axis][0] = 1.0;
+        for (int k = 1; k <= order; k++) p[axis][k] = p[axis][k - 1] * d[axis];
+    }
+}
+
+// Monomial d^k / k! of coefficient t from precomputed powers
+static double monomial(const FMMSolver *fmm, double p[3][FMM_MAX_ORDER + 1], int t) {
+    const int *k = fmm->power[t];
+    return p[0][k[0]] * p[1][k[1]] * p[2][k[2]] * fmm->inv_factorial[t];
+}
+
+// Multipole moments sum m (c - x)^k / k!; the mirrored offset gives the (-1)^|k| sign
+static void p2m(FMMSolver *fmm, int cell) {
+    FMMCell *c = &fmm->cells[cell];
+    double *M = multipole_of(fmm, cell);
+    memset(M, 0, (size_t)fmm->terms * sizeof(double));
+
+    double radius_sq = 0.0;
+    for (int q = c->begin; q < c->begin + c->count; q++) {
+        double d[3] = { c->center[0] - fmm->px[q], c->center[1] - fmm->py[q], c->center[2] - fmm->pz[q] };
+        double dist_sq = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+        if (dist_sq > radius_sq) radius_sq = dist_sq;
+
+        double p[3][FMM_MAX_ORDER + 1];
+        powers(d, fmm->order, p);
+        for (int t = 0; t < fmm->terms; t++) {
+            M[t] += fmm->pm[q] * monomial(fmm, p, t);
+        }
+    }
+    c->radius = sqrt(radius_sq);
+}
+
+// Shift the children's moments to this cell's center and sum them
+static void m2m(FMMSolver *fmm, int cell) {
+    FMMCell *c = &fmm->cells[cell];
+    double *M = multipole_of(fmm, cell);
+    memset(M, 0, (size_t)fmm->terms * sizeof(double));
+
+    double radius = 0.0;
+    for (int k = 0; k < c->child_count; k++) {
+        int child = c->first_child + k;
+        const FMMCell *ch = &fmm->cells[child];
+        const double *Mc = multipole_of(fmm, child);
+        double d[3] = { c->center[0] - ch->center[0], c->center[1] - ch->center[1], c->center[2] - ch->center[2] };
+        double dist = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        if (ch->radius + dist > radius) radius = ch->radius + dist;
+
+        double p[3][FMM_MAX_ORDER + 1];
+        powers(d, fmm->order, p);
+        for (int t = 0; t < fmm->terms; t++) {
+            const int *kt = fmm->power[t];
+            double sum = 0.0;
+            for (int a = 0; a <= t; a++) {
+                const int *ka = fmm->power[a];
+                if (ka[0] > kt[0] || ka[1] > kt[1] || ka[2] > kt[2]) continue;
+                int shift = fmm->lookup[kt[0] - ka[0]][kt[1] - ka[1]][kt[2] - ka[2]];
+                sum += Mc[a] * monomial(fmm, p, shift);
+            }
+            M[t] += sum;
+        }
+    }
+    c->radius = radius;
+}
+
+static void upward(FMMSolver *fmm, int cell, int depth) {
+    const FMMCell *c = &fmm->cells[cell];
+    if (c->first_child < 0) {
+        p2m(fmm, cell);
+        return;
+    }
+    for (int k = 0; k < c->child_count; k++) {
+        int child = c->first_child + k;
+        #pragma omp task if(depth < FMM_TASK_DEPTH)
+        upward(fmm, child, depth + 1);
+    }
+    #pragma omp taskwait
+    m2m(fmm, cell);
+}
+
+// Derivatives of 1/r at r up to the expansion order, from
+// r² T_n = -(2 n_i - 1) r_i T_{n-e_i} - (n_i - 1)² T_{n-2e_i}
+//          - sum_{j != i} (2 n_j r_j T_{n-e_j} + n_j (n_j - 1) T_{n-2e_j})
+static void derivatives(const FMMSolver *fmm, const double r[3], double *T) {
+    double r_sq = r[0] * r[0] + r[1] * r[1] + r[2] * r[2];
+    double inv_r_sq = 1.0 / r_sq;
+    T[0] = sqrt(inv_r_sq);
+
+    for (int t = 1; t < fmm->terms; t++) {
+        const int *n = fmm->power[t];
+        int i = fmm->recur_axis[t];
+        double sum = -(2 * n[i] - 1) * r[i] * T[fmm->recur_minus[t][i]];
+        if (n[i] >= 2) sum -= (double)(n[i] - 1) * (n[i] - 1) * T[fmm->recur_minus2[t][i]];
+        for (int j = 0; j < 3; j++) {
+            if (j == i || n[j] == 0) continue;
+            sum -= 2.0 * n[j] * r[j] * T[fmm->recur_minus[t][j]];
+            if (n[j] >= 2) sum -= (double)n[j] * (n[j] - 1) * T[fmm->recur_minus2[t][j]];
+        }
+        T[t] = sum * inv_r_sq;
+    }
+}
+
+static void m2l(FMMSolver *fmm, int source, int target) {
+    const FMMCell *s = &fmm->cells[source];
+    const FMMCell *t = &fmm->cells[target];
+    double r[3] = { t->center[0] - s->center[0], t->center[1] - s->center[1], t->center[2] - s->center[2] };
+    double T[FMM_MAX_TERMS];
+    derivatives(fmm, r, T);
+
+    const double *M = multipole_of(fmm, source);
+    double *L = local_of(fmm, target);
+    for (int n = 0; n < fmm->terms; n++) {
+        const int *row = fmm->sum_index + (size_t)n * fmm->terms;
+        const int *pn = fmm->power[n];
+        // Moments k with |n + k| <= order
+        int count = term_count(fmm->order - pn[0] - pn[1] - pn[2]);
+        double sum = 0.0;
+        for (int k = 0; k < count; k++) sum += M[k] * T[row[k]];
+        L[n] += sum;
+    }
+}
+
+// Shift the parent's local expansion to a child's center and add it
+static void l2l(FMMSolver *fmm, int parent, int cell) {
+    const FMMCell *pc = &fmm->cells[parent];
+    const FMMCell *c = &fmm->cells[cell];
+    const double *Lp = local_of(fmm, parent);
+    double *L = local_of(fmm, cell);
+    double d[3] = { c->center[0] - pc->center[0], c->center[1] - pc->center[1], c->center[2] - pc->center[2] };
+    double p[3][FMM_MAX_ORDER + 1];
+    powers(d, fmm->order, p);
+
+    for (int n = 0; n < fmm->terms; n++) {
+        const int *pn = fmm->power[n];
+        double sum = 0.0;
+        for (int k = n; k < fmm->terms; k++) {
+            const int *pk = fmm->power[k];
+            if (pk[0] < pn[0] || pk[1] < pn[1] || pk[2] < pn[2]) continue;
+            sum += Lp[k] * monomial(fmm, p, fmm->lookup[pk[0] - pn[0]][pk[1] - pn[1]][pk[2] - pn[2]]);
+        }
+        L[n] += sum;
+    }
+}
+
+// Acceleration -grad(phi) at each particle of a leaf from its local expansion
+static void l2p(FMMSolver *fmm, int cell) {
+    const FMMCell *c = &fmm->cells[cell];
+    const double *L = local_of(fmm, cell);
+    const int lower = term_count(fmm->order - 1);
+    const int ex = fmm->lookup[1][0][0], ey = fmm->lookup[0][1][0], ez = fmm->lookup[0][0][1];
+
+    for (int q = c->begin; q < c->begin + c->count; q++) {
+        double d[3] = { fmm->px[q] - c->center[0], fmm->py[q] - c->center[1], fmm->pz[q] - c->center[2] };
+        double p[3][FMM_MAX_ORDER + 1];
+        powers(d, fmm->order, p);
+
+        double ax = 0.0, ay = 0.0, az = 0.0;
+        for (int n = 0; n < lower; n++) {
+            const int *row = fmm->sum_index + (size_t)n * fmm->terms;
+            double w = monomial(fmm, p, n);
+            ax += L[row[ex]] * w;
+            ay += L[row[ey]] * w;
+            az += L[row[ez]] * w;
+        }
+        // phi = -G sum L; a = -grad(phi)
+        fmm->ax[q] += (float)(G * ax);
+        fmm->ay[q] += (float)(G * ay);
+        fmm->az[q] += (float)(G * az);
+    }
+}
+
+// Direct sum onto the particles of target from those of source. Cell ranges are not
+// padded, so the SSE loop leaves up to 3 sources to the scalar tail.
+#ifdef FMM_P2P_SSE
+__attribute__((target("sse2")))
+#endif
+static void p2p(FMMSolver *fmm, int target, int source) {
+    const FMMCell *t = &fmm->cells[target];
+    const FMMCell *s = &fmm->cells[source];
+    const float *x = fmm->px, *y = fmm->py, *z = fmm->pz, *m = fmm->pm;
+    const int end = s->begin + s->count;
+
+    for (int q = t->begin; q < t->begin + t->count; q++) {
+        float xi = x[q], yi = y[q], zi = z[q];
+        float ax = 0.0f, ay = 0.0f, az = 0.0f;
+        int j = s->begin;
+
+#ifdef FMM_P2P_SSE
+        // rsqrt estimate refined with one Newton-Raphson step, as in the direct kernels
+        const __m128 eps = _mm_set1_ps(GRAVITY_SOFTENING);
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 three_halves = _mm_set1_ps(1.5f);
+        __m128 vxi = _mm_set1_ps(xi), vyi = _mm_set1_ps(yi), vzi = _mm_set1_ps(zi);
+        __m128 acc_x = _mm_setzero_ps(), acc_y = _mm_setzero_ps(), acc_z = _mm_setzero_ps();
+        for (; j + 4 <= end; j += 4) {
+            __m128 dx = _mm_sub_ps(_mm_loadu_ps(x + j), vxi);
+            __m128 dy = _mm_sub_ps(_mm_loadu_ps(y + j), vyi);
+            __m128 dz = _mm_sub_ps(_mm_loadu_ps(z + j), vzi);
+            __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                   _mm_add_ps(_mm_mul_ps(dz, dz), eps));
+
+            __m128 inv = _mm_rsqrt_ps(r2);
+            inv = _mm_mul_ps(inv, _mm_sub_ps(three_halves, _mm_mul_ps(_mm_mul_ps(half, r2), _mm_mul_ps(inv, inv))));
+
+            __m128 w = _mm_mul_ps(_mm_loadu_ps(m + j), _mm_mul_ps(inv, _mm_mul_ps(inv, inv)));
+            acc_x = _mm_add_ps(acc_x, _mm_mul_ps(dx, w));
+            acc_y = _mm_add_ps(acc_y, _mm_mul_ps(dy, w));
+            acc_z = _mm_add_ps(acc_z, _mm_mul_ps(dz, w));
+        }
+        float lanes_x[4], lanes_y[4], lanes_z[4];
+        _mm_storeu_ps(lanes_x, acc_x);
+        _mm_storeu_ps(lanes_y, acc_y);
+        _mm_storeu_ps(lanes_z, acc_z);
+        ax = (lanes_x[0] + lanes_x[1]) + (lanes_x[2] + lanes_x[3]);
+        ay = (lanes_y[0] + lanes_y[1]) + (lanes_y[2] + lanes_y[3]);
+        az = (lanes_z[0] + lanes_z[1]) + (lanes_z[2] + lanes_z[3]);
+#endif
+
+        // A particle meets itself when target == source; its zero offset adds nothing
+        for (; j < end; j++) {
+            float dx = x[j] - xi;
+            float dy = y[j] - yi;
+            float dz = z[j] - zi;
+            float dist_sq = dx * dx + dy * dy + dz * dz + GRAVITY_SOFTENING;
+            float inv = 1.0f / sqrtf(dist_sq);
+            float w = m[j] * inv * inv * inv;
+            ax += w * dx;
+            ay += w * dy;
+            az += w * dz;
+        }
+        fmm->ax[q] += G * ax;
+        fmm->ay[q] += G * ay;
+        fmm->az[q] += G * az;
+    }
+}
+
+static int separated(const FMMSolver *fmm, int a, int b, double theta) {
+    const FMMCell *ca = &fmm->cells[a];
+    const FMMCell *cb = &fmm->cells[b];
+    double dx = ca->center[0] - cb->center[0];
+    double dy = ca->center[1] - cb->center[1];
+    double dz = ca->center[2] - cb->center[2];
+    double reach = ca->radius + cb->radius;
+    return reach * reach < theta * theta * (dx * dx + dy * dy + dz * dz);
+}
+
+// Well-separated cells get an M2L translation, unless both are leaves small enough that
+// summing their pairs directly is cheaper (and exact)
+static int use_m2l(const FMMSolver *fmm, int target, int source, double theta) {
+    const FMMCell *t = &fmm->cells[target];
+    const FMMCell *s = &fmm->cells[source];
+    if (!separated(fmm, target, source, theta)) return 0;
+    if (t->first_child >= 0 || s->first_child >= 0) return 1;
+    return (long long)t->count * s->count > (long long)FMM_M2L_PAIRS * fmm->terms;
+}
+
+// A leaf target against a source cell: M2L if far enough, else direct or descend the source
+static void leaf_interact(FMMSolver *fmm, int target, int source, double theta, long long *m2l_count,
+                          long long *p2p_count) {
+    if (use_m2l(fmm, target, source, theta)) {
+        m2l(fmm, source, target);
+        (*m2l_count)++;
+        return;
+    }
+    const FMMCell *s = &fmm->cells[source];
+    if (s->first_child < 0) {
+        p2p(fmm, target, source);
+        *p2p_count += (long long)fmm->cells[target].count * s->count;
+        return;
+    }
+    for (int k = 0; k < s->child_count; k++) {
+        leaf_interact(fmm, target, s->first_child + k, theta, m2l_count, p2p_count);
+    }
+}
+
+// Top-down dual traversal. parent_near lists the source cells too close to the parent
+// for M2L; the cell refines it to its own list, translating whatever is now far enough.
+static void downward(FMMSolver *fmm, int cell, int parent, const int *parent_near, int parent_count,
+                     double theta, int depth) {
+    int stack[FMM_NEAR_STACK];
+    int *near = stack;
+    int count = 0;
+    long long m2l_count = 0, p2p_count = 0;
+
+    if (parent < 0) {
+        near[count++] = cell;
+    } else {
+        l2l(fmm, parent, cell);
+        int capacity = 8 * parent_count;
+        if (capacity > FMM_NEAR_STACK) {
+            // Released with the rest of the thread's arena by the next call
+            Arena *arena = arena_set_local(&fmm->lists);
+            near = arena ? arena_alloc(arena, (size_t)capacity * sizeof(int)) : NULL;
+            if (!near) {
+                fmm->failed = 1;
+                return;
+            }
+        }
+        for (int k = 0; k < parent_count; k++) {
+            const FMMCell *s = &fmm->cells[parent_near[k]];
+            // Leaf sources stay whole; others are refined to their children
+            int first = s->first_child < 0 ? parent_near[k] : s->first_child;
+            int n = s->first_child < 0 ? 1 : s->child_count;
+            for (int source = first; source < first + n; source++) {
+                if (use_m2l(fmm, cell, source, theta)) {
+                    m2l(fmm, source, cell);
+                    m2l_count++;
+                } else {
+                    near[count++] = source;
+                }
+            }
+        }
+    }
+
+    const FMMCell *c = &fmm->cells[cell];
+    if (c->first_child < 0) {
+        for (int k = 0; k < count; k++) {
+            leaf_interact(fmm, cell, near[k], theta, &m2l_count, &p2p_count);
+        }
+        l2p(fmm, cell);
+    } else {
+        for (int k = 0; k < c->child_count; k++) {
+            int child = c->first_child + k;
+            #pragma omp task if(depth < FMM_TASK_DEPTH)
+            downward(fmm, child, cell, near, count, theta, depth + 1);
+        }
+        // The children read this cell's near list
+        #pragma omp taskwait
+    }
+
+    #pragma omp atomic
+    fmm->m2l += m2l_count;
+    #pragma omp atomic
+    fmm->p2p += p2p_count;
+}
+
+int fmm_compute_forces(FMMSolver *fmm, ParticleSystem *ps, const Octree *tree, const SimConfig *config,
+                       const int *active, int active_count) {
+    fmm->m2l = 0;
+    fmm->p2p = 0;
+    fmm->failed = 0;
+    if (ps->count == 0 || tree->node_count == 0) return 1;
+
+    int order = config->fmm_order;
+    if (order < 1) order = 1;
+    if (order > FMM_MAX_ORDER) order = FMM_MAX_ORDER;
+    int leaf_size = config->fmm_leaf_size > 0 ? config->fmm_leaf_size : 1;
+    double theta = config->fmm_theta;
+    if (!build_tables(fmm, order) || !reserve_particles(fmm, ps->count)) return 0;
+#ifdef _OPENMP
+    if (!arena_set_reserve(&fmm->lists, omp_get_max_threads())) return 0;
+#else
+    if (!arena_set_reserve(&fmm->lists, 1)) return 0;
+#endif
+    arena_set_reset(&fmm->lists);
+
+    // Coarsen the octree into cells
+    fmm->cell_count = 0;
+    int position = 0;
+    if (new_cells(fmm, 1) < 0 || !build_cell(fmm, tree, 0, 0, leaf_size, &position)) return 0;
+
+    size_t expansion = (size_t)fmm->cell_count * fmm->terms;
+    if (expansion > fmm->expansion_capacity) {
+        // The cell count drifts from step to step; headroom keeps it from reallocating each time
+        size_t capacity = expansion + expansion / 8;
+        double *multipole = realloc(fmm->multipole, capacity * sizeof(double));
+        if (multipole) fmm->multipole = multipole;
+        double *local = realloc(fmm->local, capacity * sizeof(double));
+        if (local) fmm->local = local;
+        if (!multipole || !local) {
+            fprintf(stderr, "FMM: failed to allocate expansions\n");
+            return 0;
+        }
+        fmm->expansion_capacity = capacity;
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int q = 0; q < ps->count; q++) {
+        int i = fmm->order_index[q];
+        fmm->slot[i] = q;
+        fmm->px[q] = ps->x[i];
+        fmm->py[q] = ps->y[i];
+        fmm->pz[q] = ps->z[i];
+        fmm->pm[q] = ps->mass[i];
+        fmm->ax[q] = 0.0f;
+        fmm->ay[q] = 0.0f;
+        fmm->az[q] = 0.0f;
+    }
+    memset(fmm->local, 0, expansion * sizeof(double));
+
+    #pragma omp parallel
+    #pragma omp single
+    upward(fmm, 0, 0);
+
+    #pragma omp parallel
+    #pragma omp single
+    downward(fmm, 0, -1, NULL, 0, theta, 0);
+
+    if (fmm->failed) {
+        fprintf(stderr, "FMM: failed to allocate a traversal list\n");
+        return 0;
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < active_count; k++) {
+        int i = active ? active[k] : k;
+        int q = fmm->slot[i];
+        ps->ax[i] += fmm->ax[q];
+        ps->ay[i] += fmm->ay[q];
+        ps->az[i] += fmm->az[q];
+    }
+    return 1;
+}
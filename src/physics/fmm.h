@@ -0,0 +1,72 @@
+#ifndef FMM_H
+#define FMM_H
+
+#include "particle.h"
+#include "octree.h"
+#include "../utils/arena.h"
+#include "../utils/config.h"
+
+// Fast multipole method on Cartesian Taylor expansions. The octree is coarsened into
+// cells of at most fmm_leaf_size particles; each cell gets a multipole expansion of order
+// fmm_order about its center of mass (upward pass, P2M and M2M). A dual traversal then
+// turns every pair of cells with (r_a + r_b) < fmm_theta * distance into an M2L
+// translation to a local expansion, and closer leaf pairs into direct sums. Local
+// expansions are shifted down the tree (L2L) and evaluated at the particles (L2P).
+// M2L keeps the terms of total order |n| + |k| <= fmm_order, so it only needs the
+// derivatives of 1/r up to fmm_order. The force error falls as fmm_theta^fmm_order.
+
+#define FMM_MAX_ORDER 6
+
+// Multi-indices (a, b, c) with a + b + c <= FMM_MAX_ORDER
+#define FMM_MAX_TERMS 84
+
+typedef struct {
+    double center[3];  // Expansion center (center of mass)
+    double radius;     // Distance from the center to the farthest particle
+    int first_child;   // Children are contiguous cells; -1 for leaves
+    int child_count;
+    int begin;         // Particles [begin, begin + count) of the cell order
+    int count;
+} FMMCell;
+
+typedef struct {
+    int order;          // Expansion order the tables were built for
+    int terms;          // Coefficients of an expansion (multi-indices up to order)
+    int power[FMM_MAX_TERMS][3];        // Multi-index of each coefficient, graded by order
+    double inv_factorial[FMM_MAX_TERMS]; // 1 / (a! b! c!)
+    int *sum_index;     // terms x terms: coefficient index of n + k where |n + k| <= order
+    int lookup[FMM_MAX_ORDER + 1][FMM_MAX_ORDER + 1][FMM_MAX_ORDER + 1];
+    // Derivative recurrence: the axis it steps along, and the indices of n - e_j and n - 2 e_j (-1: none)
+    int recur_axis[FMM_MAX_TERMS];
+    int recur_minus[FMM_MAX_TERMS][3];
+    int recur_minus2[FMM_MAX_TERMS][3];
+
+    FMMCell *cells;
+    int cell_count;
+    int cell_capacity;
+    double *multipole;  // Per cell, signed by (-1)^|k| so M2L is a plain sum
+    double *local;      // Per cell, without the -G factor
+    size_t expansion_capacity; // Doubles allocated in each of multipole and local
+
+    // Particles in cell order, so every cell is a contiguous range
+    int *order_index;   // Particle at each position
+    int *slot;          // Position of each particle
+    float *px, *py, *pz, *pm;
+    float *ax, *ay, *az;
+    int particle_capacity;
+
+    ArenaSet lists;     // Per-thread near lists too long for the stack, reset every call
+    int failed;         // A traversal buffer could not be allocated
+    long long m2l;      // M2L translations in the last call
+    long long p2p;      // Direct particle pairs in the last call
+} FMMSolver;
+
+void fmm_init(FMMSolver *fmm);
+void fmm_free(FMMSolver *fmm);
+
+// Add to the listed particles (all of them when active is NULL) the acceleration from
+// every particle, using a tree already built over ps. Returns 0 on allocation failure.
+int fmm_compute_forces(FMMSolver *fmm, ParticleSystem *ps, const Octree *tree, const SimConfig *config,
+                       const int *active, int active_count);
+
+#endif /* FMM_H */
@@ -3,20 +3,19 @@
 #include <math.h>
 
 // Apply gravitational force between two particles
-void apply_gravity(Particle *p1, Particle *p2) {
+void apply_gravity(ParticleSystem *ps, int i, int j) {
     // Calculate distance vector
     Vec3 r = {
-        p2->position.x - p1->position.x,
-        p2->position.y - p1->position.y,
-        p2->position.z - p1->position.z
+        ps->x[j] - ps->x[i],
+        ps->y[j] - ps->y[i],
+        ps->z[j] - ps->z[i]
     };
     
     // Calculate squared distance
     float dist_sq = r.x * r.x + r.y * r.y + r.z * r.z;
     
     // Add softening parameter to prevent extreme forces at very close distances
-    float softening = 1e-5f;
-    dist_sq += softening;
+    dist_sq += GRAVITY_SOFTENING;
     
     // Calculate distance
     float dist = sqrtf(dist_sq);
@@ -28,48 +27,42 @@ void apply_gravity(Particle *p1, Particle *p2) {
         r.z / dist
     };
     
-    // Calculate gravitational force magnitude: F = G * m1 * m2 / r^2
-    float force_mag = G * p1->mass * p2->mass / dist_sq;
-    
-    // Apply acceleration to each particle (F = ma, so a = F/m)
-    float a1 = force_mag / p1->mass;
-    float a2 = force_mag / p2->mass;
+    // Acceleration magnitudes: a1 = G * m2 / r^2, a2 = G * m1 / r^2
+    float a1 = G * ps->mass[j] / dist_sq;
+    float a2 = G * ps->mass[i] / dist_sq;
     
     // Update accelerations for both particles
-    p1->acceleration.x += dir.x * a1;
-    p1->acceleration.y += dir.y * a1;
-    p1->acceleration.z += dir.z * a1;
+    ps->ax[i] += dir.x * a1;
+    ps->ay[i] += dir.y * a1;
+    ps->az[i] += dir.z * a1;
     
-    p2->acceleration.x -= dir.x * a2;
-    p2->acceleration.y -= dir.y * a2;
-    p2->acceleration.z -= dir.z * a2;
+    ps->ax[j] -= dir.x * a2;
+    ps->ay[j] -= dir.y * a2;
+    ps->az[j] -= dir.z * a2;
 }
 
 // Apply gravitational forces from all other particles
-void apply_gravity_system(Particle *particles, int count, int current_index) {
-    Particle *current = &particles[current_index];
-    
-    for (int i = 0; i < count; i++) {
+void apply_gravity_system(ParticleSystem *ps, int current_index) {
+    for (int i = 0; i < ps->count; i++) {
         if (i == current_index) continue; // Skip self
         
-        apply_gravity(current, &particles[i]);
+        apply_gravity(ps, current_index, i);
     }
 }
 
-void apply_central_gravity(Particle *particle, Vec3 center_pos, float center_mass) {
+void apply_central_gravity(ParticleSystem *ps, int i, Vec3 center_pos, float center_mass) {
     // Calculate distance vector
     Vec3 r = {
-        center_pos.x - particle->position.x,
-        center_pos.y - particle->position.y,
-        center_pos.z - particle->position.z
+        center_pos.x - ps->x[i],
+        center_pos.y - ps->y[i],
+        center_pos.z - ps->z[i]
     };
     
     // Calculate squared distance
     float dist_sq = r.x * r.x + r.y * r.y + r.z * r.z;
     
     // Add softening parameter to prevent extreme forces at very close distances
-    float softening = 1e-5f;
-    dist_sq += softening;
+    dist_sq += GRAVITY_SOFTENING;
     
     // Calculate distance
     float dist = sqrtf(dist_sq);
@@ -81,14 +74,117 @@ void apply_central_gravity(Particle *particle, Vec3 center_pos, float center_mas
         r.z / dist
     };
     
-    // Calculate gravitational force magnitude: F = G * m1 * m2 / r^2
-    float force_mag = G * particle->mass * center_mass / dist_sq;
-    
-    // Apply acceleration to particle (F = ma, so a = F/m)
-    float acc = force_mag / particle->mass;
+    // Acceleration magnitude: a = G * M / r^2
+    float acc = G * center_mass / dist_sq;
     
     // Update acceleration for the particle
-    particle->acceleration.x += dir.x * acc;
-    particle->acceleration.y += dir.y * acc;
-    particle->acceleration.z += dir.z * acc;
-}
\ No newline at end of file
+    ps->ax[i] += dir.x * acc;
+    ps->ay[i] += dir.y * acc;
+    ps->az[i] += dir.z * acc;
+}
+
+// Apply gravity from all other particles by walking a Barnes-Hut octree
+int apply_barnes_hut_gravity(ParticleSystem *ps, int i, Octree *root) {
+    if (root->node_count == 0) return 0;
+
+    float px = ps->x[i], py = ps->y[i], pz = ps->z[i];
+    float acc_x = 0.0f, acc_y = 0.0f, acc_z = 0.0f;
+    float theta_sq = root->theta * root->theta;
+    int interactions = 0;
+
+    // Explicit stack: each level pushes at most 8 children
+    int stack[8 * (OCTREE_MAX_DEPTH + 1)];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        OctreeNode *node = &root->nodes[stack[--top]];
+        if (node->count == 0) continue;
+
+        // Leaf: interact directly with every particle stored in it
+        if (node->particle >= 0) {
+            for (int p = node->particle; p >= 0; p = root->next[p]) {
+                if (p == i) continue;
+
+                float dx = ps->x[p] - px;
+                float dy = ps->y[p] - py;
+                float dz = ps->z[p] - pz;
+                float dist_sq = dx * dx + dy * dy + dz * dz + GRAVITY_SOFTENING;
+                float inv_dist = 1.0f / sqrtf(dist_sq);
+                float s = G * ps->mass[p] * inv_dist * inv_dist * inv_dist;
+
+                acc_x += dx * s;
+                acc_y += dy * s;
+                acc_z += dz * s;
+                interactions++;
+            }
+            continue;
+        }
+
+        float dx = node->com.x - px;
+        float dy = node->com.y - py;
+        float dz = node->com.z - pz;
+        float dist_sq = dx * dx + dy * dy + dz * dz + GRAVITY_SOFTENING;
+        float size = 2.0f * node->half_size;
+
+        // Cell too close for its size: open it
+        if (size * size >= theta_sq * dist_sq) {
+            for (int c = 0; c < 8; c++) {
+                if (node->children[c] >= 0) stack[top++] = node->children[c];
+            }
+            continue;
+        }
+
+        // Monopole term
+        interactions++;
+        float inv_dist = 1.0f / sqrtf(dist_sq);
+        float inv_dist3 = inv_dist * inv_dist * inv_dist;
+        float s = G * node->mass * inv_dist3;
+        acc_x += dx * s;
+        acc_y += dy * s;
+        acc_z += dz * s;
+
+        // Quadrupole term: a = G * (Q r / r^5 - 5/2 (r.Q.r) r / r^7), with r pointing from com to the particle
+        if (root->use_quadrupole) {
+            const float *q = node->quad;
+            float rx = -dx, ry = -dy, rz = -dz;
+            float qrx = q[0] * rx + q[1] * ry + q[2] * rz;
+            float qry = q[1] * rx + q[3] * ry + q[4] * rz;
+            float qrz = q[2] * rx + q[4] * ry + q[5] * rz;
+            float rqr = rx * qrx + ry * qry + rz * qrz;
+            float inv_dist5 = inv_dist3 * inv_dist * inv_dist;
+            float inv_dist7 = inv_dist5 * inv_dist * inv_dist;
+
+            acc_x += G * (qrx * inv_dist5 - 2.5f * rqr * rx * inv_dist7);
+            acc_y += G * (qry * inv_dist5 - 2.5f * rqr * ry * inv_dist7);
+            acc_z += G * (qrz * inv_dist5 - 2.5f * rqr * rz * inv_dist7);
+        }
+    }
+
+    ps->ax[i] += acc_x;
+    ps->ay[i] += acc_y;
+    ps->az[i] += acc_z;
+    return interactions;
+}
+
+double gravity_total_energy(const ParticleSystem *ps) {
+    double kinetic = 0.0;
+    double potential = 0.0;
+    
+    #pragma omp parallel for schedule(dynamic, 16) reduction(+:kinetic, potential)
+    for (int i = 0; i < ps->count; i++) {
+        double v2 = (double)ps->vx[i] * ps->vx[i] + (double)ps->vy[i] * ps->vy[i] + (double)ps->vz[i] * ps->vz[i];
+        kinetic += 0.5 * ps->mass[i] * v2;
+        
+        // Plummer potential, consistent with the softened forces
+        for (int j = i + 1; j < ps->count; j++) {
+            double dx = (double)ps->x[j] - ps->x[i];
+            double dy = (double)ps->y[j] - ps->y[i];
+            double dz = (double)ps->z[j] - ps->z[i];
+            double r = sqrt(dx * dx + dy * dy + dz * dz + GRAVITY_SOFTENING);
+            potential -= (double)G * ps->mass[i] * ps->mass[j] / r;
+        }
+    }
+    
+    return kinetic + potential;
+}
@@ -2,21 +2,30 @@
 #define GRAVITY_H
 
 #include "particle.h"
+#include "octree.h"
 
 // Gravitational constant (can be adjusted for simulation scale)
 #define G 6.67430e-11f
 
+// Softening added to squared distances to prevent extreme forces at close range
+#define GRAVITY_SOFTENING 1e-5f
+
 // Apply gravitational force between two particles
-void apply_gravity(Particle *p1, Particle *p2);
+void apply_gravity(ParticleSystem *ps, int i, int j);
 
 // Apply gravitational force between a particle and all other particles in the system
-void apply_gravity_system(Particle *particles, int count, int current_index);
+void apply_gravity_system(ParticleSystem *ps, int current_index);
 
 // Optional: Apply gravity from a central massive body (e.g., sun in a solar system)
-void apply_central_gravity(Particle *particle, Vec3 center_pos, float center_mass);
+void apply_central_gravity(ParticleSystem *ps, int i, Vec3 center_pos, float center_mass);
+
+// Total kinetic plus (softened) potential energy, summed directly in double precision.
+// O(n²); meant for diagnostics and benchmarks, not for use every step.
+double gravity_total_energy(const ParticleSystem *ps);
 
-// Optional: Apply gravitational force with Barnes-Hut algorithm for optimization
-// This would require additional structures like octrees
-// void apply_barnes_hut_gravity(Particle *particle, Octree *root);
+// Apply gravity from all other particles using a Barnes-Hut walk of a built octree.
+// Only the particle's own acceleration is updated, so calls for different particles are independent.
+// Returns the number of particle and cell interactions evaluated.
+int apply_barnes_hut_gravity(ParticleSystem *ps, int i, Octree *root);
 
 #endif /* GRAVITY_H */
@@ -0,0 +1,455 @@
+#include "gravity_kernel.h"
+#include "gravity.h"
+#include <math.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GRAVITY_KERNEL_X86 1
+#endif
+
+typedef void (*GravityKernelFn)(ParticleSystem *ps, int begin, int end, int j_begin, int j_end);
+
+// Number of j-particles to stream: the massive particles rounded up to the padding (the
+// tracers and padding slots behind them have zero mass)
+static int padded_count(const ParticleSystem *ps) {
+    return (ps->massive_count + PARTICLE_PADDING - 1) / PARTICLE_PADDING * PARTICLE_PADDING;
+}
+
+// Scalar full-sum kernel for one j block
+static void kernel_scalar(ParticleSystem *ps, int begin, int end, int j_begin, int j_end) {
+    const float *x = ps->x, *y = ps->y, *z = ps->z, *m = ps->mass;
+
+    for (int i = begin; i < end; i++) {
+        float xi = x[i], yi = y[i], zi = z[i];
+        float acc_x = 0.0f, acc_y = 0.0f, acc_z = 0.0f;
+
+        for (int j = j_begin; j < j_end; j++) {
+            float dx = x[j] - xi;
+            float dy = y[j] - yi;
+            float dz = z[j] - zi;
+            float dist_sq = dx * dx + dy * dy + dz * dz + GRAVITY_SOFTENING;
+            float inv_dist = 1.0f / sqrtf(dist_sq);
+            float s = m[j] * inv_dist * inv_dist * inv_dist;
+            acc_x += dx * s;
+            acc_y += dy * s;
+            acc_z += dz * s;
+        }
+
+        ps->ax[i] += G * acc_x;
+        ps->ay[i] += G * acc_y;
+        ps->az[i] += G * acc_z;
+    }
+}
+
+#ifdef GRAVITY_KERNEL_X86
+
+// SSE kernel: rsqrt estimate refined with one Newton-Raphson step
+__attribute__((target("sse2")))
+static void kernel_sse(ParticleSystem *ps, int begin, int end, int j_begin, int j_end) {
+    const float *x = ps->x, *y = ps->y, *z = ps->z, *m = ps->mass;
+    const __m128 eps = _mm_set1_ps(GRAVITY_SOFTENING);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 three_halves = _mm_set1_ps(1.5f);
+
+    for (int i = begin; i < end; i++) {
+        __m128 xi = _mm_set1_ps(x[i]);
+        __m128 yi = _mm_set1_ps(y[i]);
+        __m128 zi = _mm_set1_ps(z[i]);
+        __m128 acc_x = _mm_setzero_ps();
+        __m128 acc_y = _mm_setzero_ps();
+        __m128 acc_z = _mm_setzero_ps();
+
+        for (int j = j_begin; j < j_end; j += 4) {
+            __m128 dx = _mm_sub_ps(_mm_load_ps(x + j), xi);
+            __m128 dy = _mm_sub_ps(_mm_load_ps(y + j), yi);
+            __m128 dz = _mm_sub_ps(_mm_load_ps(z + j), zi);
+            __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                   _mm_add_ps(_mm_mul_ps(dz, dz), eps));
+
+            __m128 inv = _mm_rsqrt_ps(r2);
+            inv = _mm_mul_ps(inv, _mm_sub_ps(three_halves, _mm_mul_ps(_mm_mul_ps(half, r2), _mm_mul_ps(inv, inv))));
+
+            __m128 s = _mm_mul_ps(_mm_load_ps(m + j), _mm_mul_ps(inv, _mm_mul_ps(inv, inv)));
+            acc_x = _mm_add_ps(acc_x, _mm_mul_ps(dx, s));
+            acc_y = _mm_add_ps(acc_y, _mm_mul_ps(dy, s));
+            acc_z = _mm_add_ps(acc_z, _mm_mul_ps(dz, s));
+        }
+
+        float lanes_x[4], lanes_y[4], lanes_z[4];
+        _mm_storeu_ps(lanes_x, acc_x);
+        _mm_storeu_ps(lanes_y, acc_y);
+        _mm_storeu_ps(lanes_z, acc_z);
+        ps->ax[i] += G * ((lanes_x[0] + lanes_x[1]) + (lanes_x[2] + lanes_x[3]));
+        ps->ay[i] += G * ((lanes_y[0] + lanes_y[1]) + (lanes_y[2] + lanes_y[3]));
+        ps->az[i] += G * ((lanes_z[0] + lanes_z[1]) + (lanes_z[2] + lanes_z[3]));
+    }
+}
+
+// Horizontal sum of an AVX register
+__attribute__((target("avx2")))
+static float hsum256(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+    return _mm_cvtss_f32(lo);
+}
+
+// AVX2 + FMA kernel
+__attribute__((target("avx2,fma")))
+static void kernel_avx2(ParticleSystem *ps, int begin, int end, int j_begin, int j_end) {
+    const float *x = ps->x, *y = ps->y, *z = ps->z, *m = ps->mass;
+    const __m256 eps = _mm256_set1_ps(GRAVITY_SOFTENING);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 three_halves = _mm256_set1_ps(1.5f);
+
+    for (int i = begin; i < end; i++) {
+        __m256 xi = _mm256_set1_ps(x[i]);
+        __m256 yi = _mm256_set1_ps(y[i]);
+        __m256 zi = _mm256_set1_ps(z[i]);
+        __m256 acc_x = _mm256_setzero_ps();
+        __m256 acc_y = _mm256_setzero_ps();
+        __m256 acc_z = _mm256_setzero_ps();
+
+        for (int j = j_begin; j < j_end; j += 8) {
+            __m256 dx = _mm256_sub_ps(_mm256_load_ps(x + j), xi);
+            __m256 dy = _mm256_sub_ps(_mm256_load_ps(y + j), yi);
+            __m256 dz = _mm256_sub_ps(_mm256_load_ps(z + j), zi);
+            __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_fmadd_ps(dz, dz, eps)));
+
+            __m256 inv = _mm256_rsqrt_ps(r2);
+            __m256 inv2 = _mm256_mul_ps(inv, inv);
+            inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), inv2, three_halves));
+
+            __m256 s = _mm256_mul_ps(_mm256_load_ps(m + j), _mm256_mul_ps(inv, _mm256_mul_ps(inv, inv)));
+            acc_x = _mm256_fmadd_ps(dx, s, acc_x);
+            acc_y = _mm256_fmadd_ps(dy, s, acc_y);
+            acc_z = _mm256_fmadd_ps(dz, s, acc_z);
+        }
+
+        ps->ax[i] += G * hsum256(acc_x);
+        ps->ay[i] += G * hsum256(acc_y);
+        ps->az[i] += G * hsum256(acc_z);
+    }
+}
+
+// AVX-512 kernel: rsqrt14 estimate is refined the same way
+__attribute__((target("avx512f")))
+static void kernel_avx512(ParticleSystem *ps, int begin, int end, int j_begin, int j_end) {
+    const float *x = ps->x, *y = ps->y, *z = ps->z, *m = ps->mass;
+    const __m512 eps = _mm512_set1_ps(GRAVITY_SOFTENING);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 three_halves = _mm512_set1_ps(1.5f);
+
+    for (int i = begin; i < end; i++) {
+        __m512 xi = _mm512_set1_ps(x[i]);
+        __m512 yi = _mm512_set1_ps(y[i]);
+        __m512 zi = _mm512_set1_ps(z[i]);
+        __m512 acc_x = _mm512_setzero_ps();
+        __m512 acc_y = _mm512_setzero_ps();
+        __m512 acc_z = _mm512_setzero_ps();
+
+        for (int j = j_begin; j < j_end; j += 16) {
+            __m512 dx = _mm512_sub_ps(_mm512_load_ps(x + j), xi);
+            __m512 dy = _mm512_sub_ps(_mm512_load_ps(y + j), yi);
+            __m512 dz = _mm512_sub_ps(_mm512_load_ps(z + j), zi);
+            __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_fmadd_ps(dz, dz, eps)));
+
+            __m512 inv = _mm512_rsqrt14_ps(r2);
+            __m512 inv2 = _mm512_mul_ps(inv, inv);
+            inv = _mm512_mul_ps(inv, _mm512_fnmadd_ps(_mm512_mul_ps(half, r2), inv2, three_halves));
+
+            __m512 s = _mm512_mul_ps(_mm512_load_ps(m + j), _mm512_mul_ps(inv, _mm512_mul_ps(inv, inv)));
+            acc_x = _mm512_fmadd_ps(dx, s, acc_x);
+            acc_y = _mm512_fmadd_ps(dy, s, acc_y);
+            acc_z = _mm512_fmadd_ps(dz, s, acc_z);
+        }
+
+        ps->ax[i] += G * _mm512_reduce_add_ps(acc_x);
+        ps->ay[i] += G * _mm512_reduce_add_ps(acc_y);
+        ps->az[i] += G * _mm512_reduce_add_ps(acc_z);
+    }
+}
+
+// Tracer kernels: the same sum with the vectors running over consecutive i (the tracers
+// are contiguous) and each j broadcast, since there are usually few massive particles.
+// i is loaded unaligned; the last i that do not fill a vector take the scalar kernel.
+
+__attribute__((target("sse2")))
+static void tracer_sse(ParticleSystem *ps, int begin, int end, int j_begin, int j_end) {
+    const float *x = ps->x, *y = ps->y, *z = ps->z, *m = ps->mass;
+    const __m128 eps = _mm_set1_ps(GRAVITY_SOFTENING);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 three_halves = _mm_set1_ps(1.5f);
+    const __m128 g = _mm_set1_ps(G);
+
+    int i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 xi = _mm_loadu_ps(x + i);
+        __m128 yi = _mm_loadu_ps(y + i);
+        __m128 zi = _mm_loadu_ps(z + i);
+        __m128 acc_x = _mm_setzero_ps();
+        __m128 acc_y = _mm_setzero_ps();
+        __m128 acc_z = _mm_setzero_ps();
+
+        for (int j = j_begin; j < j_end; j++) {
+            __m128 dx = _mm_sub_ps(_mm_set1_ps(x[j]), xi);
+            __m128 dy = _mm_sub_ps(_mm_set1_ps(y[j]), yi);
+            __m128 dz = _mm_sub_ps(_mm_set1_ps(z[j]), zi);
+            __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                   _mm_add_ps(_mm_mul_ps(dz, dz), eps));
+
+            __m128 inv = _mm_rsqrt_ps(r2);
+            inv = _mm_mul_ps(inv, _mm_sub_ps(three_halves, _mm_mul_ps(_mm_mul_ps(half, r2), _mm_mul_ps(inv, inv))));
+
+            __m128 s = _mm_mul_ps(_mm_set1_ps(m[j]), _mm_mul_ps(inv, _mm_mul_ps(inv, inv)));
+            acc_x = _mm_add_ps(acc_x, _mm_mul_ps(dx, s));
+            acc_y = _mm_add_ps(acc_y, _mm_mul_ps(dy, s));
+            acc_z = _mm_add_ps(acc_z, _mm_mul_ps(dz, s));
+        }
+
+        _mm_storeu_ps(ps->ax + i, _mm_add_ps(_mm_loadu_ps(ps->ax + i), _mm_mul_ps(g, acc_x)));
+        _mm_storeu_ps(ps->ay + i, _mm_add_ps(_mm_loadu_ps(ps->ay + i), _mm_mul_ps(g, acc_y)));
+        _mm_storeu_ps(ps->az + i, _mm_add_ps(_mm_loadu_ps(ps->az + i), _mm_mul_ps(g, acc_z)));
+    }
+    kernel_scalar(ps, i, end, j_begin, j_end);
+}
+
+__attribute__((target("avx2,fma")))
+static void tracer_avx2(ParticleSystem *ps, int begin, int end, int j_begin, int j_end) {
+    const float *x = ps->x, *y = ps->y, *z = ps->z, *m = ps->mass;
+    const __m256 eps = _mm256_set1_ps(GRAVITY_SOFTENING);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 three_halves = _mm256_set1_ps(1.5f);
+    const __m256 g = _mm256_set1_ps(G);
+
+    int i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 xi = _mm256_loadu_ps(x + i);
+        __m256 yi = _mm256_loadu_ps(y + i);
+        __m256 zi = _mm256_loadu_ps(z + i);
+        __m256 acc_x = _mm256_setzero_ps();
+        __m256 acc_y = _mm256_setzero_ps();
+        __m256 acc_z = _mm256_setzero_ps();
+
+        for (int j = j_begin; j < j_end; j++) {
+            __m256 dx = _mm256_sub_ps(_mm256_set1_ps(x[j]), xi);
+            __m256 dy = _mm256_sub_ps(_mm256_set1_ps(y[j]), yi);
+            __m256 dz = _mm256_sub_ps(_mm256_set1_ps(z[j]), zi);
+            __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_fmadd_ps(dz, dz, eps)));
+
+            __m256 inv = _mm256_rsqrt_ps(r2);
+            __m256 inv2 = _mm256_mul_ps(inv, inv);
+            inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), inv2, three_halves));
+
+            __m256 s = _mm256_mul_ps(_mm256_set1_ps(m[j]), _mm256_mul_ps(inv, _mm256_mul_ps(inv, inv)));
+            acc_x = _mm256_fmadd_ps(dx, s, acc_x);
+            acc_y = _mm256_fmadd_ps(dy, s, acc_y);
+            acc_z = _mm256_fmadd_ps(dz, s, acc_z);
+        }
+
+        _mm256_storeu_ps(ps->ax + i, _mm256_fmadd_ps(g, acc_x, _mm256_loadu_ps(ps->ax + i)));
+        _mm256_storeu_ps(ps->ay + i, _mm256_fmadd_ps(g, acc_y, _mm256_loadu_ps(ps->ay + i)));
+        _mm256_storeu_ps(ps->az + i, _mm256_fmadd_ps(g, acc_z, _mm256_loadu_ps(ps->az + i)));
+    }
+    kernel_scalar(ps, i, end, j_begin, j_end);
+}
+
+__attribute__((target("avx512f")))
+static void tracer_avx512(ParticleSystem *ps, int begin, int end, int j_begin, int j_end) {
+    const float *x = ps->x, *y = ps->y, *z = ps->z, *m = ps->mass;
+    const __m512 eps = _mm512_set1_ps(GRAVITY_SOFTENING);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 three_halves = _mm512_set1_ps(1.5f);
+    const __m512 g = _mm512_set1_ps(G);
+
+    int i = begin;
+    for (; i + 16 <= end; i += 16) {
+        __m512 xi = _mm512_loadu_ps(x + i);
+        __m512 yi = _mm512_loadu_ps(y + i);
+        __m512 zi = _mm512_loadu_ps(z + i);
+        __m512 acc_x = _mm512_setzero_ps();
+        __m512 acc_y = _mm512_setzero_ps();
+        __m512 acc_z = _mm512_setzero_ps();
+
+        for (int j = j_begin; j < j_end; j++) {
+            __m512 dx = _mm512_sub_ps(_mm512_set1_ps(x[j]), xi);
+            __m512 dy = _mm512_sub_ps(_mm512_set1_ps(y[j]), yi);
+            __m512 dz = _mm512_sub_ps(_mm512_set1_ps(z[j]), zi);
+            __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_fmadd_ps(dz, dz, eps)));
+
+            __m512 inv = _mm512_rsqrt14_ps(r2);
+            __m512 inv2 = _mm512_mul_ps(inv, inv);
+            inv = _mm512_mul_ps(inv, _mm512_fnmadd_ps(_mm512_mul_ps(half, r2), inv2, three_halves));
+
+            __m512 s = _mm512_mul_ps(_mm512_set1_ps(m[j]), _mm512_mul_ps(inv, _mm512_mul_ps(inv, inv)));
+            acc_x = _mm512_fmadd_ps(dx, s, acc_x);
+            acc_y = _mm512_fmadd_ps(dy, s, acc_y);
+            acc_z = _mm512_fmadd_ps(dz, s, acc_z);
+        }
+
+        _mm512_storeu_ps(ps->ax + i, _mm512_fmadd_ps(g, acc_x, _mm512_loadu_ps(ps->ax + i)));
+        _mm512_storeu_ps(ps->ay + i, _mm512_fmadd_ps(g, acc_y, _mm512_loadu_ps(ps->ay + i)));
+        _mm512_storeu_ps(ps->az + i, _mm512_fmadd_ps(g, acc_z, _mm512_loadu_ps(ps->az + i)));
+    }
+    kernel_scalar(ps, i, end, j_begin, j_end);
+}
+
+#endif /* GRAVITY_KERNEL_X86 */
+
+static int current_kernel = GRAVITY_KERNEL_SCALAR;
+static GravityKernelFn current_fn = kernel_scalar;
+static GravityKernelFn current_tracer_fn = kernel_scalar;
+
+// Widest kernel the running CPU supports
+static int detect_kernel(void) {
+#ifdef GRAVITY_KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return GRAVITY_KERNEL_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return GRAVITY_KERNEL_AVX2;
+    if (__builtin_cpu_supports("sse2")) return GRAVITY_KERNEL_SSE;
+#endif
+    return GRAVITY_KERNEL_SCALAR;
+}
+
+int gravity_kernel_select(int requested) {
+    int supported = detect_kernel();
+    int kernel = (requested < 0 || requested > supported) ? supported : requested;
+
+    current_kernel = kernel;
+    switch (kernel) {
+#ifdef GRAVITY_KERNEL_X86
+        case GRAVITY_KERNEL_AVX512: current_fn = kernel_avx512; current_tracer_fn = tracer_avx512; break;
+        case GRAVITY_KERNEL_AVX2:   current_fn = kernel_avx2;   current_tracer_fn = tracer_avx2;   break;
+        case GRAVITY_KERNEL_SSE:    current_fn = kernel_sse;    current_tracer_fn = tracer_sse;    break;
+#endif
+        default:                    current_fn = kernel_scalar; current_tracer_fn = kernel_scalar; break;
+    }
+    return kernel;
+}
+
+int gravity_kernel_current(void) {
+    return current_kernel;
+}
+
+const char *gravity_kernel_name(int kernel) {
+    switch (kernel) {
+        case GRAVITY_KERNEL_SCALAR: return "scalar";
+        case GRAVITY_KERNEL_SSE:    return "sse";
+        case GRAVITY_KERNEL_AVX2:   return "avx2";
+        case GRAVITY_KERNEL_AVX512: return "avx512";
+        default:                    return "auto";
+    }
+}
+
+void gravity_direct_sum(ParticleSystem *ps, int begin, int end) {
+    int n = padded_count(ps);
+
+    // Stream j in cache-sized blocks so each block stays resident while all i pass over it
+    for (int j_begin = 0; j_begin < n; j_begin += GRAVITY_KERNEL_BLOCK) {
+        int j_end = j_begin + GRAVITY_KERNEL_BLOCK < n ? j_begin + GRAVITY_KERNEL_BLOCK : n;
+        current_fn(ps, begin, end, j_begin, j_end);
+    }
+}
+
+void gravity_tracer_sum(ParticleSystem *ps, int begin, int end) {
+    int n = ps->massive_count;
+
+    for (int j_begin = 0; j_begin < n; j_begin += GRAVITY_KERNEL_BLOCK) {
+        int j_end = j_begin + GRAVITY_KERNEL_BLOCK < n ? j_begin + GRAVITY_KERNEL_BLOCK : n;
+        current_tracer_fn(ps, begin, end, j_begin, j_end);
+    }
+}
+
+void gravity_direct_sum_list(ParticleSystem *ps, const int *indices, int count) {
+    int n = padded_count(ps);
+
+    for (int j_begin = 0; j_begin < n; j_begin += GRAVITY_KERNEL_BLOCK) {
+        int j_end = j_begin + GRAVITY_KERNEL_BLOCK < n ? j_begin + GRAVITY_KERNEL_BLOCK : n;
+        for (int k = 0; k < count; k++) {
+            current_fn(ps, indices[k], indices[k] + 1, j_begin, j_end);
+        }
+    }
+}
+
+void gravity_direct_pairs(ParticleSystem *ps) {
+    // Pairs of tracers contribute nothing, so i only runs over the massive particles
+    for (int i = 0; i < ps->massive_count; i++) {
+        for (int j = i + 1; j < ps->count; j++) {
+            apply_gravity(ps, i, j);
+        }
+    }
+}
+
+void gravity_direct_pairs_threaded(ParticleSystem *ps, float *scratch, int threads) {
+    int count = ps->count;
+    int massive = ps->massive_count;
+    size_t stride = (size_t)ps->capacity;
+
+    #pragma omp parallel num_threads(threads)
+    {
+#ifdef _OPENMP
+        int thread = omp_get_thread_num();
+        int nthreads = omp_get_num_threads();
+#else
+        int thread = 0;
+        int nthreads = 1;
+#endif
+        float *ax = scratch + (size_t)thread * 3 * stride;
+        float *ay = ax + stride;
+        float *az = ay + stride;
+        memset(ax, 0, 3 * stride * sizeof(float));
+
+        // Cyclic rows balance the shrinking triangle i<j between threads
+        for (int i = thread; i < massive; i += nthreads) {
+            float xi = ps->x[i], yi = ps->y[i], zi = ps->z[i], mi = ps->mass[i];
+            float acc_x = 0.0f, acc_y = 0.0f, acc_z = 0.0f;
+
+            for (int j = i + 1; j < count; j++) {
+                float dx = ps->x[j] - xi;
+                float dy = ps->y[j] - yi;
+                float dz = ps->z[j] - zi;
+                float dist_sq = dx * dx + dy * dy + dz * dz + GRAVITY_SOFTENING;
+                float inv_dist = 1.0f / sqrtf(dist_sq);
+                float inv_dist3 = G * inv_dist * inv_dist * inv_dist;
+
+                float s1 = ps->mass[j] * inv_dist3;
+                float s2 = mi * inv_dist3;
+                acc_x += dx * s1;
+                acc_y += dy * s1;
+                acc_z += dz * s1;
+                ax[j] -= dx * s2;
+                ay[j] -= dy * s2;
+                az[j] -= dz * s2;
+            }
+
+            ax[i] += acc_x;
+            ay[i] += acc_y;
+            az[i] += acc_z;
+        }
+
+        // Every slice must be complete before the reduction reads it
+        #pragma omp barrier
+
+        // Reduce the per-thread slices in a fixed order
+        #pragma omp for schedule(static)
+        for (int i = 0; i < count; i++) {
+            float sum_x = 0.0f, sum_y = 0.0f, sum_z = 0.0f;
+            for (int t = 0; t < nthreads; t++) {
+                const float *slice = scratch + (size_t)t * 3 * stride;
+                sum_x += slice[i];
+                sum_y += slice[stride + i];
+                sum_z += slice[2 * stride + i];
+            }
+            ps->ax[i] += sum_x;
+            ps->ay[i] += sum_y;
+            ps->az[i] += sum_z;
+        }
+    }
+}
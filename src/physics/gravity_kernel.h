@@ -0,0 +1,51 @@
+#ifndef GRAVITY_KERNEL_H
+#define GRAVITY_KERNEL_H
+
+#include "particle.h"
+
+// Direct-summation kernel variants, ordered by vector width
+#define GRAVITY_KERNEL_AUTO   -1 // Widest kernel supported by the CPU
+#define GRAVITY_KERNEL_SCALAR  0 // Reference i<j pair loop using apply_gravity
+#define GRAVITY_KERNEL_SSE     1 // 4 j-particles per iteration
+#define GRAVITY_KERNEL_AVX2    2 // 8 j-particles per iteration (with FMA)
+#define GRAVITY_KERNEL_AVX512  3 // 16 j-particles per iteration
+
+// Number of j-particles streamed per cache block (4 arrays * 2048 floats = 32 KB)
+#define GRAVITY_KERNEL_BLOCK 2048
+
+// Select the kernel used by gravity_direct_sum. Requests for kernels the CPU
+// cannot run are lowered to the widest supported one. Returns the selected kernel.
+int gravity_kernel_select(int requested);
+
+// Currently selected kernel
+int gravity_kernel_current(void);
+
+// Human-readable kernel name
+const char *gravity_kernel_name(int kernel);
+
+// Accumulate into ax/ay/az of particles [begin, end) the acceleration from every
+// massive particle in the system. Each i is only written by its own call, so disjoint
+// ranges can run concurrently. The scalar kernel falls back to a full (not
+// pair-halved) scalar loop here; the pair-halved reference is gravity_direct_pairs.
+void gravity_direct_sum(ParticleSystem *ps, int begin, int end);
+
+// As gravity_direct_sum, for a range of tracers (begin >= ps->massive_count). The kernel
+// vectorises over the contiguous targets instead of the few massive sources, so the cost
+// is O(tracers * massive particles) at full vector width.
+void gravity_tracer_sum(ParticleSystem *ps, int begin, int end);
+
+// As gravity_direct_sum, for an arbitrary list of target particles (e.g. the active
+// particles of a block timestep). j is still streamed in cache blocks.
+void gravity_direct_sum_list(ParticleSystem *ps, const int *indices, int count);
+
+// Reference O(n²) i<j pair loop using apply_gravity (Newton's third law halving); pairs
+// of two tracers are skipped
+void gravity_direct_pairs(ParticleSystem *ps);
+
+// Threaded version of the pair loop. Rows are dealt to threads cyclically and each
+// thread accumulates both sides of its pairs into a private slice of scratch
+// (threads * 3 * ps->capacity floats); the slices are then summed in thread order,
+// so results are bit-identical for a fixed thread count.
+void gravity_direct_pairs_threaded(ParticleSystem *ps, float *scratch, int threads);
+
+#endif /* GRAVITY_KERNEL_H */
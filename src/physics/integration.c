@@ -1,117 +1,1099 @@
 /* src/physics/integration.c */
 #include "integration.h"
+#include "gravity.h"
+#include "gravity_kernel.h"
+#include "../utils/profiler.h"
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-// Euler integration (simplest but least accurate)
-void euler_integrate(Particle *p, float dt) {
-    // Update velocity based on acceleration
-    p->velocity.x += p->acceleration.x * dt;
-    p->velocity.y += p->acceleration.y * dt;
-    p->velocity.z += p->acceleration.z * dt;
-    
-    // Update position based on velocity
-    p->position.x += p->velocity.x * dt;
-    p->position.y += p->velocity.y * dt;
-    p->position.z += p->velocity.z * dt;
-}
-
-// Velocity Verlet integration (better accuracy)
-void verlet_integrate(Particle *p, float dt) {
-    // Store old acceleration for second half of the update
-    Vec3 old_acc = p->acceleration;
-    
-    // Update position based on velocity and half acceleration
-    p->position.x += p->velocity.x * dt + 0.5f * old_acc.x * dt * dt;
-    p->position.y += p->velocity.y * dt + 0.5f * old_acc.y * dt * dt;
-    p->position.z += p->velocity.z * dt + 0.5f * old_acc.z * dt * dt;
-    
-    // At this point, we need new accelerations based on the updated positions
-    // This is typically done by recalculating forces, which happens outside this function
-    
-    // Update velocity using average of old and new acceleration
-    p->velocity.x += 0.5f * (old_acc.x + p->acceleration.x) * dt;
-    p->velocity.y += 0.5f * (old_acc.y + p->acceleration.y) * dt;
-    p->velocity.z += 0.5f * (old_acc.z + p->acceleration.z) * dt;
-}
-
-// Runge-Kutta 4th order integration (most accurate but computationally expensive)
-void rk4_integrate(Particle *p, float dt) {
-    // This is a simplified RK4 implementation
-    // A full implementation would require storing the state at multiple steps
-    // and evaluating forces multiple times, which is complex
-    
-    // k1 = f(y_n)
-    Vec3 k1_vel = p->acceleration;
-    Vec3 k1_pos = p->velocity;
-    
-    // k2 = f(y_n + dt/2 * k1)
-    Vec3 k2_pos = {
-        p->velocity.x + 0.5f * dt * k1_vel.x,
-        p->velocity.y + 0.5f * dt * k1_vel.y,
-        p->velocity.z + 0.5f * dt * k1_vel.z
-    };
-    // For k2_vel, we would need to recalculate acceleration at the new position
-    // This is typically done outside this function
-    Vec3 k2_vel = p->acceleration; // Simplification
-    
-    // k3 = f(y_n + dt/2 * k2)
-    Vec3 k3_pos = {
-        p->velocity.x + 0.5f * dt * k2_vel.x,
-        p->velocity.y + 0.5f * dt * k2_vel.y,
-        p->velocity.z + 0.5f * dt * k2_vel.z
-    };
-    // Again, we would need to recalculate acceleration
-    Vec3 k3_vel = p->acceleration; // Simplification
-    
-    // k4 = f(y_n + dt * k3)
-    Vec3 k4_pos = {
-        p->velocity.x + dt * k3_vel.x,
-        p->velocity.y + dt * k3_vel.y,
-        p->velocity.z + dt * k3_vel.z
-    };
-    // One more acceleration recalculation
-    Vec3 k4_vel = p->acceleration; // Simplification
-    
-    // Update position: y_{n+1} = y_n + dt/6 * (k1 + 2*k2 + 2*k3 + k4)
-    p->position.x += dt / 6.0f * (k1_pos.x + 2.0f * k2_pos.x + 2.0f * k3_pos.x + k4_pos.x);
-    p->position.y += dt / 6.0f * (k1_pos.y + 2.0f * k2_pos.y + 2.0f * k3_pos.y + k4_pos.y);
-    p->position.z += dt / 6.0f * (k1_pos.z + 2.0f * k2_pos.z + 2.0f * k3_pos.z + k4_pos.z);
-    
-    // Update velocity
-    p->velocity.x += dt / 6.0f * (k1_vel.x + 2.0f * k2_vel.x + 2.0f * k3_vel.x + k4_vel.x);
-    p->velocity.y += dt / 6.0f * (k1_vel.y + 2.0f * k2_vel.y + 2.0f * k3_vel.y + k4_vel.y);
-    p->velocity.z += dt / 6.0f * (k1_vel.z + 2.0f * k2_vel.z + 2.0f * k3_vel.z + k4_vel.z);
-}
-
-// Update the entire particle system
-void update_particle_system(Particle *particles, int count, float dt, int integration_method) {
-    // First, reset all forces
-    for (int i = 0; i < count; i++) {
-        particle_reset_forces(&particles[i]);
-    }
-    
-    // Calculate gravitational forces between all pairs of particles
-    // This is O(n²) complexity - for large simulations, optimization would be needed
-    for (int i = 0; i < count; i++) {
-        for (int j = i + 1; j < count; j++) {
-            apply_gravity(&particles[i], &particles[j]);
-        }
-    }
-    
-    // Update all particles using the selected integration method
-    for (int i = 0; i < count; i++) {
-        switch (integration_method) {
-            case 0:
-                euler_integrate(&particles[i], dt);
-                break;
-            case 1:
-                verlet_integrate(&particles[i], dt);
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Yoshida / Forest-Ruth coefficients: three leapfrog steps of w1, w0, w1 compose into a
+// fourth-order method (w0 is negative, so the middle step runs backwards in time)
+#define YOSHIDA_CBRT2 1.2599210498948732
+#define YOSHIDA_W1 (1.0 / (2.0 - YOSHIDA_CBRT2))
+#define YOSHIDA_W0 (-YOSHIDA_CBRT2 * YOSHIDA_W1)
+
+// Arrays in the RK4 stage buffer, each capacity floats long
+enum {
+    STAGE_X0, STAGE_Y0, STAGE_Z0,      // Positions at the start of the step
+    STAGE_VX0, STAGE_VY0, STAGE_VZ0,   // Velocities at the start of the step
+    STAGE_SX, STAGE_SY, STAGE_SZ,      // Weighted sum of stage velocities
+    STAGE_SVX, STAGE_SVY, STAGE_SVZ,   // Weighted sum of stage accelerations
+    STAGE_ARRAYS
+};
+
+// Deepest block timestep level
+#define BLOCK_MAX_LEVELS 20
+
+// Arrays in the adaptive timestep buffer, each capacity floats long
+enum {
+    SAVED_X, SAVED_Y, SAVED_Z,      // Positions at the start of the step
+    SAVED_VX, SAVED_VY, SAVED_VZ,   // Velocities at the start of the step
+    SAVED_AX, SAVED_AY, SAVED_AZ,   // Accelerations at the start of the step, kept for the jerk
+    SAVED_ARRAYS
+};
+
+// Evaluate forces at the current positions and count them towards the step
+static void evaluate_forces(ParticleSystem *ps, PhysicsState *state, SimConfig *config) {
+    compute_forces(ps, state, config);
+    state->step_interactions += state->interactions;
+    state->step_force_evaluations++;
+    state->step_particle_forces += ps->count;
+    state->acc_valid = 1;
+}
+
+// Reuse the accelerations left by the previous step when the positions have not moved since
+static void ensure_forces(ParticleSystem *ps, PhysicsState *state, SimConfig *config) {
+    if (!state->acc_valid) {
+        evaluate_forces(ps, state, config);
+    }
+}
+
+// v += a * dt
+static void kick(ParticleSystem *ps, float dt) {
+    PROFILE_BEGIN(PROFILE_INTEGRATE);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < ps->count; i++) {
+        ps->vx[i] += ps->ax[i] * dt;
+        ps->vy[i] += ps->ay[i] * dt;
+        ps->vz[i] += ps->az[i] * dt;
+    }
+    PROFILE_END(PROFILE_INTEGRATE);
+}
+
+// x += v * dt; the accelerations no longer match the positions afterwards
+static void drift(ParticleSystem *ps, PhysicsState *state, float dt) {
+    PROFILE_BEGIN(PROFILE_INTEGRATE);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < ps->count; i++) {
+        ps->x[i] += ps->vx[i] * dt;
+        ps->y[i] += ps->vy[i] * dt;
+        ps->z[i] += ps->vz[i] * dt;
+    }
+    state->acc_valid = 0;
+    PROFILE_END(PROFILE_INTEGRATE);
+}
+
+// Semi-implicit Euler (first order, one force evaluation per step)
+void euler_integrate(ParticleSystem *ps, PhysicsState *state, SimConfig *config, float dt) {
+    ensure_forces(ps, state, config);
+    kick(ps, dt);
+    drift(ps, state, dt);
+}
+
+// Kick-drift-kick leapfrog, i.e. velocity Verlet (second order, symplectic).
+// The closing kick's forces open the next step, so it costs one evaluation per step.
+void leapfrog_integrate(ParticleSystem *ps, PhysicsState *state, SimConfig *config, float dt) {
+    ensure_forces(ps, state, config);
+    kick(ps, 0.5f * dt);
+    drift(ps, state, dt);
+    evaluate_forces(ps, state, config);
+    kick(ps, 0.5f * dt);
+}
+
+// Yoshida / Forest-Ruth fourth-order symplectic integrator in kick-drift-kick form.
+// Three force evaluations per step; the last one is reused by the next step.
+void yoshida_integrate(ParticleSystem *ps, PhysicsState *state, SimConfig *config, float dt) {
+    const float c_outer = (float)(0.5 * YOSHIDA_W1) * dt;
+    const float c_inner = (float)(0.5 * (YOSHIDA_W0 + YOSHIDA_W1)) * dt;
+    const float d_outer = (float)YOSHIDA_W1 * dt;
+    const float d_inner = (float)YOSHIDA_W0 * dt;
+    
+    ensure_forces(ps, state, config);
+    kick(ps, c_outer);
+    drift(ps, state, d_outer);
+    evaluate_forces(ps, state, config);
+    kick(ps, c_inner);
+    drift(ps, state, d_inner);
+    evaluate_forces(ps, state, config);
+    kick(ps, c_inner);
+    drift(ps, state, d_outer);
+    evaluate_forces(ps, state, config);
+    kick(ps, c_outer);
+}
+
+// Slot of the central body (ID 0, wherever reordering has moved it), -1 without one
+static int find_central_body(const ParticleSystem *ps, const SimConfig *config) {
+    if (!config->enable_central_body) return -1;
+    for (int i = 0; i < ps->massive_count; i++) {
+        if (ps->id[i] == 0) return ps->mass[i] > 0.0f ? i : -1;
+    }
+    return -1;
+}
+
+// Add sign times the central body's pull to every other particle's acceleration
+static void add_central_term(ParticleSystem *ps, int central, float sign) {
+    Vec3 center = {ps->x[central], ps->y[central], ps->z[central]};
+    float mass = sign * ps->mass[central];
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < ps->count; i++) {
+        if (i != central) apply_central_gravity(ps, i, center, mass);
+    }
+}
+
+// Mutual accelerations of everything but the central body: a force evaluation with the
+// central mass switched off, counted like any other
+static void evaluate_perturbations(ParticleSystem *ps, PhysicsState *state, SimConfig *config, int central) {
+    float mass = ps->mass[central];
+    ps->mass[central] = 0.0f;
+    evaluate_forces(ps, state, config);
+    ps->mass[central] = mass;
+}
+
+// Stumpff functions c2(z) = (1 - cos √z) / z and c3(z) = (√z - sin √z) / z^(3/2),
+// continued to z < 0 through cosh and sinh; series near zero where those cancel
+static void stumpff(double z, double *c2, double *c3) {
+    if (z > 1e-4) {
+        double s = sqrt(z);
+        *c2 = (1.0 - cos(s)) / z;
+        *c3 = (s - sin(s)) / (z * s);
+    } else if (z < -1e-4) {
+        double s = sqrt(-z);
+        *c2 = (cosh(s) - 1.0) / -z;
+        *c3 = (sinh(s) - s) / (-z * s);
+    } else {
+        *c2 = 0.5 - z * (1.0 / 24.0 - z * (1.0 / 720.0));
+        *c3 = 1.0 / 6.0 - z * (1.0 / 120.0 - z * (1.0 / 5040.0));
+    }
+}
+
+// Advance position r and velocity v, relative to a fixed mass with mu = G * M, along their
+// two-body orbit for time dt. Universal variables cover elliptic, parabolic and hyperbolic
+// orbits alike; Kepler's equation in the universal anomaly chi is solved by Laguerre-Conway
+// iteration, which converges from a crude guess.
+static void kepler_drift(double mu, double dt, double r[3], double v[3]) {
+    double r0 = sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+    if (r0 == 0.0 || mu <= 0.0) {
+        for (int k = 0; k < 3; k++) r[k] += v[k] * dt;
+        return;
+    }
+    double v2 = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+    double sqrt_mu = sqrt(mu);
+    double eta = (r[0] * v[0] + r[1] * v[1] + r[2] * v[2]) / sqrt_mu;
+    double alpha = 2.0 / r0 - v2 / mu; // 1 / semi-major axis, <= 0 when unbound
+    double zeta = 1.0 - alpha * r0;
+    
+    // Whole periods of a bound orbit change nothing
+    double chi = sqrt_mu * dt / r0;
+    if (alpha > 0.0) {
+        double period = 2.0 * M_PI / (sqrt_mu * alpha * sqrt(alpha));
+        dt = fmod(dt, period);
+        chi = sqrt_mu * alpha * dt;
+    }
+    
+    double c2 = 0.5, c3 = 1.0 / 6.0;
+    for (int iter = 0; iter < 50; iter++) {
+        double chi2 = chi * chi;
+        double z = alpha * chi2;
+        stumpff(z, &c2, &c3);
+        double f = eta * chi2 * c2 + zeta * chi2 * chi * c3 + r0 * chi - sqrt_mu * dt;
+        double df = eta * chi * (1.0 - z * c3) + zeta * chi2 * c2 + r0;
+        double ddf = eta * (1.0 - z * c2) + zeta * chi * (1.0 - z * c3);
+        double root = sqrt(fabs(16.0 * df * df - 20.0 * f * ddf));
+        double step = 5.0 * f / (df + (df >= 0.0 ? root : -root));
+        chi -= step;
+        if (fabs(step) <= 1e-14 * fabs(chi)) break;
+    }
+    
+    double chi2 = chi * chi;
+    stumpff(alpha * chi2, &c2, &c3);
+    double f = 1.0 - chi2 * c2 / r0;
+    double g = dt - chi2 * chi * c3 / sqrt_mu;
+    double rn[3];
+    for (int k = 0; k < 3; k++) rn[k] = f * r[k] + g * v[k];
+    double r1 = sqrt(rn[0] * rn[0] + rn[1] * rn[1] + rn[2] * rn[2]);
+    double df = sqrt_mu / (r1 * r0) * chi * (alpha * chi2 * c3 - 1.0);
+    double dg = 1.0 - chi2 * c2 / r1;
+    for (int k = 0; k < 3; k++) {
+        v[k] = df * r[k] + dg * v[k];
+        r[k] = rn[k];
+    }
+}
+
+// Wisdom-Holman map in democratic heliocentric coordinates (Duncan, Levison & Lee 1998):
+// positions relative to the central body, velocities relative to the barycentre. The
+// Hamiltonian splits into Kepler orbits about the central mass, solved exactly, the
+// mutual interactions of the other bodies, applied as kicks, and a linear term from the
+// central body's recoil, applied as a drift (the "jump"). The steps compose as
+// kick(dt/2) jump(dt/2) Kepler(dt) jump(dt/2) kick(dt/2), so the error only comes from the
+// weak perturbations and steps may be a sizeable fraction of an orbit.
+//
+// ps->ax etc. hold the full accelerations between steps like every other integrator; the
+// kicks take the central term back out. The closing evaluation opens the next step.
+void wisdom_holman_integrate(ParticleSystem *ps, PhysicsState *state, SimConfig *config, float dt) {
+    int central = find_central_body(ps, config);
+    if (central < 0) {
+        leapfrog_integrate(ps, state, config, dt);
+        return;
+    }
+    ensure_forces(ps, state, config);
+    
+    const int n = ps->count;
+    const double half = 0.5 * dt;
+    const double mc = ps->mass[central];
+    const double mu = (double)G * mc;
+    
+    // Barycentre and total momentum, which the map conserves
+    double total = 0.0, bx = 0.0, by = 0.0, bz = 0.0, px = 0.0, py = 0.0, pz = 0.0;
+    #pragma omp parallel for schedule(static) reduction(+:total, bx, by, bz, px, py, pz)
+    for (int i = 0; i < ps->massive_count; i++) {
+        double m = ps->mass[i];
+        total += m;
+        bx += m * ps->x[i];
+        by += m * ps->y[i];
+        bz += m * ps->z[i];
+        px += m * ps->vx[i];
+        py += m * ps->vy[i];
+        pz += m * ps->vz[i];
+    }
+    bx /= total;
+    by /= total;
+    bz /= total;
+    const double ux = px / total, uy = py / total, uz = pz / total;
+    
+    {
+        PROFILE_BEGIN(PROFILE_INTEGRATE);
+        add_central_term(ps, central, -1.0f);
+        
+        // To heliocentric positions and barycentric velocities, with the opening kick
+        const float cx = ps->x[central], cy = ps->y[central], cz = ps->z[central];
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            if (i == central) continue;
+            ps->x[i] -= cx;
+            ps->y[i] -= cy;
+            ps->z[i] -= cz;
+            ps->vx[i] = (float)(ps->vx[i] - ux + ps->ax[i] * half);
+            ps->vy[i] = (float)(ps->vy[i] - uy + ps->ay[i] * half);
+            ps->vz[i] = (float)(ps->vz[i] - uz + ps->az[i] * half);
+        }
+        
+        for (int pass = 0; pass < 2; pass++) {
+            // Jump: every body drifts with the central body's recoil velocity
+            double sx = 0.0, sy = 0.0, sz = 0.0;
+            #pragma omp parallel for schedule(static) reduction(+:sx, sy, sz)
+            for (int i = 0; i < ps->massive_count; i++) {
+                if (i == central) continue;
+                sx += (double)ps->mass[i] * ps->vx[i];
+                sy += (double)ps->mass[i] * ps->vy[i];
+                sz += (double)ps->mass[i] * ps->vz[i];
+            }
+            const float jx = (float)(sx / mc * half), jy = (float)(sy / mc * half), jz = (float)(sz / mc * half);
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < n; i++) {
+                if (i == central) continue;
+                ps->x[i] += jx;
+                ps->y[i] += jy;
+                ps->z[i] += jz;
+            }
+            if (pass == 1) break;
+            
+            // Kepler orbits about the central mass, in double precision
+            #pragma omp parallel for schedule(dynamic, 64)
+            for (int i = 0; i < n; i++) {
+                if (i == central) continue;
+                double r[3] = {ps->x[i], ps->y[i], ps->z[i]};
+                double v[3] = {ps->vx[i], ps->vy[i], ps->vz[i]};
+                kepler_drift(mu, dt, r, v);
+                ps->x[i] = (float)r[0];
+                ps->y[i] = (float)r[1];
+                ps->z[i] = (float)r[2];
+                ps->vx[i] = (float)v[0];
+                ps->vy[i] = (float)v[1];
+                ps->vz[i] = (float)v[2];
+            }
+        }
+        
+        // Back to inertial coordinates: the barycentre has moved on uniformly and the central
+        // body sits where it keeps it in place
+        double qx = 0.0, qy = 0.0, qz = 0.0;
+        #pragma omp parallel for schedule(static) reduction(+:qx, qy, qz)
+        for (int i = 0; i < ps->massive_count; i++) {
+            if (i == central) continue;
+            qx += (double)ps->mass[i] * ps->x[i];
+            qy += (double)ps->mass[i] * ps->y[i];
+            qz += (double)ps->mass[i] * ps->z[i];
+        }
+        ps->x[central] = (float)(bx + ux * dt - qx / total);
+        ps->y[central] = (float)(by + uy * dt - qy / total);
+        ps->z[central] = (float)(bz + uz * dt - qz / total);
+        const float nx = ps->x[central], ny = ps->y[central], nz = ps->z[central];
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            if (i == central) continue;
+            ps->x[i] += nx;
+            ps->y[i] += ny;
+            ps->z[i] += nz;
+        }
+        state->acc_valid = 0;
+        PROFILE_END(PROFILE_INTEGRATE);
+    }
+    
+    // Closing kick from the perturbations at the new positions, still barycentric
+    evaluate_perturbations(ps, state, config, central);
+    {
+        PROFILE_BEGIN(PROFILE_INTEGRATE);
+        double sx = 0.0, sy = 0.0, sz = 0.0;
+        #pragma omp parallel for schedule(static) reduction(+:sx, sy, sz)
+        for (int i = 0; i < n; i++) {
+            if (i == central) continue;
+            ps->vx[i] = (float)(ps->vx[i] + ps->ax[i] * half + ux);
+            ps->vy[i] = (float)(ps->vy[i] + ps->ay[i] * half + uy);
+            ps->vz[i] = (float)(ps->vz[i] + ps->az[i] * half + uz);
+            if (i < ps->massive_count) {
+                sx += (double)ps->mass[i] * ps->vx[i];
+                sy += (double)ps->mass[i] * ps->vy[i];
+                sz += (double)ps->mass[i] * ps->vz[i];
+            }
+        }
+        
+        // The central body carries whatever momentum the others do not
+        ps->vx[central] = (float)((px - sx) / mc);
+        ps->vy[central] = (float)((py - sy) / mc);
+        ps->vz[central] = (float)((pz - sz) / mc);
+        add_central_term(ps, central, 1.0f);
+        PROFILE_END(PROFILE_INTEGRATE);
+    }
+}
+
+// Make sure the RK4 stage buffer can hold the whole system
+static float *ensure_stage(PhysicsState *state, ParticleSystem *ps) {
+    size_t needed = (size_t)STAGE_ARRAYS * ps->capacity;
+    if (needed > state->stage_capacity) {
+        float *buffer = (float*)realloc(state->stage, needed * sizeof(float));
+        if (!buffer) {
+            fprintf(stderr, "Failed to allocate integrator stage buffers\n");
+            return NULL;
+        }
+        state->stage = buffer;
+        state->stage_capacity = needed;
+    }
+    return state->stage;
+}
+
+// Move to the next RK4 stage: x = x0 + hx * v, v = v0 + hv * a, from the current stage's v and a
+static void rk4_stage(ParticleSystem *ps, PhysicsState *state, const float *stage, float hx, float hv) {
+    const int n = ps->capacity;
+    PROFILE_BEGIN(PROFILE_INTEGRATE);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < ps->count; i++) {
+        ps->x[i] = stage[STAGE_X0 * n + i] + hx * ps->vx[i];
+        ps->y[i] = stage[STAGE_Y0 * n + i] + hx * ps->vy[i];
+        ps->z[i] = stage[STAGE_Z0 * n + i] + hx * ps->vz[i];
+        ps->vx[i] = stage[STAGE_VX0 * n + i] + hv * ps->ax[i];
+        ps->vy[i] = stage[STAGE_VY0 * n + i] + hv * ps->ay[i];
+        ps->vz[i] = stage[STAGE_VZ0 * n + i] + hv * ps->az[i];
+    }
+    state->acc_valid = 0;
+    PROFILE_END(PROFILE_INTEGRATE);
+}
+
+// Add weight times the current stage's derivative (v, a) to the running sums
+static void rk4_accumulate(ParticleSystem *ps, float *stage, float weight) {
+    const int n = ps->capacity;
+    PROFILE_BEGIN(PROFILE_INTEGRATE);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < ps->count; i++) {
+        stage[STAGE_SX * n + i] += weight * ps->vx[i];
+        stage[STAGE_SY * n + i] += weight * ps->vy[i];
+        stage[STAGE_SZ * n + i] += weight * ps->vz[i];
+        stage[STAGE_SVX * n + i] += weight * ps->ax[i];
+        stage[STAGE_SVY * n + i] += weight * ps->ay[i];
+        stage[STAGE_SVZ * n + i] += weight * ps->az[i];
+    }
+    PROFILE_END(PROFILE_INTEGRATE);
+}
+
+// Classical fourth-order Runge-Kutta on (x, v) with four force evaluations per step
+// (the first is skipped when the accelerations are still current)
+void rk4_integrate(ParticleSystem *ps, PhysicsState *state, SimConfig *config, float dt) {
+    float *stage = ensure_stage(state, ps);
+    if (!stage) {
+        leapfrog_integrate(ps, state, config, dt);
+        return;
+    }
+    const int n = ps->capacity;
+    
+    // k1 at the start of the step
+    ensure_forces(ps, state, config);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < ps->count; i++) {
+        stage[STAGE_X0 * n + i] = ps->x[i];
+        stage[STAGE_Y0 * n + i] = ps->y[i];
+        stage[STAGE_Z0 * n + i] = ps->z[i];
+        stage[STAGE_VX0 * n + i] = ps->vx[i];
+        stage[STAGE_VY0 * n + i] = ps->vy[i];
+        stage[STAGE_VZ0 * n + i] = ps->vz[i];
+        stage[STAGE_SX * n + i] = 0.0f;
+        stage[STAGE_SY * n + i] = 0.0f;
+        stage[STAGE_SZ * n + i] = 0.0f;
+        stage[STAGE_SVX * n + i] = 0.0f;
+        stage[STAGE_SVY * n + i] = 0.0f;
+        stage[STAGE_SVZ * n + i] = 0.0f;
+    }
+    rk4_accumulate(ps, stage, 1.0f);
+    
+    // k2 and k3 at the midpoint, k4 at the end
+    rk4_stage(ps, state, stage, 0.5f * dt, 0.5f * dt);
+    evaluate_forces(ps, state, config);
+    rk4_accumulate(ps, stage, 2.0f);
+    
+    rk4_stage(ps, state, stage, 0.5f * dt, 0.5f * dt);
+    evaluate_forces(ps, state, config);
+    rk4_accumulate(ps, stage, 2.0f);
+    
+    rk4_stage(ps, state, stage, dt, dt);
+    evaluate_forces(ps, state, config);
+    rk4_accumulate(ps, stage, 1.0f);
+    
+    // y_{n+1} = y_n + dt/6 * (k1 + 2*k2 + 2*k3 + k4)
+    const float h = dt / 6.0f;
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < ps->count; i++) {
+        ps->x[i] = stage[STAGE_X0 * n + i] + h * stage[STAGE_SX * n + i];
+        ps->y[i] = stage[STAGE_Y0 * n + i] + h * stage[STAGE_SY * n + i];
+        ps->z[i] = stage[STAGE_Z0 * n + i] + h * stage[STAGE_SZ * n + i];
+        ps->vx[i] = stage[STAGE_VX0 * n + i] + h * stage[STAGE_SVX * n + i];
+        ps->vy[i] = stage[STAGE_VY0 * n + i] + h * stage[STAGE_SVY * n + i];
+        ps->vz[i] = stage[STAGE_VZ0 * n + i] + h * stage[STAGE_SVZ * n + i];
+    }
+    state->acc_valid = 0;
+}
+
+// Make sure the block arrays hold the whole system; a new or resized system restarts
+// every particle on the finest level, which is always safe
+static int ensure_block(PhysicsState *state, ParticleSystem *ps, int finest) {
+    if (ps->capacity > state->block_capacity) {
+        int *level = (int*)realloc(state->block_level, (size_t)ps->capacity * sizeof(int));
+        if (level) state->block_level = level;
+        int *active = (int*)realloc(state->block_active, (size_t)ps->capacity * sizeof(int));
+        if (active) state->block_active = active;
+        float *acc_old = (float*)realloc(state->block_acc_old, (size_t)ps->capacity * 3 * sizeof(float));
+        if (acc_old) state->block_acc_old = acc_old;
+        if (!level || !active || !acc_old) {
+            fprintf(stderr, "Failed to allocate block timestep arrays\n");
+            return 0;
+        }
+        state->block_capacity = ps->capacity;
+        state->block_count = 0;
+    }
+    
+    if (state->block_count != ps->count) {
+        const int n = ps->capacity;
+        for (int i = 0; i < ps->count; i++) {
+            state->block_level[i] = finest;
+            state->block_acc_old[i] = ps->ax[i];
+            state->block_acc_old[n + i] = ps->ay[i];
+            state->block_acc_old[2 * n + i] = ps->az[i];
+        }
+        state->block_count = ps->count;
+    }
+    return 1;
+}
+
+void block_leapfrog_integrate(ParticleSystem *ps, PhysicsState *state, SimConfig *config, float dt) {
+    int finest = config->block_levels - 1;
+    if (finest < 0) finest = 0;
+    if (finest > BLOCK_MAX_LEVELS - 1) finest = BLOCK_MAX_LEVELS - 1;
+    
+    // Accelerations must match the positions before the opening kicks
+    ensure_forces(ps, state, config);
+    if (!ensure_block(state, ps, finest)) {
+        leapfrog_integrate(ps, state, config, dt);
+        return;
+    }
+    
+    const long ticks = 1L << finest;
+    const float tick = dt / (float)ticks;
+    const float eta = config->block_eta;
+    const int n = ps->capacity;
+    int *level = state->block_level;
+    int *active = state->block_active;
+    float *acc_old = state->block_acc_old;
+    
+    // The tree only needs a full build once per step; the ticks in between refit it
+    state->block_refits = (int)(ticks - 1);
+    
+    for (long t = 0; t < ticks; t++) {
+        // Opening half kick for every particle whose step starts at this tick
+        {
+            PROFILE_BEGIN(PROFILE_INTEGRATE);
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < ps->count; i++) {
+                long span = 1L << (finest - level[i]);
+                if (t % span == 0) {
+                    float h = 0.5f * tick * (float)span;
+                    ps->vx[i] += ps->ax[i] * h;
+                    ps->vy[i] += ps->ay[i] * h;
+                    ps->vz[i] += ps->az[i] * h;
+                }
+            }
+            PROFILE_END(PROFILE_INTEGRATE);
+        }
+        
+        // Every particle drifts, so active forces always see synchronised positions
+        drift(ps, state, tick);
+        
+        // Particles whose step ends at the next tick
+        long now = t + 1;
+        int active_count = 0;
+        for (int i = 0; i < ps->count; i++) {
+            if (now % (1L << (finest - level[i])) == 0) active[active_count++] = i;
+        }
+        
+        if (active_count == 0) continue;
+        
+        compute_forces_active(ps, state, config, active, active_count);
+        state->step_interactions += state->interactions;
+        state->step_force_evaluations++;
+        state->step_particle_forces += active_count;
+        
+        // Closing half kick, then pick the next level from the jerk estimate
+        {
+            PROFILE_BEGIN(PROFILE_INTEGRATE);
+            #pragma omp parallel for schedule(static)
+            for (int k = 0; k < active_count; k++) {
+                int i = active[k];
+                long span = 1L << (finest - level[i]);
+                float step = tick * (float)span;
+                float h = 0.5f * step;
+                ps->vx[i] += ps->ax[i] * h;
+                ps->vy[i] += ps->ay[i] * h;
+                ps->vz[i] += ps->az[i] * h;
+                
+                float jx = ps->ax[i] - acc_old[i];
+                float jy = ps->ay[i] - acc_old[n + i];
+                float jz = ps->az[i] - acc_old[2 * n + i];
+                float da = sqrtf(jx * jx + jy * jy + jz * jz);
+                float a = sqrtf(ps->ax[i] * ps->ax[i] + ps->ay[i] * ps->ay[i] + ps->az[i] * ps->az[i]);
+                acc_old[i] = ps->ax[i];
+                acc_old[n + i] = ps->ay[i];
+                acc_old[2 * n + i] = ps->az[i];
+                
+                // |a| / |da/dt| with da/dt ~ da / step; no change in a allows the largest step
+                float wanted = da > 0.0f ? eta * a * step / da : dt;
+                int next = 0;
+                while (next < finest && dt / (float)(1L << next) > wanted) next++;
+                
+                // Grow the step by at most one level, and only onto a block boundary
+                if (next < level[i] - 1) next = level[i] - 1;
+                while (next < level[i] && now % (1L << (finest - next)) != 0) next++;
+                level[i] = next;
+            }
+            PROFILE_END(PROFILE_INTEGRATE);
+        }
+    }
+    
+    state->block_refits = 0;
+    
+    // The last tick is a boundary for every level, so all accelerations are current
+    state->acc_valid = 1;
+}
+
+// Make sure the adaptive timestep buffer can hold the whole system; a new size drops the
+// acceleration history
+static float *ensure_saved(PhysicsState *state, ParticleSystem *ps) {
+    size_t needed = (size_t)SAVED_ARRAYS * ps->capacity;
+    if (needed > state->saved_capacity) {
+        float *buffer = (float*)realloc(state->saved, needed * sizeof(float));
+        if (!buffer) {
+            fprintf(stderr, "Failed to allocate the adaptive timestep buffer\n");
+            return NULL;
+        }
+        state->saved = buffer;
+        state->saved_capacity = needed;
+        state->saved_count = 0;
+    }
+    return state->saved;
+}
+
+// Step size the current state asks for: eta * max|v| / max|a|, and with adaptive_jerk the
+// smallest eta * |a| / |da/dt| over the particles as well, da/dt being the change from
+// acc_old over the interval h. INFINITY when neither criterion applies (nothing moves or
+// accelerates).
+static float adaptive_criterion(const ParticleSystem *ps, const SimConfig *config, const float *acc_old,
+                                int stride, float h) {
+    const int jerk = acc_old && config->adaptive_jerk && h > 0.0f;
+    float a2_max = 0.0f, v2_max = 0.0f, ratio2_min = INFINITY;
+    
+    #pragma omp parallel for schedule(static) reduction(max:a2_max, v2_max) reduction(min:ratio2_min)
+    for (int i = 0; i < ps->count; i++) {
+        float a2 = ps->ax[i] * ps->ax[i] + ps->ay[i] * ps->ay[i] + ps->az[i] * ps->az[i];
+        float v2 = ps->vx[i] * ps->vx[i] + ps->vy[i] * ps->vy[i] + ps->vz[i] * ps->vz[i];
+        if (a2 > a2_max) a2_max = a2;
+        if (v2 > v2_max) v2_max = v2;
+        if (jerk) {
+            float jx = ps->ax[i] - acc_old[i];
+            float jy = ps->ay[i] - acc_old[stride + i];
+            float jz = ps->az[i] - acc_old[2 * stride + i];
+            float d2 = jx * jx + jy * jy + jz * jz;
+            if (d2 > 0.0f && a2 < ratio2_min * d2) ratio2_min = a2 / d2;
+        }
+    }
+    
+    float dt = INFINITY;
+    if (a2_max > 0.0f && v2_max > 0.0f) dt = config->adaptive_eta * sqrtf(v2_max / a2_max);
+    if (ratio2_min < INFINITY) {
+        float dt_jerk = config->adaptive_eta * sqrtf(ratio2_min) * h;
+        if (dt_jerk < dt) dt = dt_jerk;
+    }
+    return dt;
+}
+
+// Clamp a wanted step into [adaptive_min_step, adaptive_max_step]; NaN gets the smallest
+static float clamp_step(float dt, const SimConfig *config) {
+    if (!(dt >= config->adaptive_min_step)) return config->adaptive_min_step;
+    if (dt > config->adaptive_max_step) return config->adaptive_max_step;
+    return dt;
+}
+
+// Copy between the particle arrays and the saved start-of-step state, arrays first to last
+static void copy_state(ParticleSystem *ps, float *saved, int first, int last, int to_saved) {
+    float *arrays[SAVED_ARRAYS] = {ps->x, ps->y, ps->z, ps->vx, ps->vy, ps->vz, ps->ax, ps->ay, ps->az};
+    const size_t stride = ps->capacity;
+    const size_t bytes = (size_t)ps->count * sizeof(float);
+    for (int a = first; a <= last; a++) {
+        if (to_saved) memcpy(saved + a * stride, arrays[a], bytes);
+        else memcpy(arrays[a], saved + a * stride, bytes);
+    }
+}
+
+// One step of the configured global-step integrator
+static void integrate(ParticleSystem *ps, PhysicsState *state, SimConfig *config, float dt) {
+    switch (config->integration_method) {
+        case 0:
+            euler_integrate(ps, state, config, dt);
+            break;
+        case 1:
+            leapfrog_integrate(ps, state, config, dt);
+            break;
+        case 2:
+            rk4_integrate(ps, state, config, dt);
+            break;
+        case 3:
+            yoshida_integrate(ps, state, config, dt);
+            break;
+        case 4:
+            wisdom_holman_integrate(ps, state, config, dt);
+            break;
+        default:
+            leapfrog_integrate(ps, state, config, dt);
+    }
+}
+
+float adaptive_integrate(ParticleSystem *ps, PhysicsState *state, SimConfig *config) {
+    ensure_forces(ps, state, config);
+    float *saved = ensure_saved(state, ps);
+    if (!saved) {
+        integrate(ps, state, config, config->time_step);
+        return config->time_step;
+    }
+    
+    const int stride = ps->capacity;
+    const int iterations = integrator_is_symplectic(config->integration_method) ? config->adaptive_symmetric : 0;
+    const float *history = state->saved_count == ps->count ? saved + SAVED_AX * stride : NULL;
+    
+    PROFILE_BEGIN(PROFILE_INTEGRATE);
+    float start_dt = adaptive_criterion(ps, config, history, stride, state->saved_dt);
+    // The start state is what the iterations restart from and the next step's jerk history
+    if (iterations > 0 || config->adaptive_jerk) {
+        copy_state(ps, saved, iterations > 0 ? SAVED_X : SAVED_AX, SAVED_AZ, 1);
+        state->saved_count = ps->count;
+    }
+    PROFILE_END(PROFILE_INTEGRATE);
+    
+    // Time-symmetric selection: the step is the mean of what the criterion asks for at its
+    // two ends, found by redoing the step from the saved state
+    float dt = clamp_step(start_dt, config);
+    for (int k = 0; ; k++) {
+        integrate(ps, state, config, dt);
+        if (k >= iterations) break;
+        
+        ensure_forces(ps, state, config);
+        PROFILE_BEGIN(PROFILE_INTEGRATE);
+        float end_dt = adaptive_criterion(ps, config, saved + SAVED_AX * stride, stride, dt);
+        float next = clamp_step(0.5f * (clamp_step(start_dt, config) + clamp_step(end_dt, config)), config);
+        copy_state(ps, saved, SAVED_X, SAVED_AZ, 0);
+        state->acc_valid = 1;
+        PROFILE_END(PROFILE_INTEGRATE);
+        dt = next;
+    }
+    
+    state->saved_dt = dt;
+    return dt;
+}
+
+const char *integrator_name(int method) {
+    switch (method) {
+        case 0:  return "euler";
+        case 1:  return "leapfrog";
+        case 2:  return "rk4";
+        case 3:  return "yoshida";
+        case 4:  return "wisdom_holman";
+        default: return "unknown";
+    }
+}
+
+int integrator_is_symplectic(int method) {
+    return method == 1 || method == 3 || method == 4;
+}
+
+void physics_state_init(PhysicsState *state, SimConfig *config) {
+    octree_init(&state->tree, config->barnes_hut_theta, config->barnes_hut_quadrupole);
+    state->tree.parallel_build = config->tree_build;
+    state->kernel = gravity_kernel_select(config->force_kernel);
+    
+#ifdef _OPENMP
+    state->threads = config->num_threads > 0 ? config->num_threads : omp_get_num_procs();
+#else
+    state->threads = 1;
+#endif
+    physics_state_attach_thread(state);
+    
+    state->thread_acc = NULL;
+    state->thread_acc_capacity = 0;
+    state->stage = NULL;
+    state->stage_capacity = 0;
+    state->acc_valid = 0;
+    state->block_level = NULL;
+    state->block_active = NULL;
+    state->block_acc_old = NULL;
+    state->block_capacity = 0;
+    state->block_count = 0;
+    state->block_refits = 0;
+    state->saved = NULL;
+    state->saved_capacity = 0;
+    state->saved_count = 0;
+    state->saved_dt = 0.0f;
+    state->step_dt = config->time_step;
+    collision_grid_init(&state->collisions);
+    pm_init(&state->pm);
+    fmm_init(&state->fmm);
+    morton_init(&state->morton);
+    external_field_init(&state->external);
+    if (!external_field_build(&state->external, config)) {
+        fprintf(stderr, "Running without the external potential\n");
+    }
+    boundary_init(&state->boundary);
+    if (!boundary_setup(&state->boundary, config)) {
+        fprintf(stderr, "Running without box boundaries\n");
+    }
+    state->steps = 0;
+    state->interactions = 0;
+    state->step_interactions = 0;
+    state->step_force_evaluations = 0;
+    state->step_particle_forces = 0;
+}
+
+void physics_state_attach_thread(PhysicsState *state) {
+#ifdef _OPENMP
+    // All parallel regions in the physics code use this thread count
+    omp_set_num_threads(state->threads);
+#else
+    (void)state;
+#endif
+}
+
+void physics_state_cleanup(PhysicsState *state) {
+    octree_free(&state->tree);
+    free(state->thread_acc);
+    state->thread_acc = NULL;
+    state->thread_acc_capacity = 0;
+    free(state->stage);
+    state->stage = NULL;
+    state->stage_capacity = 0;
+    free(state->block_level);
+    free(state->block_active);
+    free(state->block_acc_old);
+    state->block_level = NULL;
+    state->block_active = NULL;
+    state->block_acc_old = NULL;
+    state->block_capacity = 0;
+    state->block_count = 0;
+    state->block_refits = 0;
+    free(state->saved);
+    state->saved = NULL;
+    state->saved_capacity = 0;
+    state->saved_count = 0;
+    collision_grid_free(&state->collisions);
+    pm_free(&state->pm);
+    fmm_free(&state->fmm);
+    morton_free(&state->morton);
+    external_field_free(&state->external);
+    boundary_free(&state->boundary);
+}
+
+// Make sure the per-thread acceleration slices can hold the whole system
+static int ensure_thread_acc(PhysicsState *state, ParticleSystem *ps) {
+    size_t needed = (size_t)state->threads * 3 * ps->capacity;
+    if (needed <= state->thread_acc_capacity) return 1;
+    
+    float *buffer = (float*)realloc(state->thread_acc, needed * sizeof(float));
+    if (!buffer) {
+        fprintf(stderr, "Failed to allocate per-thread acceleration buffers\n");
+        return 0;
+    }
+    state->thread_acc = buffer;
+    state->thread_acc_capacity = needed;
+    return 1;
+}
+
+// Direct O(n²) summation, split across threads
+static void compute_direct_forces(ParticleSystem *ps, PhysicsState *state) {
+    int count = ps->count;
+    int massive = ps->massive_count;
+    state->interactions = (long long)massive * (massive - 1) + (long long)(count - massive) * massive;
+    
+    if (state->kernel == GRAVITY_KERNEL_SCALAR) {
+        // Pair-halved reference loop: per-thread buffers avoid racing on the j side
+        if (state->threads > 1 && ensure_thread_acc(state, ps)) {
+            gravity_direct_pairs_threaded(ps, state->thread_acc, state->threads);
+        } else {
+            gravity_direct_pairs(ps);
+        }
+        return;
+    }
+    
+    // SIMD kernels only write the i side, so contiguous i chunks are race-free.
+    // Chunks are a multiple of the padding so every thread starts on a cache line; the
+    // chunk holding the first tracer is split between the two kernels.
+    int chunk = PARTICLE_PADDING * 4;
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int begin = 0; begin < count; begin += chunk) {
+        int end = begin + chunk < count ? begin + chunk : count;
+        if (begin < massive) gravity_direct_sum(ps, begin, end < massive ? end : massive);
+        if (end > massive) gravity_tracer_sum(ps, begin > massive ? begin : massive, end);
+    }
+}
+
+// Direct summation for a subset of targets; any kernel works since only i rows are written
+static void compute_direct_forces_active(ParticleSystem *ps, PhysicsState *state, const int *active,
+                                         int active_count) {
+    // Tracers feel every massive particle, the massive ones all but themselves
+    long long tracers = 0;
+    for (int k = 0; k < active_count; k++) {
+        tracers += active[k] >= ps->massive_count;
+    }
+    state->interactions = (long long)active_count * (ps->massive_count - 1) + tracers;
+    
+    int chunk = PARTICLE_PADDING * 4;
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int begin = 0; begin < active_count; begin += chunk) {
+        int n = begin + chunk < active_count ? chunk : active_count - begin;
+        gravity_direct_sum_list(ps, active + begin, n);
+    }
+}
+
+// Bring the octree up to date: a full build, or a refit while tree_refit_interval allows
+static int update_tree(ParticleSystem *ps, PhysicsState *state, SimConfig *config) {
+    Octree *tree = &state->tree;
+    tree->parallel_build = config->tree_build;
+    tree->refit_interval = config->tree_refit_interval > state->block_refits ?
+                           config->tree_refit_interval : state->block_refits;
+    tree->refit_growth = config->tree_refit_growth;
+    
+    PROFILE_BEGIN(PROFILE_TREE_BUILD);
+    int updated = octree_update(tree, ps);
+    PROFILE_END(PROFILE_TREE_BUILD);
+    return updated;
+}
+
+// Gravity between the particles with the configured force method, falling back towards
+// direct summation when a method cannot run
+static void compute_method_forces(ParticleSystem *ps, PhysicsState *state, SimConfig *config,
+                                  const int *active, int active_count) {
+    switch (config->force_method) {
+        case 2:
+            // Particle mesh: O(n + m log m) for m mesh cells, plus the P3M pairs
+            if (pm_compute_forces(&state->pm, ps, config, active, active_count)) {
+                state->interactions = active_count + state->pm.pairs;
                 break;
-            case 2:
-                rk4_integrate(&particles[i], dt);
+            }
+            fprintf(stderr, "Particle mesh failed, falling back to Barnes-Hut\n");
+            /* fall through */
+        case 3:
+            // Fast multipole: O(n) cell-cell translations over the octree. Reached from
+            // the particle-mesh fallback too, which goes straight on to Barnes-Hut.
+            if (config->force_method == 3) {
+                if (update_tree(ps, state, config) &&
+                    fmm_compute_forces(&state->fmm, ps, &state->tree, config, active, active_count)) {
+                    state->interactions = state->fmm.p2p + state->fmm.m2l;
+                    break;
+                }
+                fprintf(stderr, "Fast multipole failed, falling back to Barnes-Hut\n");
+            }
+            /* fall through */
+        case 1:
+            // Barnes-Hut: O(n log n) tree walk per particle. The tree always holds every
+            // particle; only the walks are limited to the active ones.
+            state->tree.theta = config->barnes_hut_theta;
+            state->tree.use_quadrupole = config->barnes_hut_quadrupole;
+            if (update_tree(ps, state, config)) {
+                long long interactions = 0;
+                // Each walk only writes its own particle, so the loop parallelises directly
+                #pragma omp parallel for schedule(dynamic, 64) reduction(+:interactions)
+                for (int k = 0; k < active_count; k++) {
+                    int i = active ? active[k] : k;
+                    interactions += apply_barnes_hut_gravity(ps, i, &state->tree);
+                }
+                state->interactions = interactions;
                 break;
-            default:
-                euler_integrate(&particles[i], dt);
+            }
+            fprintf(stderr, "Octree build failed, falling back to direct summation\n");
+            /* fall through */
+        case 0:
+        default:
+            // Calculate gravitational forces between all pairs of particles
+            // This is O(n²) complexity - use the Barnes-Hut method for large simulations
+            if (active) {
+                compute_direct_forces_active(ps, state, active, active_count);
+            } else {
+                compute_direct_forces(ps, state);
+            }
+            break;
+    }
+}
+
+// Compute the accelerations of all particles with the configured force method
+void compute_forces(ParticleSystem *ps, PhysicsState *state, SimConfig *config) {
+    compute_forces_active(ps, state, config, NULL, ps->count);
+}
+
+void compute_forces_active(ParticleSystem *ps, PhysicsState *state, SimConfig *config,
+                           const int *active, int active_count) {
+    PROFILE_BEGIN(PROFILE_FORCES);
+    
+    // First, reset the forces being recomputed; the others keep their last values
+    if (active) {
+        #pragma omp parallel for schedule(static)
+        for (int k = 0; k < active_count; k++) {
+            int i = active[k];
+            ps->ax[i] = 0.0f;
+            ps->ay[i] = 0.0f;
+            ps->az[i] = 0.0f;
         }
+    } else {
+        particle_system_reset_forces(ps);
+    }
+    
+    // Every periodic image has to be seen, which only the direct sum does
+    if (state->boundary.mode == BOUNDARY_PERIODIC) {
+        state->interactions = boundary_periodic_forces(&state->boundary, ps, active, active_count);
+    } else {
+        compute_method_forces(ps, state, config, active, active_count);
+    }
+    
+    // The background field is a fixed table lookup per particle, whatever the method
+    if (state->external.nodes) {
+        PROFILE_BEGIN(PROFILE_EXTERNAL);
+        external_field_apply(&state->external, ps, active, active_count);
+        PROFILE_END(PROFILE_EXTERNAL);
     }
-}
\ No newline at end of file
+    
+    PROFILE_END(PROFILE_FORCES);
+}
+
+// Resolve contacts after the integrator; any change invalidates the cached accelerations
+static void resolve_collisions(ParticleSystem *ps, PhysicsState *state, SimConfig *config) {
+    PROFILE_BEGIN(PROFILE_COLLISIONS);
+    if (collision_step(&state->collisions, ps, config) > 0) {
+        state->acc_valid = 0;
+    }
+    PROFILE_END(PROFILE_COLLISIONS);
+}
+
+// Wrap particles around a periodic box (forces are periodic, so they stay valid) or bounce
+// them off the walls (the reflected velocities need fresh forces at the mirrored positions)
+static void apply_boundaries(ParticleSystem *ps, PhysicsState *state) {
+    PROFILE_BEGIN(PROFILE_INTEGRATE);
+    if (boundary_apply(&state->boundary, ps) > 0) {
+        state->acc_valid = 0;
+    }
+    PROFILE_END(PROFILE_INTEGRATE);
+}
+
+// Sort the particle arrays along the Morton curve so that particles near in space are near
+// in memory. Per-particle solver state is permuted along; accelerations move with their
+// particles, so they stay valid.
+static void reorder_particles(ParticleSystem *ps, PhysicsState *state) {
+    if (ps->count == 0) return; // Nothing to permute, and the arrays may be NULL
+    PROFILE_BEGIN(PROFILE_REORDER);
+    // The octree's leaves refer to particle slots
+    octree_invalidate(&state->tree);
+    if (morton_reorder(&state->morton, ps)) {
+        const int *order = state->morton.index;
+        const int n = ps->count;
+        const int stride = ps->capacity;
+        float *acc = state->morton.permute_scratch;
+        
+        // Block levels and the accelerations of each particle's previous evaluation
+        if (state->block_count == n) {
+            int *level = state->morton.index_scratch;
+            for (int k = 0; k < n; k++) {
+                level[k] = state->block_level[order[k]];
+            }
+            memcpy(state->block_level, level, (size_t)n * sizeof(int));
+            for (int c = 0; c < 3; c++) {
+                float *old = state->block_acc_old + (size_t)c * stride;
+                for (int k = 0; k < n; k++) {
+                    acc[k] = old[order[k]];
+                }
+                memcpy(old, acc, (size_t)n * sizeof(float));
+            }
+        }
+        
+        // The adaptive step's acceleration history
+        if (state->saved_count == n) {
+            for (int c = SAVED_AX; c <= SAVED_AZ; c++) {
+                float *old = state->saved + (size_t)c * stride;
+                for (int k = 0; k < n; k++) {
+                    acc[k] = old[order[k]];
+                }
+                memcpy(old, acc, (size_t)n * sizeof(float));
+            }
+        }
+    }
+    PROFILE_END(PROFILE_REORDER);
+}
+
+// Advance the entire particle system by one step. Forces are evaluated inside the
+// integrator, once per stage.
+void update_particle_system(ParticleSystem *ps, PhysicsState *state, SimConfig *config) {
+    float dt = config->time_step;
+    
+    state->step_interactions = 0;
+    state->step_force_evaluations = 0;
+    state->step_particle_forces = 0;
+    
+    // Block timesteps replace the global-step integrators
+    if (config->block_timesteps) {
+        block_leapfrog_integrate(ps, state, config, dt);
+    } else if (config->adaptive_timestep) {
+        dt = adaptive_integrate(ps, state, config);
+    } else {
+        integrate(ps, state, config, dt);
+    }
+    state->step_dt = dt;
+    
+    if (state->boundary.mode != BOUNDARY_OPEN) {
+        apply_boundaries(ps, state);
+    }
+    
+    if (config->enable_collision) {
+        resolve_collisions(ps, state, config);
+    }
+    
+    state->steps++;
+    if (config->reorder_interval > 0 && state->steps % config->reorder_interval == 0) {
+        reorder_particles(ps, state);
+    }
+}
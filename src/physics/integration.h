@@ -1,18 +1,124 @@
 #ifndef INTEGRATION_H
 #define INTEGRATION_H
 
+#include <stddef.h>
 #include "particle.h"
+#include "octree.h"
+#include "collision.h"
+#include "pm.h"
+#include "fmm.h"
+#include "morton.h"
+#include "external.h"
+#include "boundary.h"
+#include "../utils/config.h"
 
-// Simple Euler integration
-void euler_integrate(Particle *p, float dt);
+// Physics data that persists between steps so it is not reallocated every frame
+typedef struct {
+    Octree tree; // Barnes-Hut / FMM tree, rebuilt or refit in place each force evaluation
+    PMSolver pm; // Particle-mesh workspace, sized on first use
+    FMMSolver fmm; // Fast multipole cells and expansions, sized on first use
+    ExternalField external; // Tabulated background field, built at startup (empty without one)
+    BoundaryBox boundary; // Box walls and the periodic Ewald table, set up at startup
+    int kernel;  // Direct-summation kernel picked at startup (GRAVITY_KERNEL_*)
+    int threads; // Worker threads used by the force and integration phases
+    
+    float *thread_acc;         // Per-thread acceleration slices for the pair-halved reference loop
+    size_t thread_acc_capacity; // Floats allocated in thread_acc
+    
+    float *stage;               // Saved state and stage sums for RK4
+    size_t stage_capacity;      // Floats allocated in stage
+    
+    int acc_valid;              // The accelerations in the particle system match its positions
+    
+    // Block timestep state (config->block_timesteps)
+    int *block_level;           // Per-particle level; level k steps time_step / 2^k
+    int *block_active;          // Particles whose step ends at the current tick
+    float *block_acc_old;       // Acceleration at each particle's previous force evaluation (3 arrays)
+    int block_capacity;         // Particles the block arrays can hold
+    int block_count;            // Particle count the levels were assigned for, 0: not started
+    int block_refits;           // Tree refits allowed in a row during a block step's sub-ticks
+    
+    // Adaptive global timestep state (config->adaptive_timestep)
+    float *saved;               // Start-of-step positions, velocities and accelerations
+    size_t saved_capacity;      // Floats allocated in saved
+    int saved_count;            // Particle count the saved accelerations belong to, 0: none
+    float saved_dt;             // Step the saved accelerations were taken before
+    float step_dt;              // Size of the last step taken by update_particle_system
+    
+    CollisionGrid collisions;   // Spatial hash for config->enable_collision
+    MortonOrder morton;         // Key sort for config->reorder_interval
+    long long steps;            // Calls to update_particle_system so far
+    
+    long long interactions;      // Particle-particle/cell interactions evaluated by the last compute_forces
+    long long step_interactions; // Interactions summed over every force evaluation of the last step
+    int step_force_evaluations;  // Force evaluations in the last step
+    long long step_particle_forces; // Particle accelerations computed in the last step
+} PhysicsState;
 
-// Velocity Verlet integration (more accurate)
-void verlet_integrate(Particle *p, float dt);
+// Integrators advance ps by dt. Each stage re-evaluates the accelerations through
+// compute_forces; accelerations still valid from the previous step are reused.
 
-// Runge-Kutta 4th order integration (most accurate)
-void rk4_integrate(Particle *p, float dt);
+// Semi-implicit Euler: 1st order, 1 force evaluation per step
+void euler_integrate(ParticleSystem *ps, PhysicsState *state, SimConfig *config, float dt);
 
-// Update the entire particle system using the selected integration method
-void update_particle_system(Particle *particles, int count, float dt, int integration_method);
+// Kick-drift-kick leapfrog (velocity Verlet): 2nd order, symplectic, 1 evaluation per step
+void leapfrog_integrate(ParticleSystem *ps, PhysicsState *state, SimConfig *config, float dt);
+
+// Classical Runge-Kutta: 4th order, not symplectic, 4 evaluations per step
+void rk4_integrate(ParticleSystem *ps, PhysicsState *state, SimConfig *config, float dt);
+
+// Yoshida / Forest-Ruth: 4th order, symplectic, 3 evaluations per step
+void yoshida_integrate(ParticleSystem *ps, PhysicsState *state, SimConfig *config, float dt);
+
+// Wisdom-Holman mixed-variable map: exact Kepler orbits about the central body (ID 0)
+// with the mutual perturbations of the other bodies as kicks. 2nd order in the
+// perturbation strength, symplectic, 1 evaluation per step; falls back to leapfrog when
+// there is no central body.
+void wisdom_holman_integrate(ParticleSystem *ps, PhysicsState *state, SimConfig *config, float dt);
+
+// Hierarchical (power-of-two) block timesteps on a kick-drift-kick leapfrog. Level k
+// particles step dt / 2^k; at every tick only the particles whose step ends there get new
+// forces and kicks. Levels come from the jerk criterion block_eta * |a| / |da/dt| and may
+// only grow the step where the block boundaries line up. Ticks with no particle due skip
+// the force phase, and the tree methods refit their octree between the step's ticks
+// (whatever tree_refit_interval says) instead of rebuilding it for every tick.
+void block_leapfrog_integrate(ParticleSystem *ps, PhysicsState *state, SimConfig *config, float dt);
+
+// One step of the configured integrator with a size chosen from the particles' state:
+// eta * max|v| / max|a|, and with adaptive_jerk also eta * |a| / |da/dt| per particle
+// (Aarseth's criterion cut to the first derivative, da/dt from the previous step), clamped
+// to [adaptive_min_step, adaptive_max_step]. The symplectic integrators (leapfrog, Yoshida,
+// Wisdom-Holman) redo the step adaptive_symmetric times with the mean of the criterion at
+// both ends, which makes the step selection time-symmetric. Returns the step taken.
+float adaptive_integrate(ParticleSystem *ps, PhysicsState *state, SimConfig *config);
+
+// Short name of an integration_method value
+const char *integrator_name(int method);
+
+// Whether an integration_method value is symplectic (leapfrog, Yoshida, Wisdom-Holman)
+int integrator_is_symplectic(int method);
+
+// Initialize physics state for the given configuration
+void physics_state_init(PhysicsState *state, SimConfig *config);
+
+// Apply the configured worker thread count to the calling thread. Needed by any
+// thread other than the one that called physics_state_init before it steps.
+void physics_state_attach_thread(PhysicsState *state);
+
+// Free memory owned by the physics state
+void physics_state_cleanup(PhysicsState *state);
+
+// Reset and recompute the accelerations of all particles (force phase only), including
+// the external potential. A periodic box replaces the force method with its own direct sum.
+void compute_forces(ParticleSystem *ps, PhysicsState *state, SimConfig *config);
+
+// Reset and recompute the accelerations of the listed particles only, from all particles.
+// With active NULL, all active_count == ps->count particles are computed.
+void compute_forces_active(ParticleSystem *ps, PhysicsState *state, SimConfig *config,
+                           const int *active, int active_count);
+
+// Advance the entire particle system by one step of the configured integrator; the step
+// size is left in state->step_dt
+void update_particle_system(ParticleSystem *ps, PhysicsState *state, SimConfig *config);
 
 #endif /* INTEGRATION_H */
\ No newline at end of file
@@ -0,0 +1,224 @@
+#include "morton.h"
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+void morton_init(MortonOrder *order) {
+    memset(order, 0, sizeof(*order));
+}
+
+void morton_free(MortonOrder *order) {
+    free(order->keys);
+    free(order->key_scratch);
+    free(order->index);
+    free(order->index_scratch);
+    free(order->permute_scratch);
+    free(order->histogram);
+    memset(order, 0, sizeof(*order));
+}
+
+// Spread the low 21 bits of v so two zero bits follow each one
+static uint64_t expand_bits(uint32_t v) {
+    uint64_t x = v & 0x1fffffu;
+    x = (x | x << 32) & 0x1f00000000ffffull;
+    x = (x | x << 16) & 0x1f0000ff0000ffull;
+    x = (x | x << 8) & 0x100f00f00f00f00full;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+    x = (x | x << 2) & 0x1249249249249249ull;
+    return x;
+}
+
+uint64_t morton_encode(uint32_t x, uint32_t y, uint32_t z) {
+    return expand_bits(x) << 2 | expand_bits(y) << 1 | expand_bits(z);
+}
+
+// Inverse of expand_bits: gather every third bit
+static uint32_t compact_bits(uint64_t x) {
+    x &= 0x1249249249249249ull;
+    x = (x | x >> 2) & 0x10c30c30c30c30c3ull;
+    x = (x | x >> 4) & 0x100f00f00f00f00full;
+    x = (x | x >> 8) & 0x1f0000ff0000ffull;
+    x = (x | x >> 16) & 0x1f00000000ffffull;
+    x = (x | x >> 32) & 0x1fffffull;
+    return (uint32_t)x;
+}
+
+void morton_decode(uint64_t key, uint32_t *x, uint32_t *y, uint32_t *z) {
+    *x = compact_bits(key >> 2);
+    *y = compact_bits(key >> 1);
+    *z = compact_bits(key);
+}
+
+static int reserve(MortonOrder *order, int count, int threads) {
+    if (count > order->capacity) {
+        uint64_t *keys = realloc(order->keys, (size_t)count * sizeof(uint64_t));
+        if (keys) order->keys = keys;
+        uint64_t *key_scratch = realloc(order->key_scratch, (size_t)count * sizeof(uint64_t));
+        if (key_scratch) order->key_scratch = key_scratch;
+        int *index = realloc(order->index, (size_t)count * sizeof(int));
+        if (index) order->index = index;
+        int *index_scratch = realloc(order->index_scratch, (size_t)count * sizeof(int));
+        if (index_scratch) order->index_scratch = index_scratch;
+        void *permute_scratch = realloc(order->permute_scratch, (size_t)count * sizeof(Vec3));
+        if (permute_scratch) order->permute_scratch = permute_scratch;
+        if (!keys || !key_scratch || !index || !index_scratch || !permute_scratch) {
+            fprintf(stderr, "Morton: failed to allocate sort buffers\n");
+            return 0;
+        }
+        order->capacity = count;
+    }
+    if (threads > order->histogram_threads) {
+        size_t *histogram = realloc(order->histogram, (size_t)threads * MORTON_RADIX * sizeof(size_t));
+        if (!histogram) {
+            fprintf(stderr, "Morton: failed to allocate sort buffers\n");
+            return 0;
+        }
+        order->histogram = histogram;
+        order->histogram_threads = threads;
+    }
+    return 1;
+}
+
+// Keys from positions inside the cube at the lower corner of the bounding box. Particles
+// from slot split on get the spare top bit, so they sort after all the others.
+static void compute_keys(MortonOrder *order, const ParticleSystem *ps, int split) {
+    const int n = ps->count;
+    float min_x = FLT_MAX, min_y = FLT_MAX, min_z = FLT_MAX;
+    float max_x = -FLT_MAX, max_y = -FLT_MAX, max_z = -FLT_MAX;
+
+    #pragma omp parallel for schedule(static) reduction(min:min_x, min_y, min_z) reduction(max:max_x, max_y, max_z)
+    for (int i = 0; i < n; i++) {
+        if (ps->x[i] < min_x) min_x = ps->x[i];
+        if (ps->y[i] < min_y) min_y = ps->y[i];
+        if (ps->z[i] < min_z) min_z = ps->z[i];
+        if (ps->x[i] > max_x) max_x = ps->x[i];
+        if (ps->y[i] > max_y) max_y = ps->y[i];
+        if (ps->z[i] > max_z) max_z = ps->z[i];
+    }
+
+    float extent = max_x - min_x;
+    if (max_y - min_y > extent) extent = max_y - min_y;
+    if (max_z - min_z > extent) extent = max_z - min_z;
+    // Pad slightly so particles on the upper faces fall strictly inside the cube
+    order->origin = (Vec3){min_x, min_y, min_z};
+    order->size = extent * 1.001f + 1e-6f;
+
+    // Largest cell index the quantisation may produce
+    const float top = (float)((1u << MORTON_BITS) - 1);
+    float scale = (float)(1u << MORTON_BITS) / order->size;
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        float fx = (ps->x[i] - min_x) * scale;
+        float fy = (ps->y[i] - min_y) * scale;
+        float fz = (ps->z[i] - min_z) * scale;
+        // Rounding at the top edge can reach 2^MORTON_BITS; NaN positions land in cell 0
+        uint32_t qx = fx < top ? (fx > 0.0f ? (uint32_t)fx : 0u) : (uint32_t)top;
+        uint32_t qy = fy < top ? (fy > 0.0f ? (uint32_t)fy : 0u) : (uint32_t)top;
+        uint32_t qz = fz < top ? (fz > 0.0f ? (uint32_t)fz : 0u) : (uint32_t)top;
+        order->keys[i] = morton_encode(qx, qy, qz) | (uint64_t)(i >= split) << 63;
+        order->index[i] = i;
+    }
+}
+
+// Stable LSD radix sort of keys with their indices. Each thread histograms and then
+// scatters its own contiguous chunk, so equal digits keep their order across threads.
+// Passes where every key has the same digit are skipped.
+static void radix_sort(MortonOrder *order, int n, int threads) {
+    uint64_t *keys = order->keys, *keys_out = order->key_scratch;
+    int *index = order->index, *index_out = order->index_scratch;
+    size_t *histogram = order->histogram;
+
+    for (int shift = 0; shift < 3 * MORTON_BITS; shift += MORTON_RADIX_BITS) {
+        int skip = 0;
+
+        #pragma omp parallel num_threads(threads)
+        {
+#ifdef _OPENMP
+            int t = omp_get_thread_num();
+            int team = omp_get_num_threads();
+#else
+            int t = 0;
+            int team = 1;
+#endif
+            int begin = (int)((long long)n * t / team);
+            int end = (int)((long long)n * (t + 1) / team);
+            size_t *counts = histogram + (size_t)t * MORTON_RADIX;
+
+            memset(counts, 0, MORTON_RADIX * sizeof(size_t));
+            for (int i = begin; i < end; i++) {
+                counts[(keys[i] >> shift) & (MORTON_RADIX - 1)]++;
+            }
+            #pragma omp barrier
+
+            // Turn the counts into each thread's first output position per digit
+            #pragma omp single
+            {
+                size_t offset = 0;
+                for (int d = 0; d < MORTON_RADIX; d++) {
+                    size_t digit_total = 0;
+                    for (int k = 0; k < team; k++) {
+                        size_t c = histogram[(size_t)k * MORTON_RADIX + d];
+                        histogram[(size_t)k * MORTON_RADIX + d] = offset + digit_total;
+                        digit_total += c;
+                    }
+                    if (digit_total == (size_t)n) skip = 1;
+                    offset += digit_total;
+                }
+            }
+
+            if (!skip) {
+                for (int i = begin; i < end; i++) {
+                    size_t position = counts[(keys[i] >> shift) & (MORTON_RADIX - 1)]++;
+                    keys_out[position] = keys[i];
+                    index_out[position] = index[i];
+                }
+            }
+        }
+
+        if (!skip) {
+            uint64_t *swap_keys = keys;
+            keys = keys_out;
+            keys_out = swap_keys;
+            int *swap_index = index;
+            index = index_out;
+            index_out = swap_index;
+        }
+    }
+
+    // The sorted data may have ended in the scratch arrays
+    order->keys = keys;
+    order->key_scratch = keys_out;
+    order->index = index;
+    order->index_scratch = index_out;
+}
+
+static int sort_particles(MortonOrder *order, const ParticleSystem *ps, int split) {
+#ifdef _OPENMP
+    int threads = omp_get_max_threads();
+#else
+    int threads = 1;
+#endif
+    if (!reserve(order, ps->count, threads)) return 0;
+    if (ps->count == 0) return 1;
+
+    compute_keys(order, ps, split);
+    radix_sort(order, ps->count, threads);
+    return 1;
+}
+
+int morton_sort_particles(MortonOrder *order, const ParticleSystem *ps) {
+    return sort_particles(order, ps, ps->count);
+}
+
+int morton_reorder(MortonOrder *order, ParticleSystem *ps) {
+    // Tracers are sorted among themselves and stay behind the massive particles
+    if (!sort_particles(order, ps, ps->massive_count)) return 0;
+    particle_system_permute(ps, order->index, order->permute_scratch);
+    return 1;
+}
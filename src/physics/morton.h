@@ -0,0 +1,51 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <stdint.h>
+#include "particle.h"
+
+// Morton (Z-curve) ordering. Positions are quantised to MORTON_BITS bits per axis inside
+// a cube just enclosing the particles' bounding box and the bits interleaved (x highest),
+// so particles close in the key order are close in space. Every 3 key bits from the top
+// pick an octant of the cube, so a key prefix of 3m bits names a cell of an octree at
+// depth m.
+
+#define MORTON_BITS 21 // Bits per axis; keys use 63 bits
+
+// Key bits consumed per radix sort pass
+#define MORTON_RADIX_BITS 8
+#define MORTON_RADIX (1 << MORTON_RADIX_BITS)
+
+typedef struct {
+    uint64_t *keys;        // Particle keys, in sorted order after morton_sort_particles
+    uint64_t *key_scratch;
+    int *index;            // Slot of the particle with each sorted key
+    int *index_scratch;
+    void *permute_scratch; // Staging for particle_system_permute (one Vec3 per particle)
+    int capacity;          // Particles the arrays can hold
+    Vec3 origin;           // Lower corner of the quantisation cube of the last sort
+    float size;            // Its edge length
+
+    size_t *histogram;     // MORTON_RADIX counts per thread
+    int histogram_threads;
+} MortonOrder;
+
+void morton_init(MortonOrder *order);
+void morton_free(MortonOrder *order);
+
+// Interleave three MORTON_BITS-bit coordinates
+uint64_t morton_encode(uint32_t x, uint32_t y, uint32_t z);
+
+// Split a key back into its three coordinates
+void morton_decode(uint64_t key, uint32_t *x, uint32_t *y, uint32_t *z);
+
+// Compute the keys of all particles and sort them, leaving keys and index in key order.
+// Returns 0 on allocation failure.
+int morton_sort_particles(MortonOrder *order, const ParticleSystem *ps);
+
+// Sort the particles by key and permute the particle arrays into that order; order->index
+// then maps each new slot to its old one. Massive particles and tracers are sorted
+// separately, so both stay contiguous. Returns 0 on allocation failure.
+int morton_reorder(MortonOrder *order, ParticleSystem *ps);
+
+#endif /* MORTON_H */
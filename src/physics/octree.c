@@ -0,0 +1,655 @@
+#include "octree.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Tree levels whose children are refit as separate tasks; deeper subtrees stay on one thread
+#define OCTREE_TASK_DEPTH 4
+
+void octree_init(Octree *tree, float theta, int use_quadrupole) {
+    tree->nodes = NULL;
+    tree->node_count = 0;
+    tree->node_capacity = 0;
+    tree->next = NULL;
+    tree->next_capacity = 0;
+    tree->ps = NULL;
+    tree->theta = theta;
+    tree->use_quadrupole = use_quadrupole;
+    tree->parallel_build = 0;
+    tree->refit_interval = 0;
+    tree->refit_growth = 1.0f;
+    tree->refits = 0;
+    tree->built_count = -1;
+    tree->built_size = 0.0;
+    tree->quality = 1.0;
+
+    morton_init(&tree->morton);
+    arena_init(&tree->scratch);
+    tree->radix_parent = NULL;
+    tree->radix_prefix = NULL;
+    tree->radix_first = NULL;
+    tree->radix_last = NULL;
+    tree->cell_offset = NULL;
+    tree->node_parent = NULL;
+    tree->node_pending = NULL;
+}
+
+void octree_free(Octree *tree) {
+    free(tree->nodes);
+    free(tree->next);
+    morton_free(&tree->morton);
+    arena_free(&tree->scratch);
+
+    int parallel_build = tree->parallel_build;
+    int refit_interval = tree->refit_interval;
+    float refit_growth = tree->refit_growth;
+    octree_init(tree, tree->theta, tree->use_quadrupole);
+    tree->parallel_build = parallel_build;
+    tree->refit_interval = refit_interval;
+    tree->refit_growth = refit_growth;
+}
+
+// Append an empty node covering the given cube, growing the pool if needed.
+// Returns the new node index, or -1 if the pool could not grow.
+static int octree_new_node(Octree *tree, Vec3 center, float half_size) {
+    if (tree->node_count == tree->node_capacity) {
+        int new_capacity = tree->node_capacity ? tree->node_capacity * 2 : 1024;
+        OctreeNode *nodes = (OctreeNode*)realloc(tree->nodes, new_capacity * sizeof(OctreeNode));
+        if (!nodes) {
+            fprintf(stderr, "Failed to allocate memory for octree nodes\n");
+            return -1;
+        }
+        tree->nodes = nodes;
+        tree->node_capacity = new_capacity;
+    }
+
+    int index = tree->node_count++;
+    OctreeNode *node = &tree->nodes[index];
+    node->center = center;
+    node->half_size = half_size;
+    node->com = (Vec3){0.0f, 0.0f, 0.0f};
+    node->mass = 0.0f;
+    for (int i = 0; i < 6; i++) node->quad[i] = 0.0f;
+    for (int i = 0; i < 8; i++) node->children[i] = -1;
+    node->particle = -1;
+    node->count = 0;
+    return index;
+}
+
+// Return the child of node_index containing position, creating it if necessary
+static int octree_child_for(Octree *tree, int node_index, Vec3 position) {
+    OctreeNode *node = &tree->nodes[node_index];
+    int octant = (position.x >= node->center.x ? 1 : 0) |
+                 (position.y >= node->center.y ? 2 : 0) |
+                 (position.z >= node->center.z ? 4 : 0);
+
+    if (node->children[octant] >= 0) {
+        return node->children[octant];
+    }
+
+    float quarter = node->half_size * 0.5f;
+    Vec3 center = {
+        node->center.x + ((octant & 1) ? quarter : -quarter),
+        node->center.y + ((octant & 2) ? quarter : -quarter),
+        node->center.z + ((octant & 4) ? quarter : -quarter)
+    };
+
+    // The pool may move, so the child link is written through the index afterwards
+    int child = octree_new_node(tree, center, quarter);
+    if (child >= 0) {
+        tree->nodes[node_index].children[octant] = child;
+    }
+    return child;
+}
+
+static int octree_insert(Octree *tree, int p) {
+    int node_index = 0;
+    int depth = 0;
+    ParticleSystem *ps = tree->ps;
+    Vec3 position = {ps->x[p], ps->y[p], ps->z[p]};
+
+    for (;;) {
+        OctreeNode *node = &tree->nodes[node_index];
+
+        // Empty cell: the particle becomes its only occupant
+        if (node->count == 0) {
+            node->particle = p;
+            node->count = 1;
+            tree->next[p] = -1;
+            return 1;
+        }
+
+        // Occupied leaf: either chain the particle or push the resident down a level
+        if (node->particle >= 0) {
+            if (depth >= OCTREE_MAX_DEPTH) {
+                tree->next[p] = node->particle;
+                node->particle = p;
+                node->count++;
+                return 1;
+            }
+
+            int resident = node->particle;
+            node->particle = -1;
+            Vec3 resident_position = {ps->x[resident], ps->y[resident], ps->z[resident]};
+            int child = octree_child_for(tree, node_index, resident_position);
+            if (child < 0) return 0;
+            tree->nodes[child].particle = resident;
+            tree->nodes[child].count = 1;
+        }
+
+        tree->nodes[node_index].count++;
+        node_index = octree_child_for(tree, node_index, position);
+        if (node_index < 0) return 0;
+        depth++;
+    }
+}
+
+// Accumulate the quadrupole of a point mass m at offset d from the expansion center
+static void add_point_quadrupole(float *quad, float m, float dx, float dy, float dz) {
+    float r2 = dx * dx + dy * dy + dz * dz;
+    quad[0] += m * (3.0f * dx * dx - r2);
+    quad[1] += m * (3.0f * dx * dy);
+    quad[2] += m * (3.0f * dx * dz);
+    quad[3] += m * (3.0f * dy * dy - r2);
+    quad[4] += m * (3.0f * dy * dz);
+    quad[5] += m * (3.0f * dz * dz - r2);
+}
+
+// Compute mass, center of mass and (optionally) quadrupole moments of one node from its
+// particles or, for internal nodes, from the finished moments of its children
+static void compute_node_moments(Octree *tree, int node_index) {
+    OctreeNode *node = &tree->nodes[node_index];
+    ParticleSystem *ps = tree->ps;
+    float mass = 0.0f;
+    Vec3 weighted = {0.0f, 0.0f, 0.0f};
+
+    if (node->particle >= 0) {
+        for (int p = node->particle; p >= 0; p = tree->next[p]) {
+            mass += ps->mass[p];
+            weighted.x += ps->mass[p] * ps->x[p];
+            weighted.y += ps->mass[p] * ps->y[p];
+            weighted.z += ps->mass[p] * ps->z[p];
+        }
+    } else {
+        for (int c = 0; c < 8; c++) {
+            int child_index = node->children[c];
+            if (child_index < 0) continue;
+            OctreeNode *child = &tree->nodes[child_index];
+            mass += child->mass;
+            weighted.x += child->mass * child->com.x;
+            weighted.y += child->mass * child->com.y;
+            weighted.z += child->mass * child->com.z;
+        }
+    }
+
+    node->mass = mass;
+    node->com = mass > 0.0f ? vec3_div(weighted, mass) : node->center;
+
+    if (!tree->use_quadrupole) return;
+
+    // Leaves sum their particles directly; internal nodes shift child moments
+    // to this node's center of mass (parallel-axis theorem for the traceless tensor)
+    if (node->particle >= 0) {
+        for (int p = node->particle; p >= 0; p = tree->next[p]) {
+            add_point_quadrupole(node->quad, ps->mass[p],
+                                 ps->x[p] - node->com.x,
+                                 ps->y[p] - node->com.y,
+                                 ps->z[p] - node->com.z);
+        }
+    } else {
+        for (int c = 0; c < 8; c++) {
+            int child_index = node->children[c];
+            if (child_index < 0) continue;
+            OctreeNode *child = &tree->nodes[child_index];
+            for (int k = 0; k < 6; k++) node->quad[k] += child->quad[k];
+            add_point_quadrupole(node->quad, child->mass,
+                                 child->com.x - node->com.x,
+                                 child->com.y - node->com.y,
+                                 child->com.z - node->com.z);
+        }
+    }
+}
+
+// Compute the moments of a subtree, children first
+static void octree_compute_moments(Octree *tree, int node_index) {
+    if (tree->nodes[node_index].particle < 0) {
+        for (int c = 0; c < 8; c++) {
+            int child_index = tree->nodes[node_index].children[c];
+            if (child_index >= 0) octree_compute_moments(tree, child_index);
+        }
+    }
+    compute_node_moments(tree, node_index);
+}
+
+static int reserve_next(Octree *tree, int count) {
+    if (count > tree->next_capacity) {
+        int *next = (int*)realloc(tree->next, count * sizeof(int));
+        if (!next) {
+            fprintf(stderr, "Failed to allocate memory for octree leaf chains\n");
+            return 0;
+        }
+        tree->next = next;
+        tree->next_capacity = count;
+    }
+    return 1;
+}
+
+// Serial build: insert the particles one at a time from the root
+static int octree_build_serial(Octree *tree, ParticleSystem *ps) {
+    int count = ps->count;
+
+    // Bounding cube of all particles
+    Vec3 min = {0.0f, 0.0f, 0.0f};
+    Vec3 max = {0.0f, 0.0f, 0.0f};
+    if (count > 0) {
+        min = max = (Vec3){ps->x[0], ps->y[0], ps->z[0]};
+    }
+    for (int i = 1; i < count; i++) {
+        Vec3 p = {ps->x[i], ps->y[i], ps->z[i]};
+        if (p.x < min.x) min.x = p.x;
+        if (p.y < min.y) min.y = p.y;
+        if (p.z < min.z) min.z = p.z;
+        if (p.x > max.x) max.x = p.x;
+        if (p.y > max.y) max.y = p.y;
+        if (p.z > max.z) max.z = p.z;
+    }
+
+    Vec3 center = vec3_mul(vec3_add(min, max), 0.5f);
+    float half_size = fmaxf(max.x - min.x, fmaxf(max.y - min.y, max.z - min.z)) * 0.5f;
+    // Pad slightly so particles on the upper faces fall strictly inside the root
+    half_size = half_size * 1.001f + 1e-6f;
+
+    if (octree_new_node(tree, center, half_size) < 0) return 0;
+
+    for (int i = 0; i < count; i++) {
+        if (!octree_insert(tree, i)) return 0;
+    }
+
+    octree_compute_moments(tree, 0);
+    return 1;
+}
+
+// Radix tree arrays for count keys from the build scratch
+static int reserve_radix(Octree *tree, int count) {
+    Arena *scratch = &tree->scratch;
+    // A radix tree over n keys has n - 1 internal nodes and n leaves
+    tree->radix_parent = arena_alloc(scratch, 2 * (size_t)count * sizeof(int));
+    tree->radix_prefix = arena_alloc(scratch, (size_t)count * sizeof(int));
+    tree->radix_first = arena_alloc(scratch, (size_t)count * sizeof(int));
+    tree->radix_last = arena_alloc(scratch, (size_t)count * sizeof(int));
+    tree->cell_offset = arena_alloc(scratch, 2 * (size_t)count * sizeof(int));
+    if (!tree->radix_parent || !tree->radix_prefix || !tree->radix_first || !tree->radix_last ||
+        !tree->cell_offset) {
+        fprintf(stderr, "Failed to allocate memory for the octree radix tree\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Node pool for count nodes, plus the moment-pass arrays from the build scratch
+static int reserve_nodes(Octree *tree, int count) {
+    if (count > tree->node_capacity) {
+        int new_capacity = tree->node_capacity ? tree->node_capacity : 1024;
+        while (new_capacity < count) new_capacity *= 2;
+        OctreeNode *nodes = (OctreeNode*)realloc(tree->nodes, new_capacity * sizeof(OctreeNode));
+        if (!nodes) {
+            fprintf(stderr, "Failed to allocate memory for octree nodes\n");
+            return 0;
+        }
+        tree->nodes = nodes;
+        tree->node_capacity = new_capacity;
+    }
+    tree->node_parent = arena_alloc(&tree->scratch, (size_t)count * sizeof(int));
+    tree->node_pending = arena_alloc(&tree->scratch, (size_t)count * sizeof(atomic_int));
+    if (!tree->node_parent || !tree->node_pending) {
+        fprintf(stderr, "Failed to allocate memory for octree nodes\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Length in bits of the common prefix of sorted keys i and j, or -1 when j is out of
+// range. Equal keys continue with the common prefix of their positions, so duplicates
+// still split into a proper binary tree.
+static inline int radix_delta(const uint64_t *keys, int n, int i, int j) {
+    if (j < 0 || j >= n) return -1;
+    uint64_t diff = keys[i] ^ keys[j];
+    // The top bit of a key is always clear
+    if (diff) return __builtin_clzll(diff) - 1;
+    return 3 * MORTON_BITS + __builtin_clz((unsigned)(i ^ j));
+}
+
+// Deepest octree level whose cell holds every key sharing a prefix of the given length
+static inline int prefix_depth(int prefix) {
+    return (prefix < 3 * MORTON_BITS ? prefix : 3 * MORTON_BITS) / 3;
+}
+
+// Octant of the level-depth cell holding key inside its parent cell
+static inline int key_octant(uint64_t key, int depth) {
+    int digit = (int)(key >> (3 * (MORTON_BITS - depth))) & 7;
+    // Keys interleave x, y, z from the high bit; octants use x = 1, y = 2, z = 4
+    return (digit >> 2 & 1) | (digit & 2) | (digit & 1) << 2;
+}
+
+// Level of the first octree cell belonging to radix node r. The cells of an internal node
+// run from just below its parent's deepest cell down to the depth of its own prefix; a
+// leaf gets one cell, just below its parent, unless it is one of several equal keys.
+static inline int radix_top_depth(const Octree *tree, int r) {
+    return r == 0 ? 0 : prefix_depth(tree->radix_prefix[tree->radix_parent[r]]) + 1;
+}
+
+static inline int radix_cell_count(const Octree *tree, int n, int r) {
+    if (r >= n - 1) {
+        return tree->radix_prefix[tree->radix_parent[r]] < 3 * MORTON_BITS ? 1 : 0;
+    }
+    return prefix_depth(tree->radix_prefix[r]) - radix_top_depth(tree, r) + 1;
+}
+
+// Binary radix tree over the sorted keys (Karras 2012): each internal node finds its key
+// range and split on its own, so all of them are built in parallel
+static void build_radix_tree(Octree *tree, int n) {
+    const uint64_t *keys = tree->morton.keys;
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n - 1; i++) {
+        // Direction of the range: towards the neighbour sharing the longer prefix
+        int d = radix_delta(keys, n, i, i + 1) > radix_delta(keys, n, i, i - 1) ? 1 : -1;
+        int delta_min = radix_delta(keys, n, i, i - d);
+
+        // Far end of the range: exponential then binary search
+        int length_max = 2;
+        while (radix_delta(keys, n, i, i + length_max * d) > delta_min) length_max *= 2;
+        int length = 0;
+        for (int t = length_max / 2; t >= 1; t /= 2) {
+            if (radix_delta(keys, n, i, i + (length + t) * d) > delta_min) length += t;
+        }
+        int j = i + length * d;
+        int delta_node = radix_delta(keys, n, i, j);
+
+        // Split: the last key sharing more than delta_node bits with key i
+        int split = 0;
+        int t = length;
+        do {
+            t = (t + 1) / 2;
+            if (radix_delta(keys, n, i, i + (split + t) * d) > delta_node) split += t;
+        } while (t > 1);
+        int gamma = i + split * d + (d < 0 ? d : 0);
+
+        int first = i < j ? i : j;
+        int last = i < j ? j : i;
+        int left = first == gamma ? n - 1 + gamma : gamma;
+        int right = last == gamma + 1 ? n + gamma : gamma + 1;
+
+        tree->radix_prefix[i] = delta_node;
+        tree->radix_first[i] = first;
+        tree->radix_last[i] = last;
+        tree->radix_parent[left] = i;
+        tree->radix_parent[right] = i;
+    }
+    tree->radix_parent[0] = -1;
+}
+
+// Fill the chain of octree cells of radix node r and link them to each other
+static void fill_cells(Octree *tree, int n, int r) {
+    int cell = tree->cell_offset[r];
+    int cells = tree->cell_offset[r + 1] - cell;
+    if (cells == 0) return;
+
+    int leaf = r >= n - 1;
+    int first = leaf ? r - (n - 1) : tree->radix_first[r];
+    int last = leaf ? first : tree->radix_last[r];
+    uint64_t key = tree->morton.keys[first];
+    int top = radix_top_depth(tree, r);
+    Vec3 origin = tree->morton.origin;
+
+    for (int k = 0; k < cells; k++) {
+        int depth = top + k;
+        uint32_t cx, cy, cz;
+        morton_decode(key >> (3 * (MORTON_BITS - depth)), &cx, &cy, &cz);
+        float edge = tree->morton.size / (float)(1u << depth);
+
+        OctreeNode *node = &tree->nodes[cell + k];
+        node->center = (Vec3){
+            origin.x + ((float)cx + 0.5f) * edge,
+            origin.y + ((float)cy + 0.5f) * edge,
+            origin.z + ((float)cz + 0.5f) * edge
+        };
+        node->half_size = 0.5f * edge;
+        node->com = (Vec3){0.0f, 0.0f, 0.0f};
+        node->mass = 0.0f;
+        for (int q = 0; q < 6; q++) node->quad[q] = 0.0f;
+        for (int c = 0; c < 8; c++) node->children[c] = -1;
+        node->particle = -1;
+        node->count = last - first + 1;
+
+        // Every cell but the deepest has exactly one child, the next cell of the chain
+        if (k + 1 < cells) {
+            node->children[key_octant(key, depth + 1)] = cell + k + 1;
+            tree->node_parent[cell + k + 1] = cell + k;
+        }
+    }
+
+    // Leaves hold their particle; a range of equal keys ends in one leaf holding them all
+    const int *index = tree->morton.index;
+    if (leaf || tree->radix_prefix[r] >= 3 * MORTON_BITS) {
+        for (int k = first; k < last; k++) tree->next[index[k]] = index[k + 1];
+        tree->next[index[last]] = -1;
+        tree->nodes[cell + cells - 1].particle = index[first];
+    }
+}
+
+// Parallel build: sort the Morton keys, derive the radix tree and read the octree off it
+static int octree_build_parallel(Octree *tree, ParticleSystem *ps) {
+    const int n = ps->count;
+    const int radix_nodes = 2 * n - 1;
+
+    arena_reset(&tree->scratch);
+    if (!morton_sort_particles(&tree->morton, ps)) return 0;
+    if (!reserve_radix(tree, n)) return 0;
+    build_radix_tree(tree, n);
+
+    // Octree nodes of each radix node: internal nodes first, so the root cell is node 0.
+    // Exclusive scan of the counts: each thread sums its chunk, then writes its offsets
+    // starting after the chunks before it.
+#ifdef _OPENMP
+    int threads = omp_get_max_threads();
+#else
+    int threads = 1;
+#endif
+    int *chunk_total = arena_alloc(&tree->scratch, (size_t)threads * sizeof(int));
+    if (!chunk_total) return 0;
+
+    #pragma omp parallel num_threads(threads)
+    {
+#ifdef _OPENMP
+        int t = omp_get_thread_num();
+        int team = omp_get_num_threads();
+#else
+        int t = 0;
+        int team = 1;
+#endif
+        int begin = (int)((long long)radix_nodes * t / team);
+        int end = (int)((long long)radix_nodes * (t + 1) / team);
+
+        int sum = 0;
+        for (int r = begin; r < end; r++) sum += radix_cell_count(tree, n, r);
+        chunk_total[t] = sum;
+        #pragma omp barrier
+
+        int offset = 0;
+        for (int k = 0; k < t; k++) offset += chunk_total[k];
+        for (int r = begin; r < end; r++) {
+            tree->cell_offset[r] = offset;
+            offset += radix_cell_count(tree, n, r);
+        }
+    }
+    int total = tree->cell_offset[radix_nodes - 1] + radix_cell_count(tree, n, radix_nodes - 1);
+    tree->cell_offset[radix_nodes] = total;
+
+    if (!reserve_nodes(tree, total)) return 0;
+    tree->node_count = total;
+
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < radix_nodes; r++) {
+        fill_cells(tree, n, r);
+    }
+
+    // Hang the first cell of each radix node below the deepest cell of the nearest
+    // ancestor that has cells of its own
+    tree->node_parent[0] = -1;
+    #pragma omp parallel for schedule(static)
+    for (int r = 1; r < radix_nodes; r++) {
+        int cell = tree->cell_offset[r];
+        if (tree->cell_offset[r + 1] == cell) continue;
+
+        int ancestor = tree->radix_parent[r];
+        while (tree->cell_offset[ancestor + 1] == tree->cell_offset[ancestor]) {
+            ancestor = tree->radix_parent[ancestor];
+        }
+        int parent = tree->cell_offset[ancestor + 1] - 1;
+        int first = r >= n - 1 ? r - (n - 1) : tree->radix_first[r];
+        int octant = key_octant(tree->morton.keys[first], radix_top_depth(tree, r));
+        tree->nodes[parent].children[octant] = cell;
+        tree->node_parent[cell] = parent;
+    }
+
+    // Moments bottom-up: every leaf starts a climb, and the last child to finish
+    // computes its parent and carries on
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < total; i++) {
+        int children = 0;
+        for (int c = 0; c < 8; c++) children += tree->nodes[i].children[c] >= 0;
+        atomic_init(&tree->node_pending[i], children);
+    }
+
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (int i = 0; i < total; i++) {
+        if (tree->nodes[i].particle < 0) continue;
+        int node = i;
+        compute_node_moments(tree, node);
+        for (;;) {
+            int parent = tree->node_parent[node];
+            if (parent < 0 || atomic_fetch_sub(&tree->node_pending[parent], 1) != 1) break;
+            compute_node_moments(tree, parent);
+            node = parent;
+        }
+    }
+    return 1;
+}
+
+int octree_build(Octree *tree, ParticleSystem *ps) {
+    tree->ps = ps;
+    tree->node_count = 0;
+    if (!reserve_next(tree, ps->count)) return 0;
+
+    // Fewer than two particles give a single root cell either way
+    if (tree->parallel_build && ps->count > 1) return octree_build_parallel(tree, ps);
+    return octree_build_serial(tree, ps);
+}
+
+// Shrink a node to the bounding cube of its particles, or of its children's cubes, and
+// recompute its moments, children first. Returns the summed edge length of the internal
+// cells in the subtree.
+static double refit_node(Octree *tree, int node_index, int depth) {
+    OctreeNode *node = &tree->nodes[node_index];
+    ParticleSystem *ps = tree->ps;
+    if (node->count == 0) return 0.0;
+
+    Vec3 lo = {FLT_MAX, FLT_MAX, FLT_MAX};
+    Vec3 hi = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    double size = 0.0;
+
+    if (node->particle >= 0) {
+        for (int p = node->particle; p >= 0; p = tree->next[p]) {
+            if (ps->x[p] < lo.x) lo.x = ps->x[p];
+            if (ps->y[p] < lo.y) lo.y = ps->y[p];
+            if (ps->z[p] < lo.z) lo.z = ps->z[p];
+            if (ps->x[p] > hi.x) hi.x = ps->x[p];
+            if (ps->y[p] > hi.y) hi.y = ps->y[p];
+            if (ps->z[p] > hi.z) hi.z = ps->z[p];
+        }
+    } else {
+        double child_size[8] = {0.0};
+        for (int c = 0; c < 8; c++) {
+            int child = node->children[c];
+            if (child < 0) continue;
+            // Deep nodes recurse directly; even an undeferred task costs more than a refit
+            if (depth < OCTREE_TASK_DEPTH) {
+                #pragma omp task shared(child_size)
+                child_size[c] = refit_node(tree, child, depth + 1);
+            } else {
+                child_size[c] = refit_node(tree, child, depth + 1);
+            }
+        }
+        if (depth < OCTREE_TASK_DEPTH) {
+            #pragma omp taskwait
+        }
+
+        for (int c = 0; c < 8; c++) {
+            int child_index = node->children[c];
+            if (child_index < 0) continue;
+            const OctreeNode *child = &tree->nodes[child_index];
+            size += child_size[c];
+            Vec3 child_lo = {child->center.x - child->half_size, child->center.y - child->half_size,
+                             child->center.z - child->half_size};
+            Vec3 child_hi = {child->center.x + child->half_size, child->center.y + child->half_size,
+                             child->center.z + child->half_size};
+            if (child_lo.x < lo.x) lo.x = child_lo.x;
+            if (child_lo.y < lo.y) lo.y = child_lo.y;
+            if (child_lo.z < lo.z) lo.z = child_lo.z;
+            if (child_hi.x > hi.x) hi.x = child_hi.x;
+            if (child_hi.y > hi.y) hi.y = child_hi.y;
+            if (child_hi.z > hi.z) hi.z = child_hi.z;
+        }
+    }
+
+    float extent = hi.x - lo.x;
+    if (hi.y - lo.y > extent) extent = hi.y - lo.y;
+    if (hi.z - lo.z > extent) extent = hi.z - lo.z;
+    node->center = (Vec3){0.5f * (lo.x + hi.x), 0.5f * (lo.y + hi.y), 0.5f * (lo.z + hi.z)};
+    node->half_size = 0.5f * extent;
+    for (int k = 0; k < 6; k++) node->quad[k] = 0.0f;
+    compute_node_moments(tree, node_index);
+
+    if (node->particle < 0) size += 2.0 * node->half_size;
+    return size;
+}
+
+static double octree_refit(Octree *tree) {
+    double size = 0.0;
+    #pragma omp parallel
+    #pragma omp single
+    size = refit_node(tree, 0, 0);
+    return size;
+}
+
+int octree_update(Octree *tree, ParticleSystem *ps) {
+    if (tree->refit_interval <= 0) {
+        tree->built_count = -1;
+        return octree_build(tree, ps);
+    }
+
+    // The leaf chains hold particle slots, so any change of slots needs a new tree
+    if (tree->ps == ps && tree->built_count == ps->count && tree->refits < tree->refit_interval) {
+        double size = octree_refit(tree);
+        tree->quality = tree->built_size > 0.0 ? size / tree->built_size : 1.0;
+        tree->refits++;
+        if (tree->quality <= tree->refit_growth) return 1;
+    }
+
+    if (!octree_build(tree, ps)) return 0;
+    tree->built_size = octree_refit(tree);
+    tree->built_count = ps->count;
+    tree->refits = 0;
+    tree->quality = 1.0;
+    return 1;
+}
+
+void octree_invalidate(Octree *tree) {
+    tree->built_count = -1;
+}
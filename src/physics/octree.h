@@ -0,0 +1,83 @@
+#ifndef OCTREE_H
+#define OCTREE_H
+
+#include <stdatomic.h>
+#include "particle.h"
+#include "morton.h"
+#include "../utils/arena.h"
+
+// Maximum subdivision depth; coincident particles share a leaf past this depth
+#define OCTREE_MAX_DEPTH 32
+
+typedef struct {
+    Vec3 center;       // Geometric center of the cell
+    float half_size;   // Half the edge length of the (cubic) cell
+    Vec3 com;          // Center of mass of the particles inside the cell
+    float mass;        // Total mass inside the cell
+    float quad[6];     // Traceless quadrupole about com (xx, xy, xz, yy, yz, zz)
+    int children[8];   // Child node indices, -1 where the octant is empty
+    int particle;      // First particle of a leaf's chain, -1 for internal nodes
+    int count;         // Number of particles inside the cell
+} OctreeNode;
+
+typedef struct Octree {
+    OctreeNode *nodes;     // Node pool, nodes[0] is the root
+    int node_count;
+    int node_capacity;
+
+    int *next;             // Per-particle chain links for leaves holding several particles
+    int next_capacity;
+
+    ParticleSystem *ps;    // Particles the tree was last built from
+
+    float theta;           // Opening angle: a cell is accepted when size / distance < theta
+    int use_quadrupole;    // Add the quadrupole term to accepted cells
+    int parallel_build;    // Build from sorted Morton keys instead of inserting one by one
+
+    // Refitting (octree_update): between full builds the structure is kept and only the
+    // cell bounds and moments follow the particles
+    int refit_interval;    // Most refits in a row before a full build, 0: always rebuild
+    float refit_growth;    // Rebuild once the summed cell sizes pass this multiple of the fresh tree's
+    int refits;            // Refits since the last full build
+    int built_count;       // Particle count at the last build, -1: rebuild on the next update
+    double built_size;     // Summed edge length of the internal cells just after the last build
+    double quality;        // Summed edge length after the last update over built_size
+
+    // Parallel build state: the sorted keys and the binary radix tree over them, with
+    // internal node i at i and the leaf of sorted key j at n-1+j. The arrays below live
+    // in scratch, which every parallel build resets, and are only valid during a build.
+    MortonOrder morton;
+    Arena scratch;
+    int *radix_parent;        // Radix node above each radix node, -1 at the root
+    int *radix_prefix;        // Key bits shared by the range of each internal node
+    int *radix_first;         // Sorted key range of each internal node
+    int *radix_last;
+    int *cell_offset;         // First octree node of each radix node, plus the total at the end
+    int *node_parent;         // Octree node above each node, for the bottom-up moment pass
+    atomic_int *node_pending; // Children each node still waits for
+} Octree;
+
+// Initialize an empty tree (no allocation until the first build)
+void octree_init(Octree *tree, float theta, int use_quadrupole);
+
+// Rebuild the tree over the given particles, reusing previously allocated storage.
+// With parallel_build set, the particles' Morton keys are radix sorted, a binary radix
+// tree is built over them with one independent task per internal node (Karras 2012), the
+// octree cells are read off its key prefixes and the moments are summed bottom-up, all
+// in parallel. Coincident particles then share a leaf at depth MORTON_BITS.
+int octree_build(Octree *tree, ParticleSystem *ps);
+
+// Bring the tree up to date with moved particles. While refit_interval allows it, the
+// previous structure is kept and every cell is shrunk to the bounding cube of its
+// particles with its moments recomputed, bottom-up and in parallel. A full build (whose
+// cells are then tightened the same way) happens after refit_interval refits, when the
+// summed cell sizes grow by more than refit_growth, or after octree_invalidate.
+int octree_update(Octree *tree, ParticleSystem *ps);
+
+// Make the next octree_update rebuild, e.g. after the particle slots were reordered
+void octree_invalidate(Octree *tree);
+
+// Free the storage owned by the tree
+void octree_free(Octree *tree);
+
+#endif /* OCTREE_H */
@@ -1,5 +1,7 @@
 #include "particle.h"
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
 void particle_init(Particle *p, Vec3 pos, Vec3 vel, float mass, float radius, Vec3 color) {
     p->position = pos;
@@ -28,3 +30,151 @@ void particle_update(Particle *p, float dt) {
     p->position.y += p->velocity.y * dt;
     p->position.z += p->velocity.z * dt;
 }
+
+// Allocate a zeroed array of capacity elements aligned to PARTICLE_ALIGNMENT
+static void *alloc_aligned_array(int capacity, size_t element_size) {
+    size_t bytes = (size_t)capacity * element_size;
+    bytes = (bytes + PARTICLE_ALIGNMENT - 1) / PARTICLE_ALIGNMENT * PARTICLE_ALIGNMENT;
+    void *array = aligned_alloc(PARTICLE_ALIGNMENT, bytes);
+    if (array) memset(array, 0, bytes);
+    return array;
+}
+
+int particle_system_init(ParticleSystem *ps, int count) {
+    int capacity = (count + PARTICLE_PADDING - 1) / PARTICLE_PADDING * PARTICLE_PADDING;
+    if (capacity == 0) capacity = PARTICLE_PADDING;
+    
+    ps->count = count;
+    ps->massive_count = count;
+    ps->capacity = capacity;
+    ps->mapping = NULL;
+    ps->mapping_size = 0;
+    
+    ps->x = alloc_aligned_array(capacity, sizeof(float));
+    ps->y = alloc_aligned_array(capacity, sizeof(float));
+    ps->z = alloc_aligned_array(capacity, sizeof(float));
+    ps->vx = alloc_aligned_array(capacity, sizeof(float));
+    ps->vy = alloc_aligned_array(capacity, sizeof(float));
+    ps->vz = alloc_aligned_array(capacity, sizeof(float));
+    ps->ax = alloc_aligned_array(capacity, sizeof(float));
+    ps->ay = alloc_aligned_array(capacity, sizeof(float));
+    ps->az = alloc_aligned_array(capacity, sizeof(float));
+    ps->mass = alloc_aligned_array(capacity, sizeof(float));
+    ps->radius = alloc_aligned_array(capacity, sizeof(float));
+    ps->color = alloc_aligned_array(capacity, sizeof(Vec3));
+    ps->id = alloc_aligned_array(capacity, sizeof(int));
+    
+    if (!ps->x || !ps->y || !ps->z || !ps->vx || !ps->vy || !ps->vz ||
+        !ps->ax || !ps->ay || !ps->az || !ps->mass || !ps->radius || !ps->color || !ps->id) {
+        particle_system_free(ps);
+        return 0;
+    }
+    for (int i = 0; i < capacity; i++) {
+        ps->id[i] = i;
+    }
+    return 1;
+}
+
+void particle_system_free(ParticleSystem *ps) {
+    if (ps->mapping) {
+        munmap(ps->mapping, ps->mapping_size);
+        memset(ps, 0, sizeof(*ps));
+        return;
+    }
+    
+    free(ps->x);
+    free(ps->y);
+    free(ps->z);
+    free(ps->vx);
+    free(ps->vy);
+    free(ps->vz);
+    free(ps->ax);
+    free(ps->ay);
+    free(ps->az);
+    free(ps->mass);
+    free(ps->radius);
+    free(ps->color);
+    free(ps->id);
+    memset(ps, 0, sizeof(*ps));
+}
+
+void particle_system_set(ParticleSystem *ps, int i, const Particle *p) {
+    ps->x[i] = p->position.x;
+    ps->y[i] = p->position.y;
+    ps->z[i] = p->position.z;
+    ps->vx[i] = p->velocity.x;
+    ps->vy[i] = p->velocity.y;
+    ps->vz[i] = p->velocity.z;
+    ps->ax[i] = p->acceleration.x;
+    ps->ay[i] = p->acceleration.y;
+    ps->az[i] = p->acceleration.z;
+    ps->mass[i] = p->mass;
+    ps->radius[i] = p->radius;
+    ps->color[i] = p->color;
+}
+
+Particle particle_system_get(const ParticleSystem *ps, int i) {
+    Particle p;
+    p.position = (Vec3){ps->x[i], ps->y[i], ps->z[i]};
+    p.velocity = (Vec3){ps->vx[i], ps->vy[i], ps->vz[i]};
+    p.acceleration = (Vec3){ps->ax[i], ps->ay[i], ps->az[i]};
+    p.mass = ps->mass[i];
+    p.radius = ps->radius[i];
+    p.color = ps->color[i];
+    return p;
+}
+
+// Gather one array through order, staging the result in scratch
+static void permute_array(void *array, size_t element_size, const int *order, int count, void *scratch) {
+    if (count == 0) return; // The arrays may be NULL
+    const unsigned char *source = array;
+    unsigned char *staged = scratch;
+    
+    if (element_size == sizeof(float)) {
+        // Fixed-size copies compile to plain loads and stores
+        #pragma omp parallel for schedule(static)
+        for (int k = 0; k < count; k++) {
+            memcpy(staged + (size_t)k * sizeof(float), source + (size_t)order[k] * sizeof(float), sizeof(float));
+        }
+    } else {
+        #pragma omp parallel for schedule(static)
+        for (int k = 0; k < count; k++) {
+            memcpy(staged + (size_t)k * element_size, source + (size_t)order[k] * element_size, element_size);
+        }
+    }
+    memcpy(array, staged, (size_t)count * element_size);
+}
+
+void particle_system_permute(ParticleSystem *ps, const int *order, void *scratch) {
+    float *arrays[] = {
+        ps->x, ps->y, ps->z, ps->vx, ps->vy, ps->vz, ps->ax, ps->ay, ps->az, ps->mass, ps->radius
+    };
+    for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); a++) {
+        permute_array(arrays[a], sizeof(float), order, ps->count, scratch);
+    }
+    permute_array(ps->id, sizeof(int), order, ps->count, scratch);
+    permute_array(ps->color, sizeof(Vec3), order, ps->count, scratch);
+}
+
+int particle_system_find_massive_count(const ParticleSystem *ps) {
+    int n = ps->count;
+    while (n > 0 && ps->mass[n - 1] == 0.0f) n--;
+    return n;
+}
+
+void particle_system_reset_forces(ParticleSystem *ps) {
+    size_t bytes = (size_t)ps->capacity * sizeof(float);
+    memset(ps->ax, 0, bytes);
+    memset(ps->ay, 0, bytes);
+    memset(ps->az, 0, bytes);
+}
+
+ParticleRenderView particle_system_render_view(const ParticleSystem *ps) {
+    ParticleRenderView view = {
+        ps->x, ps->y, ps->z,
+        ps->radius,
+        ps->color,
+        ps->count
+    };
+    return view;
+}
@@ -1,8 +1,16 @@
 #ifndef PARTICLE_H
 #define PARTICLE_H
 
+#include <stddef.h>
 #include "../utils/vector.h"
 
+// Alignment (bytes) of every particle array; one cache line and one AVX-512 register
+#define PARTICLE_ALIGNMENT 64
+
+// Array capacities are padded to a multiple of this many floats
+#define PARTICLE_PADDING (PARTICLE_ALIGNMENT / (int)sizeof(float))
+
+// Single particle record, used to build or inspect individual particles
 typedef struct {
     Vec3 position;     // Position in 3D space
     Vec3 velocity;     // Velocity vector
@@ -12,6 +20,45 @@ typedef struct {
     Vec3 color;        // RGB color for rendering
 } Particle;
 
+// Structure-of-arrays particle storage used by the physics code.
+// Hot arrays (position, velocity, acceleration, mass) are kept apart from the
+// render-only attributes so force loops only stream the data they use.
+// Padding slots past count are kept at zero mass.
+// Massless tracers (test particles) follow the massive particles: slots [0, massive_count)
+// carry mass and source gravity, slots [massive_count, count) only feel it. Anything that
+// reorders or compacts the arrays keeps the two classes contiguous.
+typedef struct {
+    // Hot physics data
+    float *x, *y, *z;
+    float *vx, *vy, *vz;
+    float *ax, *ay, *az;
+    float *mass;
+    
+    // Cold render data
+    float *radius;
+    Vec3 *color;
+    
+    // Stable external ID of the particle in each slot: its creation index. Slots move when
+    // the arrays are reordered or compacted, IDs do not.
+    int *id;
+    
+    int count;         // Number of live particles
+    int massive_count; // Particles that carry mass; the rest are tracers
+    int capacity; // Allocated length of every array (multiple of PARTICLE_PADDING)
+    
+    // Set when the arrays point into a memory-mapped snapshot instead of the heap
+    void *mapping;
+    size_t mapping_size;
+} ParticleSystem;
+
+// Read-only view of the attributes the renderer needs; no data is copied
+typedef struct {
+    const float *x, *y, *z;
+    const float *radius;
+    const Vec3 *color;
+    int count;
+} ParticleRenderView;
+
 // Initialize a particle with given properties
 void particle_init(Particle *p, Vec3 pos, Vec3 vel, float mass, float radius, Vec3 color);
 
@@ -21,4 +68,31 @@ void particle_reset_forces(Particle *p);
 // Update particle state (called after forces are calculated)
 void particle_update(Particle *p, float dt);
 
-#endif /* PARTICLE_H */
\ No newline at end of file
+// Allocate storage for count particles (all fields zeroed)
+int particle_system_init(ParticleSystem *ps, int count);
+
+// Free all particle arrays (or unmap them when they come from a snapshot)
+void particle_system_free(ParticleSystem *ps);
+
+// Store a particle record at index i
+void particle_system_set(ParticleSystem *ps, int i, const Particle *p);
+
+// Read the particle at index i back into a record
+Particle particle_system_get(const ParticleSystem *ps, int i);
+
+// Reorder every array (IDs included) so slot k holds the particle previously in slot
+// order[k], for k < count. scratch must hold count Vec3s. order must keep the massive
+// particles in [0, massive_count).
+void particle_system_permute(ParticleSystem *ps, const int *order, void *scratch);
+
+// One past the last particle with nonzero mass: the massive/tracer split of arrays that
+// were filled without one (e.g. a restored snapshot)
+int particle_system_find_massive_count(const ParticleSystem *ps);
+
+// Zero all accelerations before forces are accumulated
+void particle_system_reset_forces(ParticleSystem *ps);
+
+// Get a render view of the system
+ParticleRenderView particle_system_render_view(const ParticleSystem *ps);
+
+#endif /* PARTICLE_H */
@@ -0,0 +1,567 @@
+#include "pm.h"
+#include "gravity.h"
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Plain PM (no P3M) softens Green's function by this many cells; the mesh cannot resolve
+// anything smaller anyway
+#define PM_SOFTENING_CELLS 0.5f
+
+void pm_init(PMSolver *pm) {
+    memset(pm, 0, sizeof(*pm));
+}
+
+static void free_mesh(PMSolver *pm) {
+    fft_plan_free(&pm->plan);
+    free(pm->green);
+    free(pm->mesh);
+    for (int a = 0; a < 3; a++) free(pm->force[a]);
+    free(pm->scratch);
+    pm->green = NULL;
+    pm->mesh = NULL;
+    for (int a = 0; a < 3; a++) pm->force[a] = NULL;
+    pm->scratch = NULL;
+    pm->scratch_threads = 0;
+    pm->grid = 0;
+    pm->padded = 0;
+}
+
+void pm_free(PMSolver *pm) {
+    free_mesh(pm);
+    free(pm->short_table);
+    arena_free(&pm->chain_arena);
+    arena_free(&pm->slab_arena);
+    memset(pm, 0, sizeof(*pm));
+}
+
+static int thread_count(void) {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+static int thread_id(void) {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+// Complex element index in the padded mesh
+static size_t mesh_index(const PMSolver *pm, int x, int y, int z) {
+    return ((size_t)z * pm->padded + y) * pm->padded + x;
+}
+
+// FFT along one axis over the lines whose other two coordinates are below limit_u and
+// limit_v (u is the faster of the two). Beyond those limits the mesh is known to be zero
+// on the way in, or is not needed on the way out, so those lines are skipped. Lines are
+// gathered FFT_LINES at a time, neighbours along u, into split real/imaginary rows.
+static void transform_axis(PMSolver *pm, int axis, int limit_u, int limit_v, int inverse) {
+    const int P = pm->padded;
+    // Complex-element strides along the transform axis and along u
+    const size_t along = axis == 0 ? 1 : axis == 1 ? (size_t)P : (size_t)P * P;
+    const size_t across = axis == 0 ? (size_t)P : 1;
+    const int blocks = limit_u / FFT_LINES;
+
+    #pragma omp parallel for schedule(static) collapse(2)
+    for (int v = 0; v < limit_v; v++) {
+        for (int b = 0; b < blocks; b++) {
+            float *re = pm->scratch + (size_t)thread_id() * 2 * FFT_LINES * P;
+            float *im = re + (size_t)FFT_LINES * P;
+            int u = b * FFT_LINES;
+            // x lines: u = y, v = z; y lines: u = x, v = z; z lines: u = x, v = y
+            size_t base = axis == 0 ? mesh_index(pm, 0, u, v)
+                        : axis == 1 ? mesh_index(pm, u, 0, v)
+                                    : mesh_index(pm, u, v, 0);
+
+            for (int k = 0; k < P; k++) {
+                for (int l = 0; l < FFT_LINES; l++) {
+                    const float *value = pm->mesh + 2 * (base + k * along + l * across);
+                    re[k * FFT_LINES + l] = value[0];
+                    im[k * FFT_LINES + l] = value[1];
+                }
+            }
+            fft_transform_lines(&pm->plan, re, im, inverse);
+            for (int k = 0; k < P; k++) {
+                for (int l = 0; l < FFT_LINES; l++) {
+                    float *value = pm->mesh + 2 * (base + k * along + l * across);
+                    value[0] = re[k * FFT_LINES + l];
+                    value[1] = im[k * FFT_LINES + l];
+                }
+            }
+        }
+    }
+}
+
+// Mass lives in the unpadded octant, and only that octant of the potential is read back
+static void forward_transform(PMSolver *pm) {
+    transform_axis(pm, 0, pm->grid, pm->grid, 0);
+    transform_axis(pm, 1, pm->padded, pm->grid, 0);
+    transform_axis(pm, 2, pm->padded, pm->padded, 0);
+}
+
+static void inverse_transform(PMSolver *pm) {
+    transform_axis(pm, 2, pm->padded, pm->padded, 1);
+    transform_axis(pm, 1, pm->padded, pm->grid, 1);
+    transform_axis(pm, 0, pm->grid, pm->grid, 1);
+}
+
+// Potential of a unit mass on the padded mesh, with distances wrapped so the transform
+// is real, then transformed and scaled by 1 / padded^3 for the unnormalised inverse
+static void build_green(PMSolver *pm) {
+    const int P = pm->padded;
+    const double rs = (double)pm->split * pm->cell;
+    const double eps = (double)PM_SOFTENING_CELLS * pm->cell;
+
+    #pragma omp parallel for schedule(static) collapse(2)
+    for (int z = 0; z < P; z++) {
+        for (int y = 0; y < P; y++) {
+            for (int x = 0; x < P; x++) {
+                double dx = (double)(x <= P / 2 ? x : P - x) * pm->cell;
+                double dy = (double)(y <= P / 2 ? y : P - y) * pm->cell;
+                double dz = (double)(z <= P / 2 ? z : P - z) * pm->cell;
+                double r = sqrt(dx * dx + dy * dy + dz * dz);
+                double g;
+                if (pm->p3m) {
+                    g = r > 0.0 ? -erf(r / (2.0 * rs)) / r : -1.0 / (rs * sqrt(M_PI));
+                } else {
+                    g = -1.0 / sqrt(r * r + eps * eps);
+                }
+                size_t i = mesh_index(pm, x, y, z);
+                pm->mesh[2 * i] = (float)(G * g);
+                pm->mesh[2 * i + 1] = 0.0f;
+            }
+        }
+    }
+
+    transform_axis(pm, 0, P, P, 0);
+    transform_axis(pm, 1, P, P, 0);
+    transform_axis(pm, 2, P, P, 0);
+
+    const size_t total = (size_t)P * P * P;
+    const float scale = 1.0f / (float)total;
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < total; i++) {
+        pm->green[i] = pm->mesh[2 * i] * scale;
+    }
+}
+
+// Tabulate the short-range force factor so the pair loop needs no erfc or exp
+static int build_short_table(PMSolver *pm) {
+    if (!pm->short_table) {
+        pm->short_table = malloc((PM_P3M_TABLE + 1) * sizeof(float));
+        if (!pm->short_table) {
+            fprintf(stderr, "PM: failed to allocate the P3M force table\n");
+            return 0;
+        }
+    }
+
+    const double rs = (double)pm->split * pm->cell;
+    const double cutoff = PM_P3M_CUTOFF * rs;
+    for (int k = 0; k <= PM_P3M_TABLE; k++) {
+        double r = cutoff * sqrt((double)k / PM_P3M_TABLE);
+        double u = r / (2.0 * rs);
+        pm->short_table[k] = (float)(erfc(u) + 2.0 * u / sqrt(M_PI) * exp(-u * u));
+    }
+    return 1;
+}
+
+// Size the mesh for the configuration and rebuild Green's function if anything it
+// depends on changed
+static int setup(PMSolver *pm, const SimConfig *config) {
+    int grid = config->pm_grid;
+    if (grid < FFT_LINES || (grid & (grid - 1)) != 0) {
+        fprintf(stderr, "PM: pm_grid must be a power of two of at least %d\n", FFT_LINES);
+        return 0;
+    }
+
+    Vec3 extent = vec3_sub(config->space_max, config->space_min);
+    float size = fmaxf(extent.x, fmaxf(extent.y, extent.z));
+    if (!(size > 0.0f)) {
+        fprintf(stderr, "PM: space_max must lie above space_min\n");
+        return 0;
+    }
+    float cell = size / grid;
+    int threads = thread_count();
+
+    if (grid == pm->grid && threads <= pm->scratch_threads && cell == pm->cell &&
+        config->space_min.x == pm->origin.x && config->space_min.y == pm->origin.y &&
+        config->space_min.z == pm->origin.z && config->pm_p3m == pm->p3m && config->pm_split == pm->split &&
+        (!pm->p3m || pm->short_table)) {
+        return 1;
+    }
+
+    if (grid != pm->grid || threads > pm->scratch_threads) {
+        free_mesh(pm);
+        int padded = 2 * grid;
+        size_t padded_cells = (size_t)padded * padded * padded;
+        size_t cells = (size_t)grid * grid * grid;
+        int ok = fft_plan_init(&pm->plan, padded);
+        pm->green = malloc(padded_cells * sizeof(float));
+        pm->mesh = malloc(2 * padded_cells * sizeof(float));
+        for (int a = 0; a < 3; a++) pm->force[a] = malloc(cells * sizeof(float));
+        pm->scratch = malloc((size_t)threads * 2 * FFT_LINES * padded * sizeof(float));
+        if (!ok || !pm->green || !pm->mesh || !pm->force[0] || !pm->force[1] || !pm->force[2] || !pm->scratch) {
+            fprintf(stderr, "PM: failed to allocate a %d^3 mesh\n", grid);
+            free_mesh(pm);
+            return 0;
+        }
+        pm->grid = grid;
+        pm->padded = padded;
+        pm->scratch_threads = threads;
+    }
+
+    pm->cell = cell;
+    pm->origin = config->space_min;
+    pm->p3m = config->pm_p3m;
+    pm->split = config->pm_split;
+    build_green(pm);
+    if (pm->p3m && !build_short_table(pm)) return 0;
+    return 1;
+}
+
+// Mesh cells and weights along one axis for a particle coordinate inside the mesh;
+// returns the stencil width
+static int stencil(const PMSolver *pm, int assignment, float pos, float origin, int *index, float *weight) {
+    const int n = pm->grid;
+    // Coordinate in cell-centre units; the outer half cells use the edge cells
+    float u = (pos - origin) / pm->cell - 0.5f;
+    if (!(u > 0.0f)) u = 0.0f;
+    if (u > (float)(n - 1)) u = (float)(n - 1);
+
+    if (assignment == PM_ASSIGN_TSC) {
+        int c = (int)floorf(u + 0.5f);
+        float d = u - (float)c;
+        index[0] = c > 0 ? c - 1 : 0;
+        index[1] = c;
+        index[2] = c < n - 1 ? c + 1 : n - 1;
+        weight[0] = 0.5f * (0.5f - d) * (0.5f - d);
+        weight[1] = 0.75f - d * d;
+        weight[2] = 0.5f * (0.5f + d) * (0.5f + d);
+        return 3;
+    }
+
+    int c = (int)u;
+    if (c > n - 2) c = n - 2;
+    float f = u - (float)c;
+    index[0] = c;
+    index[1] = c + 1;
+    weight[0] = 1.0f - f;
+    weight[1] = f;
+    return 2;
+}
+
+static int inside_mesh(const PMSolver *pm, float pos, float origin) {
+    float u = (pos - origin) / pm->cell;
+    return u >= 0.0f && u <= (float)pm->grid; // Also rejects NaN
+}
+
+// Counting-sort the particles inside the mesh by the z cell their stencil is centred on
+// (the lower of the two for cloud-in-cell)
+static int bin_particles(PMSolver *pm, const ParticleSystem *ps, int assignment) {
+    const int n = pm->grid;
+    Arena *arena = &pm->slab_arena;
+    arena_reset(arena);
+    pm->slab_start = arena_alloc(arena, ((size_t)n + 1) * sizeof(int));
+    pm->slab_sorted = arena_alloc(arena, (size_t)ps->count * sizeof(int));
+    pm->slab_of = arena_alloc(arena, (size_t)ps->count * sizeof(int));
+    if (!pm->slab_start || !pm->slab_sorted || !pm->slab_of) {
+        fprintf(stderr, "PM: failed to allocate the deposit bins\n");
+        return 0;
+    }
+
+    int outside = 0;
+    #pragma omp parallel for schedule(static) reduction(+:outside)
+    for (int i = 0; i < ps->count; i++) {
+        if (!inside_mesh(pm, ps->x[i], pm->origin.x) || !inside_mesh(pm, ps->y[i], pm->origin.y) ||
+            !inside_mesh(pm, ps->z[i], pm->origin.z)) {
+            outside++;
+            pm->slab_of[i] = -1;
+            continue;
+        }
+        int iz[3];
+        float wz[3];
+        stencil(pm, assignment, ps->z[i], pm->origin.z, iz, wz);
+        pm->slab_of[i] = assignment == PM_ASSIGN_TSC ? iz[1] : iz[0];
+    }
+    pm->outside = outside;
+    if (outside > 0 && !pm->outside_reported) {
+        fprintf(stderr, "PM: %d particle%s outside the mesh (space_min/space_max) and left out of "
+                "the force; later escapes are not reported\n", outside, outside == 1 ? " is" : "s are");
+        pm->outside_reported = 1;
+    }
+
+    // Count, exclusive prefix sum, scatter (stable, so each slab keeps index order), then
+    // shift the ends back to starts
+    int *start = pm->slab_start;
+    memset(start, 0, ((size_t)n + 1) * sizeof(int));
+    for (int i = 0; i < ps->count; i++) {
+        if (pm->slab_of[i] >= 0) start[pm->slab_of[i]]++;
+    }
+    int sum = 0;
+    for (int c = 0; c < n; c++) {
+        int count = start[c];
+        start[c] = sum;
+        sum += count;
+    }
+    for (int i = 0; i < ps->count; i++) {
+        if (pm->slab_of[i] >= 0) pm->slab_sorted[start[pm->slab_of[i]]++] = i;
+    }
+    for (int c = n; c > 0; c--) start[c] = start[c - 1];
+    start[0] = 0;
+    return 1;
+}
+
+// Each z plane of the mesh is filled by one thread from the slabs whose stencils reach it,
+// in slab then particle order, so no cell is shared between threads and the sums do not
+// depend on the schedule
+static void deposit(PMSolver *pm, const ParticleSystem *ps, int assignment) {
+    const int n = pm->grid;
+    const int P = pm->padded;
+    // Slabs whose stencils can reach plane z: z - 1 .. z for CIC, z - 1 .. z + 1 for TSC
+    const int reach = assignment == PM_ASSIGN_TSC ? 1 : 0;
+
+    // The padding must be zero for the convolution to be isolated
+    #pragma omp parallel for schedule(static)
+    for (int z = 0; z < P; z++) {
+        memset(pm->mesh + 2 * mesh_index(pm, 0, 0, z), 0, 2 * (size_t)P * P * sizeof(float));
+    }
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int z = 0; z < n; z++) {
+        int first = pm->slab_start[z > 0 ? z - 1 : 0];
+        int last = pm->slab_start[z + reach < n ? z + reach + 1 : n];
+        for (int k = first; k < last; k++) {
+            int i = pm->slab_sorted[k];
+            int ix[3], iy[3], iz[3];
+            float wx[3], wy[3], wz[3];
+            int s = stencil(pm, assignment, ps->z[i], pm->origin.z, iz, wz);
+            stencil(pm, assignment, ps->x[i], pm->origin.x, ix, wx);
+            stencil(pm, assignment, ps->y[i], pm->origin.y, iy, wy);
+
+            for (int c = 0; c < s; c++) {
+                if (iz[c] != z) continue;
+                for (int b = 0; b < s; b++) {
+                    float wzy = ps->mass[i] * wz[c] * wy[b];
+                    for (int a = 0; a < s; a++) {
+                        pm->mesh[2 * mesh_index(pm, ix[a], iy[b], z)] += wzy * wx[a];
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Derivative of the potential along one axis: 4-point central differences inside,
+// falling back to 2-point and one-sided differences at the mesh edge
+static float derivative(const float *phi, ptrdiff_t stride, int c, int n, float inv_cell) {
+    if (c >= 2 && c < n - 2) {
+        return ((phi[stride] - phi[-stride]) * (8.0f / 12.0f) -
+                (phi[2 * stride] - phi[-2 * stride]) * (1.0f / 12.0f)) * inv_cell;
+    }
+    if (c >= 1 && c < n - 1) return 0.5f * (phi[stride] - phi[-stride]) * inv_cell;
+    if (c == 0) return (phi[stride] - phi[0]) * inv_cell;
+    return (phi[0] - phi[-stride]) * inv_cell;
+}
+
+static void mesh_forces(PMSolver *pm) {
+    const int n = pm->grid;
+    const int P = pm->padded;
+    const float inv_cell = 1.0f / pm->cell;
+    // Strides between neighbouring real parts along x, y and z
+    const ptrdiff_t sx = 2, sy = 2 * (ptrdiff_t)P, sz = 2 * (ptrdiff_t)P * P;
+
+    #pragma omp parallel for schedule(static) collapse(2)
+    for (int z = 0; z < n; z++) {
+        for (int y = 0; y < n; y++) {
+            for (int x = 0; x < n; x++) {
+                const float *phi = pm->mesh + 2 * mesh_index(pm, x, y, z);
+                size_t i = ((size_t)z * n + y) * n + x;
+                pm->force[0][i] = -derivative(phi, sx, x, n, inv_cell);
+                pm->force[1][i] = -derivative(phi, sy, y, n, inv_cell);
+                pm->force[2][i] = -derivative(phi, sz, z, n, inv_cell);
+            }
+        }
+    }
+}
+
+static void interpolate(PMSolver *pm, ParticleSystem *ps, int assignment, const int *active, int active_count) {
+    const int n = pm->grid;
+
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < active_count; k++) {
+        int i = active ? active[k] : k;
+        if (pm->slab_of[i] < 0) continue;
+        int ix[3], iy[3], iz[3];
+        float wx[3], wy[3], wz[3];
+        int s = stencil(pm, assignment, ps->x[i], pm->origin.x, ix, wx);
+        stencil(pm, assignment, ps->y[i], pm->origin.y, iy, wy);
+        stencil(pm, assignment, ps->z[i], pm->origin.z, iz, wz);
+
+        float ax = 0.0f, ay = 0.0f, az = 0.0f;
+        for (int c = 0; c < s; c++) {
+            for (int b = 0; b < s; b++) {
+                for (int a = 0; a < s; a++) {
+                    float w = wz[c] * wy[b] * wx[a];
+                    size_t cell = ((size_t)iz[c] * n + iy[b]) * n + ix[a];
+                    ax += w * pm->force[0][cell];
+                    ay += w * pm->force[1][cell];
+                    az += w * pm->force[2][cell];
+                }
+            }
+        }
+        ps->ax[i] += ax;
+        ps->ay[i] += ay;
+        ps->az[i] += az;
+    }
+}
+
+static int chain_coord(const PMSolver *pm, float pos, float origin) {
+    float c = floorf((pos - origin) / pm->chain_size);
+    if (!(c > 0.0f)) return 0;
+    if (c > (float)(pm->chain_cells - 1)) return pm->chain_cells - 1;
+    return (int)c;
+}
+
+// Counting-sort the particles into chaining-mesh cells at least one cutoff wide
+static int build_chain(PMSolver *pm, const ParticleSystem *ps) {
+    float cutoff = PM_P3M_CUTOFF * pm->split * pm->cell;
+    float size = pm->cell * pm->grid;
+    int cells = (int)(size / cutoff);
+    if (cells < 1) cells = 1;
+    if (cells > pm->grid) cells = pm->grid;
+
+    Arena *arena = &pm->chain_arena;
+    arena_reset(arena);
+    pm->chain_start = arena_alloc(arena, ((size_t)cells * cells * cells + 1) * sizeof(int));
+    pm->chain_sorted = arena_alloc(arena, (size_t)ps->count * sizeof(int));
+    pm->chain_cell = arena_alloc(arena, (size_t)ps->count * sizeof(int));
+    if (!pm->chain_start || !pm->chain_sorted || !pm->chain_cell) {
+        fprintf(stderr, "PM: failed to allocate the P3M chaining mesh\n");
+        return 0;
+    }
+    pm->chain_cells = cells;
+    pm->chain_size = size / cells;
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < ps->count; i++) {
+        int cx = chain_coord(pm, ps->x[i], pm->origin.x);
+        int cy = chain_coord(pm, ps->y[i], pm->origin.y);
+        int cz = chain_coord(pm, ps->z[i], pm->origin.z);
+        pm->chain_cell[i] = (cz * cells + cy) * cells + cx;
+    }
+
+    // Count, exclusive prefix sum, scatter, then shift the ends back to starts
+    int total = cells * cells * cells;
+    int *start = pm->chain_start;
+    memset(start, 0, ((size_t)total + 1) * sizeof(int));
+    for (int i = 0; i < ps->count; i++) start[pm->chain_cell[i]]++;
+    int sum = 0;
+    for (int c = 0; c < total; c++) {
+        int n = start[c];
+        start[c] = sum;
+        sum += n;
+    }
+    for (int i = 0; i < ps->count; i++) pm->chain_sorted[start[pm->chain_cell[i]]++] = i;
+    for (int c = total; c > 0; c--) start[c] = start[c - 1];
+    start[0] = 0;
+    return 1;
+}
+
+// Short-range complement of the long-range mesh force, summed over pairs within the cutoff
+static long long short_range(PMSolver *pm, ParticleSystem *ps, const int *active, int active_count) {
+    const int cells = pm->chain_cells;
+    const float rs = pm->split * pm->cell;
+    const float cutoff = PM_P3M_CUTOFF * rs;
+    const float cutoff_sq = cutoff * cutoff;
+    const float table_scale = PM_P3M_TABLE / cutoff_sq;
+    const float *table = pm->short_table;
+    long long pairs = 0;
+
+    #pragma omp parallel for schedule(dynamic, 64) reduction(+:pairs)
+    for (int k = 0; k < active_count; k++) {
+        int i = active ? active[k] : k;
+        if (pm->slab_of[i] < 0) continue;
+        int c = pm->chain_cell[i];
+        int cx = c % cells, cy = (c / cells) % cells, cz = c / (cells * cells);
+        float xi = ps->x[i], yi = ps->y[i], zi = ps->z[i];
+        float ax = 0.0f, ay = 0.0f, az = 0.0f;
+
+        for (int z = cz > 0 ? cz - 1 : 0; z <= cz + 1 && z < cells; z++) {
+            for (int y = cy > 0 ? cy - 1 : 0; y <= cy + 1 && y < cells; y++) {
+                int row = (z * cells + y) * cells;
+                int first = pm->chain_start[row + (cx > 0 ? cx - 1 : 0)];
+                int last = pm->chain_start[row + (cx + 1 < cells ? cx + 1 : cells - 1) + 1];
+                for (int m = first; m < last; m++) {
+                    int j = pm->chain_sorted[m];
+                    float dx = ps->x[j] - xi;
+                    float dy = ps->y[j] - yi;
+                    float dz = ps->z[j] - zi;
+                    float dist_sq = dx * dx + dy * dy + dz * dz;
+                    if (j == i || dist_sq >= cutoff_sq || pm->slab_of[j] < 0) continue;
+                    pairs++;
+
+                    // Linear interpolation in r²
+                    float t = dist_sq * table_scale;
+                    int slot = (int)t;
+                    float f = table[slot] + (t - (float)slot) * (table[slot + 1] - table[slot]);
+
+                    dist_sq += GRAVITY_SOFTENING;
+                    float dist = sqrtf(dist_sq);
+                    float s = G * ps->mass[j] * f / (dist_sq * dist);
+                    ax += s * dx;
+                    ay += s * dy;
+                    az += s * dz;
+                }
+            }
+        }
+        ps->ax[i] += ax;
+        ps->ay[i] += ay;
+        ps->az[i] += az;
+    }
+    return pairs;
+}
+
+int pm_compute_forces(PMSolver *pm, ParticleSystem *ps, const SimConfig *config,
+                      const int *active, int active_count) {
+    pm->pairs = 0;
+    if (!setup(pm, config)) return 0;
+    int assignment = config->pm_assignment == PM_ASSIGN_TSC ? PM_ASSIGN_TSC : PM_ASSIGN_CIC;
+    // Everything that can fail comes before the first acceleration is written
+    if (!bin_particles(pm, ps, assignment)) return 0;
+    if (pm->p3m && !build_chain(pm, ps)) return 0;
+
+    deposit(pm, ps, assignment);
+    forward_transform(pm);
+
+    // Convolution with Green's function (real, so both parts scale alike)
+    const size_t total = (size_t)pm->padded * pm->padded * pm->padded;
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < total; i++) {
+        pm->mesh[2 * i] *= pm->green[i];
+        pm->mesh[2 * i + 1] *= pm->green[i];
+    }
+
+    inverse_transform(pm);
+    mesh_forces(pm);
+    interpolate(pm, ps, assignment, active, active_count);
+
+    if (pm->p3m) {
+        pm->pairs = short_range(pm, ps, active, active_count);
+    }
+    return 1;
+}
@@ -0,0 +1,80 @@
+#ifndef PM_H
+#define PM_H
+
+#include "particle.h"
+#include "fft.h"
+#include "../utils/arena.h"
+#include "../utils/config.h"
+
+// Particle-mesh gravity. Mass is assigned to a cubic mesh of pm_grid cells per side
+// anchored at space_min and covering space_max. The potential is the convolution of that
+// mass with Green's function, done by FFT on a mesh zero-padded to twice the size so the
+// boundaries are isolated rather than periodic. Accelerations are finite differences of
+// the potential, interpolated back to the particles with the assignment weights.
+//
+// With pm_p3m the mesh only carries the long-range part of a Gaussian split of 1/r at
+// pm_split cells, and pairs closer than PM_P3M_CUTOFF split radii are summed directly.
+//
+// Mass is deposited plane by plane along z, each plane by one thread in a fixed particle
+// order, so the result does not depend on the thread count or scheduling. Particles within
+// half a cell of the mesh faces use the edge cells. Particles outside the mesh are left out
+// altogether: they neither add mass nor receive a mesh or P3M force (with a warning the
+// first time it happens).
+
+#define PM_ASSIGN_CIC 1 // Cloud-in-cell: 2 cells per axis
+#define PM_ASSIGN_TSC 2 // Triangular-shaped cloud: 3 cells per axis
+
+// Short-range cutoff in split radii; the long-range force is within 1e-5 of 1/r² there
+#define PM_P3M_CUTOFF 4.5f
+
+// Entries in the table of the short-range force factor, uniform in r² up to the cutoff
+#define PM_P3M_TABLE 1024
+
+typedef struct {
+    // Geometry and split the Green's function was built for
+    int grid;          // Cells per side (power of two)
+    int padded;        // 2 * grid
+    float cell;        // Cell width
+    Vec3 origin;       // Corner of cell (0, 0, 0)
+    int p3m;
+    float split;
+
+    FFTPlan plan;          // Length padded, shared by all three axes
+    float *green;          // Transformed Green's function (real), scaled for the inverse FFT
+    float *mesh;           // padded^3 complex values: mass, its transform, then the potential
+    float *force[3];       // Mesh accelerations on the grid^3 unpadded cells
+    float *scratch;        // Per-thread line buffers for the strided FFT passes
+    int scratch_threads;
+
+    float *short_table;    // P3M factor erfc(u) + 2u / sqrt(pi) exp(-u²), u = r / (2 split)
+
+    // P3M chaining mesh: cells at least a cutoff wide, filled by counting sort. The arrays
+    // are rebuilt from chain_arena on every call.
+    Arena chain_arena;
+    int chain_cells;       // Cells per side
+    float chain_size;      // Cell width
+    int *chain_start;      // chain_cells^3 + 1 offsets into chain_sorted
+    int *chain_sorted;     // Particle indices ordered by cell
+    int *chain_cell;       // Cell of each particle
+
+    // Mass assignment: particles counting-sorted by the z cell their stencil is centred
+    // on, rebuilt from slab_arena on every call
+    Arena slab_arena;
+    int *slab_start;       // grid + 1 offsets into slab_sorted
+    int *slab_sorted;      // Particle indices ordered by slab
+    int *slab_of;          // Slab of each particle, -1 outside the mesh
+    int outside;           // Particles left out by the last call
+    int outside_reported;
+
+    long long pairs;       // Short-range pairs summed by the last call
+} PMSolver;
+
+void pm_init(PMSolver *pm);
+void pm_free(PMSolver *pm);
+
+// Add to the listed particles (all of them when active is NULL) the acceleration from
+// every particle. Returns 0 if the mesh could not be allocated.
+int pm_compute_forces(PMSolver *pm, ParticleSystem *ps, const SimConfig *config,
+                      const int *active, int active_count);
+
+#endif /* PM_H */
@@ -1,4 +1,5 @@
 #include "renderer.h"
+#include "../utils/profiler.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
@@ -7,9 +8,12 @@
 #define M_PI 3.14159265358979323846
 #endif
 
+// Floats per particle instance: position (3), radius (1), color (3)
+#define INSTANCE_FLOATS 7
+
 // Forward declarations for static functions
-static void setup_sphere_mesh(void);
-static void render_sphere(Renderer *renderer, Vec3 position, float radius, Vec3 color);
+static int setup_sphere_mesh(Renderer *renderer);
+static int upload_instances(Renderer *renderer, const ParticleRenderView *view);
 
 // Callback function wrappers (to access renderer from callbacks)
 static Renderer *current_renderer = NULL;
@@ -72,12 +76,17 @@ int renderer_init(Renderer *renderer, SimConfig *config) {
         return 0;
     }
     
-    // Setup VAO and VBO for rendering
+    // Setup VAO and buffers for rendering
     glGenVertexArrays(1, &renderer->vao);
     glGenBuffers(1, &renderer->vbo);
+    glGenBuffers(1, &renderer->ebo);
+    glGenBuffers(1, &renderer->instance_vbo);
+    renderer->instance_capacity = 0;
     
-    // Setup sphere mesh for rendering particles
-    setup_sphere_mesh();
+    // Upload the sphere mesh once; only instance data changes per frame
+    if (!setup_sphere_mesh(renderer)) {
+        return 0;
+    }
     
     // Initialize time
     renderer->last_frame_time = glfwGetTime();
@@ -101,30 +110,84 @@ int renderer_init(Renderer *renderer, SimConfig *config) {
     return 1;
 }
 
-void renderer_main_loop(Renderer *renderer, Particle *particles, int particle_count, SimConfig *config) {
+void renderer_main_loop(Renderer *renderer, Simulation *sim) {
+    long frames = 0;
+    long max_frames = sim->config->max_frames;
+    double start_time = glfwGetTime();
+    
+    // With a physics thread the simulation runs freely and each frame draws the newest snapshot;
+    // otherwise one step is taken per frame on this thread
+    PhysicsThread physics_thread;
+    int threaded = sim->config->physics_thread && physics_thread_start(&physics_thread, sim);
+    
     while (!glfwWindowShouldClose(renderer->window)) {
+        PROFILE_BEGIN(PROFILE_FRAME);
+        
         // Update delta time
         renderer_update_time(renderer);
         
         // Process input
         renderer_process_input(renderer);
         
-        // Update physics if not paused
-        if (!renderer->paused || renderer->single_step) {
-            update_particle_system(particles, particle_count, config->time_step, config->integration_method);
-            renderer->single_step = 0;
+        ParticleRenderView view;
+        if (threaded) {
+            // Forward pause / single-step requests to the physics thread
+            physics_thread_set_paused(&physics_thread, renderer->paused);
+            if (renderer->single_step) {
+                physics_thread_request_step(&physics_thread);
+                renderer->single_step = 0;
+            }
+            view = render_snapshot_view(physics_thread_latest(&physics_thread));
+        } else {
+            // Update physics if not paused
+            if (!renderer->paused || renderer->single_step) {
+                simulation_step(sim);
+                renderer->single_step = 0;
+            }
+            view = particle_system_render_view(&sim->particles);
         }
         
         // Render frame
-        renderer_render_frame(renderer, particles, particle_count);
+        PROFILE_BEGIN(PROFILE_RENDER);
+        renderer_render_frame(renderer, &view);
+        PROFILE_END(PROFILE_RENDER);
         
         // Swap buffers and poll events
+        PROFILE_BEGIN(PROFILE_SWAP);
         glfwSwapBuffers(renderer->window);
+        PROFILE_END(PROFILE_SWAP);
+        
+        PROFILE_BEGIN(PROFILE_EVENTS);
         glfwPollEvents();
+        PROFILE_END(PROFILE_EVENTS);
+        
+        PROFILE_END(PROFILE_FRAME);
+        
+        // Report GL errors from the first frame, which exercises every draw path once
+        if (++frames == 1) {
+            GLenum error = glGetError();
+            if (error != GL_NO_ERROR) {
+                fprintf(stderr, "OpenGL error 0x%04x during first frame\n", error);
+            }
+        }
+        
+        if (max_frames > 0 && frames >= max_frames) {
+            glfwSetWindowShouldClose(renderer->window, 1);
+        }
+    }
+    
+    if (threaded) {
+        physics_thread_stop(&physics_thread);
+    }
+    
+    double elapsed = glfwGetTime() - start_time;
+    if (elapsed > 0.0) {
+        printf("Rendered %ld frames in %.2f s (%.1f fps), %ld physics steps (%.1f steps/s)\n",
+               frames, elapsed, frames / elapsed, sim->step, sim->step / elapsed);
     }
 }
 
-void renderer_render_frame(Renderer *renderer, Particle *particles, int particle_count) {
+void renderer_render_frame(Renderer *renderer, const ParticleRenderView *view) {
     // Clear the screen
     glClearColor(0.2f, 0.0f, 0.2f, 1.0f); // Dark blue background
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -144,11 +207,14 @@ void renderer_render_frame(Renderer *renderer, Particle *particles, int particle
     shader_set_mat4(&renderer->shader, "view", view_matrix);
     shader_set_mat4(&renderer->shader, "projection", projection_matrix);
     
-    // Render each particle as a sphere
-    for (int i = 0; i < particle_count; i++) {
-        Particle *p = &particles[i];
-        render_sphere(renderer, p->position, p->radius, p->color);
+    // Stream this frame's particle data, then draw every sphere in one call
+    if (view->count == 0 || !upload_instances(renderer, view)) {
+        return;
     }
+    
+    glBindVertexArray(renderer->vao);
+    glDrawElementsInstanced(GL_TRIANGLES, renderer->index_count, GL_UNSIGNED_INT, (void*)0, view->count);
+    glBindVertexArray(0);
 }
 
 void renderer_process_input(Renderer *renderer) {
@@ -178,9 +244,11 @@ void renderer_update_time(Renderer *renderer) {
 }
 
 void renderer_cleanup(Renderer *renderer) {
-    // Delete VAO and VBO
+    // Delete VAO and buffers
     glDeleteVertexArrays(1, &renderer->vao);
     glDeleteBuffers(1, &renderer->vbo);
+    glDeleteBuffers(1, &renderer->ebo);
+    glDeleteBuffers(1, &renderer->instance_vbo);
     
     // Delete shader program
     shader_delete(&renderer->shader);
@@ -241,22 +309,23 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 }
 
 // Sphere rendering for particles
-// We'll use a simplified version with icosphere generation
+// A UV sphere: (STACKS + 1) x (SECTORS + 1) vertices indexed as triangles
 #define SPHERE_STACKS 16
 #define SPHERE_SECTORS 32
 
-static GLfloat *sphere_vertices = NULL;
-static GLuint sphere_vertex_count = 0;
-
-static void setup_sphere_mesh(void) {
-    // Calculate number of vertices needed
-    sphere_vertex_count = (SPHERE_STACKS + 1) * (SPHERE_SECTORS + 1) * 6; // 6 floats per vertex (position + normal)
-    
-    // Allocate memory for vertices
-    sphere_vertices = (GLfloat*)malloc(sphere_vertex_count * sizeof(GLfloat));
-    if (!sphere_vertices) {
+static int setup_sphere_mesh(Renderer *renderer) {
+    // Calculate number of vertices and indices needed
+    int vertex_count = (SPHERE_STACKS + 1) * (SPHERE_SECTORS + 1);
+    int index_count = SPHERE_SECTORS * (SPHERE_STACKS - 1) * 6; // Pole rows have one triangle per sector
+    
+    // Temporary CPU copies, freed once the GPU has them
+    GLfloat *vertices = (GLfloat*)malloc(vertex_count * 6 * sizeof(GLfloat)); // position + normal
+    GLuint *indices = (GLuint*)malloc(index_count * sizeof(GLuint));
+    if (!vertices || !indices) {
         fprintf(stderr, "Failed to allocate memory for sphere mesh\n");
-        return;
+        free(vertices);
+        free(indices);
+        return 0;
     }
     
     // Generate unit sphere vertices
@@ -274,45 +343,45 @@ static void setup_sphere_mesh(void) {
             float y = xy * sinf(sector_angle);
             
             // Position
-            sphere_vertices[vertex_index++] = x;
-            sphere_vertices[vertex_index++] = y;
-            sphere_vertices[vertex_index++] = z;
+            vertices[vertex_index++] = x;
+            vertices[vertex_index++] = y;
+            vertices[vertex_index++] = z;
             
             // Normal (same as position for a unit sphere)
-            sphere_vertices[vertex_index++] = x;
-            sphere_vertices[vertex_index++] = y;
-            sphere_vertices[vertex_index++] = z;
+            vertices[vertex_index++] = x;
+            vertices[vertex_index++] = y;
+            vertices[vertex_index++] = z;
         }
     }
-}
-
-static void render_sphere(Renderer *renderer, Vec3 position, float radius, Vec3 color) {
-    shader_use(&renderer->shader);
-    
-    // Create model matrix (translation and scaling)
-    float model_matrix[16] = {0};
-    
-    // Scale
-    model_matrix[0] = radius;
-    model_matrix[5] = radius;
-    model_matrix[10] = radius;
     
-    // Translation
-    model_matrix[12] = position.x;
-    model_matrix[13] = position.y;
-    model_matrix[14] = position.z;
-    model_matrix[15] = 1.0f;
-    
-    // Set uniforms
-    shader_set_mat4(&renderer->shader, "model", model_matrix);
-    shader_set_vec3(&renderer->shader, "objectColor", color.x, color.y, color.z);
+    // Two triangles per quad, skipping the degenerate ones at the poles
+    int index = 0;
+    for (int i = 0; i < SPHERE_STACKS; i++) {
+        GLuint k1 = i * (SPHERE_SECTORS + 1);
+        GLuint k2 = k1 + SPHERE_SECTORS + 1;
+        
+        for (int j = 0; j < SPHERE_SECTORS; j++, k1++, k2++) {
+            if (i != 0) {
+                indices[index++] = k1;
+                indices[index++] = k2;
+                indices[index++] = k1 + 1;
+            }
+            if (i != SPHERE_STACKS - 1) {
+                indices[index++] = k1 + 1;
+                indices[index++] = k2;
+                indices[index++] = k2 + 1;
+            }
+        }
+    }
+    renderer->index_count = index;
     
-    // Bind VAO
     glBindVertexArray(renderer->vao);
     
-    // Update VBO with sphere data
+    // Mesh vertices and indices, uploaded once
     glBindBuffer(GL_ARRAY_BUFFER, renderer->vbo);
-    glBufferData(GL_ARRAY_BUFFER, sphere_vertex_count * sizeof(GLfloat), sphere_vertices, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, vertex_count * 6 * sizeof(GLfloat), vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer->ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index * sizeof(GLuint), indices, GL_STATIC_DRAW);
     
     // Position attribute
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
@@ -322,9 +391,55 @@ static void render_sphere(Renderer *renderer, Vec3 position, float radius, Vec3
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
     
-    // Draw sphere
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, sphere_vertex_count / 6);
+    // Per-instance attributes: position + radius, then color, advancing once per instance
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->instance_vbo);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, INSTANCE_FLOATS * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, INSTANCE_FLOATS * sizeof(float), (void*)(4 * sizeof(float)));
+    glEnableVertexAttribArray(3);
+    glVertexAttribDivisor(3, 1);
     
-    // Unbind
+    // Unbind (the element buffer binding stays recorded in the VAO)
     glBindVertexArray(0);
-}
\ No newline at end of file
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    
+    free(vertices);
+    free(indices);
+    return 1;
+}
+
+// Write this frame's instance data straight into the (orphaned) instance buffer
+static int upload_instances(Renderer *renderer, const ParticleRenderView *view) {
+    GLsizeiptr size = (GLsizeiptr)view->count * INSTANCE_FLOATS * sizeof(float);
+    
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->instance_vbo);
+    if (view->count > renderer->instance_capacity) {
+        glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+        renderer->instance_capacity = view->count;
+    }
+    
+    // Invalidating lets the driver hand out fresh storage instead of stalling on the previous frame
+    float *data = (float*)glMapBufferRange(GL_ARRAY_BUFFER, 0, size,
+                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (!data) {
+        fprintf(stderr, "Failed to map instance buffer\n");
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return 0;
+    }
+    
+    for (int i = 0; i < view->count; i++) {
+        float *instance = data + (size_t)i * INSTANCE_FLOATS;
+        instance[0] = view->x[i];
+        instance[1] = view->y[i];
+        instance[2] = view->z[i];
+        instance[3] = view->radius[i];
+        instance[4] = view->color[i].x;
+        instance[5] = view->color[i].y;
+        instance[6] = view->color[i].z;
+    }
+    
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return 1;
+}
@@ -6,6 +6,8 @@
 #include "shader.h"
 #include "camera.h"
 #include "../physics/particle.h"
+#include "../sim/simulation.h"
+#include "../sim/physics_thread.h"
 #include "../utils/config.h"
 
 typedef struct {
@@ -16,8 +18,12 @@ typedef struct {
     Shader shader;
     Camera camera;
     
-    GLuint vao;  // Vertex Array Object
-    GLuint vbo;  // Vertex Buffer Object
+    GLuint vao;          // Vertex Array Object
+    GLuint vbo;          // Sphere mesh vertices (position + normal)
+    GLuint ebo;          // Sphere mesh indices
+    GLuint instance_vbo; // Per-particle position/radius/color, streamed each frame
+    GLsizei index_count;   // Indices in the sphere mesh
+    int instance_capacity; // Instances the instance buffer can currently hold
     
     double last_frame_time;
     float delta_time;
@@ -40,10 +46,10 @@ typedef struct {
 int renderer_init(Renderer *renderer, SimConfig *config);
 
 // Main rendering loop
-void renderer_main_loop(Renderer *renderer, Particle *particles, int particle_count, SimConfig *config);
+void renderer_main_loop(Renderer *renderer, Simulation *sim);
 
 // Render a single frame
-void renderer_render_frame(Renderer *renderer, Particle *particles, int particle_count);
+void renderer_render_frame(Renderer *renderer, const ParticleRenderView *view);
 
 // Process input
 void renderer_process_input(Renderer *renderer);
@@ -0,0 +1,72 @@
+#define _POSIX_C_SOURCE 199309L
+#include "physics_thread.h"
+#include <stdio.h>
+#include <time.h>
+
+// Sleep used while paused with nothing to do
+#define PHYSICS_THREAD_IDLE_NS 1000000L
+
+static void *physics_thread_main(void *arg) {
+    PhysicsThread *pt = (PhysicsThread*)arg;
+    Simulation *sim = pt->sim;
+    
+    // OpenMP thread counts are per thread, so apply the configured one here too
+    physics_state_attach_thread(&sim->physics);
+    
+    while (atomic_load(&pt->running)) {
+        if (atomic_load(&pt->paused)) {
+            // Consume one pending single-step request, if any
+            int requests = atomic_load(&pt->step_requests);
+            if (requests == 0 || !atomic_compare_exchange_weak(&pt->step_requests, &requests, requests - 1)) {
+                struct timespec idle = {0, PHYSICS_THREAD_IDLE_NS};
+                nanosleep(&idle, NULL);
+                continue;
+            }
+        }
+        
+        simulation_step(sim);
+        triple_buffer_publish(&pt->snapshots, &sim->particles, sim->step, sim->time);
+    }
+    
+    return NULL;
+}
+
+int physics_thread_start(PhysicsThread *pt, Simulation *sim) {
+    pt->sim = sim;
+    if (!triple_buffer_init(&pt->snapshots, sim->particles.capacity)) {
+        fprintf(stderr, "Failed to allocate render snapshots\n");
+        return 0;
+    }
+    
+    atomic_init(&pt->running, 1);
+    atomic_init(&pt->paused, 0);
+    atomic_init(&pt->step_requests, 0);
+    
+    // The first frame shows the initial conditions
+    triple_buffer_publish(&pt->snapshots, &sim->particles, sim->step, sim->time);
+    
+    if (pthread_create(&pt->thread, NULL, physics_thread_main, pt) != 0) {
+        fprintf(stderr, "Failed to start physics thread\n");
+        triple_buffer_free(&pt->snapshots);
+        return 0;
+    }
+    return 1;
+}
+
+void physics_thread_stop(PhysicsThread *pt) {
+    atomic_store(&pt->running, 0);
+    pthread_join(pt->thread, NULL);
+    triple_buffer_free(&pt->snapshots);
+}
+
+void physics_thread_set_paused(PhysicsThread *pt, int paused) {
+    atomic_store(&pt->paused, paused);
+}
+
+void physics_thread_request_step(PhysicsThread *pt) {
+    atomic_fetch_add(&pt->step_requests, 1);
+}
+
+const RenderSnapshot *physics_thread_latest(PhysicsThread *pt) {
+    return triple_buffer_acquire(&pt->snapshots);
+}
@@ -0,0 +1,37 @@
+#ifndef PHYSICS_THREAD_H
+#define PHYSICS_THREAD_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "simulation.h"
+#include "triple_buffer.h"
+
+// Runs simulation_step on its own thread as fast as possible and publishes a
+// render snapshot after every step. Pause and single-step requests are atomics,
+// so the render thread never blocks on physics.
+typedef struct {
+    pthread_t thread;
+    Simulation *sim;
+    TripleBuffer snapshots;
+    
+    atomic_int running;       // Cleared to ask the thread to exit
+    atomic_int paused;        // While set, steps only run on request
+    atomic_int step_requests; // Pending single steps while paused
+} PhysicsThread;
+
+// Publish the initial state and start stepping. Returns 1 on success.
+int physics_thread_start(PhysicsThread *pt, Simulation *sim);
+
+// Ask the thread to stop, wait for it and free the snapshots
+void physics_thread_stop(PhysicsThread *pt);
+
+// Pause or resume stepping
+void physics_thread_set_paused(PhysicsThread *pt, int paused);
+
+// Run exactly one step while paused
+void physics_thread_request_step(PhysicsThread *pt);
+
+// Newest published snapshot (render thread only)
+const RenderSnapshot *physics_thread_latest(PhysicsThread *pt);
+
+#endif /* PHYSICS_THREAD_H */
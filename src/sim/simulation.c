@@ -0,0 +1,254 @@
+#include "simulation.h"
+#include "../io/snapshot.h"
+#include "../physics/gravity_kernel.h"
+#include "../utils/profiler.h"
+#include "../utils/timer.h"
+#include <stdio.h>
+
+int simulation_init(Simulation *sim, SimConfig *config) {
+    sim->config = config;
+    sim->time = 0.0;
+    sim->step = 0;
+    sim->interactions = 0;
+    sim->collisions = 0;
+    
+    if (config->restart_path) {
+        // Resume: the particle arrays are mapped straight from the snapshot
+        SnapshotState state;
+        if (!snapshot_map(config->restart_path, &sim->particles, &state)) {
+            return 0;
+        }
+        config->max_particles = sim->particles.massive_count;
+        config->tracer_count = sim->particles.count - sim->particles.massive_count;
+        sim->time = state.time;
+        sim->step = state.step;
+        sim->rng = state.rng;
+        printf("Restored %d particles at step %ld from %s\n",
+               sim->particles.count, sim->step, config->restart_path);
+    } else {
+        // Create particles
+        if (!particle_system_init(&sim->particles, config->max_particles + config->tracer_count)) {
+            fprintf(stderr, "Failed to allocate memory for particles\n");
+            return 0;
+        }
+        
+        // Initialize particles
+        create_initial_particles(config, &sim->particles);
+        printf("Created %d particles\n", sim->particles.count);
+        
+        // Separate stream from the one that placed the particles
+        rng_seed(&sim->rng, config->random_seed + 1);
+    }
+    
+    // Initialize physics state (force solver workspace)
+    physics_state_init(&sim->physics, config);
+    if ((config->external_potential && !sim->physics.external.nodes) ||
+        (config->enable_bounded_space && sim->physics.boundary.mode != config->enable_bounded_space)) {
+        physics_state_cleanup(&sim->physics);
+        particle_system_free(&sim->particles);
+        return 0;
+    }
+    
+    PROFILER_INIT(config->profile_counters);
+    
+    if (config->trajectory_path) {
+        if (!trajectory_open(&sim->trajectory, config->trajectory_path, sim->particles.count,
+                             config->trajectory_precision, config->trajectory_velocity_precision,
+                             config->trajectory_keyframe_interval,
+                             config->restart_path ? sim->step : -1)) {
+            physics_state_cleanup(&sim->physics);
+            particle_system_free(&sim->particles);
+            return 0;
+        }
+        // The first frame holds the initial (or restored) state; a restart appends to the
+        // trajectory it was checkpointed from
+        trajectory_push(&sim->trajectory, &sim->particles, sim->step, sim->time);
+    }
+    return 1;
+}
+
+void simulation_step(Simulation *sim) {
+    PROFILE_BEGIN(PROFILE_STEP);
+    update_particle_system(&sim->particles, &sim->physics, sim->config);
+    PROFILE_END(PROFILE_STEP);
+    
+    sim->time += sim->physics.step_dt;
+    sim->step++;
+    sim->interactions += sim->physics.step_interactions;
+    if (sim->config->enable_collision) sim->collisions += sim->physics.collisions.collisions;
+    
+    SimConfig *config = sim->config;
+    if (config->trajectory_path && config->trajectory_interval > 0 &&
+        sim->step % config->trajectory_interval == 0) {
+        PROFILE_BEGIN(PROFILE_TRAJECTORY);
+        trajectory_push(&sim->trajectory, &sim->particles, sim->step, sim->time);
+        PROFILE_END(PROFILE_TRAJECTORY);
+    }
+    
+    if (config->checkpoint_path && config->checkpoint_interval > 0 &&
+        sim->step % config->checkpoint_interval == 0) {
+        simulation_write_checkpoint(sim);
+    }
+}
+
+int simulation_write_checkpoint(Simulation *sim) {
+    SnapshotState state = { sim->step, sim->time, sim->rng };
+    return snapshot_write(sim->config->checkpoint_path, &sim->particles, sim->config, &state);
+}
+
+void simulation_print_summary(Simulation *sim) {
+    SimConfig *config = sim->config;
+    
+    printf("Starting simulation with:\n");
+    printf("- %d particles\n", config->max_particles);
+    printf("- Random seed: %llu\n", (unsigned long long)config->random_seed);
+    printf("- Time step: %f\n", config->time_step);
+    if (config->block_timesteps) {
+        printf("- Integration method: block leapfrog, %d levels, eta %g\n",
+               config->block_levels, config->block_eta);
+    } else {
+        printf("- Integration method: %d (%s)\n", config->integration_method,
+               integrator_name(config->integration_method));
+        if (config->adaptive_timestep) {
+            printf("- Adaptive time step: eta %g, %g-%g%s", config->adaptive_eta,
+                   config->adaptive_min_step, config->adaptive_max_step, config->adaptive_jerk ? ", with jerk" : "");
+            if (config->adaptive_symmetric > 0 && integrator_is_symplectic(config->integration_method)) {
+                printf(", time-symmetric (%d iterations)", config->adaptive_symmetric);
+            }
+            printf("\n");
+        }
+    }
+    printf("- Force method: %d\n", config->force_method);
+    printf("- Threads: %d\n", sim->physics.threads);
+    if (config->reorder_interval > 0) {
+        printf("- Morton reorder: every %d steps\n", config->reorder_interval);
+    }
+    
+    if (config->force_method == 0) {
+        printf("- Direct-sum kernel: %s\n", gravity_kernel_name(sim->physics.kernel));
+    } else if (config->force_method == 1) {
+        printf("- Barnes-Hut theta: %.2f%s\n", config->barnes_hut_theta,
+               config->barnes_hut_quadrupole ? " (with quadrupole)" : "");
+    } else if (config->force_method == 2) {
+        printf("- Particle mesh: %d^3 cells, %s", config->pm_grid, config->pm_assignment == 2 ? "TSC" : "CIC");
+        if (config->pm_p3m) printf(", P3M split %g cells", config->pm_split);
+        printf("\n");
+    } else if (config->force_method == 3) {
+        printf("- Fast multipole: order %d, theta %.2f, leaves of %d\n", config->fmm_order,
+               config->fmm_theta, config->fmm_leaf_size);
+    }
+    if (config->force_method == 1 || config->force_method == 3) {
+        printf("- Octree build: %s\n", config->tree_build ? "parallel, from sorted Morton keys" : "serial insertion");
+        if (config->tree_refit_interval > 0) {
+            printf("- Octree refit: up to %d times between builds, rebuild past %.2fx growth\n",
+                   config->tree_refit_interval, config->tree_refit_growth);
+        }
+    }
+    
+    if (config->enable_central_body) {
+        printf("- Central body enabled with mass %e\n", config->central_body_mass);
+    }
+    if (sim->physics.external.nodes) {
+        const ExternalField *field = &sim->physics.external;
+        printf("- External potential: %s, %dx%dx%d nodes, extent %g\n",
+               field->geometry == EXTERNAL_AXISYMMETRIC ? "axisymmetric R-z" : "Cartesian",
+               field->nx, field->ny, field->nz, field->extent);
+    }
+    if (sim->physics.boundary.mode != BOUNDARY_OPEN) {
+        const BoundaryBox *box = &sim->physics.boundary;
+        printf("- Boundaries: %s box %gx%gx%g", box->mode == BOUNDARY_PERIODIC ? "periodic" : "reflective",
+               box->size.x, box->size.y, box->size.z);
+        if (box->mode == BOUNDARY_PERIODIC) {
+            if (box->table) printf(", Ewald table %d^3", box->table_size);
+            else printf(", nearest image only");
+            if (config->force_method != 0) printf(" (direct sum replaces force method %d)", config->force_method);
+        }
+        printf("\n");
+    }
+    if (config->tracer_count > 0) {
+        printf("- Tracers: %d massless, orbits %g-%g\n", config->tracer_count,
+               config->tracer_min_orbit, config->tracer_max_orbit);
+    }
+    
+    if (config->enable_collision) {
+        if (config->collision_mode == 1) printf("- Collisions: merge\n");
+        else printf("- Collisions: bounce, restitution %g\n", config->collision_damping);
+    }
+    
+    if (config->trajectory_path) {
+        printf("- Trajectory: %s every %ld steps, precision %g / %g\n", config->trajectory_path,
+               config->trajectory_interval, config->trajectory_precision,
+               config->trajectory_velocity_precision);
+    }
+    
+    if (config->checkpoint_path) {
+        printf("- Checkpoints: %s every %ld steps (0: at exit only)\n",
+               config->checkpoint_path, config->checkpoint_interval);
+    }
+}
+
+void simulation_cleanup(Simulation *sim) {
+    if (sim->config->trajectory_path) {
+        TrajectoryWriter *trajectory = &sim->trajectory;
+        if (trajectory_close(trajectory)) {
+            double coordinates = (double)trajectory->frames_written * sim->particles.count * trajectory->components;
+            printf("Wrote %ld trajectory frames to %s (%.2f bytes/coordinate, %.3f s waiting for the writer)\n",
+                   trajectory->frames_written, sim->config->trajectory_path,
+                   coordinates > 0 ? trajectory->bytes_written / coordinates : 0.0, trajectory->wait_seconds);
+        }
+    }
+    PROFILER_SHUTDOWN(sim->config->profile_output);
+    physics_state_cleanup(&sim->physics);
+    particle_system_free(&sim->particles);
+}
+
+int simulation_run_headless(SimConfig *config) {
+    if (config->headless_steps <= 0 && config->headless_sim_time <= 0.0f) {
+        fprintf(stderr, "Headless mode needs a step count or a simulated time limit\n");
+        return 0;
+    }
+    
+    Simulation sim;
+    if (!simulation_init(&sim, config)) {
+        return 0;
+    }
+    
+    simulation_print_summary(&sim);
+    printf("- Headless: %ld steps, %g simulated time (0: no limit)\n",
+           config->headless_steps, config->headless_sim_time);
+    
+    long start_step = sim.step;
+    double start_time = sim.time;
+    double start = timer_now();
+    
+    for (;;) {
+        if (config->headless_steps > 0 && sim.step - start_step >= config->headless_steps) break;
+        if (config->headless_sim_time > 0.0f && sim.time - start_time >= config->headless_sim_time) break;
+        simulation_step(&sim);
+    }
+    
+    double elapsed = timer_now() - start;
+    if (elapsed <= 0.0) elapsed = 1e-9;
+    
+    printf("Headless run finished:\n");
+    printf("- Steps: %ld\n", sim.step - start_step);
+    printf("- Simulated time: %g\n", sim.time - start_time);
+    if (config->adaptive_timestep && !config->block_timesteps && sim.step > start_step) {
+        printf("- Mean time step: %g\n", (sim.time - start_time) / (sim.step - start_step));
+    }
+    printf("- Wall time: %.3f s\n", elapsed);
+    printf("- Steps/sec: %.2f\n", (sim.step - start_step) / elapsed);
+    printf("- Interactions/sec: %.4e\n", sim.interactions / elapsed);
+    if (config->enable_collision) {
+        printf("- Collisions: %lld (%d particles left)\n", sim.collisions, sim.particles.count);
+    }
+    
+    int ok = 1;
+    if (config->checkpoint_path) {
+        ok = simulation_write_checkpoint(&sim);
+        if (ok) printf("Wrote checkpoint %s at step %ld\n", config->checkpoint_path, sim.step);
+    }
+    
+    simulation_cleanup(&sim);
+    return ok;
+}
@@ -0,0 +1,47 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include "../io/trajectory.h"
+#include "../physics/particle.h"
+#include "../physics/integration.h"
+#include "../utils/config.h"
+#include "../utils/rng.h"
+
+// A running simulation: particles, solver state and the step clock.
+// Both the windowed and the headless front ends advance it through simulation_step.
+typedef struct {
+    SimConfig *config;
+    ParticleSystem particles;
+    PhysicsState physics;
+    
+    double time;            // Simulated time
+    long step;              // Steps taken
+    long long interactions; // Total force interactions evaluated
+    long long collisions;   // Total collisions resolved
+    Rng rng;                // Stream for stochastic stages, saved in snapshots
+    TrajectoryWriter trajectory; // Open when config->trajectory_path is set
+} Simulation;
+
+// Allocate and populate a simulation from the configuration, or resume
+// config->restart_path when it is set
+int simulation_init(Simulation *sim, SimConfig *config);
+
+// Advance the simulation by one time step
+void simulation_step(Simulation *sim);
+
+// Write a snapshot to config->checkpoint_path. Returns 1 on success.
+int simulation_write_checkpoint(Simulation *sim);
+
+// Print the settings the simulation runs with
+void simulation_print_summary(Simulation *sim);
+
+// Free all resources owned by the simulation
+void simulation_cleanup(Simulation *sim);
+
+// Run a simulation without a window for config->headless_steps steps and/or
+// config->headless_sim_time simulated time (both counted from the start or restart
+// point), then report throughput and write a final checkpoint if one is configured.
+// Returns 1 on success.
+int simulation_run_headless(SimConfig *config);
+
+#endif /* SIMULATION_H */
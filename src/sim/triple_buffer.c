@@ -0,0 +1,86 @@
+#include "triple_buffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Set in middle when the shared slot holds a snapshot the consumer has not seen
+#define TRIPLE_BUFFER_FRESH 4
+#define TRIPLE_BUFFER_INDEX 3
+
+static int snapshot_init(RenderSnapshot *snapshot, int capacity) {
+    snapshot->x = (float*)calloc(capacity, sizeof(float));
+    snapshot->y = (float*)calloc(capacity, sizeof(float));
+    snapshot->z = (float*)calloc(capacity, sizeof(float));
+    snapshot->radius = (float*)calloc(capacity, sizeof(float));
+    snapshot->color = (Vec3*)calloc(capacity, sizeof(Vec3));
+    snapshot->count = 0;
+    snapshot->step = 0;
+    snapshot->time = 0.0;
+    return snapshot->x && snapshot->y && snapshot->z && snapshot->radius && snapshot->color;
+}
+
+static void snapshot_free(RenderSnapshot *snapshot) {
+    free(snapshot->x);
+    free(snapshot->y);
+    free(snapshot->z);
+    free(snapshot->radius);
+    free(snapshot->color);
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+int triple_buffer_init(TripleBuffer *buffer, int capacity) {
+    memset(buffer, 0, sizeof(*buffer));
+    for (int i = 0; i < 3; i++) {
+        if (!snapshot_init(&buffer->slots[i], capacity)) {
+            triple_buffer_free(buffer);
+            return 0;
+        }
+    }
+    buffer->back = 0;
+    buffer->front = 1;
+    atomic_init(&buffer->middle, 2);
+    return 1;
+}
+
+void triple_buffer_free(TripleBuffer *buffer) {
+    for (int i = 0; i < 3; i++) {
+        snapshot_free(&buffer->slots[i]);
+    }
+}
+
+void triple_buffer_publish(TripleBuffer *buffer, const ParticleSystem *ps, long step, double time) {
+    RenderSnapshot *snapshot = &buffer->slots[buffer->back];
+    size_t count = (size_t)ps->count;
+    
+    memcpy(snapshot->x, ps->x, count * sizeof(float));
+    memcpy(snapshot->y, ps->y, count * sizeof(float));
+    memcpy(snapshot->z, ps->z, count * sizeof(float));
+    memcpy(snapshot->radius, ps->radius, count * sizeof(float));
+    memcpy(snapshot->color, ps->color, count * sizeof(Vec3));
+    snapshot->count = ps->count;
+    snapshot->step = step;
+    snapshot->time = time;
+    
+    // Release: the copies above become visible before the slot is handed over
+    int previous = atomic_exchange_explicit(&buffer->middle, buffer->back | TRIPLE_BUFFER_FRESH,
+                                            memory_order_acq_rel);
+    buffer->back = previous & TRIPLE_BUFFER_INDEX;
+}
+
+const RenderSnapshot *triple_buffer_acquire(TripleBuffer *buffer) {
+    if (atomic_load_explicit(&buffer->middle, memory_order_relaxed) & TRIPLE_BUFFER_FRESH) {
+        // Acquire: pairs with the producer's release so the snapshot contents are visible
+        int previous = atomic_exchange_explicit(&buffer->middle, buffer->front, memory_order_acq_rel);
+        buffer->front = previous & TRIPLE_BUFFER_INDEX;
+    }
+    return &buffer->slots[buffer->front];
+}
+
+ParticleRenderView render_snapshot_view(const RenderSnapshot *snapshot) {
+    ParticleRenderView view = {
+        snapshot->x, snapshot->y, snapshot->z,
+        snapshot->radius,
+        snapshot->color,
+        snapshot->count
+    };
+    return view;
+}
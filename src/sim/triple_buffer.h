@@ -0,0 +1,43 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stdatomic.h>
+#include "../physics/particle.h"
+
+// One published copy of the render attributes of every particle
+typedef struct {
+    float *x, *y, *z;
+    float *radius;
+    Vec3 *color;
+    int count;
+    long step;   // Simulation step the snapshot was taken at
+    double time; // Simulated time of the snapshot
+} RenderSnapshot;
+
+// Lock-free single-producer / single-consumer triple buffer.
+// The producer always owns one slot (back), the consumer one slot (front), and the
+// third slot is exchanged atomically, so neither side ever waits for the other.
+typedef struct {
+    RenderSnapshot slots[3];
+    int back;            // Producer's slot (touched by the producer only)
+    int front;           // Consumer's slot (touched by the consumer only)
+    atomic_int middle;   // Shared slot index, with TRIPLE_BUFFER_FRESH set when it holds new data
+} TripleBuffer;
+
+// Allocate three snapshots for up to capacity particles
+int triple_buffer_init(TripleBuffer *buffer, int capacity);
+
+// Free the snapshots
+void triple_buffer_free(TripleBuffer *buffer);
+
+// Producer: copy the particles' render attributes into the back slot and publish it
+void triple_buffer_publish(TripleBuffer *buffer, const ParticleSystem *ps, long step, double time);
+
+// Consumer: switch to the newest published snapshot if there is one, and return
+// the current front snapshot (valid until the next call)
+const RenderSnapshot *triple_buffer_acquire(TripleBuffer *buffer);
+
+// Render view of a snapshot
+ParticleRenderView render_snapshot_view(const RenderSnapshot *snapshot);
+
+#endif /* TRIPLE_BUFFER_H */
@@ -0,0 +1,117 @@
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+struct ArenaBlock {
+    ArenaBlock *next;
+};
+
+// Block headers are padded so the data after them stays aligned
+#define ARENA_HEADER ARENA_ALIGNMENT
+
+static size_t round_up(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+void arena_init(Arena *arena) {
+    memset(arena, 0, sizeof(*arena));
+}
+
+static void free_overflow(Arena *arena) {
+    while (arena->overflow) {
+        ArenaBlock *next = arena->overflow->next;
+        free(arena->overflow);
+        arena->overflow = next;
+    }
+}
+
+void arena_free(Arena *arena) {
+    free_overflow(arena);
+    free(arena->base);
+    long long heap_allocations = arena->heap_allocations;
+    arena_init(arena);
+    arena->heap_allocations = heap_allocations;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = round_up(size > 0 ? size : 1);
+    arena->requested += size;
+
+    if (size <= arena->capacity - arena->used) {
+        void *memory = arena->base + arena->used;
+        arena->used += size;
+        return memory;
+    }
+
+    // Out of room: give this allocation a block of its own until the next reset
+    ArenaBlock *block = aligned_alloc(ARENA_ALIGNMENT, ARENA_HEADER + size);
+    if (!block) {
+        fprintf(stderr, "Arena: failed to allocate %zu bytes\n", size);
+        return NULL;
+    }
+    arena->heap_allocations++;
+    block->next = arena->overflow;
+    arena->overflow = block;
+    return (unsigned char *)block + ARENA_HEADER;
+}
+
+void arena_reset(Arena *arena) {
+    if (arena->overflow) {
+        free_overflow(arena);
+
+        // Grow the main block to what the last pass needed, with some headroom
+        size_t capacity = round_up(arena->requested + arena->requested / 8);
+        unsigned char *base = aligned_alloc(ARENA_ALIGNMENT, capacity);
+        if (base) {
+            free(arena->base);
+            arena->base = base;
+            arena->capacity = capacity;
+            arena->heap_allocations++;
+        }
+    }
+    arena->used = 0;
+    arena->requested = 0;
+}
+
+void arena_set_init(ArenaSet *set) {
+    set->arenas = NULL;
+    set->count = 0;
+}
+
+void arena_set_free(ArenaSet *set) {
+    for (int t = 0; t < set->count; t++) arena_free(&set->arenas[t]);
+    free(set->arenas);
+    arena_set_init(set);
+}
+
+int arena_set_reserve(ArenaSet *set, int count) {
+    if (count <= set->count) return 1;
+
+    Arena *arenas = realloc(set->arenas, (size_t)count * sizeof(Arena));
+    if (!arenas) {
+        fprintf(stderr, "Arena: failed to allocate thread arenas\n");
+        return 0;
+    }
+    for (int t = set->count; t < count; t++) arena_init(&arenas[t]);
+    set->arenas = arenas;
+    set->count = count;
+    return 1;
+}
+
+Arena *arena_set_local(ArenaSet *set) {
+#ifdef _OPENMP
+    int t = omp_get_thread_num();
+#else
+    int t = 0;
+#endif
+    return t < set->count ? &set->arenas[t] : NULL;
+}
+
+void arena_set_reset(ArenaSet *set) {
+    for (int t = 0; t < set->count; t++) arena_reset(&set->arenas[t]);
+}
@@ -0,0 +1,51 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for scratch data that only lives for one pass (a tree build, a force
+// evaluation, a collision step). Allocations are slices of one block and are all released
+// together by arena_reset. A pass that needs more than the block chains extra blocks; the
+// next reset replaces them with a single block big enough for that pass, so repeated
+// passes of the same size make no heap allocations.
+
+#define ARENA_ALIGNMENT 64 // Every allocation starts on a cache line
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    unsigned char *base;    // Main block
+    size_t capacity;        // Bytes in the main block
+    size_t used;            // Bytes of the main block handed out since the last reset
+    size_t requested;       // Bytes handed out since the last reset, overflow included
+    ArenaBlock *overflow;   // Blocks added since the last reset, newest first
+    long long heap_allocations; // Blocks allocated over the arena's lifetime
+} Arena;
+
+// One arena per thread, for allocations made inside parallel regions
+typedef struct {
+    Arena *arenas;
+    int count;
+} ArenaSet;
+
+void arena_init(Arena *arena);
+void arena_free(Arena *arena);
+
+// Aligned uninitialized memory valid until the next reset, NULL if the heap is exhausted
+void *arena_alloc(Arena *arena, size_t size);
+
+// Release every allocation, merging the blocks of the last pass into one
+void arena_reset(Arena *arena);
+
+void arena_set_init(ArenaSet *set);
+void arena_set_free(ArenaSet *set);
+
+// Make room for count threads; call outside parallel regions. Returns 0 on failure.
+int arena_set_reserve(ArenaSet *set, int count);
+
+// Arena of the calling OpenMP thread, NULL if the set was reserved for fewer threads
+Arena *arena_set_local(ArenaSet *set);
+
+void arena_set_reset(ArenaSet *set);
+
+#endif /* ARENA_H */
@@ -1,6 +1,12 @@
 #include "config.h"
+#include "rng.h"
+#include "../io/snapshot.h"
+#include "../physics/gravity.h"
+#include <math.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 // Initialize configuration with default values
@@ -9,11 +15,49 @@ void config_init(SimConfig *config) {
     config->window_width = 1280;
     config->window_height = 720;
     config->window_title = "Advanced Gravity Simulation";
+    config->max_frames = 0; // Run until the window is closed
+    config->physics_thread = 1; // Decouple physics from the frame rate
     
     // Simulation settings
     config->max_particles = 1000;
     config->time_step = 0.001f; // 1ms
-    config->integration_method = 1; // Verlet integration
+    config->random_seed = 0; // Seed from the clock
+    config->integration_method = 1; // Kick-drift-kick leapfrog
+    config->force_method = 0; // Direct summation
+    config->force_kernel = -1; // Widest SIMD kernel the CPU supports
+    config->num_threads = 0; // One thread per core
+    config->reorder_interval = 16;
+    
+    // Adaptive global timestep
+    config->adaptive_timestep = 0;
+    config->adaptive_eta = 0.02f;
+    config->adaptive_jerk = 0;
+    config->adaptive_symmetric = 1;
+    config->adaptive_min_step = 1.0e-6f;
+    config->adaptive_max_step = 0.01f;
+    
+    // Block timesteps
+    config->block_timesteps = 0;
+    config->block_levels = 8;
+    config->block_eta = 0.05f;
+    
+    // Barnes-Hut settings
+    config->barnes_hut_theta = 0.5f;
+    config->barnes_hut_quadrupole = 1;
+    config->tree_build = 1; // Parallel from sorted Morton keys
+    config->tree_refit_interval = 0; // Rebuild for every force evaluation
+    config->tree_refit_growth = 1.2f;
+    
+    // Particle-mesh settings
+    config->pm_grid = 64;
+    config->pm_assignment = 1; // Cloud-in-cell
+    config->pm_p3m = 0;
+    config->pm_split = 1.25f;
+    
+    // Fast multipole settings
+    config->fmm_order = 4;
+    config->fmm_theta = 0.5f;
+    config->fmm_leaf_size = 64;
     
     // Particle settings
     config->particle_min_mass = 100.0f;
@@ -26,21 +70,196 @@ void config_init(SimConfig *config) {
     config->central_body_mass = 1.0e6f; // Much more massive
     config->central_body_position = (Vec3){0.0f, 0.0f, 0.0f};
     
+    // Test particles
+    config->tracer_count = 0;
+    config->tracer_min_orbit = 20.0f;
+    config->tracer_max_orbit = 80.0f;
+    
+    // External potential
+    config->external_potential = 0;
+    config->external_geometry = 1; // Axisymmetric
+    config->external_resolution = 128;
+    config->external_extent = 200.0f;
+    config->external_center = (Vec3){0.0f, 0.0f, 0.0f};
+    config->external_bulge_mass = 0.0f;
+    config->external_bulge_scale = 2.0f;
+    config->external_disk_mass = 0.0f;
+    config->external_disk_scale = 15.0f;
+    config->external_disk_height = 1.5f;
+    config->external_halo_mass = 0.0f;
+    config->external_halo_scale = 60.0f;
+    config->external_table_path = NULL;
+    
     // Collision settings
     config->enable_collision = 1;
     config->collision_damping = 0.8f; // Energy loss in collisions
+    config->collision_mode = 0;
     
     // Space boundaries
-    config->enable_bounded_space = 1;
+    config->enable_bounded_space = 0;
     config->space_min = (Vec3){-100.0f, -100.0f, -100.0f};
     config->space_max = (Vec3){100.0f, 100.0f, 100.0f};
+    config->periodic_ewald = 1;
+    config->periodic_ewald_table = 32;
+    
+    // Headless mode
+    config->headless = 0;
+    config->headless_steps = 1000;
+    config->headless_sim_time = 0.0f;
+    
+    // Profiling (only used when built with PROFILE=1)
+    config->profile_counters = 0;
+    config->profile_output = NULL;
+    
+    // Checkpoint / restart
+    config->checkpoint_path = NULL;
+    config->checkpoint_interval = 0; // Only at exit
+    config->restart_path = NULL;
+    
+    // Trajectory output
+    config->trajectory_path = NULL;
+    config->trajectory_interval = 10;
+    config->trajectory_precision = 1.0e-3f;
+    config->trajectory_velocity_precision = 1.0e-3f;
+    config->trajectory_keyframe_interval = 100;
     
     // Shader paths
     config->vertex_shader_path = "shaders/vertex.glsl";
     config->fragment_shader_path = "shaders/fragment.glsl";
 }
 
-// Load configuration from file (simple implementation)
+// Parse a value of the form "x y z" (commas optional) into a vector
+static int parse_vec3(const char *value, Vec3 *out) {
+    return sscanf(value, "%f%*[ ,]%f%*[ ,]%f", &out->x, &out->y, &out->z) == 3;
+}
+
+// Value types of the keys understood by config_load_from_file
+typedef enum {
+    CONFIG_INT,
+    CONFIG_LONG,
+    CONFIG_U64,
+    CONFIG_FLOAT,
+    CONFIG_VEC3
+} ConfigType;
+
+typedef struct {
+    const char *key;
+    ConfigType type;
+    size_t offset;
+} ConfigKey;
+
+#define CONFIG_KEY(field, type) { #field, type, offsetof(SimConfig, field) }
+
+// Every numeric setting, shared by the file parser and config_write.
+// String settings (title, paths) only come from the command line.
+static const ConfigKey config_keys[] = {
+    CONFIG_KEY(window_width, CONFIG_INT),
+    CONFIG_KEY(window_height, CONFIG_INT),
+    CONFIG_KEY(max_particles, CONFIG_INT),
+    CONFIG_KEY(random_seed, CONFIG_U64),
+    CONFIG_KEY(time_step, CONFIG_FLOAT),
+    CONFIG_KEY(integration_method, CONFIG_INT),
+    CONFIG_KEY(force_method, CONFIG_INT),
+    CONFIG_KEY(force_kernel, CONFIG_INT),
+    CONFIG_KEY(num_threads, CONFIG_INT),
+    CONFIG_KEY(reorder_interval, CONFIG_INT),
+    CONFIG_KEY(adaptive_timestep, CONFIG_INT),
+    CONFIG_KEY(adaptive_eta, CONFIG_FLOAT),
+    CONFIG_KEY(adaptive_jerk, CONFIG_INT),
+    CONFIG_KEY(adaptive_symmetric, CONFIG_INT),
+    CONFIG_KEY(adaptive_min_step, CONFIG_FLOAT),
+    CONFIG_KEY(adaptive_max_step, CONFIG_FLOAT),
+    CONFIG_KEY(block_timesteps, CONFIG_INT),
+    CONFIG_KEY(block_levels, CONFIG_INT),
+    CONFIG_KEY(block_eta, CONFIG_FLOAT),
+    CONFIG_KEY(barnes_hut_theta, CONFIG_FLOAT),
+    CONFIG_KEY(barnes_hut_quadrupole, CONFIG_INT),
+    CONFIG_KEY(tree_build, CONFIG_INT),
+    CONFIG_KEY(tree_refit_interval, CONFIG_INT),
+    CONFIG_KEY(tree_refit_growth, CONFIG_FLOAT),
+    CONFIG_KEY(pm_grid, CONFIG_INT),
+    CONFIG_KEY(pm_assignment, CONFIG_INT),
+    CONFIG_KEY(pm_p3m, CONFIG_INT),
+    CONFIG_KEY(pm_split, CONFIG_FLOAT),
+    CONFIG_KEY(fmm_order, CONFIG_INT),
+    CONFIG_KEY(fmm_theta, CONFIG_FLOAT),
+    CONFIG_KEY(fmm_leaf_size, CONFIG_INT),
+    CONFIG_KEY(particle_min_mass, CONFIG_FLOAT),
+    CONFIG_KEY(particle_max_mass, CONFIG_FLOAT),
+    CONFIG_KEY(particle_min_radius, CONFIG_FLOAT),
+    CONFIG_KEY(particle_max_radius, CONFIG_FLOAT),
+    CONFIG_KEY(enable_central_body, CONFIG_INT),
+    CONFIG_KEY(central_body_mass, CONFIG_FLOAT),
+    CONFIG_KEY(central_body_position, CONFIG_VEC3),
+    CONFIG_KEY(tracer_count, CONFIG_INT),
+    CONFIG_KEY(tracer_min_orbit, CONFIG_FLOAT),
+    CONFIG_KEY(tracer_max_orbit, CONFIG_FLOAT),
+    CONFIG_KEY(external_potential, CONFIG_INT),
+    CONFIG_KEY(external_geometry, CONFIG_INT),
+    CONFIG_KEY(external_resolution, CONFIG_INT),
+    CONFIG_KEY(external_extent, CONFIG_FLOAT),
+    CONFIG_KEY(external_center, CONFIG_VEC3),
+    CONFIG_KEY(external_bulge_mass, CONFIG_FLOAT),
+    CONFIG_KEY(external_bulge_scale, CONFIG_FLOAT),
+    CONFIG_KEY(external_disk_mass, CONFIG_FLOAT),
+    CONFIG_KEY(external_disk_scale, CONFIG_FLOAT),
+    CONFIG_KEY(external_disk_height, CONFIG_FLOAT),
+    CONFIG_KEY(external_halo_mass, CONFIG_FLOAT),
+    CONFIG_KEY(external_halo_scale, CONFIG_FLOAT),
+    CONFIG_KEY(enable_collision, CONFIG_INT),
+    CONFIG_KEY(collision_damping, CONFIG_FLOAT),
+    CONFIG_KEY(collision_mode, CONFIG_INT),
+    CONFIG_KEY(enable_bounded_space, CONFIG_INT),
+    CONFIG_KEY(space_min, CONFIG_VEC3),
+    CONFIG_KEY(space_max, CONFIG_VEC3),
+    CONFIG_KEY(periodic_ewald, CONFIG_INT),
+    CONFIG_KEY(periodic_ewald_table, CONFIG_INT),
+    CONFIG_KEY(max_frames, CONFIG_LONG),
+    CONFIG_KEY(physics_thread, CONFIG_INT),
+    CONFIG_KEY(headless, CONFIG_INT),
+    CONFIG_KEY(headless_steps, CONFIG_LONG),
+    CONFIG_KEY(headless_sim_time, CONFIG_FLOAT),
+    CONFIG_KEY(profile_counters, CONFIG_INT),
+    CONFIG_KEY(checkpoint_interval, CONFIG_LONG),
+    CONFIG_KEY(trajectory_interval, CONFIG_LONG),
+    CONFIG_KEY(trajectory_precision, CONFIG_FLOAT),
+    CONFIG_KEY(trajectory_velocity_precision, CONFIG_FLOAT),
+    CONFIG_KEY(trajectory_keyframe_interval, CONFIG_INT),
+};
+
+#define CONFIG_KEY_COUNT (int)(sizeof(config_keys) / sizeof(config_keys[0]))
+
+// Apply one "key: value" line; source and line_number are only used in warnings
+static void config_apply_line(SimConfig *config, const char *line, const char *source, int line_number) {
+    char key[128];
+    char value[384];
+    if (line[0] == '#' || sscanf(line, " %127[^:# \t] : %383[^#\n]", key, value) != 2) {
+        return;
+    }
+    
+    for (int k = 0; k < CONFIG_KEY_COUNT; k++) {
+        if (strcmp(key, config_keys[k].key) != 0) continue;
+        
+        void *field = (char *)config + config_keys[k].offset;
+        switch (config_keys[k].type) {
+            case CONFIG_INT:   *(int *)field = atoi(value); break;
+            case CONFIG_LONG:  *(long *)field = atol(value); break;
+            case CONFIG_U64:   *(uint64_t *)field = strtoull(value, NULL, 10); break;
+            case CONFIG_FLOAT: *(float *)field = strtof(value, NULL); break;
+            case CONFIG_VEC3:
+                if (!parse_vec3(value, (Vec3 *)field)) {
+                    printf("Warning: %s:%d: expected three numbers for '%s'\n", source, line_number, key);
+                }
+                break;
+        }
+        return;
+    }
+    
+    printf("Warning: %s:%d: unknown configuration key '%s'\n", source, line_number, key);
+}
+
+// Load configuration from file
+// Each line has the form "key: value"; blank lines and lines starting with '#' are ignored
 int config_load_from_file(SimConfig *config, const char *filename) {
     FILE *file = fopen(filename, "r");
     if (!file) {
@@ -48,59 +267,214 @@ int config_load_from_file(SimConfig *config, const char *filename) {
         return 0;
     }
     
-    // Read configuration values (very basic implementation)
-    // In a real application, you'd want a more robust parsing mechanism
-    fscanf(file, "window_width: %d\n", &config->window_width);
-    fscanf(file, "window_height: %d\n", &config->window_height);
-    // Read other parameters...
+    char line[512];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file)) {
+        config_apply_line(config, line, filename, ++line_number);
+    }
     
     fclose(file);
     return 1;
 }
 
+void config_load_from_string(SimConfig *config, const char *text, size_t length, const char *source) {
+    char line[512];
+    int line_number = 0;
+    size_t pos = 0;
+    while (pos < length) {
+        size_t end = pos;
+        while (end < length && text[end] != '\n') end++;
+        
+        size_t n = end - pos < sizeof(line) - 1 ? end - pos : sizeof(line) - 1;
+        memcpy(line, text + pos, n);
+        line[n] = '\0';
+        config_apply_line(config, line, source, ++line_number);
+        pos = end + 1;
+    }
+}
+
+int config_write(const SimConfig *config, FILE *file) {
+    for (int k = 0; k < CONFIG_KEY_COUNT; k++) {
+        const void *field = (const char *)config + config_keys[k].offset;
+        const char *key = config_keys[k].key;
+        
+        // %.9g round-trips every float exactly
+        switch (config_keys[k].type) {
+            case CONFIG_INT:   fprintf(file, "%s: %d\n", key, *(const int *)field); break;
+            case CONFIG_LONG:  fprintf(file, "%s: %ld\n", key, *(const long *)field); break;
+            case CONFIG_U64:   fprintf(file, "%s: %llu\n", key, (unsigned long long)*(const uint64_t *)field); break;
+            case CONFIG_FLOAT: fprintf(file, "%s: %.9g\n", key, *(const float *)field); break;
+            case CONFIG_VEC3: {
+                const Vec3 *v = field;
+                fprintf(file, "%s: %.9g %.9g %.9g\n", key, v->x, v->y, v->z);
+                break;
+            }
+        }
+    }
+    return ferror(file) ? 0 : 1;
+}
+
+static void print_usage(const char *program) {
+    printf("Usage: %s [config_file] [options]\n", program);
+    printf("Options:\n");
+    printf("  --headless      Run without a window\n");
+    printf("  --steps N       Number of steps in headless mode (0: no limit)\n");
+    printf("  --sim-time T    Simulated time to run in headless mode (0: no limit)\n");
+    printf("  --frames N      Close the window after N frames (0: run until closed)\n");
+    printf("  --threads N     Physics worker threads (0: one per core)\n");
+    printf("  --seed N        Seed for the initial conditions (0: from the clock)\n");
+    printf("  --profile PREFIX Write PREFIX.csv and PREFIX.json profiles (PROFILE=1 builds)\n");
+    printf("  --checkpoint FILE Write snapshots to FILE (at exit and every --checkpoint-every steps)\n");
+    printf("  --checkpoint-every N Steps between snapshots (0: only at exit)\n");
+    printf("  --trajectory FILE Stream compressed positions/velocities to FILE (appended to on --restart)\n");
+    printf("  --trajectory-every N Steps between trajectory frames\n");
+    printf("  --external-table FILE Acceleration table for external_potential 2\n");
+    printf("  --restart FILE  Resume from a snapshot; its settings apply before the config file and flags\n");
+}
+
+int config_parse_args(SimConfig *config, int argc, char *argv[]) {
+    // The settings saved in a restart snapshot come first, so the file and flags can override them
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--restart") == 0) {
+            config->restart_path = argv[i + 1];
+            if (!snapshot_read_config(config->restart_path, config)) {
+                return 0;
+            }
+            printf("Loaded configuration from snapshot: %s\n", config->restart_path);
+            break;
+        }
+    }
+    
+    // First pass: the configuration file, so flags override it wherever they appear
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-') {
+            // Skip the value of flags that take one
+            if (strcmp(argv[i], "--headless") != 0 && strcmp(argv[i], "--help") != 0) i++;
+            continue;
+        }
+        if (config_load_from_file(config, argv[i])) {
+            printf("Loaded configuration from file: %s\n", argv[i]);
+        } else {
+            printf("Failed to load configuration file, using defaults\n");
+        }
+    }
+    
+    // Second pass: flags
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        int has_value = i + 1 < argc;
+        
+        if (arg[0] != '-') {
+            continue;
+        } else if (strcmp(arg, "--headless") == 0) {
+            config->headless = 1;
+        } else if (strcmp(arg, "--steps") == 0 && has_value) {
+            config->headless_steps = atol(argv[++i]);
+        } else if (strcmp(arg, "--sim-time") == 0 && has_value) {
+            config->headless_sim_time = strtof(argv[++i], NULL);
+        } else if (strcmp(arg, "--frames") == 0 && has_value) {
+            config->max_frames = atol(argv[++i]);
+        } else if (strcmp(arg, "--threads") == 0 && has_value) {
+            config->num_threads = atoi(argv[++i]);
+        } else if (strcmp(arg, "--seed") == 0 && has_value) {
+            config->random_seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--profile") == 0 && has_value) {
+            config->profile_output = argv[++i];
+        } else if (strcmp(arg, "--checkpoint") == 0 && has_value) {
+            config->checkpoint_path = argv[++i];
+        } else if (strcmp(arg, "--checkpoint-every") == 0 && has_value) {
+            config->checkpoint_interval = atol(argv[++i]);
+        } else if (strcmp(arg, "--trajectory") == 0 && has_value) {
+            config->trajectory_path = argv[++i];
+        } else if (strcmp(arg, "--trajectory-every") == 0 && has_value) {
+            config->trajectory_interval = atol(argv[++i]);
+        } else if (strcmp(arg, "--external-table") == 0 && has_value) {
+            config->external_table_path = argv[++i];
+        } else if (strcmp(arg, "--restart") == 0 && has_value) {
+            i++; // Applied before the configuration file
+        } else {
+            print_usage(argv[0]);
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
 // Create initial particles with random properties
-void create_initial_particles(SimConfig *config, Particle *particles) {
-    // Seed the random number generator
-    srand(time(NULL));
+void create_initial_particles(SimConfig *config, ParticleSystem *ps) {
+    // Seed the random number generator; a zero seed picks one from the clock
+    // and stores it back so the run can be reproduced
+    if (config->random_seed == 0) {
+        config->random_seed = (uint64_t)time(NULL);
+    }
+    Rng rng;
+    rng_seed(&rng, config->random_seed);
+    
+    // The last tracer_count slots hold the tracers
+    int tracers = config->tracer_count < ps->count ? config->tracer_count : ps->count;
+    if (tracers < 0) tracers = 0;
+    ps->massive_count = ps->count - tracers;
     
-    for (int i = 0; i < config->max_particles; i++) {
+    for (int i = 0; i < ps->massive_count; i++) {
         // Random position within space bounds
         Vec3 pos = {
-            (float)rand() / RAND_MAX * (config->space_max.x - config->space_min.x) + config->space_min.x,
-            (float)rand() / RAND_MAX * (config->space_max.y - config->space_min.y) + config->space_min.y,
-            (float)rand() / RAND_MAX * (config->space_max.z - config->space_min.z) + config->space_min.z
+            rng_range(&rng, config->space_min.x, config->space_max.x),
+            rng_range(&rng, config->space_min.y, config->space_max.y),
+            rng_range(&rng, config->space_min.z, config->space_max.z)
         };
         
         // Random velocity (relatively small)
         Vec3 vel = {
-            ((float)rand() / RAND_MAX * 2.0f - 1.0f) * 5.0f,
-            ((float)rand() / RAND_MAX * 2.0f - 1.0f) * 5.0f,
-            ((float)rand() / RAND_MAX * 2.0f - 1.0f) * 5.0f
+            rng_range(&rng, -5.0f, 5.0f),
+            rng_range(&rng, -5.0f, 5.0f),
+            rng_range(&rng, -5.0f, 5.0f)
         };
         
         // Random mass
-        float mass = (float)rand() / RAND_MAX * (config->particle_max_mass - config->particle_min_mass) + config->particle_min_mass;
+        float mass = rng_range(&rng, config->particle_min_mass, config->particle_max_mass);
         
         // Radius based on mass (optional)
-        float radius = (float)rand() / RAND_MAX * (config->particle_max_radius - config->particle_min_radius) + config->particle_min_radius;
+        float radius = rng_range(&rng, config->particle_min_radius, config->particle_max_radius);
         
         // Random color
         Vec3 color = {
-            (float)rand() / RAND_MAX,
-            (float)rand() / RAND_MAX,
-            (float)rand() / RAND_MAX
+            rng_float(&rng),
+            rng_float(&rng),
+            rng_float(&rng)
         };
         
         // Initialize the particle
-        particle_init(&particles[i], pos, vel, mass, radius, color);
+        Particle p;
+        particle_init(&p, pos, vel, mass, radius, color);
+        particle_system_set(ps, i, &p);
     }
     
     // If central body is enabled, make the first particle the central body
-    if (config->enable_central_body) {
-        particles[0].position = config->central_body_position;
-        particles[0].velocity = (Vec3){0.0f, 0.0f, 0.0f};
-        particles[0].mass = config->central_body_mass;
-        particles[0].radius = config->particle_max_radius * 5.0f; // Larger radius
-        particles[0].color = (Vec3){1.0f, 1.0f, 0.0f}; // Yellow color for "sun"
+    if (config->enable_central_body && ps->massive_count > 0) {
+        Particle sun;
+        particle_init(&sun, config->central_body_position, (Vec3){0.0f, 0.0f, 0.0f},
+                      config->central_body_mass,
+                      config->particle_max_radius * 5.0f, // Larger radius
+                      (Vec3){1.0f, 1.0f, 0.0f});          // Yellow color for "sun"
+        particle_system_set(ps, 0, &sun);
+    }
+    
+    // Tracers on circular orbits in the x-y plane, spread evenly over the annulus; the
+    // orbital speed only counts the central body
+    float central_mass = config->enable_central_body ? config->central_body_mass : 0.0f;
+    float r2_min = config->tracer_min_orbit * config->tracer_min_orbit;
+    float r2_max = config->tracer_max_orbit * config->tracer_max_orbit;
+    for (int i = ps->massive_count; i < ps->count; i++) {
+        float r = sqrtf(rng_range(&rng, r2_min, r2_max));
+        float angle = rng_range(&rng, 0.0f, 6.2831853f);
+        float c = cosf(angle), s = sinf(angle);
+        float speed = r > 0.0f ? sqrtf(G * central_mass / r) : 0.0f;
+        
+        Vec3 pos = vec3_add(config->central_body_position, (Vec3){r * c, r * s, 0.0f});
+        Particle p;
+        particle_init(&p, pos, (Vec3){-speed * s, speed * c, 0.0f}, 0.0f,
+                      config->particle_min_radius, (Vec3){0.5f, 0.7f, 1.0f});
+        particle_system_set(ps, i, &p);
     }
 }
\ No newline at end of file
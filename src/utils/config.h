@@ -1,6 +1,9 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include "vector.h"
 #include "../physics/particle.h"
 
@@ -10,8 +13,39 @@ typedef struct {
     const char *window_title;
     
     int max_particles;
+    uint64_t random_seed;   // Seed for the initial conditions, 0: seed from the clock
     float time_step;
-    int integration_method; // 0: Euler, 1: Verlet, 2: RK4
+    int integration_method; // 0: Euler, 1: Leapfrog (KDK), 2: RK4, 3: Yoshida 4th order, 4: Wisdom-Holman
+    int force_method;       // 0: Direct O(n²) sum, 1: Barnes-Hut octree, 2: particle mesh (FFT), 3: fast multipole
+    int force_kernel;       // Direct-sum kernel: -1: auto, 0: scalar, 1: SSE, 2: AVX2, 3: AVX-512
+    int num_threads;        // Physics worker threads, 0: one per core
+    int reorder_interval;   // Steps between Morton-order sorts of the particle arrays, 0: never
+    
+    int adaptive_timestep;  // Choose every step's size from max |a|, |v| (and jerk) instead of time_step
+    float adaptive_eta;     // Accuracy parameter of the adaptive step criteria
+    int adaptive_jerk;      // Also limit the step by |a| / |da/dt| per particle (Aarseth)
+    int adaptive_symmetric; // Time-symmetric iterations for the symplectic integrators, 0: explicit
+    float adaptive_min_step;
+    float adaptive_max_step;
+    
+    int block_timesteps;    // Per-particle power-of-two timesteps (leapfrog), time_step is the largest
+    int block_levels;       // Number of levels; the smallest step is time_step / 2^(levels-1)
+    float block_eta;        // Accuracy parameter of the |a| / |da/dt| level criterion
+    
+    float barnes_hut_theta;    // Opening angle, smaller is more accurate
+    int barnes_hut_quadrupole; // Add quadrupole moments to accepted cells
+    int tree_build;            // Octree construction: 0: serial insertion, 1: parallel from sorted Morton keys
+    int tree_refit_interval;   // Force evaluations that refit the previous octree between full builds, 0: always rebuild
+    float tree_refit_growth;   // Rebuild early once refit cells have grown past this factor in summed size
+    
+    int pm_grid;               // Particle-mesh cells per side (power of two) spanning space_min/space_max
+    int pm_assignment;         // Mass assignment: 1: cloud-in-cell, 2: triangular-shaped cloud
+    int pm_p3m;                // Add direct short-range forces to a long-range mesh force (P3M)
+    float pm_split;            // P3M force split radius in mesh cells
+    
+    int fmm_order;             // Fast multipole expansion order (1-6)
+    float fmm_theta;           // Multipole acceptance: cells interact when (r_a + r_b) < theta * distance
+    int fmm_leaf_size;         // Most particles in a leaf cell
     
     float particle_min_mass;
     float particle_max_mass;
@@ -22,12 +56,55 @@ typedef struct {
     float central_body_mass;
     Vec3 central_body_position;
     
+    int tracer_count;       // Massless test particles added behind the max_particles massive ones
+    float tracer_min_orbit; // Radius range of the tracers' circular orbits about the central body
+    float tracer_max_orbit;
+    
+    int external_potential;       // Static background field: 0: none, 1: tabulated analytic profiles, 2: table file
+    int external_geometry;        // Profile grid: 0: 3D Cartesian, 1: axisymmetric R-z
+    int external_resolution;      // Grid nodes per axis (along R for the axisymmetric grid)
+    float external_extent;        // The grid reaches this far from external_center along each axis
+    Vec3 external_center;
+    float external_bulge_mass;    // Hernquist bulge (0: none) and its scale radius
+    float external_bulge_scale;
+    float external_disk_mass;     // Miyamoto-Nagai disc (0: none), scale length and height
+    float external_disk_scale;
+    float external_disk_height;
+    float external_halo_mass;     // NFW halo characteristic mass 4 pi rho_0 r_s^3 (0: none) and scale radius
+    float external_halo_scale;
+    const char *external_table_path; // Table for external_potential 2 (see external.h)
+    
     int enable_collision;
-    float collision_damping;
+    float collision_damping; // Restitution of bounces
+    int collision_mode;      // 0: bounce, 1: merge
     
-    int enable_bounded_space;
+    int enable_bounded_space;  // Box walls on space_min/space_max: 0: none, 1: periodic, 2: reflective
     Vec3 space_min;
     Vec3 space_max;
+    int periodic_ewald;        // Add the forces of all periodic images (Ewald sum) to the nearest one
+    int periodic_ewald_table;  // Ewald correction table nodes per axis over half the box
+    
+    long max_frames;         // Close the window after this many frames (0: run until closed)
+    int physics_thread;      // Step physics on its own thread instead of once per frame
+    
+    int headless;            // Run without a window, as fast as possible
+    long headless_steps;     // Steps to run in headless mode (0: no step limit)
+    float headless_sim_time; // Simulated time to run in headless mode (0: no time limit)
+    
+    int profile_counters;       // Collect hardware counters in profiled builds (make PROFILE=1)
+    const char *profile_output; // Write <prefix>.csv / <prefix>.json profiles at exit, NULL: summary only
+    
+    const char *checkpoint_path; // Snapshot file written at exit and every checkpoint_interval steps, NULL: none
+    long checkpoint_interval;    // Steps between snapshots (0: only at exit)
+    const char *restart_path;    // Snapshot to resume from, NULL: fresh initial conditions
+    
+    const char *trajectory_path;         // Compressed trajectory stream, NULL: none. With restart_path
+                                         // the run appends to it, dropping frames from the snapshot's
+                                         // step on; it must have been written with the same settings
+    long trajectory_interval;            // Steps between trajectory frames
+    float trajectory_precision;          // Position quantisation step
+    float trajectory_velocity_precision; // Velocity quantisation step (0: positions only)
+    int trajectory_keyframe_interval;    // Frames between keyframes
     
     const char *vertex_shader_path;
     const char *fragment_shader_path;
@@ -39,7 +116,21 @@ void config_init(SimConfig *config);
 // Load configuration from file (optional)
 int config_load_from_file(SimConfig *config, const char *filename);
 
+// Apply "key: value" lines held in memory (e.g. the config section of a snapshot).
+// source names the origin in warnings.
+void config_load_from_string(SimConfig *config, const char *text, size_t length, const char *source);
+
+// Write every numeric setting in the format config_load_from_file reads. Returns 1 on success.
+int config_write(const SimConfig *config, FILE *file);
+
+// Parse command line arguments: an optional configuration file followed or preceded by
+// flags (--headless, --steps N, --sim-time T, --frames N, --threads N, --seed N, --profile PREFIX,
+// --checkpoint FILE, --checkpoint-every N, --restart FILE, --trajectory FILE, --trajectory-every N,
+// --external-table FILE).
+// Returns 0 on invalid usage.
+int config_parse_args(SimConfig *config, int argc, char *argv[]);
+
 // Create initial particles based on configuration
-void create_initial_particles(SimConfig *config, Particle *particles);
+void create_initial_particles(SimConfig *config, ParticleSystem *ps);
 
 #endif /* CONFIG_H */
\ No newline at end of file
@@ -0,0 +1,271 @@
+#define _GNU_SOURCE
+#include "profiler.h"
+#include "timer.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char *phase_names[PROFILE_PHASE_COUNT] = {
+    "frame",
+    "step",
+    "forces",
+    "tree_build",
+    "integrate",
+    "render",
+    "swap_buffers",
+    "poll_events",
+    "trajectory",
+    "collisions",
+    "reorder",
+    "external"
+};
+
+static const char *counter_names[PROFILE_COUNTER_COUNT] = {
+    "cycles",
+    "instructions",
+    "cache_misses"
+};
+
+// Ring-buffered history per phase. Each phase is only ever timed from one thread
+// at a time, so the per-phase write index needs no locking.
+static ProfileSample history[PROFILE_PHASE_COUNT][PROFILE_HISTORY];
+static long long sample_counts[PROFILE_PHASE_COUNT];
+
+static double epoch = 0.0;
+static int counters_enabled = 0;
+static atomic_int next_thread_id = 0;
+
+// Per-thread id and counter file descriptors (opened lazily on first use)
+static _Thread_local int thread_id = -1;
+static _Thread_local int counter_fds[PROFILE_COUNTER_COUNT] = {-1, -1, -1};
+static _Thread_local int counters_opened = 0;
+
+#ifdef __linux__
+static int open_counter(uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // Measure the calling thread on any CPU
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+static void open_thread_counters(void) {
+    counters_opened = 1;
+#ifdef __linux__
+    static const uint64_t configs[PROFILE_COUNTER_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES
+    };
+    for (int c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+        counter_fds[c] = open_counter(configs[c]);
+        if (counter_fds[c] < 0) {
+            fprintf(stderr, "Profiler: %s counter unavailable\n", counter_names[c]);
+        }
+    }
+#endif
+}
+
+static void read_counters(uint64_t *values) {
+    for (int c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+        values[c] = 0;
+#ifdef __linux__
+        if (counter_fds[c] >= 0 && read(counter_fds[c], &values[c], sizeof(uint64_t)) != sizeof(uint64_t)) {
+            values[c] = 0;
+        }
+#endif
+    }
+}
+
+void profiler_init(int use_counters) {
+    epoch = timer_now();
+    counters_enabled = use_counters;
+    memset(sample_counts, 0, sizeof(sample_counts));
+}
+
+ProfileScope profiler_begin(ProfilePhase phase) {
+    ProfileScope scope;
+    scope.phase = phase;
+
+    if (counters_enabled && !counters_opened) {
+        open_thread_counters();
+    }
+    if (counters_enabled) {
+        read_counters(scope.counters);
+    } else {
+        memset(scope.counters, 0, sizeof(scope.counters));
+    }
+
+    // Read the clock last so counter reads are not part of the measured time
+    scope.start = timer_now();
+    return scope;
+}
+
+void profiler_end(ProfileScope *scope) {
+    double end = timer_now();
+
+    if (thread_id < 0) {
+        thread_id = atomic_fetch_add(&next_thread_id, 1);
+    }
+
+    long long index = sample_counts[scope->phase]++;
+    ProfileSample *sample = &history[scope->phase][index % PROFILE_HISTORY];
+    sample->start = scope->start - epoch;
+    sample->duration = end - scope->start;
+    sample->thread = thread_id;
+
+    if (counters_enabled) {
+        uint64_t now[PROFILE_COUNTER_COUNT];
+        read_counters(now);
+        for (int c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+            sample->counters[c] = now[c] - scope->counters[c];
+        }
+    } else {
+        memset(sample->counters, 0, sizeof(sample->counters));
+    }
+}
+
+int profiler_last_sample(ProfilePhase phase, ProfileSample *sample) {
+    long long count = sample_counts[phase];
+    if (count == 0) return 0;
+    *sample = history[phase][(count - 1) % PROFILE_HISTORY];
+    return 1;
+}
+
+// Number of retained samples and index of the oldest one for a phase
+static int retained(int phase, int *first) {
+    long long count = sample_counts[phase];
+    if (count <= PROFILE_HISTORY) {
+        *first = 0;
+        return (int)count;
+    }
+    *first = (int)(count % PROFILE_HISTORY);
+    return PROFILE_HISTORY;
+}
+
+void profiler_print_summary(void) {
+    printf("Profile (last %d samples per phase):\n", PROFILE_HISTORY);
+    printf("  %-14s %8s %12s %12s %12s", "phase", "samples", "mean ms", "min ms", "max ms");
+    if (counters_enabled) printf(" %10s %12s", "IPC", "misses/call");
+    printf("\n");
+
+    for (int p = 0; p < PROFILE_PHASE_COUNT; p++) {
+        int first;
+        int n = retained(p, &first);
+        if (n == 0) continue;
+
+        double total = 0.0, min = 1e30, max = 0.0;
+        double cycles = 0.0, instructions = 0.0, misses = 0.0;
+        for (int k = 0; k < n; k++) {
+            ProfileSample *s = &history[p][(first + k) % PROFILE_HISTORY];
+            total += s->duration;
+            if (s->duration < min) min = s->duration;
+            if (s->duration > max) max = s->duration;
+            cycles += s->counters[PROFILE_COUNTER_CYCLES];
+            instructions += s->counters[PROFILE_COUNTER_INSTRUCTIONS];
+            misses += s->counters[PROFILE_COUNTER_CACHE_MISSES];
+        }
+
+        printf("  %-14s %8d %12.4f %12.4f %12.4f", phase_names[p], n,
+               total / n * 1e3, min * 1e3, max * 1e3);
+        if (counters_enabled) {
+            printf(" %10.2f %12.0f", cycles > 0.0 ? instructions / cycles : 0.0, misses / n);
+        }
+        printf("\n");
+    }
+}
+
+int profiler_write_csv(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Profiler: could not open %s\n", path);
+        return 0;
+    }
+
+    fprintf(file, "phase,thread,start_us,duration_us");
+    for (int c = 0; c < PROFILE_COUNTER_COUNT; c++) fprintf(file, ",%s", counter_names[c]);
+    fprintf(file, "\n");
+
+    for (int p = 0; p < PROFILE_PHASE_COUNT; p++) {
+        int first;
+        int n = retained(p, &first);
+        for (int k = 0; k < n; k++) {
+            ProfileSample *s = &history[p][(first + k) % PROFILE_HISTORY];
+            fprintf(file, "%s,%d,%.3f,%.3f", phase_names[p], s->thread, s->start * 1e6, s->duration * 1e6);
+            for (int c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+                fprintf(file, ",%llu", (unsigned long long)s->counters[c]);
+            }
+            fprintf(file, "\n");
+        }
+    }
+
+    fclose(file);
+    return 1;
+}
+
+int profiler_write_chrome_trace(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Profiler: could not open %s\n", path);
+        return 0;
+    }
+
+    // Complete ("X") events in the Trace Event Format, loadable in chrome://tracing or Perfetto
+    fprintf(file, "{\"traceEvents\":[\n");
+    int first_event = 1;
+    for (int p = 0; p < PROFILE_PHASE_COUNT; p++) {
+        int first;
+        int n = retained(p, &first);
+        for (int k = 0; k < n; k++) {
+            ProfileSample *s = &history[p][(first + k) % PROFILE_HISTORY];
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                    first_event ? "" : ",\n", phase_names[p], s->thread, s->start * 1e6, s->duration * 1e6);
+            if (counters_enabled) {
+                fprintf(file, ",\"args\":{");
+                for (int c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+                    fprintf(file, "%s\"%s\":%llu", c ? "," : "", counter_names[c],
+                            (unsigned long long)s->counters[c]);
+                }
+                fprintf(file, "}");
+            }
+            fprintf(file, "}");
+            first_event = 0;
+        }
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    fclose(file);
+    return 1;
+}
+
+void profiler_shutdown(const char *output_prefix) {
+    profiler_print_summary();
+
+    if (output_prefix) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s.csv", output_prefix);
+        if (profiler_write_csv(path)) printf("Wrote profile samples to %s\n", path);
+        snprintf(path, sizeof(path), "%s.json", output_prefix);
+        if (profiler_write_chrome_trace(path)) printf("Wrote Chrome trace to %s\n", path);
+    }
+
+#ifdef __linux__
+    for (int c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+        if (counter_fds[c] >= 0) close(counter_fds[c]);
+        counter_fds[c] = -1;
+    }
+#endif
+    counters_opened = 0;
+}
@@ -0,0 +1,83 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+// Instrumented phases of a frame / physics step
+typedef enum {
+    PROFILE_FRAME,       // One iteration of the render loop
+    PROFILE_STEP,        // One simulation_step
+    PROFILE_FORCES,      // Force phase of update_particle_system
+    PROFILE_TREE_BUILD,  // Octree construction inside the force phase
+    PROFILE_INTEGRATE,   // Integrator phase of update_particle_system
+    PROFILE_RENDER,      // renderer_render_frame
+    PROFILE_SWAP,        // glfwSwapBuffers
+    PROFILE_EVENTS,      // glfwPollEvents
+    PROFILE_TRAJECTORY,  // Handing a trajectory frame to the writer thread
+    PROFILE_COLLISIONS,  // Collision detection and response
+    PROFILE_REORDER,     // Morton-order sort of the particle arrays
+    PROFILE_EXTERNAL,    // External potential interpolation inside the force phase
+    PROFILE_PHASE_COUNT
+} ProfilePhase;
+
+// Hardware counters collected per sample when enabled
+typedef enum {
+    PROFILE_COUNTER_CYCLES,
+    PROFILE_COUNTER_INSTRUCTIONS,
+    PROFILE_COUNTER_CACHE_MISSES,
+    PROFILE_COUNTER_COUNT
+} ProfileCounter;
+
+// Samples kept per phase; older samples are overwritten
+#define PROFILE_HISTORY 4096
+
+typedef struct {
+    double start;    // Seconds since profiler_init
+    double duration; // Seconds
+    uint64_t counters[PROFILE_COUNTER_COUNT];
+    int thread;      // Small per-thread id, used as the trace tid
+} ProfileSample;
+
+// An open timing scope, returned by profiler_begin and closed by profiler_end
+typedef struct {
+    ProfilePhase phase;
+    double start;
+    uint64_t counters[PROFILE_COUNTER_COUNT];
+} ProfileScope;
+
+// Start profiling. With use_counters set, cycles, instructions and cache misses are read
+// through perf_event_open (Linux only). Counters cover the thread that opens the scope,
+// so OpenMP worker time is not included; run with one thread for exact attribution.
+void profiler_init(int use_counters);
+
+ProfileScope profiler_begin(ProfilePhase phase);
+void profiler_end(ProfileScope *scope);
+
+// Copy the most recent sample of a phase. Returns 0 if the phase has none.
+int profiler_last_sample(ProfilePhase phase, ProfileSample *sample);
+
+// Print count / mean / min / max per phase over the retained history
+void profiler_print_summary(void);
+
+// Export the retained history. Both return 1 on success.
+int profiler_write_csv(const char *path);
+int profiler_write_chrome_trace(const char *path);
+
+// Write <prefix>.csv and <prefix>.json and close counter file descriptors
+void profiler_shutdown(const char *output_prefix);
+
+// Instrumentation is compiled in only with -DGRAVITY_PROFILE (make PROFILE=1);
+// otherwise every macro expands to nothing.
+#ifdef GRAVITY_PROFILE
+#define PROFILE_BEGIN(phase) ProfileScope profile_scope_##phase = profiler_begin(phase)
+#define PROFILE_END(phase) profiler_end(&profile_scope_##phase)
+#define PROFILER_INIT(use_counters) profiler_init(use_counters)
+#define PROFILER_SHUTDOWN(output_prefix) profiler_shutdown(output_prefix)
+#else
+#define PROFILE_BEGIN(phase) do { } while (0)
+#define PROFILE_END(phase) do { } while (0)
+#define PROFILER_INIT(use_counters) do { (void)(use_counters); } while (0)
+#define PROFILER_SHUTDOWN(output_prefix) do { (void)(output_prefix); } while (0)
+#endif
+
+#endif /* PROFILER_H */
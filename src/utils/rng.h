@@ -0,0 +1,24 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// Small deterministic random number generator (xoshiro128+ seeded via splitmix64).
+// Unlike rand(), its sequence is the same on every platform for a given seed.
+typedef struct {
+    uint32_t s[4];
+} Rng;
+
+// Seed the generator
+void rng_seed(Rng *rng, uint64_t seed);
+
+// Next 32 random bits
+uint32_t rng_next(Rng *rng);
+
+// Uniform float in [0, 1)
+float rng_float(Rng *rng);
+
+// Uniform float in [min, max)
+float rng_range(Rng *rng, float min, float max);
+
+#endif /* RNG_H */